@@ -30,6 +30,7 @@ SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 // Define AST Node Types
 typedef enum {
@@ -56,8 +57,18 @@ typedef enum {
     NODE_PEEK,
     NODE_ALLOCATE,
     NODE_FREE,
+    NODE_OPEN,
+    NODE_CLOSE,
+    NODE_INPUT,
+    NODE_LINE_INPUT,
+    NODE_ARRAY_REF,
+    NODE_BLOAD,
+    NODE_BSAVE,
+    NODE_SNAPSHOT,
     NODE_END,
-    NODE_STOP
+    NODE_STOP,
+    NODE_BLOCK,
+    NODE_IDENTIFIER
 } NodeType;
 
 // AST Node structure
@@ -68,9 +79,13 @@ typedef struct ASTNode {
     int children_count;
 } ASTNode;
 
+// Heap allocations made for nodes, reported by the benchmark
+static long ast_allocations = 0;
+
 // Function to create an AST Node
 ASTNode* create_ast_node(NodeType type, char* value, int children_count) {
     ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
+    ast_allocations += 1 + (value != NULL) + (children_count > 0);
     node->node_type = type;
     node->value = value ? strdup(value) : NULL;
     node->children_count = children_count;
@@ -186,7 +201,7 @@ ASTNode* create_read_node(ASTNode* variable) {
 ASTNode* create_restore_node(int line_number) {
     char buffer[20];
     sprintf(buffer, "%d", line_number);
-    return create_ast_node(NODE_RESTORE, line_number ? strdup(buffer) : NULL, 0);
+    return create_ast_node(NODE_RESTORE, line_number ? buffer : NULL, 0);
 }
 
 ASTNode* create_dim_node(ASTNode* variable, ASTNode** dimensions, int dimension_count) {
@@ -246,6 +261,65 @@ ASTNode* create_free_node(ASTNode* variable) {
     return node;
 }
 
+ASTNode* create_open_node(ASTNode* mode, ASTNode* channel, ASTNode* filename) {
+    ASTNode* node = create_ast_node(NODE_OPEN, NULL, 3);
+    add_child(node, mode);
+    add_child(node, channel);
+    add_child(node, filename);
+    return node;
+}
+
+ASTNode* create_close_node(ASTNode* channel) {
+    ASTNode* node = create_ast_node(NODE_CLOSE, NULL, channel ? 1 : 0);
+    if (channel) add_child(node, channel);
+    return node;
+}
+
+ASTNode* create_input_node(ASTNode* channel, ASTNode* variable) {
+    int children_count = channel ? 2 : 1;
+    ASTNode* node = create_ast_node(NODE_INPUT, NULL, children_count);
+    if (channel) add_child(node, channel);
+    add_child(node, variable);
+    return node;
+}
+
+ASTNode* create_line_input_node(ASTNode* channel, ASTNode* variable) {
+    int children_count = channel ? 2 : 1;
+    ASTNode* node = create_ast_node(NODE_LINE_INPUT, NULL, children_count);
+    if (channel) add_child(node, channel);
+    add_child(node, variable);
+    return node;
+}
+
+ASTNode* create_array_ref_node(char* name) {
+    return create_ast_node(NODE_ARRAY_REF, name, 0);
+}
+
+// mapped selects BLOAD ... MAP, which backs the array by the file instead of copying it
+ASTNode* create_bload_node(ASTNode* filename, ASTNode* target, ASTNode* length, int mapped) {
+    int children_count = length ? 3 : 2;
+    ASTNode* node = create_ast_node(NODE_BLOAD, mapped ? (char*)"MAP" : NULL, children_count);
+    add_child(node, filename);
+    add_child(node, target);
+    if (length) add_child(node, length);
+    return node;
+}
+
+ASTNode* create_bsave_node(ASTNode* filename, ASTNode* target, ASTNode* length) {
+    int children_count = length ? 3 : 2;
+    ASTNode* node = create_ast_node(NODE_BSAVE, NULL, children_count);
+    add_child(node, filename);
+    add_child(node, target);
+    if (length) add_child(node, length);
+    return node;
+}
+
+ASTNode* create_snapshot_node(ASTNode* filename) {
+    ASTNode* node = create_ast_node(NODE_SNAPSHOT, NULL, 1);
+    add_child(node, filename);
+    return node;
+}
+
 ASTNode* create_end_node() {
     return create_ast_node(NODE_END, NULL, 0);
 }
@@ -267,8 +341,84 @@ void free_ast_node(ASTNode* node) {
     free(node);
 }
 
-// Example usage
-int main() {
+/* ---------------------------------------------------------------------------
+   Benchmark
+
+   `ast bench [nodes [depth]]` builds a program of about the given number
+   of nodes with create_ast_node, frees it with free_ast_node, and reports
+   nodes/s for each and allocations per node. The program is a run of
+   statement trees depth levels deep: a WHILE holding a block of two such
+   trees, down to a PRINT of a variable. Small programs are built
+   repeatedly until enough time has passed to measure. Without a node
+   count, a sweep from 1K to 512K nodes is run. Every node is one to three
+   mallocs, so the rate falls once a program outgrows the cache and the
+   heap the allocator keeps around between passes.
+   --------------------------------------------------------------------------- */
+
+#define BENCH_MIN_SECONDS 0.5
+
+static char* bench_names[] = {"total", "count", "index", "x#", "y#", "name$", "offset%", "k"};
+
+// One statement tree; *serial picks the variable names
+static ASTNode* build_bench_tree(int depth, int* serial) {
+    char* name = bench_names[(*serial)++ % 8];
+    if (depth == 0) {
+        ASTNode* node = create_ast_node(NODE_PRINT_STATEMENT, NULL, 1);
+        node->children[0] = create_ast_node(NODE_IDENTIFIER, name, 0);
+        return node;
+    }
+    ASTNode* node = create_ast_node(NODE_WHILE_LOOP, NULL, 2);
+    node->children[0] = create_ast_node(NODE_IDENTIFIER, name, 0);
+    node->children[1] = create_ast_node(NODE_BLOCK, NULL, 2);
+    node->children[1]->children[0] = build_bench_tree(depth - 1, serial);
+    node->children[1]->children[1] = build_bench_tree(depth - 1, serial);
+    return node;
+}
+
+static double bench_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Build and free a program of about node_count nodes
+static void bench_ast(long node_count, int depth) {
+    long tree_nodes = 2;
+    for (int i = 0; i < depth; i++) tree_nodes = 3 + 2 * tree_nodes;
+    int trees = (int)((node_count + tree_nodes - 1) / tree_nodes);
+    long nodes = 1 + trees * tree_nodes;
+    long passes = 0;
+    long allocations = ast_allocations;
+    double build_seconds = 0, free_seconds = 0;
+    do {
+        int serial = 0;
+        double start = bench_seconds();
+        ASTNode* program = create_ast_node(NODE_PROGRAM, NULL, trees);
+        for (int i = 0; i < trees; i++) program->children[i] = build_bench_tree(depth, &serial);
+        double built = bench_seconds();
+        free_ast_node(program);
+        build_seconds += built - start;
+        free_seconds += bench_seconds() - built;
+        passes++;
+    } while (build_seconds + free_seconds < BENCH_MIN_SECONDS);
+    allocations = ast_allocations - allocations;
+
+    printf("%10ld nodes %4ld passes %12.0f built/s %12.0f freed/s %5.2f allocations/node\n", nodes, passes,
+           nodes * passes / build_seconds, nodes * passes / free_seconds, (double)allocations / (nodes * passes));
+}
+
+// Example usage, or `ast bench`
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int depth = argc > 3 ? atoi(argv[3]) : 6;
+        if (argc > 2) {
+            bench_ast(atol(argv[2]), depth);
+        } else {
+            for (long nodes = 1024; nodes <= 512 * 1024; nodes *= 8) bench_ast(nodes, depth);
+        }
+        return 0;
+    }
+
     // Example to create and print an AST Node
     ASTNode* print_node = create_print_node(create_ast_node(NODE_IDENTIFIER, "Hello", 0));
     printf("Created a print node with value: %s\n", print_node->children[0]->value);
@@ -47,6 +47,7 @@ void on_menu_item_paste(GtkWidget *widget, gpointer data);
 void on_menu_item_run(GtkWidget *widget, gpointer data);
 void on_menu_item_stop(GtkWidget *widget, gpointer data);
 void on_menu_item_kill(GtkWidget *widget, gpointer data);
+void on_menu_item_reload(GtkWidget *widget, gpointer data);
 void on_menu_item_about(GtkWidget *widget, gpointer data);
 void on_destroy(GtkWidget *widget, gpointer data);
 
@@ -119,6 +120,7 @@ GFABasicIDE* gfa_basic_ide_new() {
     create_menu_item(run_menu, "Run", G_CALLBACK(on_menu_item_run), ide);
     create_menu_item(run_menu, "Stop", G_CALLBACK(on_menu_item_stop), ide);
     create_menu_item(run_menu, "Kill", G_CALLBACK(on_menu_item_kill), ide);
+    create_menu_item(run_menu, "Reload", G_CALLBACK(on_menu_item_reload), ide);
 
     // Help menu
     GtkWidget *help_menu = gtk_menu_new();
@@ -292,6 +294,15 @@ void on_menu_item_kill(GtkWidget *widget, gpointer data) {
     gtk_text_buffer_set_text(ide->output_buffer, "Program execution killed.\n", -1);
 }
 
+void on_menu_item_reload(GtkWidget *widget, gpointer data) {
+    GFABasicIDE *ide = (GFABasicIDE *)data;
+    if (!ide->is_running) return;
+
+    // Add logic to hot-reload the edited PROCEDUREs into the running program (interpreter_reload). Run does
+    // not start the interpreter yet, so there is no program to reload into.
+    gtk_text_buffer_insert_at_cursor(ide->output_buffer, "Reload is not available: the IDE does not run programs in the interpreter yet.\n", -1);
+}
+
 void on_menu_item_about(GtkWidget *widget, gpointer data) {
     GtkWidget *dialog = gtk_message_dialog_new(NULL, GTK_DIALOG_DESTROY_WITH_PARENT,
                                                GTK_MESSAGE_INFO, GTK_BUTTONS_OK,
@@ -30,6 +30,21 @@ SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/resource.h>
 
 // Define a structure for AST nodes
 typedef struct ASTNode {
@@ -39,307 +54,8832 @@ typedef struct ASTNode {
     int children_count;
 } ASTNode;
 
+// Instruction set executed by the interpreter loop
+typedef enum {
+    OP_NOP,
+    OP_PUSH_INT,
+    OP_LOAD,
+    OP_STORE,
+    OP_ADD_INT,
+    OP_SUB_INT,
+    OP_MUL_INT,
+    OP_DIV_INT,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_PRINT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_GOSUB,
+    OP_RETURN,
+    OP_READ,
+    OP_RESTORE,
+    OP_ALLOCATE,
+    OP_FREE,
+    OP_POKE,
+    OP_POKE_UNCHECKED,
+    OP_PEEK,
+    OP_PEEK_UNCHECKED,
+    OP_CHECK_SPAN,
+    OP_ON_ERROR,
+    OP_RESUME,
+    OP_RESUME_NEXT,
+    OP_RESUME_LABEL,
+    OP_PUSH_ERR,
+    OP_PUSH_STR,
+    OP_LOAD_STR,
+    OP_STORE_STR,
+    OP_CONCAT,
+    OP_STR_COMPARE,
+    OP_PRINT_STR,
+    OP_OPEN,
+    OP_CLOSE,
+    OP_CLOSE_ALL,
+    OP_PRINT_CHANNEL,
+    OP_PRINT_CHANNEL_STR,
+    OP_INPUT_CHANNEL,
+    OP_INPUT_CHANNEL_STR,
+    OP_LINE_INPUT_CHANNEL,
+    OP_EOF,
+    OP_DIM,
+    OP_LOAD_ELEMENT,
+    OP_STORE_ELEMENT,
+    OP_BLOAD,
+    OP_BLOAD_ARRAY,
+    OP_MAP_ARRAY,
+    OP_BSAVE,
+    OP_BSAVE_ARRAY,
+    OP_PUSH_FLT,
+    OP_LOAD_FLT,
+    OP_STORE_FLT,
+    OP_ADD_FLT,
+    OP_SUB_FLT,
+    OP_MUL_FLT,
+    OP_DIV_FLT,
+    OP_CMP_FLT,
+    OP_INT_TO_FLT,
+    OP_FLT_TO_INT,
+    OP_PRINT_FLT,
+    OP_PRINT_CHANNEL_FLT,
+    OP_INPUT_CHANNEL_FLT,
+    OP_READ_FLT,
+    OP_ADD_VAR_CONST,       // Superinstructions, never emitted directly; see fuse_superinstructions
+    OP_SUB_VAR_CONST,
+    OP_ADD_VAR_VAR,
+    OP_BRANCH_VAR_CONST,
+    OP_BRANCH_VAR_VAR,
+    OP_LOAD_ELEMENT_1,      // Quickened element access for arrays of rank 1 and 2
+    OP_LOAD_ELEMENT_2,
+    OP_STORE_ELEMENT_1,
+    OP_STORE_ELEMENT_2,
+    OP_MEMO_LOOKUP,         // Before the GOSUB to a pure PROCEDURE: on a cache hit, set its results and skip the call
+    OP_SNAPSHOT,
+    OP_COUNT_LINE,          // Profiling only: count an execution of source line operand, see interpreter_set_profile
+    OP_END
+} OpCode;
+
+// Runtime error numbers, as reported by ERR (classic BASIC numbering)
+typedef enum {
+    ERR_NONE = 0,
+    ERR_RETURN_WITHOUT_GOSUB = 3,
+    ERR_OUT_OF_DATA = 4,
+    ERR_ILLEGAL_FUNCTION_CALL = 5,
+    ERR_OVERFLOW = 6,
+    ERR_OUT_OF_MEMORY = 7,
+    ERR_SUBSCRIPT_OUT_OF_RANGE = 9,
+    ERR_DIVISION_BY_ZERO = 11,
+    ERR_RESUME_WITHOUT_ERROR = 20,
+    ERR_OUT_OF_STACK = 28,
+    ERR_BAD_FILE_NUMBER = 52,
+    ERR_FILE_NOT_FOUND = 53,
+    ERR_BAD_FILE_MODE = 54,
+    ERR_FILE_ALREADY_OPEN = 55,
+    ERR_DEVICE_IO = 57,
+    ERR_INPUT_PAST_END = 62
+} ErrorCode;
+
+// Static type of an expression, from suffixes: % and & integer, # and ! float, $ string.
+// TYPE_UNKNOWN only exists while types are being inferred.
+typedef enum {
+    TYPE_UNKNOWN = -1,
+    TYPE_INT,
+    TYPE_STRING,
+    TYPE_FLOAT
+} ValueType;
+
+// Memory a program holds (strings, arrays, ALLOCATE pages, stacks), charged against a quota, see interpreter_set_quota()
+typedef struct {
+    size_t quota;           // SIZE_MAX when there is none
+    size_t in_use;
+    size_t peak;            // High-water mark of in_use
+    long refusals;          // Allocations refused with Out of memory for passing the quota
+} MemoryAccount;
+
+// Read-only mapping of an input file, shared by its channel and every string sliced from it
+typedef struct FileMapping {
+    int refcount;
+    unsigned char *base;
+    size_t size;
+} FileMapping;
+
+// Reference-counted string. NULL stands for the empty string.
+// Slices read by LINE INPUT# point into a FileMapping instead of owning their bytes.
+typedef struct String {
+    int refcount;
+    int length;
+    const char *data;
+    FileMapping *mapping;
+    MemoryAccount *account;     // Charged for the string, NULL if it was made outside a run
+    char bytes[];
+} String;
+
+// A single instruction: opcode plus one immediate operand (value, slot or address)
+typedef struct {
+    OpCode op;
+    int operand;
+} Instruction;
+
+// Named jump target (label or PROCEDURE entry)
+typedef struct {
+    char *name;
+    int address;
+} Label;
+
+// Code range of one statement; consulted only when an error is raised
+typedef struct {
+    int start;
+    int end;
+} StatementRange;
+
+#define JIT_HOT_LOOP 1000         // Back-edge count at which a loop is compiled to native code
+#define JIT_MAX_LOOP 4096         // Longest loop body, in instructions, that is compiled
+#define JIT_MAX_TEMPS 7           // Operand stack depth that fits in scratch registers
+#define JIT_MAX_HOMES 5           // Variables kept in callee-saved registers
+#define JIT_CODE_SIZE (1024 * 1024)
+
+// Where native code hands control back: the pc to resume at and the values it left on the operand stack
+typedef struct {
+    int pc;
+    int depth;
+} JitExit;
+
+typedef JitExit (*JitLoop)(int* variables, int* operands);
+
+// Per-program JIT state, created the first time a back edge is taken with the JIT enabled
+typedef struct {
+    int *counts;            // Back-edge executions per loop head
+    JitLoop *loops;         // Native entry per loop head
+    unsigned char *code;    // Executable region; writable only while a loop is being added
+    size_t code_size;
+    long loops_compiled;
+    long native_entries;
+} JitCache;
+
+#define MEMO_CAPACITY 4096      // Entries per memoized PROCEDURE, a power of two
+#define MEMO_PROBES 8           // Entries searched per lookup; a full window evicts by clock
+#define MEMO_MAX_SLOTS 16       // Most key and result variables a memoized PROCEDURE may have
+
+// Variable a memoized PROCEDURE reads (key) or writes (result)
+typedef struct {
+    int slot;
+    ValueType type;
+} MemoSlot;
+
+typedef union {
+    int i;
+    double f;
+    String *s;
+} MemoValue;
+
+// One cached call. Its key and result values live in the memo's value pool.
+typedef struct {
+    uint32_t hash;
+    unsigned generation;    // Bumped on reuse, so a call whose entry was evicted meanwhile records nothing
+    bool used;              // Key values are held
+    bool valid;             // Results recorded; false while the call that fills them is still running
+    bool referenced;        // Clock bit, set on every hit
+} MemoEntry;
+
+// Result cache of one pure PROCEDURE; entries are allocated on its first call
+typedef struct {
+    MemoSlot *slots;        // key_count keys, then result_count results
+    int key_count;
+    int result_count;
+    MemoEntry *entries;
+    MemoValue *values;      // key_count + result_count per entry
+    long hits;
+    long misses;
+    long evictions;
+} Memo;
+
+// Compiled form of a program: code, variable slots, labels and DATA values
+typedef struct Program {
+    Instruction *code;
+    int code_size;
+    int code_capacity;
+    char **symbols;         // Slot names, NULL for compiler temporaries
+    ValueType *symbol_types;    // Type inferred for each slot, so interpreter_reload() can compare it
+    int symbol_count;
+    int symbol_capacity;
+    Label *labels;
+    int label_count;
+    int label_capacity;
+    int *data;
+    int data_count;
+    int data_capacity;
+    int max_stack;          // Deepest operand stack use of any statement
+    int max_string_stack;
+    String **strings;       // String literal pool
+    int string_count;
+    int string_capacity;
+    double *floats;         // Float literal pool
+    int float_count;
+    int float_capacity;
+    int max_float_stack;
+    StatementRange *statements;     // Ordered by start address
+    int statement_count;
+    int statement_capacity;
+    Memo *memos;            // Indexed by the OP_MEMO_LOOKUP operand
+    int memo_count;
+    JitCache *jit;
+    FileMapping *image;     // Shared read-only .gfc file the tables live in when loaded from the cache, else NULL
+    int reloads;            // Hot reloads linked in; the code no longer matches a fresh compile
+} Program;
+
+// A new version of the running program from interpreter_reload(), waiting for the program's next call
+typedef struct {
+    Program *program;
+    char **procedures;      // Every PROCEDURE it defines, by name
+    int procedure_count;
+} Reload;
+
+// GOSUB/PROCEDURE activation record kept on the heap frame stack
+typedef struct {
+    int return_address;
+} Frame;
+
+// A memoized call in progress; its results are recorded when the frame at depth returns
+typedef struct {
+    int memo;
+    int entry;
+    unsigned generation;
+    int depth;
+} MemoCall;
+
+// Number of pool size classes: 16, 32, ... 4096 bytes
+#define MEMORY_SIZE_CLASSES 9
+#define MEMORY_MAX_POOLED 4096
+#define MEMORY_COMMIT_CHUNK (64 * 1024)
+#define DEFAULT_MEMORY_LIMIT (256 * 1024 * 1024)
+
+// Offsets of free blocks of one size class, most recently freed last
+typedef struct {
+    uint32_t *offsets;
+    int count;
+    int capacity;
+} FreeList;
+
+// Sandboxed address space behind ALLOCATE/FREE/PEEK/POKE.
+// BASIC addresses are offsets into one mmap-reserved region, so no access can leave it.
+typedef struct {
+    unsigned char *base;
+    size_t reserved;        // Address space reserved with PROT_NONE
+    size_t committed;       // Readable/writable prefix; only ever grows
+    size_t top;             // Bump pointer for carving new blocks
+    uint32_t *blocks;       // One entry per 16 bytes of the committed prefix, see block_table_bytes()
+    FreeList free_lists[MEMORY_SIZE_CLASSES];
+    FreeList large_free;    // Free blocks larger than MEMORY_MAX_POOLED, first-fit
+    size_t in_use;
+    size_t peak_in_use;
+    long allocations;
+    long frees;
+    MemoryAccount *account;     // Charged for committed pages
+} LinearMemory;
+
+#define MAX_CHANNELS 100
+#define CHANNEL_BUFFER_SIZE (1024 * 1024)
+
+// An open file. Regular input files are mapped whole and read in place;
+// pipes and terminals fall back to a large user-space buffer, as do all writes.
+typedef struct {
+    int fd;
+    bool output;
+    FileMapping *mapping;
+    size_t position;            // Read offset within the mapping
+    char *buffer;
+    size_t buffer_length;       // Bytes pending (output) or valid (input)
+    size_t buffer_position;     // Next unread byte (input)
+    size_t buffer_capacity;
+    bool at_eof;                // Buffered input has seen end of file
+} Channel;
+
+#define MAX_DIMENSIONS 7
+#define ARRAY_MAP_THRESHOLD (1024 * 1024)
+
+// DIM array of ints, stored contiguously in row-major order so BLOAD/BSAVE can move it in one piece
+typedef struct {
+    int *data;
+    int length;                     // Total elements
+    int extents[MAX_DIMENSIONS];    // Upper bound + 1 of each dimension
+    int dimension_count;
+    size_t mapped_bytes;            // Non-zero when data is an mmap of a file rather than malloc'd
+    MemoryAccount *account;         // Charged for data; NULL for MAP, whose pages belong to the file
+} Array;
+
+#define CALL_TIMING_INTERVAL 64       // One GOSUB in this many is timed for the call latency histogram
+#define CALL_HISTOGRAM_BUCKETS 32     // Bucket b counts timed calls that took under 2^(b+1) ns; the last takes the rest
+
+// Counters kept by code that has no interpreter at hand. Every thread has its own set, so counting needs no
+// atomics; execute_program() credits what its thread counted while the program ran to the interpreter.
+typedef struct {
+    long string_allocations;
+    long string_bytes;
+    long string_frees;          // Strings freed when their last reference was released
+    long file_bytes_read;
+    long file_bytes_written;
+} ThreadCounters;
+
+// A GOSUB being timed; its duration is recorded when the frame at depth returns
+typedef struct {
+    int depth;
+    uint64_t start;             // monotonic_ns() when the call was made
+} TimedCall;
+
+// Counters reported by interpreter_get_stats()
+typedef struct {
+    size_t memory_reserved;
+    size_t memory_committed;
+    size_t memory_in_use;
+    size_t memory_peak_in_use;
+    long memory_allocations;
+    long memory_frees;
+    size_t quota;               // 0 when there is none
+    size_t quota_in_use;
+    size_t quota_peak;
+    long quota_refusals;
+    long jit_loops_compiled;
+    long jit_native_entries;
+    long memo_hits;
+    long memo_misses;
+    long memo_evictions;
+    long instructions;          // Dispatched by the interpreter loop; a loop running as native code counts once per entry
+    long calls;                 // GOSUBs made, not counting memo hits and tail calls, which make none
+    long string_allocations;
+    long string_bytes;
+    long string_frees;
+    long output_bytes;          // Program output, one newline per line included
+    long file_bytes_read;
+    long file_bytes_written;
+    long calls_timed;           // One call in CALL_TIMING_INTERVAL, see call_histogram
+    double call_seconds;        // Total duration of the timed calls
+    long call_histogram[CALL_HISTOGRAM_BUCKETS];
+} InterpreterStats;
+
+// Format of interpreter_write_stats()
+typedef enum {
+    STATS_JSON,
+    STATS_PROMETHEUS
+} StatsFormat;
+
+// One distinct call stack seen by the sampling profiler
+typedef struct {
+    uint64_t hash;
+    int frames;             // First of its call targets in Profile.frames
+    int depth;
+    int line;               // Statement that was running
+    bool truncated;         // Frames beyond PROFILE_MAX_DEPTH were left out at the root
+    long samples;           // 0 marks a free table entry
+} ProfileStack;
+
+// Statement counts and call stack samples of a profiled run, see interpreter_set_profile()
+typedef struct {
+    int hz;
+    char **lines;           // The program listed one statement per line, indented by nesting; numbered from 1
+    bool *counted;          // Lines that carry an execution counter (not PROCEDURE headers and labels)
+    int line_count;
+    long *counts;           // Executions of each line
+    long *samples;          // Samples that found each line running
+    long sample_count;
+    int line;               // Line that started last, and the frame depth it started at
+    int depth;
+    ProfileStack *stacks;   // Open addressing on hash
+    int stack_count;
+    int stack_capacity;
+    int *frames;            // Call targets of the stacks, outermost first
+    int frame_count;
+    int frame_capacity;
+} Profile;
+
+// Inputs of a run being recorded to, or replayed from, a log file, see interpreter_set_record()
+typedef struct {
+    FILE *file;
+    bool replaying;
+    long events;
+} RunLog;
+
+// Set by the profiling timer's SIGPROF handler, cleared when the sample is taken
+static volatile sig_atomic_t profile_sample_due;
+
 // Define a structure for the Interpreter
 typedef struct Interpreter {
     void (*output_callback)(const char*);
     int *variables;
+    String **string_variables;  // Parallel to variables, used by '$' slots
+    double *float_variables;    // Parallel to variables, used by float slots
+    Array *arrays;              // Parallel to variables, used by "name()" slots
+    int variable_count;
     bool running;
-    ASTNode **return_stack;
+    Frame *return_stack;
     int return_stack_size;
     int return_stack_capacity;
+    MemoCall *memo_calls;       // Stack of memoized calls still running
+    int memo_call_count;
+    int memo_call_capacity;
+    int *operand_stack;
+    int operand_stack_capacity;
+    String **string_stack;
+    int string_stack_capacity;
+    double *float_stack;
+    int float_stack_capacity;
+    size_t stack_limit;     // Bytes available to frame and operand stacks together
     int data_pointer;
+    Program *program;
+    LinearMemory memory;
+    MemoryAccount account;  // Everything the program holds, against its quota
+    int error_handler;      // ON ERROR GOTO target, -1 when errors are fatal
+    int error_code;         // ERR of the last trapped or fatal error
+    int error_pc;           // Instruction that raised it
+    bool in_error_handler;
+    Channel *channels[MAX_CHANNELS];
+    Channel *console;           // Standard input for INPUT without a channel
+    bool jit_enabled;           // Compile hot loops to native code (x86-64 Linux only)
+    int inline_budget;          // Largest PROCEDURE body, in AST nodes, that GOSUB inlines; 0 turns inlining off
+    int compile_threads;        // Threads compiling PROCEDUREs in parallel; 0 uses every online CPU
+    char *cache_dir;            // Where compiled programs are kept as .gfc files; NULL compiles every run
+    bool hot_reload;            // Compile so that interpreter_reload() can replace every PROCEDURE; turns inlining off
+    uint64_t program_key;       // cache_key of the program being run, recorded in snapshots
+    uint64_t restored_key;      // Key of the program a restored snapshot belongs to, 0 when nothing was restored
+    int resume_pc;              // Where the next execute_program() starts; non-zero after a restore
+    uint64_t source_key;        // Hash of the running program outside its top-level PROCEDUREs
+    uint64_t *procedure_keys;   // Hash of each of those, to tell which ones a reload changes
+    int procedure_key_count;
+    char **variable_names;      // Variables of the running program and their types, which a reload may not change
+    ValueType *variable_types;
+    int variable_name_count;
+    Reload *reload;             // Left by interpreter_reload(), taken by the running program at its next call
+    pthread_mutex_t reload_lock;    // Held by interpreter_reload() and while run_program() replaces what it reads
+    int profile_hz;             // Samples per CPU second when profiling, 0 when off
+    Profile *profile;           // Results of the last run_program(), NULL unless it was profiled
+    char *run_log_path;         // Log the next run_program() records to or replays from, NULL for neither
+    bool run_log_replay;
+    RunLog *run_log;            // Open while a run records or replays
+    ThreadCounters counters;    // Credited by execute_program()
+    long instructions;
+    long calls;
+    long output_bytes;
+    TimedCall *timed_calls;     // Stack of timed calls still running
+    int timed_call_count;
+    int timed_call_capacity;
+    long calls_timed;
+    uint64_t call_nanoseconds;
+    long call_histogram[CALL_HISTOGRAM_BUCKETS];
 } Interpreter;
 
+#define DEFAULT_STACK_LIMIT (64 * 1024 * 1024)
+#define INLINE_BUDGET 32
+
 // Function prototypes
 Interpreter* interpreter_new(void (*output_callback)(const char*));
 void interpreter_init(Interpreter* interpreter);
 void interpreter_free(Interpreter* interpreter);
+void interpreter_set_stack_limit(Interpreter* interpreter, size_t bytes);
+void interpreter_set_memory_limit(Interpreter* interpreter, size_t bytes);
+void interpreter_set_quota(Interpreter* interpreter, size_t bytes);
+void interpreter_set_jit(Interpreter* interpreter, bool enabled);
+void interpreter_set_inline_budget(Interpreter* interpreter, int nodes);
+void interpreter_set_compile_threads(Interpreter* interpreter, int threads);
+void interpreter_set_cache_dir(Interpreter* interpreter, const char* path);
+void interpreter_set_hot_reload(Interpreter* interpreter, bool enabled);
+void interpreter_set_profile(Interpreter* interpreter, int hz);
+void interpreter_set_record(Interpreter* interpreter, const char* path);
+void interpreter_set_replay(Interpreter* interpreter, const char* path);
+bool interpreter_write_profile(Interpreter* interpreter, const char* folded_path, const char* listing_path);
+InterpreterStats interpreter_get_stats(Interpreter* interpreter);
+void interpreter_write_stats(Interpreter* interpreter, FILE* out, StatsFormat format);
+bool interpreter_snapshot(Interpreter* interpreter, const char* path);
+bool interpreter_restore(Interpreter* interpreter, const char* path);
+bool interpreter_reload(Interpreter* interpreter, ASTNode* ast);
 void run_program(Interpreter* interpreter, ASTNode* ast);
-void execute_statement(Interpreter* interpreter, ASTNode* node);
-void execute_print(Interpreter* interpreter, ASTNode* node);
-void execute_assignment(Interpreter* interpreter, ASTNode* node);
-void execute_if(Interpreter* interpreter, ASTNode* node);
-void execute_while(Interpreter* interpreter, ASTNode* node);
-void execute_for(Interpreter* interpreter, ASTNode* node);
-void execute_repeat_until(Interpreter* interpreter, ASTNode* node);
-void execute_select_case(Interpreter* interpreter, ASTNode* node);
-void execute_goto(Interpreter* interpreter, ASTNode* node);
-void execute_gosub(Interpreter* interpreter, ASTNode* node);
-void execute_return(Interpreter* interpreter, ASTNode* node);
-void execute_on_error_goto(Interpreter* interpreter, ASTNode* node);
-void execute_data(Interpreter* interpreter, ASTNode* node);
-void execute_read(Interpreter* interpreter, ASTNode* node);
-int evaluate_expression(Interpreter* interpreter, ASTNode* node);
-void execute_block(Interpreter* interpreter, ASTNode* node);
+Program* compile_program(ASTNode* ast, int inline_budget, int threads);
+void free_program(Program* program);
+void execute_program(Interpreter* interpreter, Program* program);
+bool transpile_program(ASTNode* ast, FILE* out);
+bool compile_native(ASTNode* ast, const char* output_path);
 
 // Helper function prototypes
-void push_return_stack(Interpreter* interpreter, ASTNode* node);
-ASTNode* pop_return_stack(Interpreter* interpreter);
+int pop_return_stack(Interpreter* interpreter);
+ErrorCode push_return_stack(Interpreter* interpreter, int return_address);
+ErrorCode memory_allocate(LinearMemory* memory, int size, int* address);
+ErrorCode memory_free(LinearMemory* memory, int address);
+String* string_new(const char* data, int length);
+void string_retain(String* string);
+void string_release(String* string);
+ErrorCode channel_open(Interpreter* interpreter, int number, String* mode, String* filename);
+ErrorCode channel_close(Interpreter* interpreter, int number);
+void channel_close_all(Interpreter* interpreter);
+ErrorCode channel_write(Channel* channel, const char* data, size_t length);
+ErrorCode channel_read_line(Channel* channel, String** line);
+ErrorCode channel_read_field(Channel* channel, String** field);
+bool channel_eof(Channel* channel);
+void array_release(Array* array);
+void memo_free(Memo* memo);
+ErrorCode array_dimension(Array* array, const int* bounds, int dimension_count);
+ErrorCode array_bload(Array* array, String* filename);
+ErrorCode array_map(Array* array, String* filename);
+ErrorCode array_bsave(Array* array, String* filename);
+ErrorCode memory_bload(LinearMemory* memory, String* filename, int address, int length, int* loaded);
+ErrorCode memory_bsave(LinearMemory* memory, String* filename, int address, int length);
+static void jit_free(JitCache* jit);
+static void mapping_release(FileMapping* mapping);
+static void account_credit(MemoryAccount* account, size_t bytes);
+static void memory_release(LinearMemory* memory);
+static uint64_t cache_key(ASTNode* ast, int inline_budget, bool profile, bool reloadable);
+static Program* cache_load(const char* directory, uint64_t key);
+static bool cache_store(const Program* program, const char* directory, uint64_t key);
+static ErrorCode snapshot_write(Interpreter* interpreter, const char* path, int resume_pc);
+static bool snapshot_fits(const Interpreter* interpreter, const Program* program);
+static Program* try_compile_program(ASTNode* ast, int inline_budget, int threads, bool profile, bool reloadable,
+                                    char error[256]);
+static uint64_t source_keys(ASTNode* ast, uint64_t** procedure_keys, int* procedure_count);
+static void reload_free(Reload* reload);
+static void forget_variable_types(Interpreter* interpreter);
+static void record_variable_types(Interpreter* interpreter, const Program* program);
+static void reload_link(Interpreter* interpreter, Program* program);
+static ASTNode** source_lines(ASTNode* ast, int** depths, int* count);
+static Profile* profile_new(ASTNode* ast, int hz);
+static void profile_free(Profile* profile);
+static void profile_start(Profile* profile);
+static void profile_stop(void);
+static void profile_sample(Interpreter* interpreter, const Program* program);
+static bool run_log_open(Interpreter* interpreter);
+static void run_log_close(Interpreter* interpreter);
 
 // Initialize a new interpreter
 Interpreter* interpreter_new(void (*output_callback)(const char*)) {
     Interpreter* interpreter = (Interpreter*)malloc(sizeof(Interpreter));
     interpreter->output_callback = output_callback;
-    interpreter->variables = (int*)calloc(1000, sizeof(int)); // Arbitrary size
+    interpreter->variables = NULL;
+    interpreter->string_variables = NULL;
+    interpreter->float_variables = NULL;
+    interpreter->arrays = NULL;
+    interpreter->variable_count = 0;
     interpreter->running = true;
     interpreter->return_stack = NULL;
     interpreter->return_stack_size = 0;
     interpreter->return_stack_capacity = 0;
+    interpreter->memo_calls = NULL;
+    interpreter->memo_call_count = 0;
+    interpreter->memo_call_capacity = 0;
+    interpreter->operand_stack = NULL;
+    interpreter->operand_stack_capacity = 0;
+    interpreter->string_stack = NULL;
+    interpreter->string_stack_capacity = 0;
+    interpreter->float_stack = NULL;
+    interpreter->float_stack_capacity = 0;
+    interpreter->stack_limit = DEFAULT_STACK_LIMIT;
     interpreter->data_pointer = 0;
+    interpreter->program = NULL;
+    memset(&interpreter->memory, 0, sizeof(LinearMemory));
+    interpreter->memory.reserved = DEFAULT_MEMORY_LIMIT;
+    memset(&interpreter->account, 0, sizeof(MemoryAccount));
+    interpreter->account.quota = SIZE_MAX;
+    interpreter->memory.account = &interpreter->account;
+    interpreter->error_handler = -1;
+    interpreter->error_code = ERR_NONE;
+    interpreter->error_pc = -1;
+    interpreter->in_error_handler = false;
+    memset(interpreter->channels, 0, sizeof(interpreter->channels));
+    interpreter->console = NULL;
+    interpreter->jit_enabled = false;
+    interpreter->inline_budget = INLINE_BUDGET;
+    interpreter->compile_threads = 0;
+    interpreter->cache_dir = NULL;
+    interpreter->hot_reload = false;
+    interpreter->program_key = 0;
+    interpreter->restored_key = 0;
+    interpreter->resume_pc = 0;
+    interpreter->source_key = 0;
+    interpreter->procedure_keys = NULL;
+    interpreter->procedure_key_count = 0;
+    interpreter->variable_names = NULL;
+    interpreter->variable_types = NULL;
+    interpreter->variable_name_count = 0;
+    interpreter->reload = NULL;
+    pthread_mutex_init(&interpreter->reload_lock, NULL);
+    interpreter->profile_hz = 0;
+    interpreter->profile = NULL;
+    interpreter->run_log_path = NULL;
+    interpreter->run_log_replay = false;
+    interpreter->run_log = NULL;
+    memset(&interpreter->counters, 0, sizeof(ThreadCounters));
+    interpreter->instructions = 0;
+    interpreter->calls = 0;
+    interpreter->output_bytes = 0;
+    interpreter->timed_calls = NULL;
+    interpreter->timed_call_count = 0;
+    interpreter->timed_call_capacity = 0;
+    interpreter->calls_timed = 0;
+    interpreter->call_nanoseconds = 0;
+    memset(interpreter->call_histogram, 0, sizeof(interpreter->call_histogram));
     return interpreter;
 }
 
 // Initialize interpreter state
 void interpreter_init(Interpreter* interpreter) {
-    memset(interpreter->variables, 0, 1000 * sizeof(int));
+    if (interpreter->variables) {
+        memset(interpreter->variables, 0, interpreter->variable_count * sizeof(int));
+        memset(interpreter->float_variables, 0, interpreter->variable_count * sizeof(double));
+        for (int i = 0; i < interpreter->variable_count; i++) {
+            string_release(interpreter->string_variables[i]);
+            interpreter->string_variables[i] = NULL;
+            array_release(&interpreter->arrays[i]);
+        }
+    }
+    channel_close_all(interpreter);
     interpreter->running = true;
+    account_credit(&interpreter->account, interpreter->return_stack_capacity * sizeof(Frame));
     free(interpreter->return_stack);
     interpreter->return_stack = NULL;
     interpreter->return_stack_size = 0;
     interpreter->return_stack_capacity = 0;
+    interpreter->memo_call_count = 0;
     interpreter->data_pointer = 0;
+    interpreter->error_handler = -1;
+    interpreter->error_code = ERR_NONE;
+    interpreter->error_pc = -1;
+    interpreter->in_error_handler = false;
+    interpreter->restored_key = 0;
+    interpreter->resume_pc = 0;
     printf("[DEBUG] Interpreter initialized.\n");
 }
 
 // Free interpreter resources
 void interpreter_free(Interpreter* interpreter) {
+    channel_close_all(interpreter);
+    if (interpreter->console) channel_close(interpreter, -1);
+    for (int i = 0; i < interpreter->variable_count; i++) {
+        string_release(interpreter->string_variables[i]);
+        array_release(&interpreter->arrays[i]);
+    }
     free(interpreter->variables);
+    free(interpreter->string_variables);
+    free(interpreter->float_variables);
+    free(interpreter->arrays);
     free(interpreter->return_stack);
+    free(interpreter->memo_calls);
+    free(interpreter->timed_calls);
+    free(interpreter->operand_stack);
+    free(interpreter->string_stack);
+    free(interpreter->float_stack);
+    free_program(interpreter->program);
+    free(interpreter->cache_dir);
+    free(interpreter->procedure_keys);
+    forget_variable_types(interpreter);
+    reload_free(interpreter->reload);
+    pthread_mutex_destroy(&interpreter->reload_lock);
+    profile_free(interpreter->profile);
+    free(interpreter->run_log_path);
+    memory_release(&interpreter->memory);
     interpreter->running = false;
     printf("[DEBUG] Interpreter resources have been freed.\n");
     free(interpreter);
 }
 
-// Run the program by traversing the AST
+// Set the memory budget for the frame and operand stacks; recursion depth is bounded only by this
+void interpreter_set_stack_limit(Interpreter* interpreter, size_t bytes) {
+    interpreter->stack_limit = bytes;
+}
+
+// Set the size of the ALLOCATE address space; takes effect before the first ALLOCATE
+void interpreter_set_memory_limit(Interpreter* interpreter, size_t bytes) {
+    if (interpreter->memory.base) {
+        fprintf(stderr, "Memory limit must be set before the first ALLOCATE\n");
+        return;
+    }
+    // BASIC addresses are ints, so the region cannot exceed INT_MAX bytes
+    interpreter->memory.reserved = bytes > 0x7fffffff ? 0x7fffffff : bytes;
+}
+
+// Cap the memory a program may hold: its strings, arrays, committed ALLOCATE pages and stacks; 0 lifts the cap.
+// An allocation that would pass it raises Out of memory, which ON ERROR can trap. Compiled code, variable
+// tables and file buffers are not counted. Takes effect at the next allocation.
+void interpreter_set_quota(Interpreter* interpreter, size_t bytes) {
+    interpreter->account.quota = bytes ? bytes : SIZE_MAX;
+}
+
+// Turn the baseline JIT for hot loops on or off; off by default
+void interpreter_set_jit(Interpreter* interpreter, bool enabled) {
+    interpreter->jit_enabled = enabled;
+}
+
+// Set how large a PROCEDURE may be, in AST nodes, for GOSUB to inline it; 0 turns inlining off
+void interpreter_set_inline_budget(Interpreter* interpreter, int nodes) {
+    interpreter->inline_budget = nodes < 0 ? 0 : nodes;
+}
+
+// Set how many threads compile PROCEDURE bodies; 0 uses one per online CPU, 1 compiles on the calling thread
+void interpreter_set_compile_threads(Interpreter* interpreter, int threads) {
+    interpreter->compile_threads = threads < 0 ? 0 : threads;
+}
+
+// Keep compiled programs in a directory and reuse them while the program is unchanged; NULL turns caching off
+void interpreter_set_cache_dir(Interpreter* interpreter, const char* path) {
+    free(interpreter->cache_dir);
+    interpreter->cache_dir = path ? strdup(path) : NULL;
+}
+
+// Compile programs so their PROCEDUREs can be replaced while they run. GOSUB is then never inlined, since an
+// inlined copy could not be replaced, and loops around a GOSUB are not optimized on the grounds of what the
+// PROCEDURE leaves alone; takes effect at the next run_program(). Off by default.
+void interpreter_set_hot_reload(Interpreter* interpreter, bool enabled) {
+    interpreter->hot_reload = enabled;
+}
+
+// Profile the next run_program(): count every statement executed and sample the running one hz times per
+// CPU second; 0 turns profiling off. GOSUB is neither inlined nor turned into a jump while profiling. Results are kept until the next
+// run, see interpreter_write_profile().
+void interpreter_set_profile(Interpreter* interpreter, int hz) {
+    interpreter->profile_hz = hz < 0 ? 0 : hz;
+}
+
+// Record what the next run_program() reads from outside (INPUT, files, BLOAD) to a log; NULL turns it off
+void interpreter_set_record(Interpreter* interpreter, const char* path) {
+    free(interpreter->run_log_path);
+    interpreter->run_log_path = path ? strdup(path) : NULL;
+    interpreter->run_log_replay = false;
+}
+
+// Feed the next run_program() the inputs of a recorded run instead of reading them; NULL turns it off
+void interpreter_set_replay(Interpreter* interpreter, const char* path) {
+    free(interpreter->run_log_path);
+    interpreter->run_log_path = path ? strdup(path) : NULL;
+    interpreter->run_log_replay = path != NULL;
+}
+
+// Snapshot of the interpreter's counters
+InterpreterStats interpreter_get_stats(Interpreter* interpreter) {
+    InterpreterStats stats;
+    stats.memory_reserved = interpreter->memory.base ? interpreter->memory.reserved : 0;
+    stats.memory_committed = interpreter->memory.committed;
+    stats.memory_in_use = interpreter->memory.in_use;
+    stats.memory_peak_in_use = interpreter->memory.peak_in_use;
+    stats.memory_allocations = interpreter->memory.allocations;
+    stats.memory_frees = interpreter->memory.frees;
+    stats.quota = interpreter->account.quota == SIZE_MAX ? 0 : interpreter->account.quota;
+    stats.quota_in_use = interpreter->account.in_use;
+    stats.quota_peak = interpreter->account.peak;
+    stats.quota_refusals = interpreter->account.refusals;
+    JitCache* jit = interpreter->program ? interpreter->program->jit : NULL;
+    stats.jit_loops_compiled = jit ? jit->loops_compiled : 0;
+    stats.jit_native_entries = jit ? jit->native_entries : 0;
+    stats.memo_hits = stats.memo_misses = stats.memo_evictions = 0;
+    for (int i = 0; interpreter->program && i < interpreter->program->memo_count; i++) {
+        stats.memo_hits += interpreter->program->memos[i].hits;
+        stats.memo_misses += interpreter->program->memos[i].misses;
+        stats.memo_evictions += interpreter->program->memos[i].evictions;
+    }
+    stats.instructions = interpreter->instructions;
+    stats.calls = interpreter->calls;
+    stats.string_allocations = interpreter->counters.string_allocations;
+    stats.string_bytes = interpreter->counters.string_bytes;
+    stats.string_frees = interpreter->counters.string_frees;
+    stats.output_bytes = interpreter->output_bytes;
+    stats.file_bytes_read = interpreter->counters.file_bytes_read;
+    stats.file_bytes_written = interpreter->counters.file_bytes_written;
+    stats.calls_timed = interpreter->calls_timed;
+    stats.call_seconds = interpreter->call_nanoseconds / 1e9;
+    memcpy(stats.call_histogram, interpreter->call_histogram, sizeof(stats.call_histogram));
+    return stats;
+}
+
+// Dump interpreter_get_stats() as one JSON object, or in the Prometheus text exposition format. Counters cover
+// the interpreter's whole life; instructions are credited when a run ends, everything else as it happens.
+void interpreter_write_stats(Interpreter* interpreter, FILE* out, StatsFormat format) {
+    InterpreterStats stats = interpreter_get_stats(interpreter);
+    const struct {
+        const char* name;
+        const char* help;
+        bool counter;           // Only ever grows; the memory figures are gauges
+        long long value;
+    } metrics[] = {
+        {"instructions", "Instructions dispatched by the interpreter loop", true, stats.instructions},
+        {"calls", "GOSUB calls made", true, stats.calls},
+        {"memo_hits", "GOSUB calls answered from a memo table", true, stats.memo_hits},
+        {"memo_misses", "Memoized GOSUB calls that had to run", true, stats.memo_misses},
+        {"memo_evictions", "Memo table entries replaced", true, stats.memo_evictions},
+        {"jit_loops_compiled", "Loops compiled to native code", true, stats.jit_loops_compiled},
+        {"jit_native_entries", "Entries into native loop code", true, stats.jit_native_entries},
+        {"string_allocations", "Strings allocated", true, stats.string_allocations},
+        {"string_bytes", "Bytes allocated for string contents", true, stats.string_bytes},
+        {"string_frees", "Strings freed when their last reference was released", true, stats.string_frees},
+        {"output_bytes", "Bytes of program output", true, stats.output_bytes},
+        {"file_read_bytes", "Bytes read from files", true, stats.file_bytes_read},
+        {"file_written_bytes", "Bytes written to files", true, stats.file_bytes_written},
+        {"memory_allocations", "ALLOCATE calls", true, stats.memory_allocations},
+        {"memory_frees", "FREE calls", true, stats.memory_frees},
+        {"quota_refusals", "Allocations refused for passing the memory quota", true, stats.quota_refusals},
+        {"memory_reserved_bytes", "Address space reserved for ALLOCATE", false, (long long)stats.memory_reserved},
+        {"memory_committed_bytes", "ALLOCATE memory backed by pages", false, (long long)stats.memory_committed},
+        {"memory_in_use_bytes", "ALLOCATE memory in use", false, (long long)stats.memory_in_use},
+        {"memory_peak_in_use_bytes", "Most ALLOCATE memory in use at once", false, (long long)stats.memory_peak_in_use},
+        {"quota_bytes", "Memory quota of the program, 0 for none", false, (long long)stats.quota},
+        {"quota_in_use_bytes", "Memory held by the program against its quota", false, (long long)stats.quota_in_use},
+        {"quota_peak_bytes", "Most memory the program held at once", false, (long long)stats.quota_peak},
+    };
+    int metric_count = (int)(sizeof(metrics) / sizeof(metrics[0]));
+
+    if (format == STATS_JSON) {
+        fputs("{\n", out);
+        for (int i = 0; i < metric_count; i++) fprintf(out, "  \"%s\": %lld,\n", metrics[i].name, metrics[i].value);
+        fprintf(out, "  \"calls_timed\": %ld,\n  \"call_seconds\": %.9f,\n  \"call_histogram\": [", stats.calls_timed,
+                stats.call_seconds);
+        // Buckets that saw a call, each with the duration its calls stayed under
+        const char* separator = "";
+        for (int b = 0; b < CALL_HISTOGRAM_BUCKETS; b++) {
+            if (stats.call_histogram[b] == 0) continue;
+            if (b < CALL_HISTOGRAM_BUCKETS - 1) {
+                fprintf(out, "%s{\"below_ns\": %llu, \"count\": %ld}", separator, 1ull << (b + 1), stats.call_histogram[b]);
+            } else {
+                fprintf(out, "%s{\"below_ns\": null, \"count\": %ld}", separator, stats.call_histogram[b]);
+            }
+            separator = ", ";
+        }
+        fputs("]\n}\n", out);
+        return;
+    }
+
+    for (int i = 0; i < metric_count; i++) {
+        const char* suffix = metrics[i].counter ? "_total" : "";
+        fprintf(out, "# HELP gfabasic_%s%s %s\n", metrics[i].name, suffix, metrics[i].help);
+        fprintf(out, "# TYPE gfabasic_%s%s %s\n", metrics[i].name, suffix, metrics[i].counter ? "counter" : "gauge");
+        fprintf(out, "gfabasic_%s%s %lld\n", metrics[i].name, suffix, metrics[i].value);
+    }
+    fprintf(out, "# HELP gfabasic_call_duration_seconds Duration of GOSUB calls, one in %d timed\n", CALL_TIMING_INTERVAL);
+    fputs("# TYPE gfabasic_call_duration_seconds histogram\n", out);
+    long cumulative = 0;
+    for (int b = 0; b < CALL_HISTOGRAM_BUCKETS - 1; b++) {
+        cumulative += stats.call_histogram[b];
+        fprintf(out, "gfabasic_call_duration_seconds_bucket{le=\"%.9g\"} %ld\n", (double)(1ull << (b + 1)) / 1e9, cumulative);
+    }
+    fprintf(out, "gfabasic_call_duration_seconds_bucket{le=\"+Inf\"} %ld\n", stats.calls_timed);
+    fprintf(out, "gfabasic_call_duration_seconds_sum %.9f\n", stats.call_seconds);
+    fprintf(out, "gfabasic_call_duration_seconds_count %ld\n", stats.calls_timed);
+}
+
+// Run the program: compile the AST once, then execute the instruction stream
 void run_program(Interpreter* interpreter, ASTNode* ast) {
     if (strcmp(ast->node_type, "program") != 0) {
         fprintf(stderr, "Expected program node\n");
-        exit(1);
+        return;
+    }
+    // interpreter_reload() on another thread reads the old program, its keys and variables until it unlocks
+    pthread_mutex_lock(&interpreter->reload_lock);
+    free_program(__atomic_exchange_n(&interpreter->program, NULL, __ATOMIC_ACQ_REL));
+    reload_free(__atomic_exchange_n(&interpreter->reload, NULL, __ATOMIC_ACQ_REL));
+    free(interpreter->procedure_keys);
+    interpreter->source_key = source_keys(ast, &interpreter->procedure_keys, &interpreter->procedure_key_count);
+    forget_variable_types(interpreter);
+    pthread_mutex_unlock(&interpreter->reload_lock);
+    profile_free(interpreter->profile);
+    interpreter->profile = interpreter->profile_hz > 0 ? profile_new(ast, interpreter->profile_hz) : NULL;
+    bool profile = interpreter->profile != NULL;
+    int inline_budget = interpreter->hot_reload || profile ? 0 : interpreter->inline_budget;
+    uint64_t key = cache_key(ast, inline_budget, profile, interpreter->hot_reload);
+    interpreter->program_key = key;
+    if (interpreter->restored_key && interpreter->restored_key != key) {
+        printf("[DEBUG] Snapshot belongs to another program; starting from the beginning.\n");
+        interpreter_init(interpreter);
+    }
+    Program* program = NULL;
+    if (interpreter->cache_dir) {
+        program = cache_load(interpreter->cache_dir, key);
+        if (program) {
+            printf("[DEBUG] Bytecode cache: mapped %016llx.gfc, %d instructions.\n", (unsigned long long)key,
+                   program->code_size);
+        }
     }
+    if (!program) {
+        char error[256];
+        program = try_compile_program(ast, inline_budget, interpreter->compile_threads, profile, interpreter->hot_reload,
+                                      error);
+        if (!program) {
+            fprintf(stderr, "%s\n", error);
+            exit(1);
+        }
+        if (interpreter->cache_dir) {
+            bool stored = cache_store(program, interpreter->cache_dir, key);
+            printf("[DEBUG] Bytecode cache: %s %016llx.gfc.\n", stored ? "wrote" : "could not write",
+                   (unsigned long long)key);
+        }
+    }
+    if (interpreter->restored_key && !snapshot_fits(interpreter, program)) {
+        printf("[DEBUG] Snapshot does not fit the program's code; starting from the beginning.\n");
+        interpreter_init(interpreter);
+    }
+    // Published last: interpreter_reload() on another thread may start once it sees the program
+    pthread_mutex_lock(&interpreter->reload_lock);
+    record_variable_types(interpreter, program);
+    __atomic_store_n(&interpreter->program, program, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&interpreter->reload_lock);
+    if (interpreter->run_log_path && !run_log_open(interpreter)) return;
     printf("[DEBUG] Starting program execution.\n");
-    for (int i = 0; i < ast->children_count; i++) {
-        execute_statement(interpreter, ast->children[i]);
-        if (!interpreter->running) break;
-    }
-}
-
-// Execute a specific statement node
-void execute_statement(Interpreter* interpreter, ASTNode* node) {
-    if (!interpreter->running) return;
-
-    if (strcmp(node->node_type, "print_statement") == 0) {
-        execute_print(interpreter, node);
-    } else if (strcmp(node->node_type, "assignment") == 0) {
-        execute_assignment(interpreter, node);
-    } else if (strcmp(node->node_type, "if_statement") == 0) {
-        execute_if(interpreter, node);
-    } else if (strcmp(node->node_type, "while_loop") == 0) {
-        execute_while(interpreter, node);
-    } else if (strcmp(node->node_type, "for_loop") == 0) {
-        execute_for(interpreter, node);
-    } else if (strcmp(node->node_type, "repeat_until") == 0) {
-        execute_repeat_until(interpreter, node);
-    } else if (strcmp(node->node_type, "select_case") == 0) {
-        execute_select_case(interpreter, node);
-    } else if (strcmp(node->node_type, "goto_statement") == 0) {
-        execute_goto(interpreter, node);
-    } else if (strcmp(node->node_type, "gosub_statement") == 0) {
-        execute_gosub(interpreter, node);
-    } else if (strcmp(node->node_type, "return_statement") == 0) {
-        execute_return(interpreter, node);
-    } else if (strcmp(node->node_type, "on_error_goto") == 0) {
-        execute_on_error_goto(interpreter, node);
-    } else if (strcmp(node->node_type, "data_statement") == 0) {
-        execute_data(interpreter, node);
-    } else if (strcmp(node->node_type, "read_statement") == 0) {
-        execute_read(interpreter, node);
-    } else {
-        fprintf(stderr, "Unknown statement type: %s\n", node->node_type);
+    if (profile) profile_start(interpreter->profile);
+    execute_program(interpreter, program);
+    if (interpreter->account.quota != SIZE_MAX) {
+        printf("[DEBUG] Memory high-water mark: %zu of %zu bytes allowed, %ld allocations refused.\n",
+               interpreter->account.peak, interpreter->account.quota, interpreter->account.refusals);
+    }
+    if (profile) {
+        profile_stop();
+        printf("[DEBUG] Profile: %ld samples over %d lines.\n", interpreter->profile->sample_count,
+               interpreter->profile->line_count);
+    }
+    if (interpreter->run_log) run_log_close(interpreter);
+}
+
+/* ---------------------------------------------------------------------------
+   Compiler: AST -> Instruction stream
+
+   The AST is walked with an explicit task stack instead of C recursion, so
+   nesting depth of the source is limited by heap memory only. Each task is a
+   small state machine; a task pushes its children and is resumed once they
+   have emitted their code.
+   --------------------------------------------------------------------------- */
+
+// Pending reference to a label that is resolved once the whole program is compiled
+typedef struct {
+    char *name;
+    int at;
+    int order;      // Top-level statement it came from, so undefined labels are reported in source order
+} Fixup;
+
+// One node being compiled, with the per-node state it needs to resume
+typedef struct {
+    ASTNode *node;
+    int state;
+    int index;      // Next child to compile
+    int patch;      // Forward jump waiting for its target
+    int target;     // Loop head, or head of the SELECT exit-jump chain
+    int slot;       // Compiler temporary (FOR limit/step, SELECT value)
+    int guards;     // FOR: chain of failed bounds-guard jumps to the checked copy
+    int exits;      // FOR: chain of loop-exit jumps from the unchecked copy
+    int statement;  // Index into program->statements, -1 for expressions and blocks
+    int values;     // FOR: first of its entries in compiler->loop_values
+    ValueType coerce;   // Type the parent needs this expression converted to, TYPE_UNKNOWN for none
+} CompileTask;
+
+#define MAX_HOISTED_ACCESSES 64
+#define MAX_HOISTED_BASES 8
+
+// PEEK/POKE nodes inside a FOR body whose bounds were proven by a guard before the loop
+typedef struct {
+    ASTNode *accesses[MAX_HOISTED_ACCESSES];
+    int access_count;
+} HoistContext;
+
+// Inferred type of every node, keyed by node address (open addressing), plus the untyped variables
+typedef struct {
+    ASTNode **nodes;
+    ValueType *node_types;
+    int capacity;           // Power of two
+    char **names;
+    ValueType *name_types;
+    int name_count;
+    int name_capacity;
+    int proven_int;         // Untyped variables inferred integer
+    int defaulted_float;    // Untyped variables that never received a typed value, so fell back to float
+    int int_operations;     // Specialized operations emitted, for the report
+    int float_operations;
+    int string_operations;
+    int conversions;
+} TypeTable;
+
+typedef enum {
+    LOOP_VALUE_PENDING,
+    LOOP_VALUE_COMPUTING,   // Being compiled in the pre-header, so not yet substituted
+    LOOP_VALUE_READY
+} LoopValueState;
+
+// Expression of a FOR body that is computed outside the loop and read from a temporary slot inside it:
+// either loop-invariant, or an induction product var * c kept up to date by adding c * step per iteration
+typedef struct {
+    ASTNode *node;
+    int slot;
+    int step;               // Induction products: slot holding c * step; -1 for invariants
+    LoopValueState state;
+} LoopValue;
+
+// A counted statement and its line in the profile listing; sorted by node so source_line() can search it
+typedef struct {
+    ASTNode *node;
+    int line;
+} SourceLine;
+
+typedef struct {
+    Program *program;
+    TypeTable *types;
+    CompileTask *tasks;
+    int task_count;
+    int task_capacity;
+    Fixup *fixups;
+    int fixup_count;
+    int fixup_capacity;
+    int depth;      // Current operand stack depth while emitting
+    int string_depth;
+    int float_depth;
+    HoistContext *hoists;
+    int hoist_count;
+    int hoist_capacity;
+    LoopValue *loop_values;     // Stack: the values of every FOR loop being compiled
+    int loop_value_count;
+    int loop_value_capacity;
+    ASTNode **procedures;       // Every PROCEDURE node, for the side-effect analysis of GOSUB
+    int procedure_count;
+    int *procedure_sizes;       // Body size in AST nodes, or -1 when the body cannot be inlined
+    bool *inlining;             // Procedures whose bodies are being compiled at a call site
+    int inline_budget;
+    int inlined;
+    int calls;
+    int *procedure_memos;       // Memo index per procedure, -1 when its calls are not memoized
+    bool *reachable;            // Procedures the program can enter; the rest are not compiled
+    bool *separate;             // Top-level procedures compiled as units of their own, see compile_unit
+    ASTNode *unit;              // The separate PROCEDURE this compiler builds, NULL for the main program
+    int unit_order;             // Its index among the program's top-level statements
+    int procedure_depth;        // PROCEDURE bodies being compiled, not counting inlined copies
+    int *tail_sites;            // GOSUBs in procedure bodies that may become tail jumps, see bind_call_sites
+    int tail_site_count;
+    int tail_site_capacity;
+    bool traps_errors;          // ON ERROR handlers can run arbitrary code in the middle of a loop
+    bool reloadable;            // Any PROCEDURE may be replaced while the program runs, see interpreter_reload
+    bool profile;               // Every call keeps its frame, so samples name the PROCEDURE running
+    const SourceLine *lines;    // Statements that count their executions when profiling, NULL otherwise
+    int line_count;
+    int hoisted;                // Report counters
+    int reduced;
+    int memoized;
+} Compiler;
+
+// Net operand stack effect of each opcode
+static const int stack_effect[] = {
+    [OP_NOP] = 0, [OP_PUSH_INT] = 1, [OP_LOAD] = 1, [OP_STORE] = -1,
+    [OP_ADD_INT] = -1, [OP_SUB_INT] = -1, [OP_MUL_INT] = -1, [OP_DIV_INT] = -1,
+    [OP_EQ] = -1, [OP_NE] = -1, [OP_LT] = -1, [OP_LE] = -1, [OP_GT] = -1, [OP_GE] = -1,
+    [OP_PRINT] = -1, [OP_JUMP] = 0, [OP_JUMP_IF_FALSE] = -1, [OP_GOSUB] = 0,
+    [OP_RETURN] = 0, [OP_READ] = 0, [OP_RESTORE] = 0,
+    [OP_ALLOCATE] = -1, [OP_FREE] = -1, [OP_POKE] = -2, [OP_POKE_UNCHECKED] = -2,
+    [OP_PEEK] = 0, [OP_PEEK_UNCHECKED] = 0, [OP_CHECK_SPAN] = -2,
+    [OP_ON_ERROR] = 0, [OP_RESUME] = 0, [OP_RESUME_NEXT] = 0, [OP_RESUME_LABEL] = 0,
+    [OP_PUSH_ERR] = 1, [OP_STR_COMPARE] = 1, [OP_OPEN] = -1, [OP_CLOSE] = -1, [OP_CLOSE_ALL] = 0,
+    [OP_PRINT_CHANNEL] = -2, [OP_PRINT_CHANNEL_STR] = -1, [OP_INPUT_CHANNEL] = -1,
+    [OP_INPUT_CHANNEL_STR] = -1, [OP_LINE_INPUT_CHANNEL] = -1, [OP_EOF] = 0,
+    [OP_DIM] = 0, [OP_LOAD_ELEMENT] = 0, [OP_STORE_ELEMENT] = 0,   // Depend on the subscript count, see emit_indexed
+    [OP_BLOAD] = -2, [OP_BLOAD_ARRAY] = 0, [OP_MAP_ARRAY] = 0, [OP_BSAVE] = -2, [OP_BSAVE_ARRAY] = 0,
+    [OP_CMP_FLT] = 1, [OP_INT_TO_FLT] = -1, [OP_FLT_TO_INT] = 1, [OP_PRINT_CHANNEL_FLT] = -1,
+    [OP_INPUT_CHANNEL_FLT] = -1,
+    [OP_END] = 0
+};
+
+// Net string stack effect of each opcode
+static const int string_stack_effect[] = {
+    [OP_PUSH_STR] = 1, [OP_LOAD_STR] = 1, [OP_STORE_STR] = -1, [OP_CONCAT] = -1,
+    [OP_STR_COMPARE] = -2, [OP_PRINT_STR] = -1, [OP_OPEN] = -2, [OP_PRINT_CHANNEL_STR] = -1,
+    [OP_BLOAD] = -1, [OP_BLOAD_ARRAY] = -1, [OP_MAP_ARRAY] = -1, [OP_BSAVE] = -1, [OP_BSAVE_ARRAY] = -1,
+    [OP_SNAPSHOT] = -1,
+    [OP_END] = 0
+};
+
+// Net float stack effect of each opcode
+static const int float_stack_effect[] = {
+    [OP_PUSH_FLT] = 1, [OP_LOAD_FLT] = 1, [OP_STORE_FLT] = -1,
+    [OP_ADD_FLT] = -1, [OP_SUB_FLT] = -1, [OP_MUL_FLT] = -1, [OP_DIV_FLT] = -1, [OP_CMP_FLT] = -2,
+    [OP_INT_TO_FLT] = 1, [OP_FLT_TO_INT] = -1, [OP_PRINT_FLT] = -1, [OP_PRINT_CHANNEL_FLT] = -1,
+    [OP_END] = 0
+};
+
+// Where a compile error on this thread goes. compile_program() collects the errors of the main program and
+// of every separately compiled unit, and reports the one a serial compile would have met first.
+typedef struct {
+    jmp_buf abort;
+    char message[256];
+    bool failed;
+    int order;              // Top-level statement being compiled when it failed
+} CompileFailure;
+
+static _Thread_local CompileFailure* compile_failure;
+
+// Report a compile error: abandon the compile running on this thread
+static void compile_error(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (!compile_failure) {
+        vfprintf(stderr, format, args);
+        va_end(args);
+        fputc('\n', stderr);
         exit(1);
     }
+    vsnprintf(compile_failure->message, sizeof(compile_failure->message), format, args);
+    va_end(args);
+    compile_failure->failed = true;
+    longjmp(compile_failure->abort, 1);
 }
 
-// Execute a print statement
-void execute_print(Interpreter* interpreter, ASTNode* node) {
-    int expr_value = evaluate_expression(interpreter, node->children[0]);
-    char output[50];
-    snprintf(output, sizeof(output), "%d", expr_value);
-    if (interpreter->output_callback) {
-        interpreter->output_callback(output);
-    } else {
-        printf("%s\n", output);
+// Top-level statement of the program the compiler is working on
+static int source_order(const Compiler* compiler) {
+    return compiler->unit ? compiler->unit_order : compiler->tasks[0].index - 1;
+}
+
+// Append an instruction and return its address
+static int emit(Compiler* compiler, OpCode op, int operand) {
+    Program* program = compiler->program;
+    if (program->code_size >= program->code_capacity) {
+        program->code_capacity = (program->code_capacity == 0) ? 64 : program->code_capacity * 2;
+        program->code = (Instruction*)realloc(program->code, program->code_capacity * sizeof(Instruction));
     }
-    printf("[DEBUG] Printed: %s\n", output);
+    program->code[program->code_size].op = op;
+    program->code[program->code_size].operand = operand;
+    compiler->depth += stack_effect[op];
+    if (compiler->depth > program->max_stack) program->max_stack = compiler->depth;
+    compiler->string_depth += string_stack_effect[op];
+    if (compiler->string_depth > program->max_string_stack) program->max_string_stack = compiler->string_depth;
+    compiler->float_depth += float_stack_effect[op];
+    if (compiler->float_depth > program->max_float_stack) program->max_float_stack = compiler->float_depth;
+    return program->code_size++;
 }
 
-// Execute an assignment statement
-void execute_assignment(Interpreter* interpreter, ASTNode* node) {
-    int expr_value = evaluate_expression(interpreter, node->children[1]);
-    int var_index = atoi(node->children[0]->value); // Assuming variable names are numbers for simplicity
-    interpreter->variables[var_index] = expr_value;
-    printf("[DEBUG] Assigned %s = %d\n", node->children[0]->value, expr_value);
+// Point a previously emitted jump at the current end of code
+static void patch_jump(Compiler* compiler, int at) {
+    compiler->program->code[at].operand = compiler->program->code_size;
 }
 
-// Execute an if statement
-void execute_if(Interpreter* interpreter, ASTNode* node) {
-    int condition_value = evaluate_expression(interpreter, node->children[0]);
-    if (condition_value) {
-        printf("[DEBUG] IF condition met, executing THEN branch\n");
-        execute_block(interpreter, node->children[1]);
-    } else if (node->children_count > 2) {
-        printf("[DEBUG] IF condition not met, executing ELSE branch\n");
-        execute_block(interpreter, node->children[2]);
+// Add a slot to the symbol table
+static int add_slot(Program* program, const char* name) {
+    if (program->symbol_count >= program->symbol_capacity) {
+        program->symbol_capacity = (program->symbol_capacity == 0) ? 16 : program->symbol_capacity * 2;
+        program->symbols = (char**)realloc(program->symbols, program->symbol_capacity * sizeof(char*));
     }
+    program->symbols[program->symbol_count] = name ? strdup(name) : NULL;
+    return program->symbol_count++;
 }
 
-// Execute a while loop
-void execute_while(Interpreter* interpreter, ASTNode* node) {
-    while (evaluate_expression(interpreter, node->children[0])) {
-        printf("[DEBUG] WHILE loop condition met, executing loop body\n");
-        execute_block(interpreter, node->children[1]);
-        if (!interpreter->running) break;
+// Resolve a variable name to its slot, creating it on first use
+static int resolve_slot(Program* program, const char* name) {
+    for (int i = 0; i < program->symbol_count; i++) {
+        if (program->symbols[i] && strcmp(program->symbols[i], name) == 0) return i;
     }
+    return add_slot(program, name);
 }
 
-// Execute a for loop
-void execute_for(Interpreter* interpreter, ASTNode* node) {
-    int init = evaluate_expression(interpreter, node->children[0]);
-    int end = evaluate_expression(interpreter, node->children[1]);
-    int step = (node->children_count > 2) ? evaluate_expression(interpreter, node->children[2]) : 1;
-    int var_index = atoi(node->children[0]->children[0]->value);
-    for (int i = init; i <= end; i += step) {
-        interpreter->variables[var_index] = i;
-        printf("[DEBUG] FOR loop iteration %s = %d\n", node->children[0]->children[0]->value, i);
-        execute_block(interpreter, node->children[3]);
-        if (!interpreter->running) break;
+// Add a string literal to the constant pool
+static int add_string_constant(Program* program, const char* text) {
+    if (program->string_count >= program->string_capacity) {
+        program->string_capacity = (program->string_capacity == 0) ? 16 : program->string_capacity * 2;
+        program->strings = (String**)realloc(program->strings, program->string_capacity * sizeof(String*));
     }
+    program->strings[program->string_count] = string_new(text, (int)strlen(text));
+    return program->string_count++;
 }
 
-// Execute a repeat-until loop
-void execute_repeat_until(Interpreter* interpreter, ASTNode* node) {
-    do {
-        printf("[DEBUG] Executing REPEAT loop body\n");
-        execute_block(interpreter, node->children[0]);
-    } while (!evaluate_expression(interpreter, node->children[1]) && interpreter->running);
-}
-
-// Execute a select-case statement
-void execute_select_case(Interpreter* interpreter, ASTNode* node) {
-    int expr_value = evaluate_expression(interpreter, node->children[0]);
-    for (int i = 1; i < node->children_count; i++) {
-        int case_value = evaluate_expression(interpreter, node->children[i]->children[0]);
-        if (expr_value == case_value) {
-            execute_block(interpreter, node->children[i]->children[1]);
-            break;
+// Add a float literal to the constant pool
+static int add_float_constant(Program* program, double value) {
+    for (int i = 0; i < program->float_count; i++) {
+        if (memcmp(&program->floats[i], &value, sizeof(double)) == 0) return i;
+    }
+    if (program->float_count >= program->float_capacity) {
+        program->float_capacity = (program->float_capacity == 0) ? 16 : program->float_capacity * 2;
+        program->floats = (double*)realloc(program->floats, program->float_capacity * sizeof(double));
+    }
+    program->floats[program->float_count] = value;
+    return program->float_count++;
+}
+
+// Is this a string variable name?
+static bool is_string_name(const char* name) {
+    size_t length = strlen(name);
+    return length > 0 && name[length - 1] == '$';
+}
+
+// Emit an array instruction; the operand packs the array slot with its subscript count
+static void emit_indexed(Compiler* compiler, OpCode op, int slot, int subscripts) {
+    emit(compiler, op, slot << 3 | subscripts);
+    if (op == OP_DIM) compiler->depth -= subscripts;
+    if (op == OP_LOAD_ELEMENT) compiler->depth += 1 - subscripts;
+    if (op == OP_STORE_ELEMENT) compiler->depth -= subscripts + 1;
+}
+
+// Arrays live in their own namespace: "a()" is a different slot from the scalar "a"
+static int resolve_array_slot(Program* program, const char* name) {
+    char key[256];
+    snprintf(key, sizeof(key), "%s()", name);
+    if (is_string_name(name)) {
+        compile_error("Type mismatch: string arrays are not supported (%s)", name);
+    }
+    return resolve_slot(program, key);
+}
+
+// Record a label at the current code address
+static void define_label(Compiler* compiler, const char* name) {
+    Program* program = compiler->program;
+    for (int i = 0; i < program->label_count; i++) {
+        if (strcmp(program->labels[i].name, name) == 0) {
+            compile_error("Duplicate label: %s", name);
         }
     }
+    if (program->label_count >= program->label_capacity) {
+        program->label_capacity = (program->label_capacity == 0) ? 8 : program->label_capacity * 2;
+        program->labels = (Label*)realloc(program->labels, program->label_capacity * sizeof(Label));
+    }
+    program->labels[program->label_count].name = strdup(name);
+    program->labels[program->label_count].address = program->code_size;
+    program->label_count++;
 }
 
-// Execute a GOTO statement (not yet implemented)
-void execute_goto(Interpreter* interpreter, ASTNode* node) {
-    printf("[DEBUG] GOTO label %s - not yet implemented.\n", node->value);
+// Emit a jump or call to a label that may not have been seen yet
+static void emit_label_reference(Compiler* compiler, OpCode op, const char* name) {
+    if (compiler->fixup_count >= compiler->fixup_capacity) {
+        compiler->fixup_capacity = (compiler->fixup_capacity == 0) ? 8 : compiler->fixup_capacity * 2;
+        compiler->fixups = (Fixup*)realloc(compiler->fixups, compiler->fixup_capacity * sizeof(Fixup));
+    }
+    compiler->fixups[compiler->fixup_count].name = (char*)name;
+    compiler->fixups[compiler->fixup_count].at = emit(compiler, op, -1);
+    compiler->fixups[compiler->fixup_count].order = source_order(compiler);
+    compiler->fixup_count++;
 }
 
-// Execute a GOSUB statement
-void execute_gosub(Interpreter* interpreter, ASTNode* node) {
-    push_return_stack(interpreter, node);
-    printf("[DEBUG] GOSUB to label %s - not yet implemented.\n", node->value);
+// Append a DATA value
+static void add_data(Program* program, int value) {
+    if (program->data_count >= program->data_capacity) {
+        program->data_capacity = (program->data_capacity == 0) ? 16 : program->data_capacity * 2;
+        program->data = (int*)realloc(program->data, program->data_capacity * sizeof(int));
+    }
+    program->data[program->data_count++] = value;
 }
 
-// Execute a RETURN statement
-void execute_return(Interpreter* interpreter, ASTNode* node) {
-    if (interpreter->return_stack_size == 0) {
-        fprintf(stderr, "RETURN called without a corresponding GOSUB\n");
-        exit(1);
+// Statements get a code range of their own; expressions, blocks and the program itself do not
+static bool is_statement(const char* type) {
+    return !(strcmp(type, "program") == 0 || strcmp(type, "block") == 0 || strcmp(type, "int_literal") == 0 ||
+             strcmp(type, "identifier") == 0 || strcmp(type, "operator") == 0 || strcmp(type, "peek") == 0 ||
+             strcmp(type, "err") == 0 || strcmp(type, "string_literal") == 0 || strcmp(type, "eof") == 0 ||
+             strcmp(type, "array_element") == 0 || strcmp(type, "array_ref") == 0 ||
+             strcmp(type, "float_literal") == 0);
+}
+
+// PROCEDURE headers and labels are listed but not counted: their code is entered by jumps that skip a counter
+static bool counts_executions(const char* type) {
+    return strcmp(type, "procedure") != 0 && strcmp(type, "label") != 0;
+}
+
+static int compare_source_lines(const void* a, const void* b) {
+    uintptr_t left = (uintptr_t)((const SourceLine*)a)->node, right = (uintptr_t)((const SourceLine*)b)->node;
+    return left < right ? -1 : left > right;
+}
+
+// Profile listing line on which this statement counts its executions, 0 when it does not
+static int source_line(const Compiler* compiler, ASTNode* node) {
+    int low = 0, high = compiler->line_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if ((uintptr_t)compiler->lines[mid].node < (uintptr_t)node) low = mid + 1; else high = mid;
     }
-    ASTNode* return_node = pop_return_stack(interpreter);
-    printf("[DEBUG] RETURNING to label %s - not yet implemented.\n", return_node->value);
+    return low < compiler->line_count && compiler->lines[low].node == node ? compiler->lines[low].line : 0;
 }
 
-// Execute an ON ERROR GOTO statement (not yet implemented)
-void execute_on_error_goto(Interpreter* interpreter, ASTNode* node) {
-    printf("[DEBUG] ON ERROR GOTO label %s - not yet implemented.\n", node->value);
+// Schedule a node for compilation
+static void push_task(Compiler* compiler, ASTNode* node) {
+    if (compiler->task_count >= compiler->task_capacity) {
+        compiler->task_capacity = (compiler->task_capacity == 0) ? 32 : compiler->task_capacity * 2;
+        compiler->tasks = (CompileTask*)realloc(compiler->tasks, compiler->task_capacity * sizeof(CompileTask));
+    }
+    CompileTask* task = &compiler->tasks[compiler->task_count++];
+    task->node = node;
+    task->state = 0;
+    task->index = 0;
+    task->patch = -1;
+    task->target = -1;
+    task->slot = -1;
+    task->guards = -1;
+    task->exits = -1;
+    task->statement = -1;
+    task->values = compiler->loop_value_count;
+    task->coerce = TYPE_UNKNOWN;
+
+    // Record where each statement's code starts; its end is filled in by finish_task
+    if (!is_statement(node->node_type)) return;
+    Program* program = compiler->program;
+    if (program->statement_count >= program->statement_capacity) {
+        program->statement_capacity = (program->statement_capacity == 0) ? 64 : program->statement_capacity * 2;
+        program->statements = (StatementRange*)realloc(program->statements, program->statement_capacity * sizeof(StatementRange));
+    }
+    task->statement = program->statement_count;
+    program->statements[program->statement_count].start = program->code_size;
+    program->statements[program->statement_count].end = program->code_size;
+    program->statement_count++;
+    int line = compiler->lines ? source_line(compiler, node) : 0;
+    if (line > 0) emit(compiler, OP_COUNT_LINE, line);
 }
 
-// Execute a DATA statement (not yet implemented)
-void execute_data(Interpreter* interpreter, ASTNode* node) {
-    printf("[DEBUG] DATA statement encountered - not yet implemented.\n");
+// Point every jump in an operand-linked chain at the current end of code
+static void patch_chain(Compiler* compiler, int at) {
+    while (at >= 0) {
+        int next = compiler->program->code[at].operand;
+        patch_jump(compiler, at);
+        at = next;
+    }
 }
 
-// Execute a READ statement (not yet implemented)
-void execute_read(Interpreter* interpreter, ASTNode* node) {
-    printf("[DEBUG] READ into variable %s - not yet implemented.\n", node->children[0]->value);
+// Flatten a subtree into a node list using an explicit stack
+static ASTNode** collect_nodes(ASTNode* root, int* count) {
+    int capacity = 64, size = 0, pending_size = 0, pending_capacity = 64;
+    ASTNode** nodes = (ASTNode**)malloc(capacity * sizeof(ASTNode*));
+    ASTNode** pending = (ASTNode**)malloc(pending_capacity * sizeof(ASTNode*));
+    pending[pending_size++] = root;
+    while (pending_size > 0) {
+        ASTNode* node = pending[--pending_size];
+        if (size >= capacity) {
+            capacity *= 2;
+            nodes = (ASTNode**)realloc(nodes, capacity * sizeof(ASTNode*));
+        }
+        nodes[size++] = node;
+        for (int i = 0; i < node->children_count; i++) {
+            if (pending_size >= pending_capacity) {
+                pending_capacity *= 2;
+                pending = (ASTNode**)realloc(pending, pending_capacity * sizeof(ASTNode*));
+            }
+            pending[pending_size++] = node->children[i];
+        }
+    }
+    free(pending);
+    *count = size;
+    return nodes;
 }
 
-// Evaluate an expression node
-int evaluate_expression(Interpreter* interpreter, ASTNode* node) {
-    if (strcmp(node->node_type, "int_literal") == 0) {
-        return atoi(node->value);
-    } else if (strcmp(node->node_type, "identifier") == 0) {
-        int var_index = atoi(node->value);
-        int value = interpreter->variables[var_index];
-        printf("[DEBUG] Retrieved value for %s = %d\n", node->value, value);
-        return value;
-    } else if (strcmp(node->node_type, "operator") == 0) {
-        int left = evaluate_expression(interpreter, node->children[0]);
-        int right = evaluate_expression(interpreter, node->children[1]);
-        if (strcmp(node->value, "+") == 0) return left + right;
-        if (strcmp(node->value, "-") == 0) return left - right;
-        if (strcmp(node->value, "*") == 0) return left * right;
-        if (strcmp(node->value, "/") == 0) return left / right;
-        fprintf(stderr, "Unknown operator: %s\n", node->value);
-        exit(1);
-    } else {
-        fprintf(stderr, "Unknown expression type: %s\n", node->node_type);
-        exit(1);
+/* ---------------------------------------------------------------------------
+   Type inference
+
+   Suffixes fix a variable's type: % and & integer, # and ! float, $ string.
+   An untyped variable takes the join of every value assigned to it
+   (integer below float), iterated to a fixed point; one that never receives
+   a value of known type is a float, the GFA default. With every expression
+   typed, the compiler emits ADD_INT, ADD_FLT or CONCAT directly and inserts
+   explicit INT_TO_FLT/FLT_TO_INT conversions, so the VM never inspects a
+   value's type at run time. Integer '/' stays integer division.
+   --------------------------------------------------------------------------- */
+
+// Map an operator node value to its integer opcode
+static OpCode operator_opcode(const char* op) {
+    if (strcmp(op, "+") == 0) return OP_ADD_INT;
+    if (strcmp(op, "-") == 0) return OP_SUB_INT;
+    if (strcmp(op, "*") == 0) return OP_MUL_INT;
+    if (strcmp(op, "/") == 0) return OP_DIV_INT;
+    if (strcmp(op, "=") == 0) return OP_EQ;
+    if (strcmp(op, "<>") == 0) return OP_NE;
+    if (strcmp(op, "<") == 0) return OP_LT;
+    if (strcmp(op, "<=") == 0) return OP_LE;
+    if (strcmp(op, ">") == 0) return OP_GT;
+    if (strcmp(op, ">=") == 0) return OP_GE;
+    compile_error("Unknown operator: %s", op);
+    return OP_NOP;
+}
+
+// Float counterpart of an integer arithmetic opcode
+static OpCode float_opcode(OpCode op) {
+    switch (op) {
+        case OP_ADD_INT: return OP_ADD_FLT;
+        case OP_SUB_INT: return OP_SUB_FLT;
+        case OP_MUL_INT: return OP_MUL_FLT;
+        default: return OP_DIV_FLT;
     }
 }
 
-// Execute a block of statements
-void execute_block(Interpreter* interpreter, ASTNode* node) {
-    if (strcmp(node->node_type, "block") != 0) {
-        fprintf(stderr, "Expected block node\n");
-        exit(1);
+// Does the name carry a type suffix?
+static bool has_type_suffix(const char* name) {
+    size_t length = strlen(name);
+    return length > 0 && strchr("$%&#!", name[length - 1]) != NULL;
+}
+
+// Slot in the type table for a node
+static int type_bucket(const TypeTable* types, const ASTNode* node) {
+    uintptr_t mask = (uintptr_t)types->capacity - 1;
+    int bucket = (int)((((uintptr_t)node >> 3) * 2654435761u) & mask);
+    while (types->nodes[bucket] && types->nodes[bucket] != node) bucket = (int)((bucket + 1) & mask);
+    return bucket;
+}
+
+// Type of a variable: fixed by its suffix, otherwise as inferred so far
+static ValueType variable_type(const TypeTable* types, const char* name) {
+    size_t length = strlen(name);
+    char suffix = length > 0 ? name[length - 1] : '\0';
+    if (suffix == '$') return TYPE_STRING;
+    if (suffix == '%' || suffix == '&') return TYPE_INT;
+    if (suffix == '#' || suffix == '!') return TYPE_FLOAT;
+    for (int i = 0; i < types->name_count; i++) {
+        if (strcmp(types->names[i], name) == 0) return types->name_types[i];
     }
-    for (int i = 0; i < node->children_count; i++) {
-        execute_statement(interpreter, node->children[i]);
-        if (!interpreter->running) break;
+    return TYPE_FLOAT;
+}
+
+// Type of an expression node
+static ValueType expression_type(const TypeTable* types, ASTNode* node) {
+    int bucket = type_bucket(types, node);
+    return types->nodes[bucket] ? types->node_types[bucket] : TYPE_INT;
+}
+
+// Reject an expression that cannot be converted to the expected type
+static void require_type(const TypeTable* types, ASTNode* node, ValueType expected) {
+    if ((expression_type(types, node) == TYPE_STRING) != (expected == TYPE_STRING)) {
+        compile_error("Type mismatch: expected %s expression", expected == TYPE_STRING ? "string" : "numeric");
     }
 }
 
-// Push an AST node onto the return stack
-void push_return_stack(Interpreter* interpreter, ASTNode* node) {
-    if (interpreter->return_stack_size >= interpreter->return_stack_capacity) {
-        interpreter->return_stack_capacity = (interpreter->return_stack_capacity == 0) ? 10 : interpreter->return_stack_capacity * 2;
-        interpreter->return_stack = (ASTNode**)realloc(interpreter->return_stack, interpreter->return_stack_capacity * sizeof(ASTNode*));
+// Join of two numeric types: unknown below integer below float. Strings do not widen a numeric variable.
+static ValueType join_types(ValueType a, ValueType b) {
+    if (b == TYPE_UNKNOWN || b == TYPE_STRING) return a;
+    if (a == TYPE_UNKNOWN) return b;
+    return (a == TYPE_FLOAT || b == TYPE_FLOAT) ? TYPE_FLOAT : TYPE_INT;
+}
+
+// Widen an untyped variable by a value assigned to it; true if its type changed
+static bool widen_variable(TypeTable* types, const char* name, ValueType value) {
+    for (int i = 0; i < types->name_count; i++) {
+        if (strcmp(types->names[i], name) == 0) {
+            ValueType joined = join_types(types->name_types[i], value);
+            if (joined == types->name_types[i]) return false;
+            types->name_types[i] = joined;
+            return true;
+        }
     }
-    interpreter->return_stack[interpreter->return_stack_size++] = node;
+    return false;
 }
 
-// Pop an AST node from the return stack
-ASTNode* pop_return_stack(Interpreter* interpreter) {
-    if (interpreter->return_stack_size == 0) {
+// Type of one node from its children's types
+static ValueType infer_node(const TypeTable* types, ASTNode* node) {
+    const char* type = node->node_type;
+    if (strcmp(type, "float_literal") == 0) return TYPE_FLOAT;
+    if (strcmp(type, "string_literal") == 0) return TYPE_STRING;
+    if (strcmp(type, "identifier") == 0) return variable_type(types, node->value);
+    if (strcmp(type, "operator") != 0 || operator_opcode(node->value) >= OP_EQ) return TYPE_INT;
+    ValueType left = expression_type(types, node->children[0]);
+    ValueType right = expression_type(types, node->children[1]);
+    if (left == TYPE_STRING || right == TYPE_STRING) return TYPE_STRING;
+    if (left == TYPE_FLOAT || right == TYPE_FLOAT) return TYPE_FLOAT;
+    return (left == TYPE_UNKNOWN || right == TYPE_UNKNOWN) ? TYPE_UNKNOWN : TYPE_INT;
+}
+
+// Type every node of a list in which parents come before their children; takes ownership of the list
+static TypeTable* infer_types(ASTNode** nodes, int count) {
+    TypeTable* types = (TypeTable*)calloc(1, sizeof(TypeTable));
+    types->capacity = 16;
+    while (types->capacity < 2 * count) types->capacity *= 2;
+    types->nodes = (ASTNode**)calloc(types->capacity, sizeof(ASTNode*));
+    types->node_types = (ValueType*)malloc(types->capacity * sizeof(ValueType));
+
+    // Untyped variables start out unknown
+    for (int i = 0; i < count; i++) {
+        if (strcmp(nodes[i]->node_type, "identifier") != 0 || has_type_suffix(nodes[i]->value)) continue;
+        int j = 0;
+        while (j < types->name_count && strcmp(types->names[j], nodes[i]->value) != 0) j++;
+        if (j < types->name_count) continue;
+        if (types->name_count >= types->name_capacity) {
+            types->name_capacity = (types->name_capacity == 0) ? 16 : types->name_capacity * 2;
+            types->names = (char**)realloc(types->names, types->name_capacity * sizeof(char*));
+            types->name_types = (ValueType*)realloc(types->name_types, types->name_capacity * sizeof(ValueType));
+        }
+        types->names[types->name_count] = nodes[i]->value;
+        types->name_types[types->name_count++] = TYPE_UNKNOWN;
+    }
+
+    // collect_nodes lists a parent before its children, so walking it backwards types children first
+    for (;;) {
+        for (int i = count - 1; i >= 0; i--) {
+            int bucket = type_bucket(types, nodes[i]);
+            types->nodes[bucket] = nodes[i];
+            types->node_types[bucket] = infer_node(types, nodes[i]);
+        }
+        bool changed = false;
+        for (int i = 0; i < count; i++) {
+            ASTNode* node = nodes[i];
+            const char* type = node->node_type;
+            if (strcmp(type, "assignment") == 0 && strcmp(node->children[0]->node_type, "identifier") == 0) {
+                changed |= widen_variable(types, node->children[0]->value, expression_type(types, node->children[1]));
+            } else if (strcmp(type, "for_loop") == 0 && node->children_count > 3) {
+                changed |= widen_variable(types, node->children[0]->children[0]->value, expression_type(types, node->children[2]));
+            } else if (strcmp(type, "read_statement") == 0 || strcmp(type, "allocate_statement") == 0) {
+                changed |= widen_variable(types, node->children[0]->value, TYPE_INT);
+            } else if (strcmp(type, "input_statement") == 0) {
+                changed |= widen_variable(types, node->children[node->children_count - 1]->value, TYPE_FLOAT);
+            }
+        }
+        if (!changed) break;
+    }
+
+    // Variables that never received a typed value fall back to float
+    for (int i = 0; i < types->name_count; i++) {
+        if (types->name_types[i] == TYPE_UNKNOWN) {
+            types->name_types[i] = TYPE_FLOAT;
+            types->defaulted_float++;
+        }
+        if (types->name_types[i] == TYPE_INT) types->proven_int++;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        types->node_types[type_bucket(types, nodes[i])] = infer_node(types, nodes[i]);
+    }
+    free(nodes);
+    return types;
+}
+
+// Free a type table
+static void free_types(TypeTable* types) {
+    if (!types) return;
+    free(types->nodes);
+    free(types->node_types);
+    free(types->names);
+    free(types->name_types);
+    free(types);
+}
+
+// Opcodes that move a value of the given type between a slot and its stack
+static OpCode load_opcode(ValueType type) {
+    return type == TYPE_STRING ? OP_LOAD_STR : type == TYPE_FLOAT ? OP_LOAD_FLT : OP_LOAD;
+}
+
+static OpCode store_opcode(ValueType type) {
+    return type == TYPE_STRING ? OP_STORE_STR : type == TYPE_FLOAT ? OP_STORE_FLT : OP_STORE;
+}
+
+// Convert the value just computed between the integer and float stacks
+static void emit_conversion(Compiler* compiler, ValueType from, ValueType to) {
+    if (from == TYPE_INT && to == TYPE_FLOAT) {
+        emit(compiler, OP_INT_TO_FLT, 0);
+        compiler->types->conversions++;
+    } else if (from == TYPE_FLOAT && to == TYPE_INT) {
+        emit(compiler, OP_FLT_TO_INT, 0);
+        compiler->types->conversions++;
+    }
+}
+
+// Schedule an expression whose value the parent needs as the given type
+static void push_coerced(Compiler* compiler, ASTNode* node, ValueType type) {
+    require_type(compiler->types, node, type);
+    push_task(compiler, node);
+    compiler->tasks[compiler->task_count - 1].coerce = type;
+}
+
+// A task has emitted all of its code: convert its value if the parent asked for it, close its statement range
+static void finish_task(Compiler* compiler, CompileTask* task) {
+    if (task->coerce != TYPE_UNKNOWN) {
+        emit_conversion(compiler, expression_type(compiler->types, task->node), task->coerce);
+    }
+    if (task->statement >= 0) {
+        compiler->program->statements[task->statement].end = compiler->program->code_size;
+    }
+}
+
+// Is name written anywhere in the node list?
+static bool is_assigned(ASTNode** nodes, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        const char* type = nodes[i]->node_type;
+        if ((strcmp(type, "assignment") == 0 || strcmp(type, "read_statement") == 0 ||
+             strcmp(type, "allocate_statement") == 0) &&
+            strcmp(nodes[i]->children[0]->value, name) == 0) {
+            return true;
+        }
+        if ((strcmp(type, "input_statement") == 0 || strcmp(type, "line_input_statement") == 0) &&
+            strcmp(nodes[i]->children[nodes[i]->children_count - 1]->value, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// If address is "var", "var + base" or "base + var" with a loop-invariant base, return true and the base (NULL for none)
+static bool hoistable_address(const TypeTable* types, ASTNode* address, const char* loop_var, ASTNode** nodes, int count,
+                              ASTNode** base) {
+    if (strcmp(address->node_type, "identifier") == 0 && strcmp(address->value, loop_var) == 0) {
+        *base = NULL;
+        return true;
+    }
+    if (strcmp(address->node_type, "operator") != 0 || strcmp(address->value, "+") != 0) return false;
+    for (int side = 0; side < 2; side++) {
+        ASTNode* var = address->children[side];
+        ASTNode* other = address->children[1 - side];
+        if (strcmp(var->node_type, "identifier") != 0 || strcmp(var->value, loop_var) != 0) continue;
+        if (strcmp(other->node_type, "int_literal") == 0 ||
+            (strcmp(other->node_type, "identifier") == 0 && strcmp(other->value, loop_var) != 0 &&
+             variable_type(types, other->value) == TYPE_INT && !is_assigned(nodes, count, other->value))) {
+            *base = other;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Find PEEK/POKE accesses in a FOR body whose bounds can be checked once before the loop.
+// Returns the number of distinct address bases, or 0 when the loop must keep per-access checks.
+static int analyze_loop_accesses(const TypeTable* types, ASTNode* block, const char* loop_var, HoistContext* context,
+                                 ASTNode** bases) {
+    int count;
+    ASTNode** nodes = collect_nodes(block, &count);
+    int base_count = 0;
+    context->access_count = 0;
+
+    // The body is compiled twice, so labels cannot appear in it; GOSUB could change the base or the loop variable
+    bool eligible = !is_assigned(nodes, count, loop_var);
+    for (int i = 0; i < count && eligible; i++) {
+        const char* type = nodes[i]->node_type;
+        if (strcmp(type, "label") == 0 || strcmp(type, "procedure") == 0 || strcmp(type, "gosub_statement") == 0) {
+            eligible = false;
+        }
+    }
+
+    for (int i = 0; i < count && eligible; i++) {
+        const char* type = nodes[i]->node_type;
+        ASTNode* base;
+        if ((strcmp(type, "peek") != 0 && strcmp(type, "poke_statement") != 0) ||
+            !hoistable_address(types, nodes[i]->children[0], loop_var, nodes, count, &base)) {
+            continue;
+        }
+        int b = 0;
+        while (b < base_count &&
+               !(bases[b] == base || (bases[b] && base && strcmp(bases[b]->node_type, base->node_type) == 0 &&
+                                      strcmp(bases[b]->value, base->value) == 0))) {
+            b++;
+        }
+        if (b == base_count) {
+            if (base_count == MAX_HOISTED_BASES) { eligible = false; break; }
+            bases[base_count++] = base;
+        }
+        if (context->access_count == MAX_HOISTED_ACCESSES) { eligible = false; break; }
+        context->accesses[context->access_count++] = nodes[i];
+    }
+
+    free(nodes);
+    return eligible ? base_count : 0;
+}
+
+// Was this PEEK/POKE node covered by the guard of an enclosing unchecked loop copy?
+static bool is_hoisted_access(Compiler* compiler, ASTNode* node) {
+    for (int i = 0; i < compiler->hoist_count; i++) {
+        for (int j = 0; j < compiler->hoists[i].access_count; j++) {
+            if (compiler->hoists[i].accesses[j] == node) return true;
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------
+   Loop-invariant code motion and strength reduction
+
+   Before a FOR body is compiled, its maximal pure subexpressions that read
+   no variable the body may write are computed once in the loop pre-header,
+   and products var * c of the loop variable with an invariant integer are
+   replaced by a temporary that grows by c * step on every iteration. Only
+   operators over literals and variables qualify: they cannot fail (division
+   only by a non-zero literal), so evaluating them early is unobservable.
+   A GOSUB in the body writes whatever its PROCEDURE, and any procedure it
+   calls, may write; a GOSUB to anything else, a GOTO or a label in the body,
+   or an ON ERROR handler anywhere in the program disables the pass. In a
+   program compiled for hot reload a GOSUB may write anything, since the
+   body it runs may not be the one compiled.
+   --------------------------------------------------------------------------- */
+
+// Index of the PROCEDURE with this name, -1 if the GOSUB target is something else
+static int find_procedure(Compiler* compiler, const char* name) {
+    for (int i = 0; i < compiler->procedure_count; i++) {
+        if (strcmp(compiler->procedures[i]->value, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Can running these nodes write name, directly or through the procedures they call?
+static bool may_write(Compiler* compiler, ASTNode** nodes, int count, const char* name) {
+    if (is_assigned(nodes, count, name)) return true;
+    bool* visited = (bool*)calloc(compiler->procedure_count + 1, sizeof(bool));
+    int* pending = (int*)malloc((compiler->procedure_count + 1) * sizeof(int));
+    int pending_count = 0;
+    bool writes = false;
+    ASTNode** scan = nodes;
+    int scan_count = count;
+    for (;;) {
+        for (int i = 0; i < scan_count && !writes; i++) {
+            const char* type = scan[i]->node_type;
+            if (strcmp(type, "goto_statement") == 0) {
+                writes = true;
+            } else if (strcmp(type, "gosub_statement") == 0) {
+                int procedure = find_procedure(compiler, scan[i]->value);
+                if (procedure < 0 || compiler->reloadable) {
+                    writes = true;
+                } else if (!visited[procedure]) {
+                    visited[procedure] = true;
+                    pending[pending_count++] = procedure;
+                }
+            }
+        }
+        if (scan != nodes) free(scan);
+        if (writes || pending_count == 0) break;
+        scan = collect_nodes(compiler->procedures[pending[--pending_count]], &scan_count);
+        writes = is_assigned(scan, scan_count, name);
+    }
+    free(visited);
+    free(pending);
+    return writes;
+}
+
+// Is expr an operator tree over literals and variables that the loop body never writes?
+static bool is_loop_invariant(Compiler* compiler, ASTNode* expr, const char* loop_var, ASTNode** body, int body_count) {
+    if (strcmp(expr->node_type, "operator") != 0 || expression_type(compiler->types, expr) == TYPE_STRING) return false;
+    int count;
+    ASTNode** nodes = collect_nodes(expr, &count);
+    bool invariant = true;
+    for (int i = 0; i < count && invariant; i++) {
+        const char* type = nodes[i]->node_type;
+        if (strcmp(type, "operator") == 0) {
+            // Hoisted code runs even if the body would not, so it may only divide by what cannot fault: not 0,
+            // and not -1, which overflows INT_MIN
+            ASTNode* divisor = nodes[i]->children[1];
+            invariant = strcmp(nodes[i]->value, "/") != 0 ||
+                        ((strcmp(divisor->node_type, "int_literal") == 0 || strcmp(divisor->node_type, "float_literal") == 0) &&
+                         atof(divisor->value) != 0.0 && atof(divisor->value) != -1.0);
+        } else if (strcmp(type, "identifier") == 0) {
+            invariant = strcmp(nodes[i]->value, loop_var) != 0 &&
+                        variable_type(compiler->types, nodes[i]->value) != TYPE_STRING &&
+                        !may_write(compiler, body, body_count, nodes[i]->value);
+        } else {
+            invariant = strcmp(type, "int_literal") == 0 || strcmp(type, "float_literal") == 0;
+        }
+    }
+    free(nodes);
+    return invariant;
+}
+
+// If expr is loop_var * c or c * loop_var with an invariant integer c, return c
+static ASTNode* induction_factor(Compiler* compiler, ASTNode* expr, const char* loop_var, ASTNode** body, int body_count) {
+    if (strcmp(expr->node_type, "operator") != 0 || strcmp(expr->value, "*") != 0 ||
+        expression_type(compiler->types, expr) != TYPE_INT) {
         return NULL;
     }
-    return interpreter->return_stack[--interpreter->return_stack_size];
+    for (int side = 0; side < 2; side++) {
+        ASTNode* var = expr->children[side];
+        ASTNode* factor = expr->children[1 - side];
+        if (strcmp(var->node_type, "identifier") != 0 || strcmp(var->value, loop_var) != 0) continue;
+        if (strcmp(factor->node_type, "int_literal") == 0) return factor;
+        if (strcmp(factor->node_type, "identifier") == 0 && strcmp(factor->value, loop_var) != 0 &&
+            variable_type(compiler->types, factor->value) == TYPE_INT && !may_write(compiler, body, body_count, factor->value)) {
+            return factor;
+        }
+    }
+    return NULL;
 }
 
-int main() {
-    // Example usage
-    Interpreter* interpreter = interpreter_new(NULL);
-    interpreter_init(interpreter);
+// Entry computed outside the loops being compiled for this node, -1 if none
+static int find_loop_value(Compiler* compiler, ASTNode* node) {
+    for (int i = compiler->loop_value_count - 1; i >= 0; i--) {
+        if (compiler->loop_values[i].node == node) return i;
+    }
+    return -1;
+}
+
+static void add_loop_value(Compiler* compiler, ASTNode* node, int step) {
+    if (compiler->loop_value_count >= compiler->loop_value_capacity) {
+        compiler->loop_value_capacity = (compiler->loop_value_capacity == 0) ? 8 : compiler->loop_value_capacity * 2;
+        compiler->loop_values = (LoopValue*)realloc(compiler->loop_values, compiler->loop_value_capacity * sizeof(LoopValue));
+    }
+    LoopValue* value = &compiler->loop_values[compiler->loop_value_count++];
+    value->node = node;
+    value->slot = add_slot(compiler->program, NULL);
+    value->step = step;
+    value->state = LOOP_VALUE_PENDING;
+}
 
-    // Example AST node setup and run
-    // This should be replaced with the actual AST creation logic
-    ASTNode* program_node = (ASTNode*)malloc(sizeof(ASTNode));
-    program_node->node_type = "program";
-    program_node->children_count = 0;
-    program_node->children = NULL;
+// Choose the loop values of a FOR body. Induction products need an integer loop variable the body never writes.
+static void plan_loop_values(Compiler* compiler, ASTNode* block, const char* loop_var, ValueType var_type) {
+    if (compiler->traps_errors) return;
+    int body_count;
+    ASTNode** body = collect_nodes(block, &body_count);
+    for (int i = 0; i < body_count; i++) {
+        if (strcmp(body[i]->node_type, "label") == 0 || strcmp(body[i]->node_type, "goto_statement") == 0) {
+            free(body);
+            return;
+        }
+    }
+    bool induction = var_type == TYPE_INT && !may_write(compiler, body, body_count, loop_var);
 
-    run_program(interpreter, program_node);
+    // Walk the body top-down so that only maximal expressions are taken
+    int pending_capacity = 16, pending_count = 0;
+    ASTNode** pending = (ASTNode**)malloc(pending_capacity * sizeof(ASTNode*));
+    pending[pending_count++] = block;
+    while (pending_count > 0) {
+        ASTNode* node = pending[--pending_count];
+        if (find_loop_value(compiler, node) >= 0) continue;
+        if (is_loop_invariant(compiler, node, loop_var, body, body_count)) {
+            add_loop_value(compiler, node, -1);
+            compiler->hoisted++;
+            continue;
+        }
+        if (induction && induction_factor(compiler, node, loop_var, body, body_count)) {
+            int step = add_slot(compiler->program, NULL);
+            add_loop_value(compiler, node, step);
+            compiler->reduced++;
+            continue;
+        }
+        for (int i = 0; i < node->children_count; i++) {
+            if (pending_count >= pending_capacity) {
+                pending_capacity *= 2;
+                pending = (ASTNode**)realloc(pending, pending_capacity * sizeof(ASTNode*));
+            }
+            pending[pending_count++] = node->children[i];
+        }
+    }
+    free(pending);
+    free(body);
+}
 
-    interpreter_free(interpreter);
-    free(program_node);
-    return 0;
+// Emit the pre-header code for the induction product at index, given the loop's variable and step slots
+static void emit_induction_start(Compiler* compiler, int index, int var_slot, int step_slot) {
+    LoopValue* value = &compiler->loop_values[index];
+    ASTNode* factor = strcmp(value->node->children[0]->node_type, "identifier") == 0 &&
+                      resolve_slot(compiler->program, value->node->children[0]->value) == var_slot
+                          ? value->node->children[1] : value->node->children[0];
+    for (int pass = 0; pass < 2; pass++) {
+        // slot = var * c, then step = step * c
+        emit(compiler, OP_LOAD, pass == 0 ? var_slot : step_slot);
+        if (strcmp(factor->node_type, "int_literal") == 0) {
+            emit(compiler, OP_PUSH_INT, atoi(factor->value));
+        } else {
+            emit(compiler, OP_LOAD, resolve_slot(compiler->program, factor->value));
+        }
+        emit(compiler, OP_MUL_INT, 0);
+        emit(compiler, OP_STORE, pass == 0 ? value->slot : value->step);
+    }
+    value->state = LOOP_VALUE_READY;
+}
+
+// Emit the FOR loop test: exit when the variable passes the limit
+static void emit_for_head(Compiler* compiler, CompileTask* task, int var_slot, ValueType type) {
+    task->target = emit(compiler, load_opcode(type), var_slot);
+    emit(compiler, load_opcode(type), task->slot);
+    if (type == TYPE_FLOAT) emit(compiler, OP_CMP_FLT, OP_LE); else emit(compiler, OP_LE, 0);
+    task->patch = emit(compiler, OP_JUMP_IF_FALSE, -1);
 }
 
+// Emit the FOR loop increment, induction product updates and back edge
+static void emit_for_tail(Compiler* compiler, CompileTask* task, int var_slot, ValueType type) {
+    for (int i = task->values; i < compiler->loop_value_count; i++) {
+        LoopValue* value = &compiler->loop_values[i];
+        if (value->step < 0) continue;
+        emit(compiler, OP_LOAD, value->slot);
+        emit(compiler, OP_LOAD, value->step);
+        emit(compiler, OP_ADD_INT, 0);
+        emit(compiler, OP_STORE, value->slot);
+    }
+    emit(compiler, load_opcode(type), var_slot);
+    emit(compiler, load_opcode(type), task->slot + 1);
+    emit(compiler, type == TYPE_FLOAT ? OP_ADD_FLT : OP_ADD_INT, 0);
+    emit(compiler, store_opcode(type), var_slot);
+    emit(compiler, OP_JUMP, task->target);
+}
+
+/* ---------------------------------------------------------------------------
+   Inlining
+
+   A GOSUB to a PROCEDURE whose body has at most inline_budget AST nodes is
+   compiled as a copy of the body at the call site: no frame is pushed, and
+   the body becomes visible to the loop optimizer, superinstructions and the
+   JIT. Bodies with labels, GOTO, an early RETURN or error trapping keep the
+   real call. A GOSUB reached while the same procedure is already being
+   inlined stays a call, which bounds recursion to one inlined level.
+   --------------------------------------------------------------------------- */
+
+// Size of a procedure body for the inliner, -1 if it must stay out of line
+static int procedure_size(ASTNode* procedure) {
+    int count;
+    ASTNode** nodes = collect_nodes(procedure->children[0], &count);
+    int size = count;
+    for (int i = 0; i < count && size >= 0; i++) {
+        const char* type = nodes[i]->node_type;
+        if (strcmp(type, "label") == 0 || strcmp(type, "goto_statement") == 0 || strcmp(type, "return_statement") == 0 ||
+            strcmp(type, "procedure") == 0 || strcmp(type, "on_error_goto") == 0 || strcmp(type, "resume_statement") == 0) {
+            size = -1;
+        }
+    }
+    free(nodes);
+    return size;
+}
+
+// Procedure to inline for this GOSUB, -1 to emit a real call
+static int inline_target(Compiler* compiler, const char* name) {
+    int procedure = find_procedure(compiler, name);
+    if (procedure < 0 || compiler->inlining[procedure]) return -1;
+    int size = compiler->procedure_sizes[procedure];
+    return size >= 0 && size <= compiler->inline_budget ? procedure : -1;
+}
+
+// Index of a PROCEDURE node in compiler->procedures
+static int procedure_index(const Compiler* compiler, ASTNode* node) {
+    int procedure = 0;
+    while (compiler->procedures[procedure] != node) procedure++;
+    return procedure;
+}
+
+/* ---------------------------------------------------------------------------
+   Lazy compilation
+
+   Programs often carry libraries of PROCEDUREs of which a run calls only a
+   few. Before compiling, the call graph is walked from the main program: a
+   procedure is compiled when a GOSUB reaches it, a GOTO, ON ERROR GOTO or
+   RESUME names a label in its body, it encloses such a procedure, or it
+   holds DATA, whose values belong to the program wherever they appear.
+   The others cost one scan and emit no code, and type inference skips them
+   too: a variable only they assign keeps the type the rest of the program
+   proves for it.
+   --------------------------------------------------------------------------- */
+
+// A name a jump can reach and the procedure that has to be compiled for it
+typedef struct {
+    const char *name;
+    int procedure;
+} EntryName;
+
+// Target label or procedure named by a statement, NULL if it names none
+static const char* jump_target(ASTNode* node) {
+    const char* type = node->node_type;
+    if (!node->value) return NULL;
+    if (strcmp(type, "gosub_statement") == 0 || strcmp(type, "goto_statement") == 0) return node->value;
+    if (strcmp(type, "on_error_goto") == 0) return strcmp(node->value, "0") == 0 ? NULL : node->value;
+    if (strcmp(type, "resume_statement") == 0) return strcmp(node->value, "NEXT") == 0 ? NULL : node->value;
+    return NULL;
+}
+
+// Mark every procedure a jump to name needs, queueing the ones not seen before
+static void reach_name(bool* reachable, int* pending, int* pending_count, const EntryName* names, int name_count,
+                       const char* name) {
+    for (int i = 0; i < name_count; i++) {
+        if (!reachable[names[i].procedure] && strcmp(names[i].name, name) == 0) {
+            reachable[names[i].procedure] = true;
+            pending[(*pending_count)++] = names[i].procedure;
+        }
+    }
+}
+
+// Which procedures can run, or hold DATA, starting from the main program
+static bool* find_reachable_procedures(Compiler* compiler, ASTNode* ast) {
+    int procedure_count = compiler->procedure_count;
+    bool* reachable = (bool*)calloc(procedure_count + 1, sizeof(bool));
+    int* pending = (int*)malloc((procedure_count + 1) * sizeof(int));
+    int pending_count = 0;
+    ASTNode*** bodies = (ASTNode***)malloc((procedure_count + 1) * sizeof(ASTNode**));
+    int* body_counts = (int*)malloc((procedure_count + 1) * sizeof(int));
+
+    // A procedure is entered through its name, a label in its body, or a procedure nested in it
+    EntryName* names = NULL;
+    int name_count = 0;
+    for (int p = 0; p < procedure_count; p++) {
+        bodies[p] = collect_nodes(compiler->procedures[p]->children[0], &body_counts[p]);
+        names = (EntryName*)realloc(names, (name_count + body_counts[p] + 1) * sizeof(EntryName));
+        names[name_count].name = compiler->procedures[p]->value;
+        names[name_count++].procedure = p;
+        for (int i = 0; i < body_counts[p]; i++) {
+            const char* type = bodies[p][i]->node_type;
+            if (strcmp(type, "label") == 0 || strcmp(type, "procedure") == 0) {
+                names[name_count].name = bodies[p][i]->value;
+                names[name_count++].procedure = p;
+            } else if (strcmp(type, "data_statement") == 0 && !reachable[p]) {
+                reachable[p] = true;
+                pending[pending_count++] = p;
+            }
+        }
+    }
+
+    for (int i = 0; i < ast->children_count; i++) {
+        if (strcmp(ast->children[i]->node_type, "procedure") == 0) continue;
+        int count;
+        ASTNode** nodes = collect_nodes(ast->children[i], &count);
+        for (int j = 0; j < count; j++) {
+            const char* target = jump_target(nodes[j]);
+            if (target) reach_name(reachable, pending, &pending_count, names, name_count, target);
+        }
+        free(nodes);
+    }
+    while (pending_count > 0) {
+        int p = pending[--pending_count];
+        for (int j = 0; j < body_counts[p]; j++) {
+            const char* target = jump_target(bodies[p][j]);
+            if (target) reach_name(reachable, pending, &pending_count, names, name_count, target);
+        }
+    }
+
+    for (int p = 0; p < procedure_count; p++) free(bodies[p]);
+    free(bodies);
+    free(body_counts);
+    free(names);
+    free(pending);
+    return reachable;
+}
+
+// Nodes of the code that gets compiled: the main program and the reachable procedures, parents first
+static ASTNode** collect_compiled_nodes(Compiler* compiler, ASTNode* ast, int* count) {
+    ASTNode** nodes = (ASTNode**)malloc(sizeof(ASTNode*));
+    nodes[0] = ast;
+    *count = 1;
+    for (int i = 0; i < ast->children_count; i++) {
+        ASTNode* child = ast->children[i];
+        if (strcmp(child->node_type, "procedure") == 0 && !compiler->reachable[procedure_index(compiler, child)]) continue;
+        int child_count;
+        ASTNode** child_nodes = collect_nodes(child, &child_count);
+        nodes = (ASTNode**)realloc(nodes, (*count + child_count) * sizeof(ASTNode*));
+        memcpy(nodes + *count, child_nodes, child_count * sizeof(ASTNode*));
+        *count += child_count;
+        free(child_nodes);
+    }
+    return nodes;
+}
+
+/* ---------------------------------------------------------------------------
+   Memoization
+
+   A PROCEDURE is pure when it, and every procedure it calls, only computes
+   with scalar variables: no I/O, DATA, arrays, linear memory, GOTO, labels
+   or error handling, and no GOSUB to anything but a procedure. A call is
+   then a function of the variables it reads before writing them, and a
+   GOSUB that is not inlined first looks those values up in a bounded cache
+   (see memo_lookup). A hit sets every variable the call would write and
+   skips it. Variables written only on some paths are part of the key too,
+   because their old value can survive the call. Programs with an ON ERROR
+   handler are not memoized: the handler could abandon a call half way. For
+   hot reload only procedures that call nothing but themselves qualify, as a
+   reload replaces a memo with its procedure but not the memos of callers.
+   --------------------------------------------------------------------------- */
+
+// Statements and expressions a memoized procedure may not contain
+static bool is_impure(const char* type) {
+    static const char* impure[] = {
+        "print_statement", "input_statement", "line_input_statement", "open_statement", "close_statement", "eof",
+        "read_statement", "restore_statement", "data_statement", "dim_statement", "array_element", "array_ref",
+        "peek", "poke_statement", "allocate_statement", "free_statement", "bload_statement", "bsave_statement",
+        "on_error_goto", "resume_statement", "err", "end_statement", "stop_statement", "goto_statement", "label",
+        "procedure", "snapshot_statement"
+    };
+    for (size_t i = 0; i < sizeof(impure) / sizeof(impure[0]); i++) {
+        if (strcmp(type, impure[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Variables of a procedure call, gathered while planning its memo
+typedef struct {
+    const char **keys;      // Read before the call writes them, or written only on some paths
+    int key_count;
+    const char **results;   // Written by the call
+    int result_count;
+    const char **defined;   // Written by every call that gets past the statements seen so far
+    int defined_count;
+} MemoPlan;
+
+static bool has_name(const char** names, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static void add_name(const char** names, int* count, const char* name) {
+    if (!has_name(names, *count, name)) names[(*count)++] = name;
+}
+
+// Nodes of a procedure body and of every procedure it reaches, or NULL when any of them is impure
+static ASTNode** pure_closure(Compiler* compiler, int procedure, int* count) {
+    bool* visited = (bool*)calloc(compiler->procedure_count + 1, sizeof(bool));
+    int* pending = (int*)malloc((compiler->procedure_count + 1) * sizeof(int));
+    int pending_count = 0;
+    ASTNode** closure = NULL;
+    bool pure = true;
+    *count = 0;
+    visited[procedure] = true;
+    pending[pending_count++] = procedure;
+    while (pure && pending_count > 0) {
+        int body_count;
+        ASTNode** body = collect_nodes(compiler->procedures[pending[--pending_count]]->children[0], &body_count);
+        closure = (ASTNode**)realloc(closure, (*count + body_count + 1) * sizeof(ASTNode*));
+        memcpy(closure + *count, body, body_count * sizeof(ASTNode*));
+        free(body);
+        for (int i = *count; i < *count + body_count && pure; i++) {
+            const char* type = closure[i]->node_type;
+            if (is_impure(type)) {
+                pure = false;
+            } else if (strcmp(type, "gosub_statement") == 0) {
+                int callee = find_procedure(compiler, closure[i]->value);
+                if (callee < 0 || (compiler->reloadable && callee != procedure)) {
+                    pure = false;
+                } else if (!visited[callee]) {
+                    visited[callee] = true;
+                    pending[pending_count++] = callee;
+                }
+            }
+        }
+        *count += body_count;
+    }
+    free(visited);
+    free(pending);
+    if (!pure) {
+        free(closure);
+        return NULL;
+    }
+    return closure;
+}
+
+// Add the variables node reads to the key unless the call has already defined them.
+// A GOSUB may read anything the procedures reached from here mention.
+static void plan_reads(MemoPlan* plan, ASTNode* node, ASTNode** closure, int closure_count) {
+    int count;
+    ASTNode** nodes = collect_nodes(node, &count);
+    ASTNode** targets = (ASTNode**)malloc((count + 1) * sizeof(ASTNode*));
+    int target_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(nodes[i]->node_type, "assignment") == 0) targets[target_count++] = nodes[i]->children[0];
+    }
+    for (int i = 0; i < count; i++) {
+        const char* type = nodes[i]->node_type;
+        bool target = false;
+        for (int j = 0; j < target_count && !target; j++) target = targets[j] == nodes[i];
+        if (strcmp(type, "identifier") == 0 && !target && !has_name(plan->defined, plan->defined_count, nodes[i]->value)) {
+            add_name(plan->keys, &plan->key_count, nodes[i]->value);
+        } else if (strcmp(type, "gosub_statement") == 0) {
+            for (int j = 0; j < closure_count; j++) {
+                if (strcmp(closure[j]->node_type, "identifier") == 0 &&
+                    !has_name(plan->defined, plan->defined_count, closure[j]->value)) {
+                    add_name(plan->keys, &plan->key_count, closure[j]->value);
+                }
+            }
+        }
+    }
+    free(targets);
+    free(nodes);
+}
+
+// Give a pure procedure a memo in the program; returns its index, or -1 when calls to it are not memoized
+static int plan_memo(Compiler* compiler, int procedure) {
+    int closure_count;
+    ASTNode** closure = compiler->traps_errors ? NULL : pure_closure(compiler, procedure, &closure_count);
+    if (!closure) return -1;
+    MemoPlan plan = {0};
+    plan.keys = (const char**)malloc((closure_count + 1) * sizeof(char*));
+    plan.results = (const char**)malloc((closure_count + 1) * sizeof(char*));
+    plan.defined = (const char**)malloc((closure_count + 1) * sizeof(char*));
+
+    // Walk the top-level statements in order: each unconditional assignment defines its variable for the rest
+    ASTNode* body = compiler->procedures[procedure]->children[0];
+    bool early_return = false;
+    for (int i = 0; i < body->children_count; i++) {
+        ASTNode* statement = body->children[i];
+        if (strcmp(statement->node_type, "for_loop") == 0) {
+            for (int j = 1; j < statement->children_count - 1; j++) plan_reads(&plan, statement->children[j], closure, closure_count);
+            plan_reads(&plan, statement->children[0]->children[1], closure, closure_count);
+            add_name(plan.defined, &plan.defined_count, statement->children[0]->children[0]->value);
+            plan_reads(&plan, statement->children[statement->children_count - 1], closure, closure_count);
+        } else {
+            plan_reads(&plan, statement, closure, closure_count);
+            if (strcmp(statement->node_type, "assignment") == 0) {
+                add_name(plan.defined, &plan.defined_count, statement->children[0]->value);
+            }
+        }
+    }
+    for (int i = 0; i < closure_count; i++) {
+        if (strcmp(closure[i]->node_type, "assignment") == 0) add_name(plan.results, &plan.result_count, closure[i]->children[0]->value);
+        if (strcmp(closure[i]->node_type, "return_statement") == 0) early_return = true;
+    }
+    for (int i = 0; i < plan.result_count; i++) {
+        if (early_return || !has_name(plan.defined, plan.defined_count, plan.results[i])) {
+            add_name(plan.keys, &plan.key_count, plan.results[i]);
+        }
+    }
+
+    int index = -1;
+    if (plan.result_count > 0 && plan.key_count + plan.result_count <= MEMO_MAX_SLOTS) {
+        Program* program = compiler->program;
+        program->memos = (Memo*)realloc(program->memos, (program->memo_count + 1) * sizeof(Memo));
+        Memo* memo = &program->memos[program->memo_count];
+        memset(memo, 0, sizeof(Memo));
+        memo->key_count = plan.key_count;
+        memo->result_count = plan.result_count;
+        memo->slots = (MemoSlot*)malloc((plan.key_count + plan.result_count) * sizeof(MemoSlot));
+        for (int i = 0; i < plan.key_count + plan.result_count; i++) {
+            const char* name = i < plan.key_count ? plan.keys[i] : plan.results[i - plan.key_count];
+            memo->slots[i].slot = resolve_slot(program, name);
+            memo->slots[i].type = variable_type(compiler->types, name);
+        }
+        index = program->memo_count++;
+    }
+    free(plan.keys);
+    free(plan.results);
+    free(plan.defined);
+    free(closure);
+    return index;
+}
+
+// Advance the task on top of the stack by one step.
+// Pointers into the task stack are not used after push_task, which may move it.
+static void compile_step(Compiler* compiler) {
+    CompileTask* task = &compiler->tasks[compiler->task_count - 1];
+    ASTNode* node = task->node;
+    const char* type = node->node_type;
+    Program* program = compiler->program;
+    TypeTable* types = compiler->types;
+
+    // Inside a FOR body, expressions computed in the pre-header are read from their slot
+    int loop_value = find_loop_value(compiler, node);
+    if (loop_value >= 0 && compiler->loop_values[loop_value].state == LOOP_VALUE_READY) {
+        emit(compiler, load_opcode(expression_type(types, node)), compiler->loop_values[loop_value].slot);
+        compiler->task_count--;
+        return;
+    }
+
+    if (strcmp(type, "program") == 0 || strcmp(type, "block") == 0) {
+        if (task->index < node->children_count) {
+            push_task(compiler, node->children[task->index++]);
+        } else {
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "int_literal") == 0) {
+        emit(compiler, OP_PUSH_INT, atoi(node->value));
+        compiler->task_count--;
+    } else if (strcmp(type, "float_literal") == 0) {
+        emit(compiler, OP_PUSH_FLT, add_float_constant(program, atof(node->value)));
+        compiler->task_count--;
+    } else if (strcmp(type, "string_literal") == 0) {
+        emit(compiler, OP_PUSH_STR, add_string_constant(program, node->value));
+        compiler->task_count--;
+    } else if (strcmp(type, "identifier") == 0) {
+        emit(compiler, load_opcode(variable_type(types, node->value)), resolve_slot(program, node->value));
+        compiler->task_count--;
+    } else if (strcmp(type, "operator") == 0) {
+        // Both operands arrive converted to the operation's type, so the stacks never need reordering
+        OpCode op = operator_opcode(node->value);
+        ValueType left = expression_type(types, node->children[0]);
+        ValueType right = expression_type(types, node->children[1]);
+        ValueType operand_type = (left == TYPE_STRING || right == TYPE_STRING) ? TYPE_STRING :
+                                 (left == TYPE_FLOAT || right == TYPE_FLOAT) ? TYPE_FLOAT : TYPE_INT;
+        if (task->state < 2) {
+            push_coerced(compiler, node->children[task->state++], operand_type);
+        } else {
+            if (operand_type == TYPE_STRING) {
+                // Strings support + (concatenation) and comparisons
+                if (op == OP_ADD_INT) {
+                    emit(compiler, OP_CONCAT, 0);
+                } else if (op >= OP_EQ && op <= OP_GE) {
+                    emit(compiler, OP_STR_COMPARE, op);
+                } else {
+                    compile_error("Type mismatch: operator %s on strings", node->value);
+                }
+                types->string_operations++;
+            } else if (operand_type == TYPE_FLOAT) {
+                if (op >= OP_EQ) emit(compiler, OP_CMP_FLT, op); else emit(compiler, float_opcode(op), 0);
+                types->float_operations++;
+            } else {
+                emit(compiler, op, 0);
+                types->int_operations++;
+            }
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "print_statement") == 0) {
+        // PRINT expr, or PRINT #channel, expr
+        bool to_channel = node->children_count > 1;
+        ValueType value_type = expression_type(types, node->children[node->children_count - 1]);
+        if (task->state < node->children_count) {
+            if (to_channel && task->state == 0) {
+                push_coerced(compiler, node->children[task->state++], TYPE_INT);
+            } else {
+                push_task(compiler, node->children[task->state++]);
+            }
+        } else {
+            if (value_type == TYPE_STRING) {
+                emit(compiler, to_channel ? OP_PRINT_CHANNEL_STR : OP_PRINT_STR, 0);
+            } else if (value_type == TYPE_FLOAT) {
+                emit(compiler, to_channel ? OP_PRINT_CHANNEL_FLT : OP_PRINT_FLT, 0);
+            } else {
+                emit(compiler, to_channel ? OP_PRINT_CHANNEL : OP_PRINT, 0);
+            }
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "assignment") == 0) {
+        // name = expr, or name(i, ...) = expr with the subscripts pushed first
+        ASTNode* target = node->children[0];
+        int subscripts = strcmp(target->node_type, "array_element") == 0 ? target->children_count : 0;
+        ValueType target_type = subscripts > 0 ? TYPE_INT : variable_type(types, target->value);
+        if (task->state < subscripts) {
+            push_coerced(compiler, target->children[task->state++], TYPE_INT);
+        } else if (task->state == subscripts) {
+            task->state++;
+            push_coerced(compiler, node->children[1], target_type);
+        } else {
+            const char* name = target->value;
+            if (subscripts > 0) {
+                emit_indexed(compiler, OP_STORE_ELEMENT, resolve_array_slot(program, name), subscripts);
+            } else {
+                emit(compiler, store_opcode(target_type), resolve_slot(program, name));
+            }
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "array_element") == 0) {
+        if (task->state < node->children_count) {
+            push_coerced(compiler, node->children[task->state++], TYPE_INT);
+        } else {
+            emit_indexed(compiler, OP_LOAD_ELEMENT, resolve_array_slot(program, node->value), node->children_count);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "dim_statement") == 0) {
+        // DIM name(upper, ...): children are the name followed by one bound per dimension
+        int dimensions = node->children_count - 1;
+        if (dimensions < 1 || dimensions > MAX_DIMENSIONS) {
+            compile_error("DIM %s: between 1 and %d dimensions are supported", node->children[0]->value, MAX_DIMENSIONS);
+        }
+        if (task->state < dimensions) {
+            push_coerced(compiler, node->children[1 + task->state++], TYPE_INT);
+        } else {
+            emit_indexed(compiler, OP_DIM, resolve_array_slot(program, node->children[0]->value), dimensions);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "bload_statement") == 0 || strcmp(type, "bsave_statement") == 0) {
+        // BLOAD file$, a() [MAP] | BLOAD file$, address [, length]
+        // BSAVE file$, a()       | BSAVE file$, address, length
+        bool save = strcmp(type, "bsave_statement") == 0;
+        bool to_array = strcmp(node->children[1]->node_type, "array_ref") == 0;
+        if (task->state < (to_array ? 1 : node->children_count)) {
+            push_coerced(compiler, node->children[task->state], task->state == 0 ? TYPE_STRING : TYPE_INT);
+            task->state++;
+        } else if (to_array) {
+            OpCode op = save ? OP_BSAVE_ARRAY : (node->value && strcmp(node->value, "MAP") == 0) ? OP_MAP_ARRAY : OP_BLOAD_ARRAY;
+            emit(compiler, op, resolve_array_slot(program, node->children[1]->value));
+            compiler->task_count--;
+        } else {
+            if (node->children_count < 3) {
+                if (save) {
+                    compile_error("BSAVE needs an address and a length");
+                }
+                emit(compiler, OP_PUSH_INT, -1);    // Whole file
+            }
+            emit(compiler, save ? OP_BSAVE : OP_BLOAD, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "if_statement") == 0) {
+        switch (task->state++) {
+            case 0:
+                push_coerced(compiler, node->children[0], TYPE_INT);
+                break;
+            case 1:
+                task->patch = emit(compiler, OP_JUMP_IF_FALSE, -1);
+                push_task(compiler, node->children[1]);
+                break;
+            case 2:
+                if (node->children_count > 2) {
+                    int skip_else = emit(compiler, OP_JUMP, -1);
+                    patch_jump(compiler, task->patch);
+                    task->patch = skip_else;
+                    push_task(compiler, node->children[2]);
+                    break;
+                }
+                /* fall through */
+            default:
+                patch_jump(compiler, task->patch);
+                compiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "while_loop") == 0) {
+        switch (task->state++) {
+            case 0:
+                task->target = program->code_size;
+                push_coerced(compiler, node->children[0], TYPE_INT);
+                break;
+            case 1:
+                task->patch = emit(compiler, OP_JUMP_IF_FALSE, -1);
+                push_task(compiler, node->children[1]);
+                break;
+            default:
+                emit(compiler, OP_JUMP, task->target);
+                patch_jump(compiler, task->patch);
+                compiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "for_loop") == 0) {
+        // children: init assignment, limit, [step], block.
+        // With a positive step, PEEK/POKE addresses linear in the loop variable are range-checked
+        // once before the loop; the body is compiled twice and a failed guard runs the checked copy.
+        // The limit and step temporaries have the loop variable's type.
+        const char* var_name = node->children[0]->children[0]->value;
+        int var_slot = resolve_slot(program, var_name);
+        ValueType var_type = variable_type(types, var_name);
+        ASTNode* block = node->children[node->children_count - 1];
+        bool has_step = node->children_count > 3;
+        switch (task->state) {
+            case 0:
+                if (var_type == TYPE_STRING) {
+                    compile_error("Type mismatch: FOR needs a numeric variable (%s)", var_name);
+                }
+                task->state = 1;
+                push_task(compiler, node->children[0]);
+                break;
+            case 1:
+                task->slot = add_slot(program, NULL);
+                add_slot(program, NULL);
+                task->state = 2;
+                push_coerced(compiler, node->children[1], var_type);
+                break;
+            case 2:
+                emit(compiler, store_opcode(var_type), task->slot);
+                task->state = 3;
+                if (has_step) {
+                    push_coerced(compiler, node->children[2], var_type);
+                } else if (var_type == TYPE_FLOAT) {
+                    emit(compiler, OP_PUSH_FLT, add_float_constant(program, 1.0));
+                } else {
+                    emit(compiler, OP_PUSH_INT, 1);
+                }
+                break;
+            case 3:
+                emit(compiler, store_opcode(var_type), task->slot + 1);
+                task->values = compiler->loop_value_count;
+                plan_loop_values(compiler, block, var_name, var_type);
+                task->state = 4;
+                break;
+            case 4: {
+                // Pre-header: compute this loop's values one at a time
+                int i = task->values;
+                while (i < compiler->loop_value_count && compiler->loop_values[i].state == LOOP_VALUE_READY) i++;
+                if (i < compiler->loop_value_count) {
+                    LoopValue* value = &compiler->loop_values[i];
+                    if (value->step >= 0) {
+                        emit_induction_start(compiler, i, var_slot, task->slot + 1);
+                    } else if (value->state == LOOP_VALUE_PENDING) {
+                        value->state = LOOP_VALUE_COMPUTING;
+                        push_task(compiler, value->node);
+                    } else {
+                        emit(compiler, store_opcode(expression_type(types, value->node)), value->slot);
+                        value->state = LOOP_VALUE_READY;
+                    }
+                    break;
+                }
+                task->state = 5;
+                break;
+            }
+            case 5: {
+                HoistContext context;
+                ASTNode* bases[MAX_HOISTED_BASES];
+                int base_count = 0;
+                if (var_type == TYPE_INT &&
+                    (!has_step || (strcmp(node->children[2]->node_type, "int_literal") == 0 && atoi(node->children[2]->value) > 0))) {
+                    base_count = analyze_loop_accesses(types, block, var_name, &context, bases);
+                }
+                if (base_count == 0) {
+                    emit_for_head(compiler, task, var_slot, var_type);
+                    task->state = 7;
+                    push_task(compiler, block);
+                    break;
+                }
+                for (int i = 0; i < base_count; i++) {
+                    if (!bases[i]) {
+                        emit(compiler, OP_PUSH_INT, 0);
+                    } else if (strcmp(bases[i]->node_type, "int_literal") == 0) {
+                        emit(compiler, OP_PUSH_INT, atoi(bases[i]->value));
+                    } else {
+                        emit(compiler, OP_LOAD, resolve_slot(program, bases[i]->value));
+                    }
+                    emit(compiler, OP_LOAD, var_slot);
+                    emit(compiler, OP_LOAD, task->slot);
+                    emit(compiler, OP_CHECK_SPAN, 0);
+                    task->guards = emit(compiler, OP_JUMP_IF_FALSE, task->guards);
+                }
+                if (compiler->hoist_count >= compiler->hoist_capacity) {
+                    compiler->hoist_capacity = (compiler->hoist_capacity == 0) ? 4 : compiler->hoist_capacity * 2;
+                    compiler->hoists = (HoistContext*)realloc(compiler->hoists, compiler->hoist_capacity * sizeof(HoistContext));
+                }
+                compiler->hoists[compiler->hoist_count++] = context;
+                emit_for_head(compiler, task, var_slot, var_type);
+                task->state = 6;
+                push_task(compiler, block);
+                break;
+            }
+            case 6:
+                // Unchecked copy done; the checked copy follows for guard failures
+                compiler->hoist_count--;
+                emit_for_tail(compiler, task, var_slot, var_type);
+                program->code[task->patch].operand = -1;
+                task->exits = task->patch;
+                patch_chain(compiler, task->guards);
+                emit_for_head(compiler, task, var_slot, var_type);
+                task->state = 7;
+                push_task(compiler, block);
+                break;
+            default:
+                emit_for_tail(compiler, task, var_slot, var_type);
+                patch_jump(compiler, task->patch);
+                patch_chain(compiler, task->exits);
+                compiler->loop_value_count = task->values;
+                compiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "repeat_until") == 0) {
+        switch (task->state++) {
+            case 0:
+                task->target = program->code_size;
+                push_task(compiler, node->children[0]);
+                break;
+            case 1:
+                push_coerced(compiler, node->children[1], TYPE_INT);
+                break;
+            default:
+                emit(compiler, OP_JUMP_IF_FALSE, task->target);
+                compiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "select_case") == 0) {
+        // Exit jumps are chained through their operands and patched when the last case is done
+        switch (task->state) {
+            case 0:
+                task->slot = add_slot(program, NULL);
+                task->index = 1;
+                task->state = 1;
+                push_coerced(compiler, node->children[0], TYPE_INT);
+                break;
+            case 1:
+                emit(compiler, OP_STORE, task->slot);
+                task->state = 2;
+                break;
+            case 2:
+                if (task->index < node->children_count) {
+                    emit(compiler, OP_LOAD, task->slot);
+                    task->state = 3;
+                    push_coerced(compiler, node->children[task->index]->children[0], TYPE_INT);
+                } else {
+                    patch_chain(compiler, task->target);
+                    compiler->task_count--;
+                }
+                break;
+            case 3:
+                emit(compiler, OP_EQ, 0);
+                task->patch = emit(compiler, OP_JUMP_IF_FALSE, -1);
+                task->state = 4;
+                push_task(compiler, node->children[task->index]->children[1]);
+                break;
+            default:
+                task->target = emit(compiler, OP_JUMP, task->target);
+                patch_jump(compiler, task->patch);
+                task->index++;
+                task->state = 2;
+                break;
+        }
+    } else if (strcmp(type, "label") == 0) {
+        define_label(compiler, node->value);
+        compiler->task_count--;
+    } else if (strcmp(type, "goto_statement") == 0) {
+        emit_label_reference(compiler, OP_JUMP, node->value);
+        compiler->task_count--;
+    } else if (strcmp(type, "gosub_statement") == 0) {
+        // Inlined: the body is compiled here, with the procedure marked so a recursive GOSUB stays a call
+        if (task->state == 0) {
+            compiler->calls++;
+            task->slot = inline_target(compiler, node->value);
+            if (task->slot < 0) {
+                int procedure = find_procedure(compiler, node->value);
+                if (procedure >= 0 && compiler->procedure_memos[procedure] >= 0) {
+                    emit(compiler, OP_MEMO_LOOKUP, compiler->procedure_memos[procedure]);
+                    compiler->memoized++;
+                } else if (compiler->procedure_depth > 0 && !compiler->traps_errors && !compiler->reloadable &&
+                           !compiler->profile) {
+                    if (compiler->tail_site_count >= compiler->tail_site_capacity) {
+                        compiler->tail_site_capacity = compiler->tail_site_capacity ? compiler->tail_site_capacity * 2 : 16;
+                        compiler->tail_sites = (int*)realloc(compiler->tail_sites, compiler->tail_site_capacity * sizeof(int));
+                    }
+                    compiler->tail_sites[compiler->tail_site_count++] = program->code_size;
+                }
+                emit_label_reference(compiler, OP_GOSUB, node->value);
+                compiler->task_count--;
+            } else {
+                compiler->inlined++;
+                compiler->inlining[task->slot] = true;
+                task->state = 1;
+                push_task(compiler, compiler->procedures[task->slot]->children[0]);
+            }
+        } else {
+            compiler->inlining[task->slot] = false;
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "return_statement") == 0) {
+        emit(compiler, OP_RETURN, 0);
+        compiler->task_count--;
+    } else if (strcmp(type, "procedure") == 0) {
+        // Body is placed inline but skipped by straight-line execution; a separate unit is placed after the
+        // main program and needs no jump around it
+        int procedure = procedure_index(compiler, node);
+        if (!compiler->reachable[procedure] || (compiler->separate[procedure] && node != compiler->unit)) {
+            compiler->task_count--;
+        } else if (task->state++ == 0) {
+            if (node != compiler->unit) task->patch = emit(compiler, OP_JUMP, -1);
+            define_label(compiler, node->value);
+            compiler->procedure_depth++;
+            push_task(compiler, node->children[0]);
+        } else {
+            compiler->procedure_depth--;
+            emit(compiler, OP_RETURN, 0);
+            if (task->patch >= 0) patch_jump(compiler, task->patch);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "on_error_goto") == 0) {
+        // ON ERROR GOTO 0 turns trapping off
+        if (!node->value || strcmp(node->value, "0") == 0) {
+            emit(compiler, OP_ON_ERROR, -1);
+        } else {
+            emit_label_reference(compiler, OP_ON_ERROR, node->value);
+        }
+        compiler->task_count--;
+    } else if (strcmp(type, "resume_statement") == 0) {
+        // RESUME retries the failed statement, RESUME NEXT skips it, RESUME label continues there
+        if (!node->value) {
+            emit(compiler, OP_RESUME, 0);
+        } else if (strcmp(node->value, "NEXT") == 0) {
+            emit(compiler, OP_RESUME_NEXT, 0);
+        } else {
+            emit_label_reference(compiler, OP_RESUME_LABEL, node->value);
+        }
+        compiler->task_count--;
+    } else if (strcmp(type, "err") == 0) {
+        emit(compiler, OP_PUSH_ERR, 0);
+        compiler->task_count--;
+    } else if (strcmp(type, "data_statement") == 0) {
+        // Values were collected in source order by prescan_program
+        compiler->task_count--;
+    } else if (strcmp(type, "read_statement") == 0) {
+        ValueType target_type = variable_type(types, node->children[0]->value);
+        require_type(types, node->children[0], TYPE_INT);
+        emit(compiler, target_type == TYPE_FLOAT ? OP_READ_FLT : OP_READ, resolve_slot(program, node->children[0]->value));
+        compiler->task_count--;
+    } else if (strcmp(type, "restore_statement") == 0) {
+        emit(compiler, OP_RESTORE, 0);
+        compiler->task_count--;
+    } else if (strcmp(type, "allocate_statement") == 0) {
+        if (task->state++ == 0) {
+            if (variable_type(types, node->children[0]->value) != TYPE_INT) {
+                compile_error("Type mismatch: ALLOCATE needs an integer variable (%s)", node->children[0]->value);
+            }
+            push_coerced(compiler, node->children[1], TYPE_INT);
+        } else {
+            emit(compiler, OP_ALLOCATE, resolve_slot(program, node->children[0]->value));
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "free_statement") == 0) {
+        if (task->state++ == 0) {
+            push_coerced(compiler, node->children[0], TYPE_INT);
+        } else {
+            emit(compiler, OP_FREE, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "poke_statement") == 0) {
+        if (task->state < 2) {
+            push_coerced(compiler, node->children[task->state++], TYPE_INT);
+        } else {
+            emit(compiler, is_hoisted_access(compiler, node) ? OP_POKE_UNCHECKED : OP_POKE, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "peek") == 0) {
+        if (task->state++ == 0) {
+            push_coerced(compiler, node->children[0], TYPE_INT);
+        } else {
+            emit(compiler, is_hoisted_access(compiler, node) ? OP_PEEK_UNCHECKED : OP_PEEK, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "open_statement") == 0) {
+        // OPEN mode$, #channel, filename$
+        if (task->state < 3) {
+            push_coerced(compiler, node->children[task->state], task->state == 1 ? TYPE_INT : TYPE_STRING);
+            task->state++;
+        } else {
+            emit(compiler, OP_OPEN, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "close_statement") == 0) {
+        // CLOSE #channel, or CLOSE to close every channel
+        if (task->state < node->children_count) {
+            push_coerced(compiler, node->children[task->state++], TYPE_INT);
+        } else {
+            emit(compiler, node->children_count > 0 ? OP_CLOSE : OP_CLOSE_ALL, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "snapshot_statement") == 0) {
+        // SNAPSHOT file$: save the run-time state; interpreter_restore() resumes after this statement
+        if (task->state++ == 0) {
+            push_coerced(compiler, node->children[0], TYPE_STRING);
+        } else {
+            emit(compiler, OP_SNAPSHOT, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "input_statement") == 0 || strcmp(type, "line_input_statement") == 0) {
+        // [LINE] INPUT [#channel,] variable; without a channel, standard input is read
+        const char* name = node->children[node->children_count - 1]->value;
+        if (task->state++ == 0 && node->children_count > 1) {
+            push_coerced(compiler, node->children[0], TYPE_INT);
+        } else {
+            if (node->children_count == 1) emit(compiler, OP_PUSH_INT, -1);
+            if (strcmp(type, "line_input_statement") == 0) {
+                if (!is_string_name(name)) {
+                    compile_error("Type mismatch: LINE INPUT needs a string variable");
+                }
+                emit(compiler, OP_LINE_INPUT_CHANNEL, resolve_slot(program, name));
+            } else {
+                ValueType target_type = variable_type(types, name);
+                emit(compiler, target_type == TYPE_STRING ? OP_INPUT_CHANNEL_STR : target_type == TYPE_FLOAT ? OP_INPUT_CHANNEL_FLT
+                                                                                                            : OP_INPUT_CHANNEL,
+                     resolve_slot(program, name));
+            }
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "eof") == 0) {
+        if (task->state++ == 0) {
+            push_coerced(compiler, node->children[0], TYPE_INT);
+        } else {
+            emit(compiler, OP_EOF, 0);
+            compiler->task_count--;
+        }
+    } else if (strcmp(type, "end_statement") == 0 || strcmp(type, "stop_statement") == 0) {
+        emit(compiler, OP_END, 0);
+        compiler->task_count--;
+    } else {
+        compile_error("Unknown statement type: %s", type);
+    }
+}
+
+/* ---------------------------------------------------------------------------
+   Superinstructions and quickening
+
+   After compilation, the first instruction of each common sequence is
+   rewritten into a superinstruction that performs the whole sequence in one
+   dispatch, reading its operands from the instructions that follow. Those
+   are left in place, so code addresses do not change and a jump, RESUME or
+   JIT side exit that lands inside a fused sequence still runs correctly.
+   The sequences are the most frequent opcode runs seen when profiling the
+   demo and benchmark programs; building with -DPROFILE_OPCODE_PAIRS prints
+   the opcode pair counts that the table was chosen from.
+
+   Element access is quickened in place at run time instead: the first
+   LOAD_ELEMENT/STORE_ELEMENT that succeeds is rewritten for the rank of the
+   array it found, and a quickened instruction whose array no longer has
+   that rank (or whose subscript is out of range) reverts to the generic
+   form, which raises the error.
+   --------------------------------------------------------------------------- */
+
+#define SUPERINSTRUCTION_LENGTH 4
+#define PATTERN_COMPARE ((OpCode)-1)    // Matches any integer comparison
+
+typedef struct {
+    OpCode op;
+    OpCode pattern[SUPERINSTRUCTION_LENGTH];
+} Superinstruction;
+
+// Ordered by frequency in the profiles: FOR tests and IF a < b, then FOR steps and accumulators, then x = x + 1
+static const Superinstruction superinstructions[] = {
+    {OP_BRANCH_VAR_VAR, {OP_LOAD, OP_LOAD, PATTERN_COMPARE, OP_JUMP_IF_FALSE}},
+    {OP_BRANCH_VAR_CONST, {OP_LOAD, OP_PUSH_INT, PATTERN_COMPARE, OP_JUMP_IF_FALSE}},
+    {OP_ADD_VAR_VAR, {OP_LOAD, OP_LOAD, OP_ADD_INT, OP_STORE}},
+    {OP_ADD_VAR_CONST, {OP_LOAD, OP_PUSH_INT, OP_ADD_INT, OP_STORE}},
+    {OP_SUB_VAR_CONST, {OP_LOAD, OP_PUSH_INT, OP_SUB_INT, OP_STORE}},
+};
+
+// Generic instruction a superinstruction or quickened instruction stands in for
+static OpCode generic_opcode(OpCode op) {
+    switch (op) {
+        case OP_ADD_VAR_CONST:
+        case OP_SUB_VAR_CONST:
+        case OP_ADD_VAR_VAR:
+        case OP_BRANCH_VAR_CONST:
+        case OP_BRANCH_VAR_VAR:
+            return OP_LOAD;
+        case OP_LOAD_ELEMENT_1:
+        case OP_LOAD_ELEMENT_2:
+            return OP_LOAD_ELEMENT;
+        case OP_STORE_ELEMENT_1:
+        case OP_STORE_ELEMENT_2:
+            return OP_STORE_ELEMENT;
+        default:
+            return op;
+    }
+}
+
+// Does the code at pc start the given sequence?
+static bool matches_superinstruction(const Program* program, int pc, const Superinstruction* super) {
+    if (pc + SUPERINSTRUCTION_LENGTH > program->code_size) return false;
+    for (int i = 0; i < SUPERINSTRUCTION_LENGTH; i++) {
+        OpCode op = program->code[pc + i].op;
+        if (super->pattern[i] == PATTERN_COMPARE ? (op < OP_EQ || op > OP_GE) : op != super->pattern[i]) return false;
+    }
+    return true;
+}
+
+// Rewrite the head of every matching sequence; returns how many were fused
+static int fuse_superinstructions(Program* program) {
+    int fused = 0;
+    for (int pc = 0; pc < program->code_size; pc++) {
+        for (size_t i = 0; i < sizeof(superinstructions) / sizeof(superinstructions[0]); i++) {
+            if (matches_superinstruction(program, pc, &superinstructions[i])) {
+                program->code[pc].op = superinstructions[i].op;
+                pc += SUPERINSTRUCTION_LENGTH - 1;
+                fused++;
+                break;
+            }
+        }
+    }
+    return fused;
+}
+
+// Integer comparison by opcode, for the fused branches
+static inline bool compare_ints(OpCode op, int left, int right) {
+    switch (op) {
+        case OP_EQ: return left == right;
+        case OP_NE: return left != right;
+        case OP_LT: return left < right;
+        case OP_LE: return left <= right;
+        case OP_GT: return left > right;
+        default: return left >= right;
+    }
+}
+
+/* ---------------------------------------------------------------------------
+   Call sites
+
+   GOSUB targets are resolved once, by the fixup pass, into the operand of
+   the call, so a call never looks a name up. Once the code is complete
+   each call is bound further: its target is threaded through unconditional
+   jumps, and a call from a PROCEDURE body whose return would go straight to
+   a RETURN becomes a jump. The callee's RETURN then pops the caller's frame,
+   so tail-recursive procedures run in constant frame space and the
+   recursion is a loop the JIT can see. Calls preceded by a memo lookup keep
+   their frame, which is how the memo knows when the call has finished.
+   Programs with ON ERROR keep every frame, so RESUME sees the same stack,
+   and so do programs compiled for hot reload: a reload rebinds GOSUBs, and
+   a tail jump out of code that is still running would reach the old body.
+   --------------------------------------------------------------------------- */
+
+// Follow unconditional jumps from address; bounded so a jump cycle cannot hang the compiler
+static int jump_destination(const Program* program, int address) {
+    for (int hops = 0; hops < 16 && program->code[address].op == OP_JUMP; hops++) {
+        address = program->code[address].operand;
+    }
+    return address;
+}
+
+// Thread GOSUB targets through jumps and turn tail calls into jumps; returns how many calls became jumps
+static int bind_call_sites(Program* program, const int* tail_sites, int tail_site_count) {
+    for (int pc = 0; pc < program->code_size; pc++) {
+        if (program->code[pc].op == OP_GOSUB) program->code[pc].operand = jump_destination(program, program->code[pc].operand);
+    }
+    int tail_calls = 0;
+    for (int i = 0; i < tail_site_count; i++) {
+        int pc = tail_sites[i];
+        if (program->code[jump_destination(program, pc + 1)].op == OP_RETURN) {
+            program->code[pc].op = OP_JUMP;
+            tail_calls++;
+        }
+    }
+    return tail_calls;
+}
+
+/* ---------------------------------------------------------------------------
+   Parallel compilation
+
+   Every reachable top-level PROCEDURE is a compile unit of its own. A cheap
+   pre-scan walks the program in source order first: it collects the DATA
+   values, whose order is visible to READ, and the labels, so that a label
+   defined in two units is still reported as a duplicate. The units are then
+   compiled on a small pool of threads that the calling thread joins, each
+   by its own Compiler into a shard Program. A shard starts out with the
+   program's symbol table and collects everything else itself: code, new
+   slots, literals, labels and fixups. Once all are done the shards are
+   appended after the main program in source order and their operands
+   relocated, so the code does not depend on the thread count or on which
+   thread compiled what.
+
+   A compile error abandons only its unit. The one reported is the one a
+   serial compile would have stopped at: the error in the earliest
+   top-level statement.
+   --------------------------------------------------------------------------- */
+
+// How an operand is rewritten when its instruction moves from a shard into the program
+typedef enum {
+    OPERAND_VALUE,          // Immediate, or a label address that is resolved afterwards
+    OPERAND_ADDRESS,
+    OPERAND_SLOT,
+    OPERAND_ELEMENT,        // Slot << 3 | subscript count
+    OPERAND_STRING,
+    OPERAND_FLOAT
+} OperandKind;
+
+static OperandKind operand_kind(OpCode op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return OPERAND_ADDRESS;
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_READ:
+        case OP_ALLOCATE:
+        case OP_LOAD_STR:
+        case OP_STORE_STR:
+        case OP_INPUT_CHANNEL:
+        case OP_INPUT_CHANNEL_STR:
+        case OP_LINE_INPUT_CHANNEL:
+        case OP_LOAD_FLT:
+        case OP_STORE_FLT:
+        case OP_INPUT_CHANNEL_FLT:
+        case OP_READ_FLT:
+        case OP_BLOAD_ARRAY:
+        case OP_MAP_ARRAY:
+        case OP_BSAVE_ARRAY:
+            return OPERAND_SLOT;
+        case OP_DIM:
+        case OP_LOAD_ELEMENT:
+        case OP_STORE_ELEMENT:
+            return OPERAND_ELEMENT;
+        case OP_PUSH_STR:
+            return OPERAND_STRING;
+        case OP_PUSH_FLT:
+            return OPERAND_FLOAT;
+        default:
+            return OPERAND_VALUE;
+    }
+}
+
+typedef struct {
+    Compiler compiler;
+    ASTNode *root;
+    TypeTable types;        // The program's inferred types; only the report counters are the unit's own
+    int symbol_base;        // Slots below this are the program's, the rest were created by the unit
+    CompileFailure failure;
+} CompileUnit;
+
+typedef struct {
+    CompileUnit *units;
+    int unit_count;
+    int next;               // Next unit to claim
+} CompileQueue;
+
+// Collect DATA values in source order and find the first label defined twice in the code to be compiled.
+// Returns its name, and in *order the top-level statement of its second definition, or NULL.
+static const char* prescan_program(Compiler* compiler, ASTNode* ast, int* order) {
+    const char** names = NULL;
+    int name_count = 0;
+    const char* duplicate = NULL;
+    ASTNode** stack = NULL;
+    int stack_capacity = 0;
+    for (int statement = 0; statement < ast->children_count; statement++) {
+        int top = 0;
+        if (stack_capacity == 0) stack = (ASTNode**)malloc((stack_capacity = 64) * sizeof(ASTNode*));
+        stack[top++] = ast->children[statement];
+        while (top > 0) {
+            ASTNode* node = stack[--top];
+            const char* type = node->node_type;
+            if (strcmp(type, "procedure") == 0 && !compiler->reachable[procedure_index(compiler, node)]) continue;
+            if (strcmp(type, "data_statement") == 0) {
+                for (int i = 0; i < node->children_count; i++) add_data(compiler->program, atoi(node->children[i]->value));
+            } else if (strcmp(type, "label") == 0 || strcmp(type, "procedure") == 0) {
+                for (int i = 0; i < name_count && !duplicate; i++) {
+                    if (strcmp(names[i], node->value) == 0) {
+                        duplicate = node->value;
+                        *order = statement;
+                    }
+                }
+                names = (const char**)realloc(names, (name_count + 1) * sizeof(const char*));
+                names[name_count++] = node->value;
+            }
+            // Children go on the stack last first, so they come off in source order
+            if (top + node->children_count > stack_capacity) {
+                while (top + node->children_count > stack_capacity) stack_capacity *= 2;
+                stack = (ASTNode**)realloc(stack, stack_capacity * sizeof(ASTNode*));
+            }
+            for (int i = node->children_count - 1; i >= 0; i--) stack[top++] = node->children[i];
+        }
+    }
+    free(stack);
+    free(names);
+    return duplicate;
+}
+
+// Run the task loop until everything pushed has been compiled
+static void compile_tasks(Compiler* compiler) {
+    while (compiler->task_count > 0) {
+        int before = compiler->task_count;
+        compile_step(compiler);
+        if (compiler->task_count < before) finish_task(compiler, &compiler->tasks[compiler->task_count]);
+    }
+}
+
+// Set up a unit to compile root: the main program into the program itself, a procedure into a shard
+static void init_unit(CompileUnit* unit, const Compiler* program_compiler, ASTNode* root, int order) {
+    Program* program = program_compiler->program;
+    Compiler* compiler = &unit->compiler;
+    unit->root = root;
+    unit->types = *program_compiler->types;
+    unit->types.int_operations = unit->types.float_operations = unit->types.string_operations = 0;
+    unit->types.conversions = 0;
+    unit->symbol_base = program->symbol_count;
+    compiler->types = &unit->types;
+    compiler->procedures = program_compiler->procedures;
+    compiler->procedure_count = program_compiler->procedure_count;
+    compiler->procedure_sizes = program_compiler->procedure_sizes;
+    compiler->procedure_memos = program_compiler->procedure_memos;
+    compiler->reachable = program_compiler->reachable;
+    compiler->separate = program_compiler->separate;
+    compiler->inline_budget = program_compiler->inline_budget;
+    compiler->traps_errors = program_compiler->traps_errors;
+    compiler->reloadable = program_compiler->reloadable;
+    compiler->profile = program_compiler->profile;
+    compiler->lines = program_compiler->lines;
+    compiler->line_count = program_compiler->line_count;
+    compiler->inlining = (bool*)calloc(compiler->procedure_count + 1, sizeof(bool));
+    if (strcmp(root->node_type, "procedure") != 0) {
+        compiler->program = program;
+        return;
+    }
+    compiler->unit = root;
+    compiler->unit_order = order;
+    compiler->program = (Program*)calloc(1, sizeof(Program));
+    compiler->program->symbols = (char**)malloc((program->symbol_count + 1) * sizeof(char*));
+    if (program->symbol_count > 0) memcpy(compiler->program->symbols, program->symbols, program->symbol_count * sizeof(char*));
+    compiler->program->symbol_count = compiler->program->symbol_capacity = program->symbol_count;
+}
+
+static void compile_unit(CompileUnit* unit) {
+    compile_failure = &unit->failure;
+    if (setjmp(unit->failure.abort) == 0) {
+        push_task(&unit->compiler, unit->root);
+        compile_tasks(&unit->compiler);
+    } else {
+        unit->failure.order = source_order(&unit->compiler);
+    }
+    compile_failure = NULL;
+}
+
+// Thread body: compile units until the queue is empty
+static void* compile_worker(void* argument) {
+    CompileQueue* queue = (CompileQueue*)argument;
+    int next;
+    while ((next = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->unit_count) {
+        compile_unit(&queue->units[next]);
+    }
+    return NULL;
+}
+
+// Append a compiled unit to the program compiled by into: its code, tables, fixups and report counters
+static void merge_unit(Compiler* into, CompileUnit* unit) {
+    Program* program = into->program;
+    Compiler* compiler = &unit->compiler;
+    Program* shard = compiler->program;
+    int code_base = 0;
+    if (shard != program) {
+        code_base = program->code_size;
+        int string_base = program->string_count;
+        int float_base = program->float_count;
+
+        // New slots keep their names, so two units using the same variable end up sharing its slot
+        int* slots = (int*)malloc((shard->symbol_count + 1) * sizeof(int));
+        for (int i = 0; i < shard->symbol_count; i++) {
+            if (i < unit->symbol_base) {
+                slots[i] = i;
+            } else {
+                slots[i] = shard->symbols[i] ? resolve_slot(program, shard->symbols[i]) : add_slot(program, NULL);
+                free(shard->symbols[i]);
+            }
+        }
+        for (int i = 0; i < shard->code_size; i++) {
+            Instruction instruction = shard->code[i];
+            switch (operand_kind(instruction.op)) {
+                case OPERAND_ADDRESS:
+                    if (instruction.operand >= 0) instruction.operand += code_base;
+                    break;
+                case OPERAND_SLOT:
+                    instruction.operand = slots[instruction.operand];
+                    break;
+                case OPERAND_ELEMENT:
+                    instruction.operand = slots[instruction.operand >> 3] << 3 | (instruction.operand & 7);
+                    break;
+                case OPERAND_STRING:
+                    instruction.operand += string_base;
+                    break;
+                case OPERAND_FLOAT:
+                    instruction.operand += float_base;
+                    break;
+                case OPERAND_VALUE:
+                    break;
+            }
+            if (program->code_size >= program->code_capacity) {
+                program->code_capacity = (program->code_capacity == 0) ? 64 : program->code_capacity * 2;
+                program->code = (Instruction*)realloc(program->code, program->code_capacity * sizeof(Instruction));
+            }
+            program->code[program->code_size++] = instruction;
+        }
+        free(slots);
+
+        for (int i = 0; i < shard->string_count; i++) {
+            if (program->string_count >= program->string_capacity) {
+                program->string_capacity = (program->string_capacity == 0) ? 16 : program->string_capacity * 2;
+                program->strings = (String**)realloc(program->strings, program->string_capacity * sizeof(String*));
+            }
+            program->strings[program->string_count++] = shard->strings[i];
+        }
+        for (int i = 0; i < shard->float_count; i++) {
+            if (program->float_count >= program->float_capacity) {
+                program->float_capacity = (program->float_capacity == 0) ? 16 : program->float_capacity * 2;
+                program->floats = (double*)realloc(program->floats, program->float_capacity * sizeof(double));
+            }
+            program->floats[program->float_count++] = shard->floats[i];
+        }
+        for (int i = 0; i < shard->label_count; i++) {
+            if (program->label_count >= program->label_capacity) {
+                program->label_capacity = (program->label_capacity == 0) ? 8 : program->label_capacity * 2;
+                program->labels = (Label*)realloc(program->labels, program->label_capacity * sizeof(Label));
+            }
+            program->labels[program->label_count].name = shard->labels[i].name;
+            program->labels[program->label_count++].address = shard->labels[i].address + code_base;
+        }
+        for (int i = 0; i < shard->statement_count; i++) {
+            if (program->statement_count >= program->statement_capacity) {
+                program->statement_capacity = (program->statement_capacity == 0) ? 64 : program->statement_capacity * 2;
+                program->statements = (StatementRange*)realloc(program->statements,
+                                                               program->statement_capacity * sizeof(StatementRange));
+            }
+            program->statements[program->statement_count].start = shard->statements[i].start + code_base;
+            program->statements[program->statement_count++].end = shard->statements[i].end + code_base;
+        }
+        if (shard->max_stack > program->max_stack) program->max_stack = shard->max_stack;
+        if (shard->max_string_stack > program->max_string_stack) program->max_string_stack = shard->max_string_stack;
+        if (shard->max_float_stack > program->max_float_stack) program->max_float_stack = shard->max_float_stack;
+        free(shard->code);
+        free(shard->symbols);
+        free(shard->labels);
+        free(shard->statements);
+        free(shard->strings);
+        free(shard->floats);
+        free(shard);
+    }
+
+    into->fixup_capacity = into->fixup_count + compiler->fixup_count + 1;
+    into->fixups = (Fixup*)realloc(into->fixups, into->fixup_capacity * sizeof(Fixup));
+    for (int i = 0; i < compiler->fixup_count; i++) {
+        into->fixups[into->fixup_count] = compiler->fixups[i];
+        into->fixups[into->fixup_count++].at += code_base;
+    }
+    into->tail_site_capacity = into->tail_site_count + compiler->tail_site_count + 1;
+    into->tail_sites = (int*)realloc(into->tail_sites, into->tail_site_capacity * sizeof(int));
+    for (int i = 0; i < compiler->tail_site_count; i++) into->tail_sites[into->tail_site_count++] = compiler->tail_sites[i] + code_base;
+    into->inlined += compiler->inlined;
+    into->calls += compiler->calls;
+    into->hoisted += compiler->hoisted;
+    into->reduced += compiler->reduced;
+    into->memoized += compiler->memoized;
+    into->types->int_operations += unit->types.int_operations;
+    into->types->float_operations += unit->types.float_operations;
+    into->types->string_operations += unit->types.string_operations;
+    into->types->conversions += unit->types.conversions;
+    free(compiler->tasks);
+    free(compiler->fixups);
+    free(compiler->tail_sites);
+    free(compiler->hoists);
+    free(compiler->loop_values);
+    free(compiler->inlining);
+}
+
+// Compile a program node into an instruction stream; GOSUB inlines procedures of up to inline_budget AST nodes.
+// Top-level procedures are compiled on up to threads threads, 0 meaning one per online CPU.
+Program* compile_program(ASTNode* ast, int inline_budget, int threads) {
+    char error[256];
+    Program* program = try_compile_program(ast, inline_budget, threads, false, false, error);
+    if (!program) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+    return program;
+}
+
+// compile_program() for callers that must survive a bad program: returns NULL with the message in error.
+// With profile, every statement starts by counting itself, see interpreter_set_profile(). With reloadable, no
+// optimization relies on what a PROCEDURE does, since interpreter_reload() may replace it.
+static Program* try_compile_program(ASTNode* ast, int inline_budget, int threads, bool profile, bool reloadable,
+                                    char error[256]) {
+    Compiler compiler = {0};
+    compiler.program = (Program*)calloc(1, sizeof(Program));
+    int node_count;
+    ASTNode** nodes = collect_nodes(ast, &node_count);
+    compiler.procedures = (ASTNode**)malloc((node_count + 1) * sizeof(ASTNode*));
+    for (int i = 0; i < node_count; i++) {
+        if (strcmp(nodes[i]->node_type, "procedure") == 0) compiler.procedures[compiler.procedure_count++] = nodes[i];
+        if (strcmp(nodes[i]->node_type, "on_error_goto") == 0) compiler.traps_errors = true;
+    }
+    free(nodes);
+    compiler.inline_budget = inline_budget;
+    compiler.reloadable = reloadable;
+    compiler.profile = profile;
+    SourceLine* lines = NULL;
+    if (profile) {
+        int* depths;
+        nodes = source_lines(ast, &depths, &node_count);
+        lines = (SourceLine*)malloc((node_count + 1) * sizeof(SourceLine));
+        for (int i = 0; i < node_count; i++) {
+            if (!counts_executions(nodes[i]->node_type)) continue;
+            lines[compiler.line_count].node = nodes[i];
+            lines[compiler.line_count++].line = i + 1;
+        }
+        qsort(lines, compiler.line_count, sizeof(SourceLine), compare_source_lines);
+        compiler.lines = lines;
+        free(nodes);
+        free(depths);
+    }
+    compiler.procedure_sizes = (int*)malloc((compiler.procedure_count + 1) * sizeof(int));
+    compiler.procedure_memos = (int*)malloc((compiler.procedure_count + 1) * sizeof(int));
+    compiler.reachable = find_reachable_procedures(&compiler, ast);
+    nodes = collect_compiled_nodes(&compiler, ast, &node_count);
+    compiler.types = infer_types(nodes, node_count);
+    int reachable = 0;
+    for (int i = 0; i < compiler.procedure_count; i++) {
+        compiler.procedure_sizes[i] = compiler.reachable[i] ? procedure_size(compiler.procedures[i]) : -1;
+        compiler.procedure_memos[i] = compiler.reachable[i] ? plan_memo(&compiler, i) : -1;
+        if (compiler.reachable[i]) reachable++;
+    }
+    int duplicate_order = 0;
+    const char* duplicate = prescan_program(&compiler, ast, &duplicate_order);
+
+    // Unit 0 is the main program, then every reachable top-level procedure in source order
+    compiler.separate = (bool*)calloc(compiler.procedure_count + 1, sizeof(bool));
+    CompileUnit* units = (CompileUnit*)calloc(ast->children_count + 1, sizeof(CompileUnit));
+    int unit_count = 0;
+    init_unit(&units[unit_count++], &compiler, ast, 0);
+    for (int i = 0; i < ast->children_count; i++) {
+        ASTNode* child = ast->children[i];
+        if (strcmp(child->node_type, "procedure") != 0 || !compiler.reachable[procedure_index(&compiler, child)]) continue;
+        compiler.separate[procedure_index(&compiler, child)] = true;
+        init_unit(&units[unit_count++], &compiler, child, i);
+    }
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > unit_count) threads = unit_count;
+    if (threads < 1) threads = 1;
+    CompileQueue queue = {units, unit_count, 0};
+    pthread_t* workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, compile_worker, &queue) == 0) started++;
+    compile_worker(&queue);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    free(workers);
+
+    // Report the error a serial compile would have stopped at
+    CompileFailure* failure = NULL;
+    error[0] = '\0';
+    for (int i = 0; i < unit_count; i++) {
+        if (units[i].failure.failed && (!failure || units[i].failure.order < failure->order)) failure = &units[i].failure;
+    }
+    if (duplicate && (!failure || duplicate_order < failure->order)) {
+        snprintf(error, 256, "Duplicate label: %s", duplicate);
+    } else if (failure) {
+        snprintf(error, 256, "%s", failure->message);
+    }
+
+    // Units that failed are merged all the same, so everything they hold is freed with the program
+    if (!error[0]) emit(&units[0].compiler, OP_END, 0);
+    for (int i = 0; i < unit_count; i++) merge_unit(&compiler, &units[i]);
+    free(units);
+
+    // Resolve GOTO/GOSUB targets now that every label is known
+    Program* program = compiler.program;
+    const Fixup* undefined = NULL;
+    for (int i = 0; i < compiler.fixup_count && !error[0]; i++) {
+        int address = -1;
+        for (int j = 0; j < program->label_count; j++) {
+            if (strcmp(program->labels[j].name, compiler.fixups[i].name) == 0) {
+                address = program->labels[j].address;
+                break;
+            }
+        }
+        if (address < 0) {
+            if (!undefined || compiler.fixups[i].order < undefined->order) undefined = &compiler.fixups[i];
+            continue;
+        }
+        program->code[compiler.fixups[i].at].operand = address;
+    }
+    if (undefined) snprintf(error, 256, "Undefined label: %s", undefined->name);
+
+    int tail_calls = error[0] ? 0 : bind_call_sites(program, compiler.tail_sites, compiler.tail_site_count);
+
+    free(compiler.fixups);
+    free(compiler.tail_sites);
+    free(compiler.procedures);
+    free(compiler.procedure_sizes);
+    free(compiler.procedure_memos);
+    free(compiler.reachable);
+    free(compiler.separate);
+    free(lines);
+    if (error[0]) {
+        free_types(compiler.types);
+        free_program(program);
+        return NULL;
+    }
+    printf("[DEBUG] Lazy compilation: %d of %d procedures reachable, %d skipped.\n", reachable, compiler.procedure_count,
+           compiler.procedure_count - reachable);
+    printf("[DEBUG] Parallel compile: %d procedures, %d threads.\n", unit_count - 1, started + 1);
+    printf("[DEBUG] Inliner: %d of %d GOSUB calls inlined (budget %d nodes), %d tail calls.\n", compiler.inlined,
+           compiler.calls, inline_budget, tail_calls);
+    printf("[DEBUG] Memoization: %d of %d procedures proven pure, %d GOSUB calls memoized.\n", program->memo_count,
+           compiler.procedure_count, compiler.memoized);
+    printf("[DEBUG] Loop optimizer: %d invariant expressions hoisted, %d multiplications strength-reduced.\n",
+           compiler.hoisted, compiler.reduced);
+    TypeTable* types = compiler.types;
+    program->symbol_types = (ValueType*)malloc((program->symbol_count + 1) * sizeof(ValueType));
+    for (int i = 0; i < program->symbol_count; i++) {
+        program->symbol_types[i] = program->symbols[i] ? variable_type(types, program->symbols[i]) : TYPE_UNKNOWN;
+    }
+    // Every operation is emitted for its operands' types, so there is no ratio to report; what falls back is
+    // an untyped variable that never receives a typed value
+    printf("[DEBUG] Type inference: %d operations specialized (%d int, %d float, %d string), %d conversions; "
+           "%d of %d untyped variables proven integer, %d defaulted to float.\n",
+           types->int_operations + types->float_operations + types->string_operations, types->int_operations,
+           types->float_operations, types->string_operations, types->conversions, types->proven_int,
+           types->name_count, types->defaulted_float);
+    free_types(types);
+    int fused = fuse_superinstructions(program);
+    printf("[DEBUG] Compiled %d instructions, %d slots, %d superinstructions.\n", program->code_size, program->symbol_count,
+           fused);
+    return program;
+}
+
+// Free a compiled program
+void free_program(Program* program) {
+    if (!program) return;
+    // A program mapped from the bytecode cache only owns its pointer tables; the rest goes with the image
+    if (!program->image) {
+        for (int i = 0; i < program->symbol_count; i++) free(program->symbols[i]);
+        for (int i = 0; i < program->label_count; i++) free(program->labels[i].name);
+        free(program->code);
+        free(program->floats);
+        free(program->data);
+        free(program->statements);
+    }
+    free(program->symbols);
+    free(program->symbol_types);
+    free(program->labels);
+    for (int i = 0; i < program->string_count; i++) string_release(program->strings[i]);
+    free(program->strings);
+    for (int i = 0; i < program->memo_count; i++) {
+        memo_free(&program->memos[i]);
+        if (!program->image) free(program->memos[i].slots);
+    }
+    free(program->memos);
+    jit_free(program->jit);
+    if (program->image) mapping_release(program->image);
+    free(program);
+}
+
+/* ---------------------------------------------------------------------------
+   Memory accounting
+
+   Each interpreter keeps one MemoryAccount for what its program holds:
+   strings, DIM arrays, committed ALLOCATE pages and the frame and operand
+   stacks. What can fail is charged before it is allocated, and refused
+   with ERR_OUT_OF_MEMORY when it would pass the quota, so ON ERROR can
+   trap it like any other error. Strings cannot fail where they are made,
+   so they are charged unconditionally: concatenation checks that its
+   result fits before making it, and INPUT and LINE INPUT raise the error
+   once the account is over, which can pass the quota by one line until
+   the error path drops it.
+
+   Strings and arrays are made by code that has no interpreter at hand, so
+   execute_program() points thread_account at its account for the run, and
+   each string or array remembers the account it was charged to.
+   --------------------------------------------------------------------------- */
+
+static _Thread_local MemoryAccount* thread_account;
+
+// Charge bytes that were allocated whatever the quota says
+static void account_add(MemoryAccount* account, size_t bytes) {
+    if (!account) return;
+    account->in_use += bytes;
+    if (account->in_use > account->peak) account->peak = account->in_use;
+}
+
+// Whether bytes more would stay within the quota; if not, the refusal is counted
+static bool account_allows(MemoryAccount* account, size_t bytes) {
+    if (!account || (account->in_use <= account->quota && bytes <= account->quota - account->in_use)) return true;
+    account->refusals++;
+    return false;
+}
+
+// Charge bytes about to be allocated; false, with nothing charged, if they would pass the quota
+static bool account_charge(MemoryAccount* account, size_t bytes) {
+    if (!account_allows(account, bytes)) return false;
+    account_add(account, bytes);
+    return true;
+}
+
+static void account_credit(MemoryAccount* account, size_t bytes) {
+    if (account) account->in_use -= bytes;
+}
+
+/* ---------------------------------------------------------------------------
+   Linear memory
+
+   Blocks are 16-byte aligned. Those up to MEMORY_MAX_POOLED bytes come
+   from per-size-class free lists; larger ones are page-rounded and recycled
+   first-fit. BASIC can write anywhere in the committed prefix, with POKE or
+   BLOAD, so nothing the allocator relies on is kept there: the size and
+   state of every block live in a table beside the region, one entry per
+   16 bytes, and the free lists are arrays of offsets.
+   --------------------------------------------------------------------------- */
+
+#define BLOCK_IN_USE 1u     // Flag in a block table entry; the rest of the entry is the block size
+
+// Bytes of block table for a committed prefix: the entry of a block's first 16 bytes holds its size
+// and state, every other entry is 0
+static size_t block_table_bytes(size_t committed) {
+    return (committed + 15) / 16 * sizeof(uint32_t);
+}
+
+static void free_list_push(FreeList* list, uint32_t offset) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->offsets = (uint32_t*)realloc(list->offsets, list->capacity * sizeof(uint32_t));
+    }
+    list->offsets[list->count++] = offset;
+}
+
+// Size class of a pooled block of block_size bytes
+static int size_class_of(size_t block_size) {
+    int size_class = 0;
+    while (((size_t)16 << size_class) < block_size) size_class++;
+    return size_class;
+}
+
+// Take fresh bytes from the end of the region, committing pages as needed; 0 when it is exhausted
+static uint32_t memory_carve(LinearMemory* memory, size_t bytes) {
+    if (!memory->base) {
+        void* base = mmap(NULL, memory->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) return 0;
+        memory->base = (unsigned char*)base;
+        memory->top = 16;   // Keep address 0 unused so it can mean "no block"
+    }
+    if (memory->top + bytes > memory->reserved) return 0;
+    if (memory->top + bytes > memory->committed) {
+        size_t commit = (memory->top + bytes + MEMORY_COMMIT_CHUNK - 1) / MEMORY_COMMIT_CHUNK * MEMORY_COMMIT_CHUNK;
+        if (commit > memory->reserved) commit = memory->reserved;
+        size_t table = block_table_bytes(commit), old_table = block_table_bytes(memory->committed);
+        size_t charge = commit - memory->committed + table - old_table;
+        if (!account_charge(memory->account, charge)) return 0;
+        if (mprotect(memory->base + memory->committed, commit - memory->committed, PROT_READ | PROT_WRITE) != 0) {
+            account_credit(memory->account, charge);
+            return 0;
+        }
+        memory->blocks = (uint32_t*)realloc(memory->blocks, table);
+        memset((unsigned char*)memory->blocks + old_table, 0, table - old_table);
+        memory->committed = commit;
+    }
+    uint32_t offset = (uint32_t)memory->top;
+    memory->top += bytes;
+    return offset;
+}
+
+// Allocate a block of at least size bytes and store its BASIC address
+ErrorCode memory_allocate(LinearMemory* memory, int size, int* address) {
+    if (size <= 0) return ERR_ILLEGAL_FUNCTION_CALL;
+    size_t need = (size_t)size;
+    uint32_t offset = 0;
+    size_t block_size;
+
+    if (need <= MEMORY_MAX_POOLED) {
+        int size_class = size_class_of(need);
+        block_size = (size_t)16 << size_class;
+        FreeList* list = &memory->free_lists[size_class];
+        if (list->count > 0) {
+            offset = list->offsets[--list->count];
+        } else {
+            offset = memory_carve(memory, block_size);
+            if (!offset) return ERR_OUT_OF_MEMORY;
+        }
+    } else {
+        block_size = (need + 4095) & ~(size_t)4095;
+        FreeList* list = &memory->large_free;
+        int found = list->count - 1;
+        while (found >= 0 && memory->blocks[list->offsets[found] / 16] < block_size) found--;
+        if (found >= 0) {
+            offset = list->offsets[found];
+            block_size = memory->blocks[offset / 16];
+            memmove(list->offsets + found, list->offsets + found + 1, (list->count - found - 1) * sizeof(uint32_t));
+            list->count--;
+        } else {
+            offset = memory_carve(memory, block_size);
+            if (!offset) return ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    memory->blocks[offset / 16] = (uint32_t)block_size | BLOCK_IN_USE;
+    memory->in_use += block_size;
+    if (memory->in_use > memory->peak_in_use) memory->peak_in_use = memory->in_use;
+    memory->allocations++;
+    *address = (int)offset;
+    return ERR_NONE;
+}
+
+// Return a block to its free list
+ErrorCode memory_free(LinearMemory* memory, int address) {
+    uint32_t offset = (uint32_t)address;
+    if (address < 16 || (offset & 15) != 0 || offset >= memory->top || !(memory->blocks[offset / 16] & BLOCK_IN_USE)) {
+        return ERR_ILLEGAL_FUNCTION_CALL;
+    }
+    uint32_t block_size = memory->blocks[offset / 16] & ~BLOCK_IN_USE;
+    memory->blocks[offset / 16] = block_size;
+    free_list_push(block_size <= MEMORY_MAX_POOLED ? &memory->free_lists[size_class_of(block_size)] : &memory->large_free,
+                   offset);
+    memory->in_use -= block_size;
+    memory->frees++;
+    return ERR_NONE;
+}
+
+// Unmap the region and drop its block table and free lists, crediting the account
+static void memory_release(LinearMemory* memory) {
+    if (memory->base) munmap(memory->base, memory->reserved);
+    account_credit(memory->account, memory->committed + block_table_bytes(memory->committed));
+    free(memory->blocks);
+    for (int i = 0; i < MEMORY_SIZE_CLASSES; i++) free(memory->free_lists[i].offsets);
+    free(memory->large_free.offsets);
+}
+
+static _Thread_local ThreadCounters thread_counters;
+
+/* ---------------------------------------------------------------------------
+   Strings
+   --------------------------------------------------------------------------- */
+
+// Allocate a string owning a copy of data
+String* string_new(const char* data, int length) {
+    thread_counters.string_allocations++;
+    thread_counters.string_bytes += length + 1;
+    String* string = (String*)malloc(sizeof(String) + length + 1);
+    string->refcount = 1;
+    string->length = length;
+    string->mapping = NULL;
+    string->account = thread_account;
+    account_add(string->account, sizeof(String) + length + 1);
+    memcpy(string->bytes, data, length);
+    string->bytes[length] = '\0';
+    string->data = string->bytes;
+    return string;
+}
+
+// Make a string that borrows bytes from a file mapping
+static String* string_slice(FileMapping* mapping, const char* data, int length) {
+    thread_counters.string_allocations++;
+    String* string = (String*)malloc(sizeof(String));
+    string->refcount = 1;
+    string->length = length;
+    string->data = data;
+    string->mapping = mapping;
+    string->account = thread_account;
+    account_add(string->account, sizeof(String));   // The bytes belong to the mapping
+    mapping->refcount++;
+    return string;
+}
+
+// Release one reference to a file mapping
+static void mapping_release(FileMapping* mapping) {
+    if (--mapping->refcount == 0) {
+        munmap(mapping->base, mapping->size);
+        free(mapping);
+    }
+}
+
+void string_retain(String* string) {
+    if (string) string->refcount++;
+}
+
+void string_release(String* string) {
+    if (string && --string->refcount == 0) {
+        thread_counters.string_frees++;
+        account_credit(string->account, sizeof(String) + (string->mapping ? 0 : string->length + 1));
+        if (string->mapping) mapping_release(string->mapping);
+        free(string);
+    }
+}
+
+static int string_length(const String* string) {
+    return string ? string->length : 0;
+}
+
+static const char* string_data(const String* string) {
+    return string ? string->data : "";
+}
+
+// Concatenate two strings, consuming both references
+static String* string_concat(String* left, String* right) {
+    if (!left) return right;
+    if (!right) return left;
+    size_t length = (size_t)left->length + right->length;
+    thread_counters.string_allocations++;
+    thread_counters.string_bytes += length + 1;
+    String* result = (String*)malloc(sizeof(String) + length + 1);
+    result->refcount = 1;
+    result->length = (int)length;
+    result->mapping = NULL;
+    result->account = thread_account;
+    account_add(result->account, sizeof(String) + result->length + 1);
+    memcpy(result->bytes, left->data, left->length);
+    memcpy(result->bytes + left->length, right->data, right->length);
+    result->bytes[result->length] = '\0';
+    result->data = result->bytes;
+    string_release(left);
+    string_release(right);
+    return result;
+}
+
+// Compare two strings byte-wise like memcmp
+static int string_compare(const String* left, const String* right) {
+    int left_length = string_length(left), right_length = string_length(right);
+    int common = left_length < right_length ? left_length : right_length;
+    int result = common > 0 ? memcmp(string_data(left), string_data(right), common) : 0;
+    if (result != 0) return result;
+    return (left_length > right_length) - (left_length < right_length);
+}
+
+/* ---------------------------------------------------------------------------
+   File channels
+
+   Input files that can be mapped are read in place: LINE INPUT# and INPUT#
+   return slices of the mapping, so a line costs one memchr and one small
+   allocation. Everything else goes through a CHANNEL_BUFFER_SIZE buffer.
+   --------------------------------------------------------------------------- */
+
+// Wrap an open descriptor in a channel, mapping it when it is a non-empty regular file
+static Channel* channel_attach(int fd, bool output) {
+    Channel* channel = (Channel*)calloc(1, sizeof(Channel));
+    channel->fd = fd;
+    channel->output = output;
+    struct stat info;
+    if (!output && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            madvise(base, (size_t)info.st_size, MADV_SEQUENTIAL);
+            channel->mapping = (FileMapping*)malloc(sizeof(FileMapping));
+            channel->mapping->refcount = 1;
+            channel->mapping->base = (unsigned char*)base;
+            channel->mapping->size = (size_t)info.st_size;
+            return channel;
+        }
+    }
+    channel->buffer_capacity = CHANNEL_BUFFER_SIZE;
+    channel->buffer = (char*)malloc(channel->buffer_capacity);
+    return channel;
+}
+
+// Channel for a BASIC channel number; -1 is standard input
+static Channel* channel_lookup(Interpreter* interpreter, int number) {
+    if (number == -1) {
+        if (!interpreter->console) interpreter->console = channel_attach(0, false);
+        return interpreter->console;
+    }
+    if (number < 0 || number >= MAX_CHANNELS) return NULL;
+    return interpreter->channels[number];
+}
+
+// Write out buffered output
+static ErrorCode channel_flush(Channel* channel) {
+    size_t written = 0;
+    while (written < channel->buffer_length) {
+        ssize_t count = write(channel->fd, channel->buffer + written, channel->buffer_length - written);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            channel->buffer_length = 0;
+            return ERR_DEVICE_IO;
+        }
+        written += (size_t)count;
+    }
+    channel->buffer_length = 0;
+    return ERR_NONE;
+}
+
+// open() a file named by a BASIC string
+static ErrorCode open_file(String* filename, int flags, int* fd) {
+    // Slices are not NUL-terminated, so copy the name
+    char path[4096];
+    int length = string_length(filename);
+    if (length == 0 || length >= (int)sizeof(path)) return ERR_FILE_NOT_FOUND;
+    memcpy(path, filename->data, length);
+    path[length] = '\0';
+    *fd = open(path, flags | O_CLOEXEC, 0644);
+    if (*fd < 0) return errno == ENOENT ? ERR_FILE_NOT_FOUND : ERR_DEVICE_IO;
+    return ERR_NONE;
+}
+
+// OPEN mode$ ("I" input, "O" output, "A" append), #number, filename$
+ErrorCode channel_open(Interpreter* interpreter, int number, String* mode, String* filename) {
+    if (number < 0 || number >= MAX_CHANNELS) return ERR_BAD_FILE_NUMBER;
+    if (interpreter->channels[number]) return ERR_FILE_ALREADY_OPEN;
+    int flags;
+    switch (string_length(mode) > 0 ? mode->data[0] : ' ') {
+        case 'I': case 'i': flags = O_RDONLY; break;
+        case 'O': case 'o': flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+        case 'A': case 'a': flags = O_WRONLY | O_CREAT | O_APPEND; break;
+        default: return ERR_BAD_FILE_MODE;
+    }
+    int fd;
+    ErrorCode error = open_file(filename, flags, &fd);
+    if (error != ERR_NONE) return error;
+    interpreter->channels[number] = channel_attach(fd, flags != O_RDONLY);
+    return ERR_NONE;
+}
+
+// CLOSE #number; open strings keep a closed file's mapping alive
+ErrorCode channel_close(Interpreter* interpreter, int number) {
+    Channel* channel = channel_lookup(interpreter, number);
+    if (!channel) return ERR_BAD_FILE_NUMBER;
+    ErrorCode error = channel->output ? channel_flush(channel) : ERR_NONE;
+    if (channel->mapping) mapping_release(channel->mapping);
+    if (number != -1) close(channel->fd);   // Standard input stays open
+    free(channel->buffer);
+    free(channel);
+    if (number == -1) {
+        interpreter->console = NULL;
+    } else {
+        interpreter->channels[number] = NULL;
+    }
+    return error;
+}
+
+// CLOSE without a channel number, and program end
+void channel_close_all(Interpreter* interpreter) {
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        if (interpreter->channels[i]) channel_close(interpreter, i);
+    }
+}
+
+// Append bytes to an output channel's buffer
+ErrorCode channel_write(Channel* channel, const char* data, size_t length) {
+    if (!channel->output) return ERR_BAD_FILE_MODE;
+    thread_counters.file_bytes_written += (long)length;
+    if (channel->buffer_length + length > channel->buffer_capacity) {
+        ErrorCode error = channel_flush(channel);
+        if (error != ERR_NONE) return error;
+        if (length > channel->buffer_capacity) {
+            // Too big to buffer: write through
+            while (length > 0) {
+                ssize_t count = write(channel->fd, data, length);
+                if (count < 0) {
+                    if (errno == EINTR) continue;
+                    return ERR_DEVICE_IO;
+                }
+                data += count;
+                length -= (size_t)count;
+            }
+            return ERR_NONE;
+        }
+    }
+    memcpy(channel->buffer + channel->buffer_length, data, length);
+    channel->buffer_length += length;
+    return ERR_NONE;
+}
+
+// Make the unread input available as one window that holds a whole line (or the rest of the file)
+static ErrorCode channel_window(Channel* channel, const char** start, size_t* available) {
+    if (channel->output) return ERR_BAD_FILE_MODE;
+    if (channel->mapping) {
+        *start = (const char*)channel->mapping->base + channel->position;
+        *available = channel->mapping->size - channel->position;
+        return ERR_NONE;
+    }
+    size_t scanned = 0;
+    for (;;) {
+        size_t pending = channel->buffer_length - channel->buffer_position;
+        if (memchr(channel->buffer + channel->buffer_position + scanned, '\n', pending - scanned) || channel->at_eof) break;
+        scanned = pending;
+        // Compact, then grow when a single line fills the whole buffer
+        memmove(channel->buffer, channel->buffer + channel->buffer_position, pending);
+        channel->buffer_length = pending;
+        channel->buffer_position = 0;
+        if (channel->buffer_length == channel->buffer_capacity) {
+            channel->buffer_capacity *= 2;
+            channel->buffer = (char*)realloc(channel->buffer, channel->buffer_capacity);
+        }
+        ssize_t count = read(channel->fd, channel->buffer + channel->buffer_length,
+                             channel->buffer_capacity - channel->buffer_length);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return ERR_DEVICE_IO;
+        }
+        if (count == 0) channel->at_eof = true;
+        channel->buffer_length += (size_t)count;
+    }
+    *start = channel->buffer + channel->buffer_position;
+    *available = channel->buffer_length - channel->buffer_position;
+    return ERR_NONE;
+}
+
+// Mark bytes of the current window as read
+static void channel_consume(Channel* channel, size_t count) {
+    thread_counters.file_bytes_read += (long)count;
+    if (channel->mapping) {
+        channel->position += count;
+    } else {
+        channel->buffer_position += count;
+    }
+}
+
+// Make a string for part of the window: a slice for mapped files, a copy otherwise
+static String* channel_string(Channel* channel, const char* data, size_t length) {
+    if (length == 0) return NULL;
+    return channel->mapping ? string_slice(channel->mapping, data, (int)length) : string_new(data, (int)length);
+}
+
+// LINE INPUT#: the next line without its terminator
+ErrorCode channel_read_line(Channel* channel, String** line) {
+    const char* start;
+    size_t available;
+    ErrorCode error = channel_window(channel, &start, &available);
+    if (error != ERR_NONE) return error;
+    if (available == 0) return ERR_INPUT_PAST_END;
+    const char* newline = (const char*)memchr(start, '\n', available);
+    size_t length = newline ? (size_t)(newline - start) : available;
+    channel_consume(channel, newline ? length + 1 : length);
+    if (length > 0 && start[length - 1] == '\r') length--;
+    *line = channel_string(channel, start, length);
+    return ERR_NONE;
+}
+
+// INPUT#: the next comma- or line-separated field, unquoted and trimmed
+ErrorCode channel_read_field(Channel* channel, String** field) {
+    const char* start;
+    size_t available;
+    ErrorCode error = channel_window(channel, &start, &available);
+    if (error != ERR_NONE) return error;
+    size_t at = 0;
+    while (at < available && (start[at] == ' ' || start[at] == '\t')) at++;
+    if (at == available) {
+        channel_consume(channel, at);
+        return ERR_INPUT_PAST_END;
+    }
+    size_t begin = at, end;
+    if (start[at] == '"') {
+        begin = ++at;
+        while (at < available && start[at] != '"' && start[at] != '\n') at++;
+        end = at;
+        if (at < available && start[at] == '"') at++;
+        while (at < available && start[at] != ',' && start[at] != '\n') at++;
+    } else {
+        while (at < available && start[at] != ',' && start[at] != '\n') at++;
+        end = at;
+        while (end > begin && (start[end - 1] == ' ' || start[end - 1] == '\t' || start[end - 1] == '\r')) end--;
+    }
+    if (at < available) at++;   // Delimiter
+    channel_consume(channel, at);
+    *field = channel_string(channel, start + begin, end - begin);
+    return ERR_NONE;
+}
+
+// EOF(): no unread input remains
+bool channel_eof(Channel* channel) {
+    if (channel->output) return true;
+    if (channel->mapping) return channel->position >= channel->mapping->size;
+    const char* start;
+    size_t available;
+    if (channel->buffer_position < channel->buffer_length) return false;
+    return channel_window(channel, &start, &available) != ERR_NONE || available == 0;
+}
+
+// Convert an INPUT field to a number; an empty field reads as 0
+static int field_to_int(const String* field) {
+    char digits[32];
+    int length = string_length(field);
+    if (length >= (int)sizeof(digits)) length = sizeof(digits) - 1;
+    memcpy(digits, string_data(field), length);
+    digits[length] = '\0';
+    return (int)strtol(digits, NULL, 10);
+}
+
+// Convert an INPUT field to a float; an empty field reads as 0
+static double field_to_float(const String* field) {
+    char digits[64];
+    int length = string_length(field);
+    if (length >= (int)sizeof(digits)) length = sizeof(digits) - 1;
+    memcpy(digits, string_data(field), length);
+    digits[length] = '\0';
+    return strtod(digits, NULL);
+}
+
+/* ---------------------------------------------------------------------------
+   Arrays and binary block I/O
+
+   BLOAD/BSAVE move raw bytes between files and an array's storage (or the
+   ALLOCATE region) with pread/pwrite and no per-element conversion. A BLOAD
+   that covers a large array replaces its storage with a private file
+   mapping, so pages are only read when touched and only copied when
+   written. MAP backs the array with a shared mapping: writes go to the file.
+   --------------------------------------------------------------------------- */
+
+// Free an array's storage and leave it undimensioned
+void array_release(Array* array) {
+    account_credit(array->account, (size_t)array->length * sizeof(int));
+    if (array->mapped_bytes) {
+        munmap(array->data, array->mapped_bytes);
+    } else {
+        free(array->data);
+    }
+    memset(array, 0, sizeof(Array));
+}
+
+// DIM: bounds are inclusive upper bounds, so DIM a(9) has ten elements
+ErrorCode array_dimension(Array* array, const int* bounds, int dimension_count) {
+    long long length = 1;
+    for (int i = 0; i < dimension_count; i++) {
+        if (bounds[i] < 0) return ERR_ILLEGAL_FUNCTION_CALL;
+        length *= (long long)bounds[i] + 1;
+        if (length > 0x7fffffff / (long long)sizeof(int)) return ERR_OUT_OF_MEMORY;
+    }
+    // A re-DIM is charged for both arrays, as both are held until the old one is released
+    MemoryAccount* account = thread_account;
+    if (!account_charge(account, (size_t)length * sizeof(int))) return ERR_OUT_OF_MEMORY;
+    int* data = (int*)calloc((size_t)length, sizeof(int));
+    if (!data) {
+        account_credit(account, (size_t)length * sizeof(int));
+        return ERR_OUT_OF_MEMORY;
+    }
+    array_release(array);
+    array->data = data;
+    array->account = account;
+    array->length = (int)length;
+    array->dimension_count = dimension_count;
+    for (int i = 0; i < dimension_count; i++) array->extents[i] = bounds[i] + 1;
+    return ERR_NONE;
+}
+
+// Row-major element offset for subscripts, or -1 when any is out of range
+static long array_offset(const Array* array, const int* subscripts, int count) {
+    if (count != array->dimension_count) return -1;
+    long offset = 0;
+    for (int i = 0; i < count; i++) {
+        if ((unsigned)subscripts[i] >= (unsigned)array->extents[i]) return -1;
+        offset = offset * array->extents[i] + subscripts[i];
+    }
+    return offset;
+}
+
+// pread until length bytes have arrived or the file ends
+static ErrorCode read_fully(int fd, void* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t count = pread(fd, (char*)buffer + done, length - done, (off_t)done);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return ERR_DEVICE_IO;
+        }
+        if (count == 0) break;
+        done += (size_t)count;
+    }
+    thread_counters.file_bytes_read += (long)done;
+    return ERR_NONE;
+}
+
+// pwrite all length bytes
+static ErrorCode write_fully(int fd, const void* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t count = pwrite(fd, (const char*)buffer + done, length - done, (off_t)done);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return ERR_DEVICE_IO;
+        }
+        done += (size_t)count;
+    }
+    thread_counters.file_bytes_written += (long)done;
+    return ERR_NONE;
+}
+
+// BLOAD file$, a(): fill the array from the start of the file; elements past the end of the file are unchanged
+ErrorCode array_bload(Array* array, String* filename) {
+    if (array->dimension_count == 0) return ERR_SUBSCRIPT_OUT_OF_RANGE;
+    int fd;
+    ErrorCode error = open_file(filename, O_RDONLY, &fd);
+    if (error != ERR_NONE) return error;
+    struct stat info;
+    size_t array_bytes = (size_t)array->length * sizeof(int);
+    if (fstat(fd, &info) == 0 && !array->mapped_bytes && array_bytes >= ARRAY_MAP_THRESHOLD &&
+        (size_t)info.st_size >= array_bytes) {
+        void* data = mmap(NULL, array_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            free(array->data);
+            array->data = (int*)data;
+            array->mapped_bytes = array_bytes;
+            thread_counters.file_bytes_read += (long)array_bytes;
+            close(fd);
+            return ERR_NONE;
+        }
+    }
+    error = read_fully(fd, array->data, array_bytes);
+    close(fd);
+    return error;
+}
+
+// BLOAD file$, a() MAP: back the array by the file. An undimensioned array takes the file's size as a 1-D array.
+ErrorCode array_map(Array* array, String* filename) {
+    int fd;
+    ErrorCode error = open_file(filename, O_RDWR, &fd);
+    if (error != ERR_NONE) return error;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return ERR_DEVICE_IO;
+    }
+    size_t bytes = array->dimension_count ? (size_t)array->length * sizeof(int) : (size_t)info.st_size;
+    if (bytes == 0 || bytes % sizeof(int) != 0 || bytes > (size_t)info.st_size || bytes > 0x7fffffff) {
+        close(fd);
+        return ERR_ILLEGAL_FUNCTION_CALL;
+    }
+    void* data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return ERR_DEVICE_IO;
+
+    Array mapped = *array;
+    mapped.account = NULL;
+    if (!array->dimension_count) {
+        mapped.dimension_count = 1;
+        mapped.extents[0] = (int)(bytes / sizeof(int));
+        mapped.length = mapped.extents[0];
+    }
+    array->dimension_count = 0;     // Keep array_release from touching the shape we just copied
+    array_release(array);
+    *array = mapped;
+    array->data = (int*)data;
+    array->mapped_bytes = bytes;
+    return ERR_NONE;
+}
+
+// BSAVE file$, a(): write the array's bytes
+ErrorCode array_bsave(Array* array, String* filename) {
+    if (array->dimension_count == 0) return ERR_SUBSCRIPT_OUT_OF_RANGE;
+    int fd;
+    ErrorCode error = open_file(filename, O_WRONLY | O_CREAT | O_TRUNC, &fd);
+    if (error != ERR_NONE) return error;
+    error = write_fully(fd, array->data, (size_t)array->length * sizeof(int));
+    close(fd);
+    return error;
+}
+
+// BLOAD file$, address [, length]: length -1 loads the whole file. *loaded is set to the length of the range.
+// Any committed bytes may be loaded over, freed blocks included: the allocator keeps nothing there.
+ErrorCode memory_bload(LinearMemory* memory, String* filename, int address, int length, int* loaded) {
+    int fd;
+    ErrorCode error = open_file(filename, O_RDONLY, &fd);
+    if (error != ERR_NONE) return error;
+    struct stat info;
+    if (length < 0) length = (fstat(fd, &info) == 0 && info.st_size <= 0x7fffffff) ? (int)info.st_size : -1;
+    if (address < 0 || length < 0 || (size_t)address + (size_t)length > memory->committed) {
+        close(fd);
+        return ERR_ILLEGAL_FUNCTION_CALL;
+    }
+    *loaded = length;
+    error = read_fully(fd, memory->base + address, (size_t)length);
+    close(fd);
+    return error;
+}
+
+// BSAVE file$, address, length
+ErrorCode memory_bsave(LinearMemory* memory, String* filename, int address, int length) {
+    if (address < 0 || length < 0 || (size_t)address + (size_t)length > memory->committed) {
+        return ERR_ILLEGAL_FUNCTION_CALL;
+    }
+    int fd;
+    ErrorCode error = open_file(filename, O_WRONLY | O_CREAT | O_TRUNC, &fd);
+    if (error != ERR_NONE) return error;
+    error = write_fully(fd, memory->base + address, (size_t)length);
+    close(fd);
+    return error;
+}
+
+/* ---------------------------------------------------------------------------
+   Record and replay
+
+   A run's behaviour depends on the world only through what it reads: the
+   outcome of OPEN, the values INPUT and LINE INPUT return, what EOF says,
+   and the bytes BLOAD and MAP bring in. With interpreter_set_record(),
+   run_program() logs each of these as it happens; with
+   interpreter_set_replay(), it takes them from the log instead of reading
+   them, so the run repeats exactly, down to the errors it trapped, without
+   the input files or a console. The log is what makes engine changes
+   comparable on bit-identical work, and since it sits at the statement
+   level rather than the instruction level, a replay can run with the JIT,
+   another inline budget or the profiler attached.
+
+   The log starts with a header holding the program's source key, and each
+   input is one event: a kind byte, a LEB128 value (the error code, or the
+   EOF result), and for reads and blocks that succeeded, a LEB128 length
+   and the bytes. Output still happens on replay: files opened for writing
+   are written. A channel opened for reading is attached to /dev/null,
+   since nothing is read from it, and an array BLOADed with MAP is replayed
+   as a private copy, so its writes do not reach the file. If the program
+   asks for an input the log does not have next, the replay stops there.
+   --------------------------------------------------------------------------- */
+
+#define RUN_LOG_MAGIC 0x31524647u   // "GFR1"
+#define RUN_LOG_VERSION 1
+
+typedef enum {
+    RUN_LOG_OPEN = 1,
+    RUN_LOG_READ,
+    RUN_LOG_EOF,
+    RUN_LOG_BLOCK
+} RunLogEvent;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;                   // source_key of the program that was recorded
+} RunLogHeader;
+
+static const char* const run_log_event_names[] = {"an unknown event", "OPEN", "INPUT", "EOF", "BLOAD"};
+
+// Open interpreter->run_log_path for the run about to start. Returns false, with a message, if it cannot be used.
+static bool run_log_open(Interpreter* interpreter) {
+    bool replaying = interpreter->run_log_replay;
+    FILE* file = fopen(interpreter->run_log_path, replaying ? "rb" : "wb");
+    if (!file) {
+        perror(interpreter->run_log_path);
+        return false;
+    }
+    RunLogHeader header = {RUN_LOG_MAGIC, RUN_LOG_VERSION, interpreter->source_key};
+    if (replaying) {
+        RunLogHeader recorded;
+        if (fread(&recorded, sizeof(recorded), 1, file) != 1 || recorded.magic != RUN_LOG_MAGIC ||
+            recorded.version != RUN_LOG_VERSION || recorded.key != header.key) {
+            fprintf(stderr, "Replay: %s is not a log of this program\n", interpreter->run_log_path);
+            fclose(file);
+            return false;
+        }
+    } else if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        perror(interpreter->run_log_path);
+        fclose(file);
+        return false;
+    }
+    interpreter->run_log = (RunLog*)calloc(1, sizeof(RunLog));
+    interpreter->run_log->file = file;
+    interpreter->run_log->replaying = replaying;
+    return true;
+}
+
+static void run_log_close(Interpreter* interpreter) {
+    RunLog* log = interpreter->run_log;
+    if (log->replaying && interpreter->running && fgetc(log->file) != EOF) {
+        fprintf(stderr, "Replay: the run ended before using all of %s\n", interpreter->run_log_path);
+    }
+    if (fclose(log->file) != 0 && !log->replaying) perror(interpreter->run_log_path);
+    printf("[DEBUG] %s %ld inputs %s %s.\n", log->replaying ? "Replayed" : "Recorded", log->events,
+           log->replaying ? "from" : "to", interpreter->run_log_path);
+    free(log);
+    interpreter->run_log = NULL;
+}
+
+static void put_leb128(FILE* file, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), file);
+    } while (value);
+}
+
+static bool get_leb128(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) return false;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Append an event; data is written only for a successful read or block
+static void run_log_put(RunLog* log, RunLogEvent kind, int value, const void* data, size_t length) {
+    fputc(kind, log->file);
+    put_leb128(log->file, (uint64_t)value);
+    if (data && value == ERR_NONE) {
+        put_leb128(log->file, length);
+        fwrite(data, 1, length, log->file);
+    }
+    log->events++;
+}
+
+// Take the next event, which must be of the given kind. Its bytes, if it carries any, are returned in *data, to
+// be freed. If the log has something else next, the replay has diverged: the run is stopped and false returned.
+static bool run_log_get(Interpreter* interpreter, RunLogEvent kind, int* value, char** data, size_t* length) {
+    RunLog* log = interpreter->run_log;
+    int recorded = fgetc(log->file);
+    uint64_t number = 0, size = 0;
+    bool valid = recorded == (int)kind && get_leb128(log->file, &number);
+    if (valid && data) {
+        *data = NULL;
+        *length = 0;
+        if (number == ERR_NONE) {
+            valid = get_leb128(log->file, &size) && size <= 0x7fffffff;
+            if (valid) {
+                *data = (char*)malloc(size ? size : 1);
+                *length = size;
+                valid = fread(*data, 1, size, log->file) == size;
+                if (!valid) free(*data);
+            }
+        }
+    }
+    if (!valid) {
+        char found[40];
+        if (recorded == EOF) {
+            snprintf(found, sizeof(found), "ends");
+        } else if (recorded == (int)kind) {
+            snprintf(found, sizeof(found), "is cut short");
+        } else {
+            snprintf(found, sizeof(found), "has %s", run_log_event_names[recorded <= RUN_LOG_BLOCK ? recorded : 0]);
+        }
+        fprintf(stderr, "Replay: the program asked for %s after %ld inputs, but %s %s\n", run_log_event_names[kind],
+                log->events, interpreter->run_log_path, found);
+        interpreter->running = false;
+        return false;
+    }
+    *value = (int)number;
+    log->events++;
+    return true;
+}
+
+// OPEN mode$, #number, filename$
+static ErrorCode logged_open(Interpreter* interpreter, int number, String* mode, String* filename) {
+    RunLog* log = interpreter->run_log;
+    if (!log) return channel_open(interpreter, number, mode, filename);
+    if (!log->replaying) {
+        ErrorCode error = channel_open(interpreter, number, mode, filename);
+        run_log_put(log, RUN_LOG_OPEN, error, NULL, 0);
+        return error;
+    }
+    int recorded;
+    if (!run_log_get(interpreter, RUN_LOG_OPEN, &recorded, NULL, NULL)) return ERR_NONE;
+    if (recorded != ERR_NONE) return (ErrorCode)recorded;
+    bool input = string_length(mode) > 0 && (string_data(mode)[0] == 'I' || string_data(mode)[0] == 'i');
+    if (!input) return channel_open(interpreter, number, mode, filename);
+    String* null_device = string_new("/dev/null", 9);
+    ErrorCode error = channel_open(interpreter, number, mode, null_device);
+    string_release(null_device);
+    return error;
+}
+
+// INPUT (a field) or LINE INPUT (a line) from a channel
+static ErrorCode logged_read(Interpreter* interpreter, Channel* channel, bool line, String** string) {
+    RunLog* log = interpreter->run_log;
+    if (!log || !log->replaying) {
+        ErrorCode error = line ? channel_read_line(channel, string) : channel_read_field(channel, string);
+        if (log) {
+            run_log_put(log, RUN_LOG_READ, error, error == ERR_NONE ? string_data(*string) : NULL,
+                        error == ERR_NONE ? (size_t)string_length(*string) : 0);
+        }
+        return error;
+    }
+    int recorded;
+    char* data;
+    size_t length;
+    if (!run_log_get(interpreter, RUN_LOG_READ, &recorded, &data, &length)) {
+        *string = string_new("", 0);
+        return ERR_NONE;
+    }
+    if (recorded != ERR_NONE) return (ErrorCode)recorded;
+    *string = string_new(data, (int)length);
+    free(data);
+    return ERR_NONE;
+}
+
+static bool logged_eof(Interpreter* interpreter, Channel* channel) {
+    RunLog* log = interpreter->run_log;
+    if (!log || !log->replaying) {
+        bool eof = channel_eof(channel);
+        if (log) run_log_put(log, RUN_LOG_EOF, eof, NULL, 0);
+        return eof;
+    }
+    int recorded;
+    return !run_log_get(interpreter, RUN_LOG_EOF, &recorded, NULL, NULL) || recorded;
+}
+
+// BLOAD file$, a() [MAP]; the log holds the whole array as it was afterwards
+static ErrorCode logged_bload_array(Interpreter* interpreter, Array* array, String* filename, bool map) {
+    RunLog* log = interpreter->run_log;
+    if (!log || !log->replaying) {
+        ErrorCode error = map ? array_map(array, filename) : array_bload(array, filename);
+        if (log) run_log_put(log, RUN_LOG_BLOCK, error, array->data, (size_t)array->length * sizeof(int));
+        return error;
+    }
+    int recorded;
+    char* data;
+    size_t length;
+    if (!run_log_get(interpreter, RUN_LOG_BLOCK, &recorded, &data, &length)) return ERR_NONE;
+    if (recorded != ERR_NONE) return (ErrorCode)recorded;
+    ErrorCode error = ERR_NONE;
+    if (array->dimension_count == 0 && map) {
+        // MAP took the file's size as a 1-D array
+        int bound = (int)(length / sizeof(int)) - 1;
+        error = array_dimension(array, &bound, 1);
+    }
+    if (error == ERR_NONE && (size_t)array->length * sizeof(int) == length) {
+        memcpy(array->data, data, length);
+    } else if (error == ERR_NONE) {
+        fprintf(stderr, "Replay: BLOAD into an array of another size than was recorded\n");
+        interpreter->running = false;
+    }
+    free(data);
+    return error;
+}
+
+// BLOAD file$, address [, length]; the log holds the range that was loaded
+static ErrorCode logged_bload_memory(Interpreter* interpreter, String* filename, int address, int length) {
+    RunLog* log = interpreter->run_log;
+    LinearMemory* memory = &interpreter->memory;
+    if (!log || !log->replaying) {
+        int loaded = 0;
+        ErrorCode error = memory_bload(memory, filename, address, length, &loaded);
+        if (log) run_log_put(log, RUN_LOG_BLOCK, error, error == ERR_NONE ? memory->base + address : NULL, (size_t)loaded);
+        return error;
+    }
+    int recorded;
+    char* data;
+    size_t loaded;
+    if (!run_log_get(interpreter, RUN_LOG_BLOCK, &recorded, &data, &loaded)) return ERR_NONE;
+    if (recorded != ERR_NONE) return (ErrorCode)recorded;
+    if (address >= 0 && (size_t)address + loaded <= memory->committed) memcpy(memory->base + address, data, loaded);
+    free(data);
+    return ERR_NONE;
+}
+
+/* ---------------------------------------------------------------------------
+   Baseline JIT for hot loops (x86-64 Linux)
+
+   Every backward jump is a loop back edge. Once a loop head has been reached
+   JIT_HOT_LOOP times through its back edge, the instructions between the
+   head and the back edge are translated one by one into machine code in an
+   mmap'ed region that is writable only while code is being added. The
+   operand stack becomes a fixed set of scratch registers, and the most used
+   variables of the loop live in callee-saved registers for its whole run.
+
+   Anything the template set does not cover (PRINT, GOSUB, arrays, PEEK...)
+   becomes a side exit: variables are written back, live stack registers are
+   stored into the operand stack, and the interpreter resumes at that
+   instruction. A divisor of 0 or -1 exits the same way, before the
+   division, so the interpreter raises the error (or, for -1, checks for
+   INT_MIN, which idiv would trap on) with ON ERROR handling intact. Operand
+   types are fixed at compile time, so no other guards are needed.
+   --------------------------------------------------------------------------- */
+
+#if defined(__x86_64__) && defined(__linux__)
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Operand stack slot i lives in jit_temps[i]; rax and rdx are left free for idiv
+static const int jit_temps[JIT_MAX_TEMPS] = {RCX, RSI, RDI, R8, R9, R10, R11};
+// Homes for the most used variables of the loop
+static const int jit_homes[JIT_MAX_HOMES] = {RBX, R12, R13, R14, R15};
+
+// x86 condition codes for OP_EQ..OP_GE
+static const int jit_conditions[] = {0x4, 0x5, 0xC, 0xE, 0xF, 0xD};
+
+typedef struct {
+    unsigned char *bytes;
+    size_t size;
+    size_t capacity;
+} CodeBuffer;
+
+// Branch in the loop body waiting for the native offset of its target, or for its exit stub
+typedef struct {
+    size_t at;      // Offset of the rel32 field
+    int pc;         // Bytecode target
+    int depth;      // Operand stack depth to materialize (exits only)
+} JitPatch;
+
+static void put_byte(CodeBuffer* buffer, int byte) {
+    if (buffer->size >= buffer->capacity) {
+        buffer->capacity = (buffer->capacity == 0) ? 1024 : buffer->capacity * 2;
+        buffer->bytes = (unsigned char*)realloc(buffer->bytes, buffer->capacity);
+    }
+    buffer->bytes[buffer->size++] = (unsigned char)byte;
+}
+
+static void put_int32(CodeBuffer* buffer, int value) {
+    for (int i = 0; i < 4; i++) put_byte(buffer, (unsigned)value >> (8 * i));
+}
+
+static void patch_int32(CodeBuffer* buffer, size_t at, int value) {
+    for (int i = 0; i < 4; i++) buffer->bytes[at + i] = (unsigned char)((unsigned)value >> (8 * i));
+}
+
+// 32-bit "op r/m, reg" (or "op reg, r/m" for two-byte opcodes) between two registers
+static void put_register_op(CodeBuffer* buffer, int opcode, int reg, int rm) {
+    if (reg >= 8 || rm >= 8) put_byte(buffer, 0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+    if (opcode > 0xff) put_byte(buffer, opcode >> 8);
+    put_byte(buffer, opcode & 0xff);
+    put_byte(buffer, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// 32-bit "op reg, [base + displacement]" / "op [base + displacement], reg"; base is rbp or rax
+static void put_memory_op(CodeBuffer* buffer, int opcode, int reg, int base, int displacement) {
+    if (reg >= 8) put_byte(buffer, 0x44);
+    put_byte(buffer, opcode);
+    put_byte(buffer, 0x80 | (reg & 7) << 3 | base);
+    put_int32(buffer, displacement);
+}
+
+static void put_move_immediate(CodeBuffer* buffer, int reg, int value) {
+    if (reg >= 8) put_byte(buffer, 0x41);
+    put_byte(buffer, 0xB8 | (reg & 7));
+    put_int32(buffer, value);
+}
+
+static void put_push(CodeBuffer* buffer, int reg) {
+    if (reg >= 8) put_byte(buffer, 0x41);
+    put_byte(buffer, 0x50 | (reg & 7));
+}
+
+static void put_pop(CodeBuffer* buffer, int reg) {
+    if (reg >= 8) put_byte(buffer, 0x41);
+    put_byte(buffer, 0x58 | (reg & 7));
+}
+
+// Emit a jcc (condition >= 0) or jmp with a placeholder rel32 and record it
+static void put_branch(CodeBuffer* buffer, int condition, JitPatch** patches, int* count, int* capacity, int pc, int depth) {
+    if (condition >= 0) {
+        put_byte(buffer, 0x0F);
+        put_byte(buffer, 0x80 | condition);
+    } else {
+        put_byte(buffer, 0xE9);
+    }
+    if (*count >= *capacity) {
+        *capacity = (*capacity == 0) ? 16 : *capacity * 2;
+        *patches = (JitPatch*)realloc(*patches, *capacity * sizeof(JitPatch));
+    }
+    (*patches)[*count].at = buffer->size;
+    (*patches)[*count].pc = pc;
+    (*patches)[*count].depth = depth;
+    (*count)++;
+    put_int32(buffer, 0);
+}
+
+// Can the template compiler translate this instruction? Everything else is a side exit.
+static bool jit_supported(OpCode op) {
+    return op == OP_NOP || op == OP_PUSH_INT || op == OP_LOAD || op == OP_STORE ||
+           (op >= OP_ADD_INT && op <= OP_GE) || op == OP_JUMP || op == OP_JUMP_IF_FALSE;
+}
+
+// Translate the loop [head, back_edge] into buffer. Returns false when the loop cannot be compiled.
+static bool jit_translate(Program* program, int head, int back_edge, CodeBuffer* buffer) {
+    int length = back_edge - head + 1;
+    if (length > JIT_MAX_LOOP || !jit_supported(generic_opcode(program->code[head].op))) return false;
+
+    // Translate the generic sequences; the fused and quickened forms only matter to the interpreter
+    Instruction* code = (Instruction*)malloc(program->code_size * sizeof(Instruction));
+    for (int pc = 0; pc < program->code_size; pc++) {
+        code[pc].op = generic_opcode(program->code[pc].op);
+        code[pc].operand = program->code[pc].operand;
+    }
+
+    // Jump targets inside the loop, and the variables worth keeping in registers
+    bool* targets = (bool*)calloc(length, sizeof(bool));
+    int* uses = (int*)calloc(program->symbol_count, sizeof(int));
+    targets[0] = true;
+    for (int pc = head; pc <= back_edge; pc++) {
+        OpCode op = code[pc].op;
+        int operand = code[pc].operand;
+        if ((op == OP_JUMP || op == OP_JUMP_IF_FALSE) && operand >= head && operand <= back_edge) targets[operand - head] = true;
+        if (op == OP_LOAD || op == OP_STORE) uses[operand]++;
+    }
+    int homes[JIT_MAX_HOMES];
+    int home_count = 0;
+    for (; home_count < JIT_MAX_HOMES; home_count++) {
+        int best = -1;
+        for (int slot = 0; slot < program->symbol_count; slot++) {
+            if (uses[slot] > 0 && (best < 0 || uses[slot] > uses[best])) best = slot;
+        }
+        if (best < 0) break;
+        homes[home_count] = best;
+        uses[best] = 0;
+    }
+    free(uses);
+
+    size_t* offsets = (size_t*)malloc(length * sizeof(size_t));
+    JitPatch* jumps = NULL;
+    JitPatch* exits = NULL;
+    int jump_count = 0, jump_capacity = 0, exit_count = 0, exit_capacity = 0;
+    bool ok = true;
+
+    // Prologue: save callee-saved registers and the operand stack pointer, rbp = variables
+    put_push(buffer, RBX);
+    put_push(buffer, RBP);
+    put_push(buffer, R12);
+    put_push(buffer, R13);
+    put_push(buffer, R14);
+    put_push(buffer, R15);
+    put_push(buffer, RSI);
+    put_byte(buffer, 0x48); put_byte(buffer, 0x89); put_byte(buffer, 0xFD);    // mov rbp, rdi
+    for (int i = 0; i < home_count; i++) put_memory_op(buffer, 0x8B, jit_homes[i], RBP, homes[i] * 4);
+
+    int depth = 0;
+    bool reachable = true;
+    for (int pc = head; pc <= back_edge && ok; pc++) {
+        const Instruction* instruction = &code[pc];
+        offsets[pc - head] = buffer->size;
+        if (targets[pc - head]) {
+            // Branches only ever arrive with an empty operand stack
+            if (reachable && depth != 0) { ok = false; break; }
+            reachable = true;
+            depth = 0;
+        }
+        if (!reachable) continue;
+
+        int home = -1;
+        if (instruction->op == OP_LOAD || instruction->op == OP_STORE) {
+            for (int i = 0; i < home_count; i++) if (homes[i] == instruction->operand) home = jit_homes[i];
+        }
+        int needed = instruction->op == OP_LOAD || instruction->op == OP_PUSH_INT ? 0 :
+                     instruction->op == OP_STORE || instruction->op == OP_JUMP_IF_FALSE ? 1 :
+                     instruction->op >= OP_ADD_INT && instruction->op <= OP_GE ? 2 : 0;
+        if (!jit_supported(instruction->op) || depth < needed) {
+            put_branch(buffer, -1, &exits, &exit_count, &exit_capacity, pc, depth);
+            reachable = false;
+            continue;
+        }
+        int top = depth > 0 ? jit_temps[depth - 1] : -1;
+        int below = depth > 1 ? jit_temps[depth - 2] : -1;
+        switch (instruction->op) {
+            case OP_NOP:
+                break;
+            case OP_PUSH_INT:
+            case OP_LOAD:
+                if (depth == JIT_MAX_TEMPS) {
+                    ok = false;
+                } else if (instruction->op == OP_PUSH_INT) {
+                    put_move_immediate(buffer, jit_temps[depth++], instruction->operand);
+                } else if (home >= 0) {
+                    put_register_op(buffer, 0x89, home, jit_temps[depth++]);                // mov temp, home
+                } else {
+                    put_memory_op(buffer, 0x8B, jit_temps[depth++], RBP, instruction->operand * 4);
+                }
+                break;
+            case OP_STORE:
+                if (home >= 0) {
+                    put_register_op(buffer, 0x89, top, home);                               // mov home, temp
+                } else {
+                    put_memory_op(buffer, 0x89, top, RBP, instruction->operand * 4);
+                }
+                depth--;
+                break;
+            case OP_ADD_INT: put_register_op(buffer, 0x01, top, below); depth--; break;         // add below, top
+            case OP_SUB_INT: put_register_op(buffer, 0x29, top, below); depth--; break;         // sub below, top
+            case OP_MUL_INT: put_register_op(buffer, 0x0FAF, below, top); depth--; break;       // imul below, top
+            case OP_DIV_INT:
+                put_register_op(buffer, 0x85, top, top);                                    // test top, top
+                put_branch(buffer, 0x4, &exits, &exit_count, &exit_capacity, pc, depth);    // jz -> interpreter raises the error
+                put_register_op(buffer, 0x83, 7, top);                                      // cmp top, -1
+                put_byte(buffer, 0xFF);
+                put_branch(buffer, 0x4, &exits, &exit_count, &exit_capacity, pc, depth);    // je -> INT_MIN / -1 would trap
+                put_register_op(buffer, 0x89, below, RAX);                                  // mov eax, below
+                put_byte(buffer, 0x99);                                                     // cdq
+                put_register_op(buffer, 0xF7, 7, top);                                      // idiv top
+                put_register_op(buffer, 0x89, RAX, below);                                  // mov below, eax
+                depth--;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE: {
+                int condition = -1;
+                if (instruction->op == OP_JUMP_IF_FALSE) {
+                    put_register_op(buffer, 0x85, top, top);                                // test top, top
+                    condition = 0x4;                                                        // jz
+                    depth--;
+                }
+                if (depth != 0) { ok = false; break; }
+                bool inside = instruction->operand >= head && instruction->operand <= back_edge;
+                if (inside) {
+                    put_branch(buffer, condition, &jumps, &jump_count, &jump_capacity, instruction->operand, 0);
+                } else {
+                    put_branch(buffer, condition, &exits, &exit_count, &exit_capacity, instruction->operand, 0);
+                }
+                if (instruction->op == OP_JUMP) reachable = false;
+                break;
+            }
+            default: {
+                // Comparison; fused with a following JUMP_IF_FALSE that nothing else jumps to
+                int condition = jit_conditions[instruction->op - OP_EQ];
+                put_register_op(buffer, 0x39, top, below);                                  // cmp below, top
+                depth -= 2;
+                if (pc < back_edge && code[pc + 1].op == OP_JUMP_IF_FALSE && !targets[pc + 1 - head] && depth == 0) {
+                    int target = code[++pc].operand;
+                    offsets[pc - head] = buffer->size;
+                    bool inside = target >= head && target <= back_edge;
+                    put_branch(buffer, condition ^ 1, inside ? &jumps : &exits, inside ? &jump_count : &exit_count,
+                               inside ? &jump_capacity : &exit_capacity, target, 0);
+                } else {
+                    int result = jit_temps[depth++];
+                    put_byte(buffer, 0x40 | (result >= 8 ? 1 : 0));                         // setcc result8
+                    put_byte(buffer, 0x0F);
+                    put_byte(buffer, 0x90 | condition);
+                    put_byte(buffer, 0xC0 | (result & 7));
+                    if (result >= 8) put_byte(buffer, 0x45); else put_byte(buffer, 0x40);   // movzx result, result8
+                    put_byte(buffer, 0x0F);
+                    put_byte(buffer, 0xB6);
+                    put_byte(buffer, 0xC0 | (result & 7) << 3 | (result & 7));
+                }
+                break;
+            }
+        }
+    }
+    // A loop that ends in a conditional back edge (REPEAT) falls through to the instruction after it
+    if (ok && reachable) put_branch(buffer, -1, &exits, &exit_count, &exit_capacity, back_edge + 1, depth);
+
+    for (int i = 0; ok && i < jump_count; i++) {
+        patch_int32(buffer, jumps[i].at, (int)(offsets[jumps[i].pc - head] - (jumps[i].at + 4)));
+    }
+
+    // Exit stubs: write the homed variables back, spill the live stack registers, return {pc, depth}
+    size_t* stub_jumps = (size_t*)malloc((exit_count + 1) * sizeof(size_t));
+    for (int i = 0; ok && i < exit_count; i++) {
+        patch_int32(buffer, exits[i].at, (int)(buffer->size - (exits[i].at + 4)));
+        for (int h = 0; h < home_count; h++) put_memory_op(buffer, 0x89, jit_homes[h], RBP, homes[h] * 4);
+        if (exits[i].depth > 0) {
+            put_byte(buffer, 0x48); put_byte(buffer, 0x8B); put_byte(buffer, 0x04); put_byte(buffer, 0x24);  // mov rax, [rsp]
+            for (int d = 0; d < exits[i].depth; d++) put_memory_op(buffer, 0x89, jit_temps[d], RAX, d * 4);
+        }
+        put_move_immediate(buffer, RAX, exits[i].pc);
+        if (exits[i].depth > 0) {
+            put_move_immediate(buffer, RDX, exits[i].depth);
+            put_byte(buffer, 0x48); put_byte(buffer, 0xC1); put_byte(buffer, 0xE2); put_byte(buffer, 0x20);  // shl rdx, 32
+            put_byte(buffer, 0x48); put_byte(buffer, 0x09); put_byte(buffer, 0xD0);                          // or rax, rdx
+        }
+        put_byte(buffer, 0xE9);
+        stub_jumps[i] = buffer->size;
+        put_int32(buffer, 0);
+    }
+    for (int i = 0; ok && i < exit_count; i++) patch_int32(buffer, stub_jumps[i], (int)(buffer->size - (stub_jumps[i] + 4)));
+
+    // Epilogue
+    put_pop(buffer, RDX);       // Operand stack pointer
+    put_pop(buffer, R15);
+    put_pop(buffer, R14);
+    put_pop(buffer, R13);
+    put_pop(buffer, R12);
+    put_pop(buffer, RBP);
+    put_pop(buffer, RBX);
+    put_byte(buffer, 0xC3);
+
+    free(stub_jumps);
+    free(code);
+    free(targets);
+    free(offsets);
+    free(jumps);
+    free(exits);
+    return ok;
+}
+
+// Compile the loop [head, back_edge] into the program's executable region
+static JitLoop jit_compile(Program* program, int head, int back_edge) {
+    JitCache* jit = program->jit;
+    CodeBuffer buffer = {0};
+    JitLoop loop = NULL;
+    if (jit_translate(program, head, back_edge, &buffer)) {
+        if (!jit->code) {
+            void* region = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region != MAP_FAILED) jit->code = (unsigned char*)region;
+        }
+        if (jit->code && jit->code_size + buffer.size <= JIT_CODE_SIZE &&
+            mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) == 0) {
+            memcpy(jit->code + jit->code_size, buffer.bytes, buffer.size);
+            loop = (JitLoop)(void*)(jit->code + jit->code_size);
+            jit->code_size = (jit->code_size + buffer.size + 15) & ~(size_t)15;
+            if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0) loop = NULL;
+            jit->loops_compiled++;
+            printf("[DEBUG] JIT compiled loop %d-%d into %zu bytes.\n", head, back_edge, buffer.size);
+        }
+    }
+    free(buffer.bytes);
+    return loop;
+}
+
+#endif
+
+// Free a program's JIT state
+static void jit_free(JitCache* jit) {
+    if (!jit) return;
+    if (jit->code) munmap(jit->code, JIT_CODE_SIZE);
+    free(jit->counts);
+    free(jit->loops);
+    free(jit);
+}
+
+// A backward jump from back_edge to head was taken. Count it, and once the loop is hot run it natively.
+// Returns the pc to continue at; *sp is updated when native code leaves values on the operand stack.
+static int jit_back_edge(Interpreter* interpreter, Program* program, int head, int back_edge, int** sp) {
+#if defined(__x86_64__) && defined(__linux__)
+    if (!program->jit) {
+        program->jit = (JitCache*)calloc(1, sizeof(JitCache));
+        program->jit->counts = (int*)calloc(program->code_size, sizeof(int));
+        program->jit->loops = (JitLoop*)calloc(program->code_size, sizeof(JitLoop));
+    }
+    JitCache* jit = program->jit;
+    if (!jit->loops[head]) {
+        // Counts stop at the threshold; a loop that failed to compile is not retried
+        if (jit->counts[head] > JIT_HOT_LOOP || ++jit->counts[head] <= JIT_HOT_LOOP) return head;
+        jit->loops[head] = jit_compile(program, head, back_edge);
+        if (!jit->loops[head]) return head;
+    }
+    if (*sp != interpreter->operand_stack) return head;
+    JitExit exit = jit->loops[head](interpreter->variables, interpreter->operand_stack);
+    jit->native_entries++;
+    *sp = interpreter->operand_stack + exit.depth;
+    return exit.pc;
+#else
+    (void)interpreter;
+    (void)program;
+    (void)back_edge;
+    (void)sp;
+    return head;
+#endif
+}
+
+/* ---------------------------------------------------------------------------
+   Memo tables
+
+   Each memo is an open-addressing table of MEMO_CAPACITY entries, probed
+   over a window of MEMO_PROBES from the key's hash. A miss claims a free
+   entry in the window or, failing that, evicts by second chance: entries
+   hit since the last sweep lose their clock bit and are passed over once.
+   Entries whose call is still running are evicted only as a last resort;
+   the generation count then keeps that call from recording its results.
+   Float keys compare bitwise, strings by content.
+   --------------------------------------------------------------------------- */
+
+static MemoValue* memo_values(Memo* memo, int entry) {
+    return &memo->values[(size_t)entry * (memo->key_count + memo->result_count)];
+}
+
+// Current value of a memoized variable; strings are borrowed
+static MemoValue memo_read(Interpreter* interpreter, const MemoSlot* slot) {
+    MemoValue value;
+    if (slot->type == TYPE_STRING) {
+        value.s = interpreter->string_variables[slot->slot];
+    } else if (slot->type == TYPE_FLOAT) {
+        value.f = interpreter->float_variables[slot->slot];
+    } else {
+        value.i = interpreter->variables[slot->slot];
+    }
+    return value;
+}
+
+// Store a cached result into its variable
+static void memo_write(Interpreter* interpreter, const MemoSlot* slot, MemoValue value) {
+    if (slot->type == TYPE_STRING) {
+        string_retain(value.s);
+        string_release(interpreter->string_variables[slot->slot]);
+        interpreter->string_variables[slot->slot] = value.s;
+    } else if (slot->type == TYPE_FLOAT) {
+        interpreter->float_variables[slot->slot] = value.f;
+    } else {
+        interpreter->variables[slot->slot] = value.i;
+    }
+}
+
+static uint32_t memo_hash(Interpreter* interpreter, const Memo* memo) {
+    uint32_t hash = 2166136261u;
+    for (int k = 0; k < memo->key_count; k++) {
+        MemoValue value = memo_read(interpreter, &memo->slots[k]);
+        const unsigned char* bytes = (const unsigned char*)&value.i;
+        size_t length = sizeof(int);
+        if (memo->slots[k].type == TYPE_STRING) {
+            bytes = (const unsigned char*)string_data(value.s);
+            length = string_length(value.s);
+        } else if (memo->slots[k].type == TYPE_FLOAT) {
+            bytes = (const unsigned char*)&value.f;
+            length = sizeof(double);
+        }
+        for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Do the variables hold the key of this entry?
+static bool memo_key_matches(Interpreter* interpreter, Memo* memo, int entry) {
+    MemoValue* keys = memo_values(memo, entry);
+    for (int k = 0; k < memo->key_count; k++) {
+        MemoValue value = memo_read(interpreter, &memo->slots[k]);
+        bool equal;
+        if (memo->slots[k].type == TYPE_STRING) {
+            equal = string_length(value.s) == string_length(keys[k].s) &&
+                    memcmp(string_data(value.s), string_data(keys[k].s), string_length(value.s)) == 0;
+        } else if (memo->slots[k].type == TYPE_FLOAT) {
+            equal = memcmp(&value.f, &keys[k].f, sizeof(double)) == 0;
+        } else {
+            equal = value.i == keys[k].i;
+        }
+        if (!equal) return false;
+    }
+    return true;
+}
+
+// Drop the values held by an entry
+static void memo_clear(Memo* memo, int entry) {
+    MemoValue* values = memo_values(memo, entry);
+    for (int i = 0; i < memo->key_count + memo->result_count; i++) {
+        if (memo->slots[i].type == TYPE_STRING) string_release(values[i].s);
+    }
+    memset(values, 0, (memo->key_count + memo->result_count) * sizeof(MemoValue));
+    memo->entries[entry].used = false;
+    memo->entries[entry].valid = false;
+}
+
+// Drop the cached calls of a memo; its slot list belongs to the program
+void memo_free(Memo* memo) {
+    for (int i = 0; memo->entries && i < MEMO_CAPACITY; i++) {
+        if (memo->entries[i].used) memo_clear(memo, i);
+    }
+    free(memo->entries);
+    free(memo->values);
+}
+
+// Look up a call before its GOSUB. On a hit the cached results are written to their variables and true is
+// returned; on a miss an entry is claimed for the key and the call is tracked until its RETURN.
+static bool memo_lookup(Interpreter* interpreter, Program* program, int index) {
+    Memo* memo = &program->memos[index];
+    int width = memo->key_count + memo->result_count;
+    if (!memo->entries) {
+        memo->entries = (MemoEntry*)calloc(MEMO_CAPACITY, sizeof(MemoEntry));
+        memo->values = (MemoValue*)calloc((size_t)MEMO_CAPACITY * width, sizeof(MemoValue));
+    }
+    uint32_t hash = memo_hash(interpreter, memo);
+    for (int probe = 0; probe < MEMO_PROBES; probe++) {
+        int entry = (hash + probe) & (MEMO_CAPACITY - 1);
+        if (memo->entries[entry].valid && memo->entries[entry].hash == hash && memo_key_matches(interpreter, memo, entry)) {
+            MemoValue* results = memo_values(memo, entry) + memo->key_count;
+            for (int r = 0; r < memo->result_count; r++) memo_write(interpreter, &memo->slots[memo->key_count + r], results[r]);
+            memo->entries[entry].referenced = true;
+            memo->hits++;
+            return true;
+        }
+    }
+    memo->misses++;
+
+    int victim = -1;
+    for (int probe = 0; probe < MEMO_PROBES && victim < 0; probe++) {
+        int entry = (hash + probe) & (MEMO_CAPACITY - 1);
+        if (!memo->entries[entry].used) victim = entry;
+    }
+    for (int probe = 0; probe < 2 * MEMO_PROBES && victim < 0; probe++) {
+        MemoEntry* candidate = &memo->entries[(hash + probe % MEMO_PROBES) & (MEMO_CAPACITY - 1)];
+        if (!candidate->valid) continue;
+        if (candidate->referenced) {
+            candidate->referenced = false;
+        } else {
+            victim = (hash + probe % MEMO_PROBES) & (MEMO_CAPACITY - 1);
+        }
+    }
+    if (victim < 0) victim = hash & (MEMO_CAPACITY - 1);
+    MemoEntry* entry = &memo->entries[victim];
+    if (entry->used) {
+        memo_clear(memo, victim);
+        memo->evictions++;
+    }
+    entry->hash = hash;
+    entry->generation++;
+    entry->used = true;
+    entry->referenced = false;
+    MemoValue* keys = memo_values(memo, victim);
+    for (int k = 0; k < memo->key_count; k++) {
+        keys[k] = memo_read(interpreter, &memo->slots[k]);
+        if (memo->slots[k].type == TYPE_STRING) string_retain(keys[k].s);
+    }
+
+    if (interpreter->memo_call_count >= interpreter->memo_call_capacity) {
+        interpreter->memo_call_capacity = interpreter->memo_call_capacity ? interpreter->memo_call_capacity * 2 : 16;
+        interpreter->memo_calls = (MemoCall*)realloc(interpreter->memo_calls, interpreter->memo_call_capacity * sizeof(MemoCall));
+    }
+    MemoCall* call = &interpreter->memo_calls[interpreter->memo_call_count++];
+    call->memo = index;
+    call->entry = victim;
+    call->generation = entry->generation;
+    call->depth = interpreter->return_stack_size + 1;   // The frame the GOSUB is about to push
+    return false;
+}
+
+// RETURN from a frame: if it belongs to a memoized call, record the call's results.
+// Calls tracked deeper than the returning frame never returned and are dropped.
+static void memo_return(Interpreter* interpreter, Program* program) {
+    int depth = interpreter->return_stack_size;
+    while (interpreter->memo_call_count > 0 && interpreter->memo_calls[interpreter->memo_call_count - 1].depth > depth) {
+        interpreter->memo_call_count--;
+    }
+    if (interpreter->memo_call_count == 0 || interpreter->memo_calls[interpreter->memo_call_count - 1].depth != depth) return;
+    MemoCall* call = &interpreter->memo_calls[--interpreter->memo_call_count];
+    Memo* memo = &program->memos[call->memo];
+    MemoEntry* entry = &memo->entries[call->entry];
+    if (entry->generation != call->generation) return;
+    MemoValue* results = memo_values(memo, call->entry) + memo->key_count;
+    for (int r = 0; r < memo->result_count; r++) {
+        results[r] = memo_read(interpreter, &memo->slots[memo->key_count + r]);
+        if (memo->slots[memo->key_count + r].type == TYPE_STRING) string_retain(results[r].s);
+    }
+    entry->valid = true;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Start timing the call whose frame was just pushed
+static void call_timing_start(Interpreter* interpreter) {
+    if (interpreter->timed_call_count >= interpreter->timed_call_capacity) {
+        interpreter->timed_call_capacity = interpreter->timed_call_capacity ? interpreter->timed_call_capacity * 2 : 16;
+        interpreter->timed_calls = (TimedCall*)realloc(interpreter->timed_calls,
+                                                       interpreter->timed_call_capacity * sizeof(TimedCall));
+    }
+    TimedCall* call = &interpreter->timed_calls[interpreter->timed_call_count++];
+    call->depth = interpreter->return_stack_size;
+    call->start = monotonic_ns();
+}
+
+// RETURN from a frame: if it belongs to a timed call, add the call to the latency histogram.
+// Calls timed deeper than the returning frame never returned and are dropped, as in memo_return().
+static void call_timing_end(Interpreter* interpreter) {
+    int depth = interpreter->return_stack_size;
+    while (interpreter->timed_call_count > 0 && interpreter->timed_calls[interpreter->timed_call_count - 1].depth > depth) {
+        interpreter->timed_call_count--;
+    }
+    if (interpreter->timed_call_count == 0 || interpreter->timed_calls[interpreter->timed_call_count - 1].depth != depth) return;
+    uint64_t elapsed = monotonic_ns() - interpreter->timed_calls[--interpreter->timed_call_count].start;
+    int bucket = 0;
+    while (bucket < CALL_HISTOGRAM_BUCKETS - 1 && elapsed >= (2ull << bucket)) bucket++;
+    interpreter->call_histogram[bucket]++;
+    interpreter->calls_timed++;
+    interpreter->call_nanoseconds += elapsed;
+}
+
+/* ---------------------------------------------------------------------------
+   Execution loop
+   --------------------------------------------------------------------------- */
+
+// Bytes currently reserved for the frame and operand stacks
+static size_t stack_bytes(int frame_capacity, int operand_capacity) {
+    return (size_t)frame_capacity * sizeof(Frame) + (size_t)operand_capacity * sizeof(int);
+}
+
+// Write a line of program output
+static void interpreter_output(Interpreter* interpreter, const char* text) {
+    interpreter->output_bytes += (long)strlen(text) + 1;
+    if (interpreter->output_callback) {
+        interpreter->output_callback(text);
+    } else {
+        printf("%s\n", text);
+    }
+}
+
+// Message for a runtime error number
+static const char* error_message(int code) {
+    switch (code) {
+        case ERR_RETURN_WITHOUT_GOSUB: return "RETURN without GOSUB";
+        case ERR_OUT_OF_DATA: return "Out of DATA";
+        case ERR_ILLEGAL_FUNCTION_CALL: return "Illegal function call";
+        case ERR_OVERFLOW: return "Overflow";
+        case ERR_OUT_OF_MEMORY: return "Out of memory";
+        case ERR_SUBSCRIPT_OUT_OF_RANGE: return "Subscript out of range";
+        case ERR_DIVISION_BY_ZERO: return "Division by zero";
+        case ERR_RESUME_WITHOUT_ERROR: return "RESUME without error";
+        case ERR_OUT_OF_STACK: return "Out of stack space";
+        case ERR_BAD_FILE_NUMBER: return "Bad file number";
+        case ERR_FILE_NOT_FOUND: return "File not found";
+        case ERR_BAD_FILE_MODE: return "Bad file mode";
+        case ERR_FILE_ALREADY_OPEN: return "File already open";
+        case ERR_DEVICE_IO: return "Device I/O error";
+        case ERR_INPUT_PAST_END: return "Input past end";
+        default: return "Unknown error";
+    }
+}
+
+// Innermost statement whose code contains pc (binary search on start, then walk out to the enclosing range)
+static const StatementRange* find_statement(Program* program, int pc) {
+    int low = 0, high = program->statement_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (program->statements[mid].start <= pc) low = mid + 1; else high = mid;
+    }
+    for (int i = low - 1; i >= 0; i--) {
+        if (program->statements[i].end > pc) return &program->statements[i];
+    }
+    return NULL;
+}
+
+// Deliver a runtime error raised by the instruction at fault_pc and return where execution continues.
+// Only this path pays for error handling; ON ERROR GOTO just stores its target.
+static int raise_error(Interpreter* interpreter, ErrorCode code, int fault_pc) {
+    interpreter->error_code = code;
+    interpreter->error_pc = fault_pc;
+    if (interpreter->error_handler >= 0 && !interpreter->in_error_handler) {
+        interpreter->in_error_handler = true;
+        return interpreter->error_handler;
+    }
+    fprintf(stderr, "Runtime error %d: %s at instruction %d\n", code, error_message(code), fault_pc);
+    interpreter->running = false;
+    return fault_pc;
+}
+
+// Grow a stack to capacity elements, charging the growth to the interpreter's account
+static bool stack_grow(Interpreter* interpreter, void** stack, int* current, int capacity, size_t element_size) {
+    if (!account_charge(&interpreter->account, (size_t)(capacity - *current) * element_size)) return false;
+    *stack = realloc(*stack, (size_t)capacity * element_size);
+    *current = capacity;
+    return true;
+}
+
+// Grow the operand stacks to the given depths; fails if they would pass the stack limit or the quota
+static ErrorCode reserve_stacks(Interpreter* interpreter, int max_stack, int max_string_stack, int max_float_stack) {
+    if (interpreter->string_stack_capacity < max_string_stack + 1 &&
+        !stack_grow(interpreter, (void**)&interpreter->string_stack, &interpreter->string_stack_capacity,
+                    max_string_stack + 1, sizeof(String*))) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    if (interpreter->float_stack_capacity < max_float_stack + 1 &&
+        !stack_grow(interpreter, (void**)&interpreter->float_stack, &interpreter->float_stack_capacity,
+                    max_float_stack + 1, sizeof(double))) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    if (interpreter->operand_stack_capacity < max_stack + 1) {
+        if (stack_bytes(interpreter->return_stack_capacity, max_stack + 1) > interpreter->stack_limit) {
+            return ERR_OUT_OF_STACK;
+        }
+        if (!stack_grow(interpreter, (void**)&interpreter->operand_stack, &interpreter->operand_stack_capacity,
+                        max_stack + 1, sizeof(int))) {
+            return ERR_OUT_OF_MEMORY;
+        }
+    }
+    return ERR_NONE;
+}
+
+// Size the variable tables and operand stacks for a program; fails only if the stacks would pass the stack
+// limit or the quota
+static ErrorCode prepare_execution(Interpreter* interpreter, const Program* program) {
+    if (interpreter->variable_count < program->symbol_count) {
+        interpreter->variables = (int*)realloc(interpreter->variables, program->symbol_count * sizeof(int));
+        memset(interpreter->variables + interpreter->variable_count, 0,
+               (program->symbol_count - interpreter->variable_count) * sizeof(int));
+        interpreter->string_variables = (String**)realloc(interpreter->string_variables, program->symbol_count * sizeof(String*));
+        memset(interpreter->string_variables + interpreter->variable_count, 0,
+               (program->symbol_count - interpreter->variable_count) * sizeof(String*));
+        interpreter->arrays = (Array*)realloc(interpreter->arrays, program->symbol_count * sizeof(Array));
+        memset(interpreter->arrays + interpreter->variable_count, 0,
+               (program->symbol_count - interpreter->variable_count) * sizeof(Array));
+        interpreter->float_variables = (double*)realloc(interpreter->float_variables, program->symbol_count * sizeof(double));
+        memset(interpreter->float_variables + interpreter->variable_count, 0,
+               (program->symbol_count - interpreter->variable_count) * sizeof(double));
+        interpreter->variable_count = program->symbol_count;
+    }
+    return reserve_stacks(interpreter, program->max_stack, program->max_string_stack, program->max_float_stack);
+}
+
+// Execute a compiled program.
+// The operand stack is sized once from the compiler's max_stack, so pushes need no bounds checks;
+// only GOSUB grows the frame stack.
+void execute_program(Interpreter* interpreter, Program* program) {
+    ErrorCode error = prepare_execution(interpreter, program);
+    if (error != ERR_NONE) {
+        raise_error(interpreter, error, 0);
+        return;
+    }
+
+    Instruction* code = program->code;     // Element access is quickened in place, except in a shared cache image
+    bool quicken = !program->image;         // Image code is read-only and was quickened when it was written
+    int* variables = interpreter->variables;
+    String** string_variables = interpreter->string_variables;
+    int* sp = interpreter->operand_stack;
+    String** ssp = interpreter->string_stack;
+    double* float_variables = interpreter->float_variables;
+    double* fsp = interpreter->float_stack;
+    Array* arrays = interpreter->arrays;
+    Array* array;
+    long offset;
+    int pc = interpreter->resume_pc > 0 && interpreter->resume_pc < program->code_size ? interpreter->resume_pc : 0;
+    interpreter->resume_pc = 0;
+    interpreter->restored_key = 0;
+    interpreter->timed_call_count = 0;
+    ThreadCounters counted = thread_counters;   // What this thread had counted before the run
+    MemoryAccount* caller_account = thread_account;
+    thread_account = &interpreter->account;
+    long executed = 0;
+    char output[50];
+    Channel* channel;
+    String* string;
+
+// Link in a pending hot reload, then run the current instruction again: the call it makes may have been rebound
+#define LINK_RELOAD() \
+    { \
+        long depth = sp - interpreter->operand_stack; \
+        long string_depth = ssp - interpreter->string_stack; \
+        long float_depth = fsp - interpreter->float_stack; \
+        reload_link(interpreter, program); \
+        code = program->code; \
+        quicken = !program->image; \
+        variables = interpreter->variables; \
+        string_variables = interpreter->string_variables; \
+        float_variables = interpreter->float_variables; \
+        arrays = interpreter->arrays; \
+        sp = interpreter->operand_stack + depth; \
+        ssp = interpreter->string_stack + string_depth; \
+        fsp = interpreter->float_stack + float_depth; \
+        pc--; \
+        continue; \
+    }
+
+// Abandon the current instruction; statements start with empty operand stacks
+#define RUNTIME_ERROR(code) \
+    { \
+        pc = raise_error(interpreter, code, pc - 1); \
+        sp = interpreter->operand_stack; \
+        fsp = interpreter->float_stack; \
+        while (ssp > interpreter->string_stack) string_release(*--ssp); \
+        continue; \
+    }
+
+#ifdef PROFILE_OPCODE_PAIRS
+    static long pair_counts[OP_END + 1][OP_END + 1];
+    OpCode previous = OP_NOP;
+#endif
+
+    while (interpreter->running) {
+        const Instruction* instruction = &code[pc++];
+        executed++;
+#ifdef PROFILE_OPCODE_PAIRS
+        pair_counts[previous][generic_opcode(instruction->op)]++;
+        previous = generic_opcode(instruction->op);
+#endif
+        switch (instruction->op) {
+            case OP_NOP:
+                break;
+            case OP_PUSH_INT:
+                *sp++ = instruction->operand;
+                break;
+            case OP_LOAD:
+                *sp++ = variables[instruction->operand];
+                break;
+            case OP_STORE:
+                variables[instruction->operand] = *--sp;
+                break;
+            // Integers wrap around, as in the JIT and the native build; unsigned arithmetic keeps that defined in C
+            case OP_ADD_INT: sp--; sp[-1] = (int)((unsigned)sp[-1] + (unsigned)sp[0]); break;
+            case OP_SUB_INT: sp--; sp[-1] = (int)((unsigned)sp[-1] - (unsigned)sp[0]); break;
+            case OP_MUL_INT: sp--; sp[-1] = (int)((unsigned)sp[-1] * (unsigned)sp[0]); break;
+            case OP_DIV_INT:
+                if (sp[-1] == 0) RUNTIME_ERROR(ERR_DIVISION_BY_ZERO);
+                if (sp[-2] == INT_MIN && sp[-1] == -1) RUNTIME_ERROR(ERR_OVERFLOW);
+                sp--;
+                sp[-1] = sp[-1] / sp[0];
+                break;
+            case OP_EQ: sp--; sp[-1] = sp[-1] == sp[0]; break;
+            case OP_NE: sp--; sp[-1] = sp[-1] != sp[0]; break;
+            case OP_LT: sp--; sp[-1] = sp[-1] < sp[0]; break;
+            case OP_LE: sp--; sp[-1] = sp[-1] <= sp[0]; break;
+            case OP_GT: sp--; sp[-1] = sp[-1] > sp[0]; break;
+            case OP_GE: sp--; sp[-1] = sp[-1] >= sp[0]; break;
+            case OP_PRINT:
+                snprintf(output, sizeof(output), "%d", *--sp);
+                interpreter_output(interpreter, output);
+                break;
+            case OP_JUMP:
+                if (instruction->operand < pc && interpreter->jit_enabled) {
+                    pc = jit_back_edge(interpreter, program, instruction->operand, pc - 1, &sp);
+                } else {
+                    pc = instruction->operand;
+                }
+                break;
+            case OP_JUMP_IF_FALSE:
+                if (*--sp) break;
+                if (instruction->operand < pc && interpreter->jit_enabled) {
+                    pc = jit_back_edge(interpreter, program, instruction->operand, pc - 1, &sp);
+                } else {
+                    pc = instruction->operand;
+                }
+                break;
+            case OP_GOSUB:
+                if (__atomic_load_n(&interpreter->reload, __ATOMIC_ACQUIRE)) LINK_RELOAD();
+                // The frame stack only needs to grow, within the stack limit, when it is full
+                if (interpreter->return_stack_size < interpreter->return_stack_capacity) {
+                    interpreter->return_stack[interpreter->return_stack_size++].return_address = pc;
+                } else if ((error = push_return_stack(interpreter, pc)) != ERR_NONE) {
+                    RUNTIME_ERROR(error);
+                }
+                if (++interpreter->calls % CALL_TIMING_INTERVAL == 0) call_timing_start(interpreter);
+                pc = instruction->operand;
+                break;
+            case OP_MEMO_LOOKUP:
+                if (__atomic_load_n(&interpreter->reload, __ATOMIC_ACQUIRE)) LINK_RELOAD();
+                if (memo_lookup(interpreter, program, instruction->operand)) pc++;
+                break;
+            case OP_RETURN:
+                if (interpreter->return_stack_size == 0) RUNTIME_ERROR(ERR_RETURN_WITHOUT_GOSUB);
+                if (interpreter->memo_call_count > 0) memo_return(interpreter, program);
+                if (interpreter->timed_call_count > 0) call_timing_end(interpreter);
+                pc = interpreter->return_stack[--interpreter->return_stack_size].return_address;
+                break;
+            case OP_READ:
+                if (interpreter->data_pointer >= program->data_count) RUNTIME_ERROR(ERR_OUT_OF_DATA);
+                variables[instruction->operand] = program->data[interpreter->data_pointer++];
+                break;
+            case OP_RESTORE:
+                interpreter->data_pointer = 0;
+                break;
+            case OP_ALLOCATE:
+                if ((error = memory_allocate(&interpreter->memory, sp[-1], &variables[instruction->operand])) != ERR_NONE) {
+                    RUNTIME_ERROR(error);
+                }
+                sp--;
+                break;
+            case OP_FREE:
+                if ((error = memory_free(&interpreter->memory, sp[-1])) != ERR_NONE) RUNTIME_ERROR(error);
+                sp--;
+                break;
+            case OP_POKE:
+                if ((unsigned)sp[-2] >= interpreter->memory.committed) RUNTIME_ERROR(ERR_ILLEGAL_FUNCTION_CALL);
+                sp -= 2;
+                interpreter->memory.base[sp[0]] = (unsigned char)sp[1];
+                break;
+            case OP_POKE_UNCHECKED:
+                sp -= 2;
+                interpreter->memory.base[sp[0]] = (unsigned char)sp[1];
+                break;
+            case OP_PEEK:
+                if ((unsigned)sp[-1] >= interpreter->memory.committed) RUNTIME_ERROR(ERR_ILLEGAL_FUNCTION_CALL);
+                /* fall through */
+            case OP_PEEK_UNCHECKED:
+                sp[-1] = interpreter->memory.base[sp[-1]];
+                break;
+            case OP_CHECK_SPAN: {
+                // base, first, last -> true if base+first .. base+last is addressable (or the loop will not run).
+                // The committed region only grows, so the answer holds for the whole loop.
+                sp -= 2;
+                long long first = (long long)sp[-1] + sp[0];
+                long long last = (long long)sp[-1] + sp[1];
+                sp[-1] = sp[0] > sp[1] || (first >= 0 && last < (long long)interpreter->memory.committed);
+                break;
+            }
+            case OP_ON_ERROR:
+                interpreter->error_handler = instruction->operand;
+                break;
+            case OP_RESUME:
+            case OP_RESUME_NEXT:
+            case OP_RESUME_LABEL: {
+                if (!interpreter->in_error_handler) RUNTIME_ERROR(ERR_RESUME_WITHOUT_ERROR);
+                const StatementRange* statement = find_statement(program, interpreter->error_pc);
+                interpreter->in_error_handler = false;
+                if (instruction->op == OP_RESUME_LABEL) {
+                    pc = instruction->operand;
+                } else if (instruction->op == OP_RESUME) {
+                    pc = statement ? statement->start : interpreter->error_pc;
+                } else {
+                    pc = statement ? statement->end : interpreter->error_pc + 1;
+                }
+                break;
+            }
+            case OP_PUSH_ERR:
+                *sp++ = interpreter->error_code;
+                break;
+            case OP_PUSH_STR:
+                string = program->strings[instruction->operand];
+                string_retain(string);
+                *ssp++ = string;
+                break;
+            case OP_LOAD_STR:
+                string = string_variables[instruction->operand];
+                string_retain(string);
+                *ssp++ = string;
+                break;
+            case OP_STORE_STR:
+                string_release(string_variables[instruction->operand]);
+                string_variables[instruction->operand] = *--ssp;
+                break;
+            case OP_CONCAT:
+                // A string's length is an int, so a result longer than INT_MAX bytes is out of memory too
+                if (string_length(ssp[-2]) > INT_MAX - string_length(ssp[-1]) ||
+                    (ssp[-2] && ssp[-1] &&
+                     !account_allows(&interpreter->account, sizeof(String) + (size_t)ssp[-2]->length + ssp[-1]->length + 1))) {
+                    RUNTIME_ERROR(ERR_OUT_OF_MEMORY);
+                }
+                ssp--;
+                ssp[-1] = string_concat(ssp[-1], ssp[0]);
+                break;
+            case OP_STR_COMPARE: {
+                ssp -= 2;
+                int order = string_compare(ssp[0], ssp[1]);
+                string_release(ssp[0]);
+                string_release(ssp[1]);
+                switch (instruction->operand) {
+                    case OP_EQ: *sp++ = order == 0; break;
+                    case OP_NE: *sp++ = order != 0; break;
+                    case OP_LT: *sp++ = order < 0; break;
+                    case OP_LE: *sp++ = order <= 0; break;
+                    case OP_GT: *sp++ = order > 0; break;
+                    default: *sp++ = order >= 0; break;
+                }
+                break;
+            }
+            case OP_PRINT_STR: {
+                // The output callback takes a C string, and slices are not NUL-terminated
+                string = *--ssp;
+                char* text = (char*)malloc(string_length(string) + 1);
+                memcpy(text, string_data(string), string_length(string));
+                text[string_length(string)] = '\0';
+                interpreter_output(interpreter, text);
+                free(text);
+                string_release(string);
+                break;
+            }
+            case OP_OPEN:
+                error = logged_open(interpreter, sp[-1], ssp[-2], ssp[-1]);
+                if (error != ERR_NONE) RUNTIME_ERROR(error);
+                sp--;
+                ssp -= 2;
+                string_release(ssp[0]);
+                string_release(ssp[1]);
+                break;
+            case OP_CLOSE:
+                if ((error = channel_close(interpreter, sp[-1])) != ERR_NONE) RUNTIME_ERROR(error);
+                sp--;
+                break;
+            case OP_CLOSE_ALL:
+                channel_close_all(interpreter);
+                break;
+            case OP_SNAPSHOT: {
+                // A snapshot resumes by address, and addresses after a hot reload exist only in this process
+                if (program->reloads > 0) RUNTIME_ERROR(ERR_ILLEGAL_FUNCTION_CALL);
+                // Slices are not NUL-terminated, so copy the name
+                char path[4096];
+                int length = string_length(ssp[-1]);
+                if (length == 0 || length >= (int)sizeof(path)) RUNTIME_ERROR(ERR_FILE_NOT_FOUND);
+                memcpy(path, string_data(ssp[-1]), length);
+                path[length] = '\0';
+                if ((error = snapshot_write(interpreter, path, pc)) != ERR_NONE) RUNTIME_ERROR(error);
+                string_release(*--ssp);
+                break;
+            }
+            case OP_COUNT_LINE: {
+                // The timer only raises a flag; the sample is taken here, between two statements
+                Profile* profile = interpreter->profile;
+                profile->counts[instruction->operand]++;
+                if (profile_sample_due) profile_sample(interpreter, program);
+                profile->line = instruction->operand;
+                profile->depth = interpreter->return_stack_size;
+                break;
+            }
+            case OP_PRINT_CHANNEL:
+            case OP_PRINT_CHANNEL_STR: {
+                int number = (instruction->op == OP_PRINT_CHANNEL) ? sp[-2] : sp[-1];
+                if (!(channel = channel_lookup(interpreter, number))) RUNTIME_ERROR(ERR_BAD_FILE_NUMBER);
+                if (instruction->op == OP_PRINT_CHANNEL) {
+                    int length = snprintf(output, sizeof(output), "%d\n", sp[-1]);
+                    error = channel_write(channel, output, length);
+                } else {
+                    error = channel_write(channel, string_data(ssp[-1]), string_length(ssp[-1]));
+                    if (error == ERR_NONE) error = channel_write(channel, "\n", 1);
+                }
+                if (error != ERR_NONE) RUNTIME_ERROR(error);
+                if (instruction->op == OP_PRINT_CHANNEL) {
+                    sp -= 2;
+                } else {
+                    sp--;
+                    string_release(*--ssp);
+                }
+                break;
+            }
+            case OP_INPUT_CHANNEL:
+            case OP_INPUT_CHANNEL_STR:
+            case OP_LINE_INPUT_CHANNEL:
+                if (!(channel = channel_lookup(interpreter, sp[-1]))) RUNTIME_ERROR(ERR_BAD_FILE_NUMBER);
+                error = logged_read(interpreter, channel, instruction->op == OP_LINE_INPUT_CHANNEL, &string);
+                if (error != ERR_NONE) RUNTIME_ERROR(error);
+                sp--;
+                if (instruction->op == OP_INPUT_CHANNEL) {
+                    variables[instruction->operand] = field_to_int(string);
+                    string_release(string);
+                } else if (!account_allows(&interpreter->account, 0)) {
+                    string_release(string);
+                    RUNTIME_ERROR(ERR_OUT_OF_MEMORY);
+                } else {
+                    string_release(string_variables[instruction->operand]);
+                    string_variables[instruction->operand] = string;
+                }
+                break;
+            case OP_EOF:
+                if (!(channel = channel_lookup(interpreter, sp[-1]))) RUNTIME_ERROR(ERR_BAD_FILE_NUMBER);
+                sp[-1] = logged_eof(interpreter, channel) ? -1 : 0;
+                break;
+            case OP_DIM: {
+                int dimensions = instruction->operand & 7;
+                error = array_dimension(&arrays[instruction->operand >> 3], sp - dimensions, dimensions);
+                if (error != ERR_NONE) RUNTIME_ERROR(error);
+                sp -= dimensions;
+                break;
+            }
+            case OP_LOAD_ELEMENT:
+            load_element: {
+                int subscripts = instruction->operand & 7;
+                array = &arrays[instruction->operand >> 3];
+                if ((offset = array_offset(array, sp - subscripts, subscripts)) < 0) RUNTIME_ERROR(ERR_SUBSCRIPT_OUT_OF_RANGE);
+                sp -= subscripts;
+                *sp++ = array->data[offset];
+                if (subscripts <= 2 && quicken) code[pc - 1].op = subscripts == 1 ? OP_LOAD_ELEMENT_1 : OP_LOAD_ELEMENT_2;
+                break;
+            }
+            case OP_STORE_ELEMENT:
+            store_element: {
+                int subscripts = instruction->operand & 7;
+                array = &arrays[instruction->operand >> 3];
+                if ((offset = array_offset(array, sp - 1 - subscripts, subscripts)) < 0) RUNTIME_ERROR(ERR_SUBSCRIPT_OUT_OF_RANGE);
+                array->data[offset] = sp[-1];
+                sp -= subscripts + 1;
+                if (subscripts <= 2 && quicken) code[pc - 1].op = subscripts == 1 ? OP_STORE_ELEMENT_1 : OP_STORE_ELEMENT_2;
+                break;
+            }
+            case OP_LOAD_ELEMENT_1:
+                array = &arrays[instruction->operand >> 3];
+                if (array->dimension_count != 1 || (unsigned)sp[-1] >= (unsigned)array->extents[0]) {
+                    if (!quicken) goto load_element;
+                    code[--pc].op = OP_LOAD_ELEMENT;
+                    break;
+                }
+                sp[-1] = array->data[sp[-1]];
+                break;
+            case OP_LOAD_ELEMENT_2:
+                array = &arrays[instruction->operand >> 3];
+                if (array->dimension_count != 2 || (unsigned)sp[-2] >= (unsigned)array->extents[0] ||
+                    (unsigned)sp[-1] >= (unsigned)array->extents[1]) {
+                    if (!quicken) goto load_element;
+                    code[--pc].op = OP_LOAD_ELEMENT;
+                    break;
+                }
+                sp--;
+                sp[-1] = array->data[(long)sp[-1] * array->extents[1] + sp[0]];
+                break;
+            case OP_STORE_ELEMENT_1:
+                array = &arrays[instruction->operand >> 3];
+                if (array->dimension_count != 1 || (unsigned)sp[-2] >= (unsigned)array->extents[0]) {
+                    if (!quicken) goto store_element;
+                    code[--pc].op = OP_STORE_ELEMENT;
+                    break;
+                }
+                array->data[sp[-2]] = sp[-1];
+                sp -= 2;
+                break;
+            case OP_STORE_ELEMENT_2:
+                array = &arrays[instruction->operand >> 3];
+                if (array->dimension_count != 2 || (unsigned)sp[-3] >= (unsigned)array->extents[0] ||
+                    (unsigned)sp[-2] >= (unsigned)array->extents[1]) {
+                    if (!quicken) goto store_element;
+                    code[--pc].op = OP_STORE_ELEMENT;
+                    break;
+                }
+                array->data[(long)sp[-3] * array->extents[1] + sp[-2]] = sp[-1];
+                sp -= 3;
+                break;
+            case OP_ADD_VAR_CONST:
+                variables[code[pc + 2].operand] = (int)((unsigned)variables[instruction->operand] + (unsigned)code[pc].operand);
+                pc += 3;
+                break;
+            case OP_SUB_VAR_CONST:
+                variables[code[pc + 2].operand] = (int)((unsigned)variables[instruction->operand] - (unsigned)code[pc].operand);
+                pc += 3;
+                break;
+            case OP_ADD_VAR_VAR:
+                variables[code[pc + 2].operand] =
+                    (int)((unsigned)variables[instruction->operand] + (unsigned)variables[code[pc].operand]);
+                pc += 3;
+                break;
+            case OP_BRANCH_VAR_CONST:
+            case OP_BRANCH_VAR_VAR: {
+                int right = instruction->op == OP_BRANCH_VAR_CONST ? code[pc].operand : variables[code[pc].operand];
+                if (compare_ints(code[pc + 1].op, variables[instruction->operand], right)) {
+                    pc += 3;
+                    break;
+                }
+                // Taken like the JUMP_IF_FALSE it replaces, including the JIT's back edge check
+                int target = code[pc + 2].operand;
+                if (target < pc + 3 && interpreter->jit_enabled) {
+                    pc = jit_back_edge(interpreter, program, target, pc + 2, &sp);
+                } else {
+                    pc = target;
+                }
+                break;
+            }
+            case OP_BLOAD_ARRAY:
+            case OP_MAP_ARRAY:
+            case OP_BSAVE_ARRAY:
+                array = &arrays[instruction->operand];
+                if (instruction->op == OP_BSAVE_ARRAY) error = array_bsave(array, ssp[-1]);
+                else error = logged_bload_array(interpreter, array, ssp[-1], instruction->op == OP_MAP_ARRAY);
+                if (error != ERR_NONE) RUNTIME_ERROR(error);
+                string_release(*--ssp);
+                break;
+            case OP_BLOAD:
+            case OP_BSAVE:
+                if (instruction->op == OP_BLOAD) error = logged_bload_memory(interpreter, ssp[-1], sp[-2], sp[-1]);
+                else error = memory_bsave(&interpreter->memory, ssp[-1], sp[-2], sp[-1]);
+                if (error != ERR_NONE) RUNTIME_ERROR(error);
+                sp -= 2;
+                string_release(*--ssp);
+                break;
+            case OP_PUSH_FLT:
+                *fsp++ = program->floats[instruction->operand];
+                break;
+            case OP_LOAD_FLT:
+                *fsp++ = float_variables[instruction->operand];
+                break;
+            case OP_STORE_FLT:
+                float_variables[instruction->operand] = *--fsp;
+                break;
+            case OP_ADD_FLT: fsp--; fsp[-1] = fsp[-1] + fsp[0]; break;
+            case OP_SUB_FLT: fsp--; fsp[-1] = fsp[-1] - fsp[0]; break;
+            case OP_MUL_FLT: fsp--; fsp[-1] = fsp[-1] * fsp[0]; break;
+            case OP_DIV_FLT:
+                if (fsp[-1] == 0.0) RUNTIME_ERROR(ERR_DIVISION_BY_ZERO);
+                fsp--;
+                fsp[-1] = fsp[-1] / fsp[0];
+                break;
+            case OP_CMP_FLT: {
+                // The operand is the integer comparison opcode; the result lands on the integer stack
+                double left = fsp[-2], right = fsp[-1];
+                fsp -= 2;
+                switch ((OpCode)instruction->operand) {
+                    case OP_EQ: *sp++ = left == right; break;
+                    case OP_NE: *sp++ = left != right; break;
+                    case OP_LT: *sp++ = left < right; break;
+                    case OP_LE: *sp++ = left <= right; break;
+                    case OP_GT: *sp++ = left > right; break;
+                    default: *sp++ = left >= right; break;
+                }
+                break;
+            }
+            case OP_INT_TO_FLT:
+                *fsp++ = *--sp;
+                break;
+            case OP_FLT_TO_INT:
+                // Truncates toward zero, like integer division
+                if (!(fsp[-1] > (double)INT_MIN - 1.0 && fsp[-1] < (double)INT_MAX + 1.0)) RUNTIME_ERROR(ERR_OVERFLOW);
+                *sp++ = (int)*--fsp;
+                break;
+            case OP_PRINT_FLT:
+                snprintf(output, sizeof(output), "%.15g", *--fsp);
+                interpreter_output(interpreter, output);
+                break;
+            case OP_PRINT_CHANNEL_FLT: {
+                if (!(channel = channel_lookup(interpreter, sp[-1]))) RUNTIME_ERROR(ERR_BAD_FILE_NUMBER);
+                int length = snprintf(output, sizeof(output), "%.15g\n", fsp[-1]);
+                if ((error = channel_write(channel, output, length)) != ERR_NONE) RUNTIME_ERROR(error);
+                sp--;
+                fsp--;
+                break;
+            }
+            case OP_INPUT_CHANNEL_FLT:
+                if (!(channel = channel_lookup(interpreter, sp[-1]))) RUNTIME_ERROR(ERR_BAD_FILE_NUMBER);
+                if ((error = logged_read(interpreter, channel, false, &string)) != ERR_NONE) RUNTIME_ERROR(error);
+                sp--;
+                float_variables[instruction->operand] = field_to_float(string);
+                string_release(string);
+                break;
+            case OP_READ_FLT:
+                if (interpreter->data_pointer >= program->data_count) RUNTIME_ERROR(ERR_OUT_OF_DATA);
+                float_variables[instruction->operand] = program->data[interpreter->data_pointer++];
+                break;
+            case OP_END:
+                interpreter->running = false;
+                break;
+        }
+    }
+#undef RUNTIME_ERROR
+#undef LINK_RELOAD
+
+#ifdef PROFILE_OPCODE_PAIRS
+    for (int i = 0; i <= OP_END; i++) {
+        for (int j = 0; j <= OP_END; j++) {
+            if (pair_counts[i][j] > 0) printf("[DEBUG] Opcode pair %d -> %d: %ld\n", i, j, pair_counts[i][j]);
+        }
+    }
+#endif
+
+    // Like END in BASIC, leaving the program flushes and closes every file
+    channel_close_all(interpreter);
+
+    thread_account = caller_account;
+    interpreter->instructions += executed;
+    interpreter->counters.string_allocations += thread_counters.string_allocations - counted.string_allocations;
+    interpreter->counters.string_bytes += thread_counters.string_bytes - counted.string_bytes;
+    interpreter->counters.string_frees += thread_counters.string_frees - counted.string_frees;
+    interpreter->counters.file_bytes_read += thread_counters.file_bytes_read - counted.file_bytes_read;
+    interpreter->counters.file_bytes_written += thread_counters.file_bytes_written - counted.file_bytes_written;
+}
+
+// Push a return address onto the frame stack, growing it within the stack limit and the quota
+ErrorCode push_return_stack(Interpreter* interpreter, int return_address) {
+    if (interpreter->return_stack_size >= interpreter->return_stack_capacity) {
+        int capacity = (interpreter->return_stack_capacity == 0) ? 64 : interpreter->return_stack_capacity * 2;
+        if (stack_bytes(capacity, interpreter->operand_stack_capacity) > interpreter->stack_limit) {
+            size_t operand_bytes = stack_bytes(0, interpreter->operand_stack_capacity);
+            if (operand_bytes >= interpreter->stack_limit) return ERR_OUT_OF_STACK;
+            capacity = (int)((interpreter->stack_limit - operand_bytes) / sizeof(Frame));
+            if (capacity <= interpreter->return_stack_size) return ERR_OUT_OF_STACK;
+        }
+        if (!stack_grow(interpreter, (void**)&interpreter->return_stack, &interpreter->return_stack_capacity, capacity,
+                        sizeof(Frame))) {
+            return ERR_OUT_OF_MEMORY;
+        }
+    }
+    interpreter->return_stack[interpreter->return_stack_size++].return_address = return_address;
+    return ERR_NONE;
+}
+
+// Pop a return address from the frame stack
+int pop_return_stack(Interpreter* interpreter) {
+    if (interpreter->return_stack_size == 0) {
+        return -1;
+    }
+    return interpreter->return_stack[--interpreter->return_stack_size].return_address;
+}
+
+/* ---------------------------------------------------------------------------
+   Bytecode cache
+
+   With a cache directory set, run_program() keeps the compiled program in
+   <dir>/<key>.gfc, where the key hashes the AST, the inline budget and the
+   build of this interpreter. A later run of the same program maps the file
+   instead of compiling. Every table is stored flat at an 8-byte aligned
+   offset and refers to others by index, never by address, so code, DATA,
+   float literals, statement ranges and memo slots are used where they lie
+   in the mapping. Only the small pointer tables are built on load: names
+   point into the file's text section and string literals are slices of
+   the mapping.
+
+   The mapping is shared and read-only, so every process running the same
+   program uses one physical copy of its code and constants; variables,
+   arrays, stacks, memo entries and JIT code stay private. Element access
+   is written to the file already quickened for the rank its subscripts
+   give, and the execution loop never rewrites image code: a quickened
+   access that meets an array of another rank runs the generic handler.
+
+   Files are written to a temporary name and renamed into place, so runs
+   that race on the same program never see half a file. A file that does not
+   match the key, the format version or its own size is ignored and replaced.
+   --------------------------------------------------------------------------- */
+
+#define CACHE_MAGIC 0x31434647u     // "GFC1"
+#define CACHE_VERSION 3             // Bump whenever the layout below or the meaning of an opcode changes
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;                  // Whole file, in bytes
+    int32_t code_size;
+    int32_t symbol_count;
+    int32_t label_count;
+    int32_t data_count;
+    int32_t string_count;
+    int32_t float_count;
+    int32_t statement_count;
+    int32_t memo_count;
+    int32_t max_stack;
+    int32_t max_string_stack;
+    int32_t max_float_stack;
+    int32_t memo_slot_count;
+    uint64_t code;                  // Section offsets
+    uint64_t symbols;
+    uint64_t symbol_types;          // int32_t ValueType of each symbol
+    uint64_t labels;
+    uint64_t data;
+    uint64_t strings;
+    uint64_t floats;
+    uint64_t statements;
+    uint64_t memos;
+    uint64_t memo_slots;
+    uint64_t text;
+} CacheHeader;
+
+// Name or string literal: offset and length in the text section, offset -1 for a nameless slot
+typedef struct {
+    int32_t offset;
+    int32_t length;
+} CacheText;
+
+typedef struct {
+    int32_t name;                   // Offset in the text section
+    int32_t address;
+} CacheLabel;
+
+typedef struct {
+    int32_t key_count;
+    int32_t result_count;
+    int32_t first_slot;             // Index of its first slot in the memo slot section
+} CacheMemo;
+
+// Growable byte image of a .gfc file
+typedef struct {
+    unsigned char *bytes;
+    size_t size;
+    size_t capacity;
+} CacheImage;
+
+// Append bytes, starting at a multiple of alignment (a power of two); returns their offset
+static uint64_t cache_append_aligned(CacheImage* image, const void* bytes, size_t length, size_t alignment) {
+    size_t offset = (image->size + alignment - 1) & ~(alignment - 1);
+    if (offset + length > image->capacity) {
+        while (offset + length > image->capacity) image->capacity = image->capacity == 0 ? 4096 : image->capacity * 2;
+        image->bytes = (unsigned char*)realloc(image->bytes, image->capacity);
+    }
+    memset(image->bytes + image->size, 0, offset - image->size);
+    if (length > 0) memcpy(image->bytes + offset, bytes, length);
+    image->size = offset + length;
+    return offset;
+}
+
+// Append bytes, starting at an 8-byte boundary; returns their offset
+static uint64_t cache_append(CacheImage* image, const void* bytes, size_t length) {
+    return cache_append_aligned(image, bytes, length, 8);
+}
+
+// Fold an AST into an FNV-1a hash, in source order
+static uint64_t hash_tree(uint64_t hash, ASTNode* root) {
+    int capacity = 64, count = 0;
+    ASTNode** stack = (ASTNode**)malloc(capacity * sizeof(ASTNode*));
+    stack[count++] = root;
+    while (count > 0) {
+        ASTNode* node = stack[--count];
+        // The terminating NULs keep "ab","c" apart from "a","bc"
+        for (const char* c = node->node_type; ; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+            if (!*c) break;
+        }
+        for (const char* c = node->value ? node->value : ""; ; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+            if (!*c) break;
+        }
+        hash = (hash ^ (uint64_t)(node->value ? node->children_count : -1 - node->children_count)) * 1099511628211ull;
+        if (count + node->children_count > capacity) {
+            while (count + node->children_count > capacity) capacity *= 2;
+            stack = (ASTNode**)realloc(stack, capacity * sizeof(ASTNode*));
+        }
+        for (int i = node->children_count - 1; i >= 0; i--) stack[count++] = node->children[i];
+    }
+    free(stack);
+    return hash;
+}
+
+// Cache key of a program: FNV-1a over its AST in source order, the inline budget, profiling, hot reload and this build
+static uint64_t cache_key(ASTNode* ast, int inline_budget, bool profile, bool reloadable) {
+    uint64_t hash = 14695981039346656037ull;
+    const char* build = __DATE__ " " __TIME__;
+    for (const char* c = build; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    hash = (hash ^ (uint64_t)(CACHE_VERSION * 65536 + inline_budget)) * 1099511628211ull;
+    hash = (hash ^ (uint64_t)(profile | reloadable << 1)) * 1099511628211ull;
+    return hash_tree(hash, ast);
+}
+
+// Path of the cache file for a key
+static void cache_path(char* path, size_t size, const char* directory, uint64_t key) {
+    snprintf(path, size, "%s/%016llx.gfc", directory, (unsigned long long)key);
+}
+
+// Add a name or literal to the text section and describe where it went
+static CacheText cache_text(CacheImage* text, const char* bytes, int length) {
+    CacheText entry = {-1, 0};
+    if (!bytes) return entry;
+    entry.offset = (int32_t)text->size;
+    entry.length = length;
+    if (text->size + length + 1 > text->capacity) {
+        while (text->size + length + 1 > text->capacity) text->capacity = text->capacity == 0 ? 4096 : text->capacity * 2;
+        text->bytes = (unsigned char*)realloc(text->bytes, text->capacity);
+    }
+    memcpy(text->bytes + text->size, bytes, length);
+    text->bytes[text->size + length] = '\0';
+    text->size += length + 1;
+    return entry;
+}
+
+// Write a compiled program to the cache; a failure only costs the next run a compile
+static bool cache_store(const Program* program, const char* directory, uint64_t key) {
+    CacheImage image = {0}, text = {0};
+    CacheHeader header = {0};
+    cache_append(&image, &header, sizeof(header));
+
+    CacheText* symbols = (CacheText*)malloc((program->symbol_count + 1) * sizeof(CacheText));
+    for (int i = 0; i < program->symbol_count; i++) {
+        const char* name = program->symbols[i];
+        symbols[i] = cache_text(&text, name, name ? (int)strlen(name) : 0);
+    }
+    CacheLabel* labels = (CacheLabel*)malloc((program->label_count + 1) * sizeof(CacheLabel));
+    for (int i = 0; i < program->label_count; i++) {
+        labels[i].name = cache_text(&text, program->labels[i].name, (int)strlen(program->labels[i].name)).offset;
+        labels[i].address = program->labels[i].address;
+    }
+    CacheText* strings = (CacheText*)malloc((program->string_count + 1) * sizeof(CacheText));
+    for (int i = 0; i < program->string_count; i++) {
+        strings[i] = cache_text(&text, string_data(program->strings[i]), string_length(program->strings[i]));
+    }
+    CacheMemo* memos = (CacheMemo*)malloc((program->memo_count + 1) * sizeof(CacheMemo));
+    int memo_slot_count = 0;
+    for (int i = 0; i < program->memo_count; i++) {
+        memos[i].key_count = program->memos[i].key_count;
+        memos[i].result_count = program->memos[i].result_count;
+        memos[i].first_slot = memo_slot_count;
+        memo_slot_count += memos[i].key_count + memos[i].result_count;
+    }
+
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.code_size = program->code_size;
+    header.symbol_count = program->symbol_count;
+    header.label_count = program->label_count;
+    header.data_count = program->data_count;
+    header.string_count = program->string_count;
+    header.float_count = program->float_count;
+    header.statement_count = program->statement_count;
+    header.memo_count = program->memo_count;
+    header.memo_slot_count = memo_slot_count;
+    header.max_stack = program->max_stack;
+    header.max_string_stack = program->max_string_stack;
+    header.max_float_stack = program->max_float_stack;
+    header.code = cache_append(&image, program->code, program->code_size * sizeof(Instruction));
+    Instruction* code = (Instruction*)(image.bytes + header.code);
+    for (int pc = 0; pc < program->code_size; pc++) {
+        int subscripts = code[pc].operand & 7;
+        if (code[pc].op == OP_LOAD_ELEMENT && subscripts <= 2) {
+            code[pc].op = subscripts == 1 ? OP_LOAD_ELEMENT_1 : OP_LOAD_ELEMENT_2;
+        } else if (code[pc].op == OP_STORE_ELEMENT && subscripts <= 2) {
+            code[pc].op = subscripts == 1 ? OP_STORE_ELEMENT_1 : OP_STORE_ELEMENT_2;
+        }
+    }
+    header.symbols = cache_append(&image, symbols, program->symbol_count * sizeof(CacheText));
+    int32_t* symbol_types = (int32_t*)malloc((program->symbol_count + 1) * sizeof(int32_t));
+    for (int i = 0; i < program->symbol_count; i++) symbol_types[i] = program->symbol_types[i];
+    header.symbol_types = cache_append(&image, symbol_types, program->symbol_count * sizeof(int32_t));
+    free(symbol_types);
+    header.labels = cache_append(&image, labels, program->label_count * sizeof(CacheLabel));
+    header.data = cache_append(&image, program->data, program->data_count * sizeof(int));
+    header.strings = cache_append(&image, strings, program->string_count * sizeof(CacheText));
+    header.floats = cache_append(&image, program->floats, program->float_count * sizeof(double));
+    header.statements = cache_append(&image, program->statements, program->statement_count * sizeof(StatementRange));
+    header.memos = cache_append(&image, memos, program->memo_count * sizeof(CacheMemo));
+    header.memo_slots = cache_append(&image, NULL, 0);
+    for (int i = 0; i < program->memo_count; i++) {
+        const Memo* memo = &program->memos[i];
+        cache_append(&image, memo->slots, (memo->key_count + memo->result_count) * sizeof(MemoSlot));
+    }
+    header.text = cache_append(&image, text.bytes, text.size);
+    header.size = image.size;
+    memcpy(image.bytes, &header, sizeof(header));
+    free(symbols);
+    free(labels);
+    free(strings);
+    free(memos);
+    free(text.bytes);
+
+    char path[PATH_MAX], temporary[PATH_MAX + 32];
+    cache_path(path, sizeof(path), directory, key);
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+    mkdir(directory, 0777);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool stored = fd >= 0 && write_fully(fd, image.bytes, image.size) == ERR_NONE;
+    if (fd >= 0) close(fd);
+    stored = stored && rename(temporary, path) == 0;
+    if (!stored) unlink(temporary);
+    free(image.bytes);
+    return stored;
+}
+
+// Is the section at offset, count entries of size bytes each, inside the file?
+static bool cache_section_fits(const CacheHeader* header, uint64_t offset, int32_t count, size_t size) {
+    return count >= 0 && offset % 8 == 0 && offset <= header->size && (uint64_t)count * size <= header->size - offset;
+}
+
+// Do the names, literals and memo slots of a mapped file lie inside their sections?
+static bool cache_tables_fit(const CacheHeader* header, const unsigned char* bytes) {
+    int64_t text_size = (int64_t)(header->size - header->text);
+    const CacheText* symbols = (const CacheText*)(bytes + header->symbols);
+    for (int i = 0; i < header->symbol_count; i++) {
+        if (symbols[i].offset >= 0 && (symbols[i].length < 0 || (int64_t)symbols[i].offset + symbols[i].length >= text_size)) {
+            return false;
+        }
+    }
+    const CacheLabel* labels = (const CacheLabel*)(bytes + header->labels);
+    for (int i = 0; i < header->label_count; i++) {
+        if (labels[i].name < 0 || labels[i].name >= text_size) return false;
+    }
+    const CacheText* strings = (const CacheText*)(bytes + header->strings);
+    for (int i = 0; i < header->string_count; i++) {
+        if (strings[i].offset < 0 || strings[i].length < 0 || (int64_t)strings[i].offset + strings[i].length >= text_size) {
+            return false;
+        }
+    }
+    const CacheMemo* memos = (const CacheMemo*)(bytes + header->memos);
+    for (int i = 0; i < header->memo_count; i++) {
+        if (memos[i].key_count < 0 || memos[i].result_count < 0 || memos[i].first_slot < 0 ||
+            (int64_t)memos[i].first_slot + memos[i].key_count + memos[i].result_count > header->memo_slot_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Map the cached program for a key; NULL when there is none or it does not belong to this build
+static Program* cache_load(const char* directory, uint64_t key) {
+    char path[PATH_MAX];
+    cache_path(path, sizeof(path), directory, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat info;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(CacheHeader)) {
+        base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    unsigned char* bytes = (unsigned char*)base;
+    const CacheHeader* header = (const CacheHeader*)base;
+    bool valid = header->magic == CACHE_MAGIC && header->version == CACHE_VERSION && header->key == key &&
+                 header->size == (uint64_t)info.st_size &&
+                 cache_section_fits(header, header->code, header->code_size, sizeof(Instruction)) &&
+                 cache_section_fits(header, header->symbols, header->symbol_count, sizeof(CacheText)) &&
+                 cache_section_fits(header, header->symbol_types, header->symbol_count, sizeof(int32_t)) &&
+                 cache_section_fits(header, header->labels, header->label_count, sizeof(CacheLabel)) &&
+                 cache_section_fits(header, header->data, header->data_count, sizeof(int)) &&
+                 cache_section_fits(header, header->strings, header->string_count, sizeof(CacheText)) &&
+                 cache_section_fits(header, header->floats, header->float_count, sizeof(double)) &&
+                 cache_section_fits(header, header->statements, header->statement_count, sizeof(StatementRange)) &&
+                 cache_section_fits(header, header->memos, header->memo_count, sizeof(CacheMemo)) &&
+                 cache_section_fits(header, header->memo_slots, header->memo_slot_count, sizeof(MemoSlot)) &&
+                 cache_section_fits(header, header->text, 0, 1) && cache_tables_fit(header, bytes);
+    if (!valid) {
+        munmap(base, (size_t)info.st_size);
+        return NULL;
+    }
+
+    Program* program = (Program*)calloc(1, sizeof(Program));
+    program->image = (FileMapping*)malloc(sizeof(FileMapping));
+    program->image->refcount = 1;
+    program->image->base = bytes;
+    program->image->size = (size_t)info.st_size;
+    const char* text = (const char*)bytes + header->text;
+    program->code = (Instruction*)(bytes + header->code);
+    program->code_size = program->code_capacity = header->code_size;
+    program->data = (int*)(bytes + header->data);
+    program->data_count = program->data_capacity = header->data_count;
+    program->floats = (double*)(bytes + header->floats);
+    program->float_count = program->float_capacity = header->float_count;
+    program->statements = (StatementRange*)(bytes + header->statements);
+    program->statement_count = program->statement_capacity = header->statement_count;
+    program->max_stack = header->max_stack;
+    program->max_string_stack = header->max_string_stack;
+    program->max_float_stack = header->max_float_stack;
+
+    const CacheText* symbols = (const CacheText*)(bytes + header->symbols);
+    const int32_t* symbol_types = (const int32_t*)(bytes + header->symbol_types);
+    program->symbols = (char**)malloc((header->symbol_count + 1) * sizeof(char*));
+    program->symbol_types = (ValueType*)malloc((header->symbol_count + 1) * sizeof(ValueType));
+    for (int i = 0; i < header->symbol_count; i++) {
+        program->symbols[i] = symbols[i].offset < 0 ? NULL : (char*)text + symbols[i].offset;
+        program->symbol_types[i] = (ValueType)symbol_types[i];
+    }
+    program->symbol_count = program->symbol_capacity = header->symbol_count;
+    const CacheLabel* labels = (const CacheLabel*)(bytes + header->labels);
+    program->labels = (Label*)malloc((header->label_count + 1) * sizeof(Label));
+    for (int i = 0; i < header->label_count; i++) {
+        program->labels[i].name = (char*)text + labels[i].name;
+        program->labels[i].address = labels[i].address;
+    }
+    program->label_count = program->label_capacity = header->label_count;
+    const CacheText* strings = (const CacheText*)(bytes + header->strings);
+    program->strings = (String**)malloc((header->string_count + 1) * sizeof(String*));
+    for (int i = 0; i < header->string_count; i++) {
+        program->strings[i] = string_slice(program->image, text + strings[i].offset, strings[i].length);
+    }
+    program->string_count = program->string_capacity = header->string_count;
+    const CacheMemo* memos = (const CacheMemo*)(bytes + header->memos);
+    MemoSlot* memo_slots = (MemoSlot*)(bytes + header->memo_slots);
+    program->memos = (Memo*)calloc(header->memo_count + 1, sizeof(Memo));
+    for (int i = 0; i < header->memo_count; i++) {
+        program->memos[i].key_count = memos[i].key_count;
+        program->memos[i].result_count = memos[i].result_count;
+        program->memos[i].slots = memo_slots + memos[i].first_slot;
+    }
+    program->memo_count = header->memo_count;
+    return program;
+}
+
+/* ---------------------------------------------------------------------------
+   Snapshots
+
+   SNAPSHOT file$ writes the whole run-time state to a file and carries on:
+   variables, arrays, the frame stack, the DATA pointer, error handling
+   state and the ALLOCATE region, together with the instruction after the
+   SNAPSHOT and the key of the program. interpreter_restore() loads such a
+   file into a fresh interpreter, and the next run_program() of the same
+   program continues from the SNAPSHOT instead of from the top, so a script
+   pays for its initialization once. Statements start with empty operand
+   stacks, so there are none to save.
+
+   Large arrays and the ALLOCATE region sit at SNAPSHOT_ALIGN boundaries in
+   the file and are mapped private on restore, so their pages are read in
+   on first touch and copied only when written. Open channels are not part
+   of a snapshot; a restored program finds them closed. Memo tables are
+   caches and start empty.
+
+   Nothing loaded is trusted: array extents must describe the elements
+   stored, the ALLOCATE blocks must tile the region with each free block
+   listed once, and when run_program() binds the snapshot every return
+   address must follow a GOSUB of its code. A file that fails is refused,
+   or the program starts from the top.
+   --------------------------------------------------------------------------- */
+
+#define SNAPSHOT_MAGIC 0x31534647u  // "GFS1"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ALIGN 65536        // Page-aligned on every page size Linux uses
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;                   // cache_key of the program that wrote it
+    uint64_t size;                  // Whole file, in bytes
+    int32_t resume_pc;
+    int32_t variable_count;
+    int32_t return_stack_size;
+    int32_t data_pointer;
+    int32_t error_handler;
+    int32_t error_code;
+    int32_t error_pc;
+    int32_t in_error_handler;
+    uint64_t memory_reserved;
+    uint64_t memory_committed;
+    uint64_t memory_top;
+    uint64_t memory_in_use;
+    uint64_t memory_peak_in_use;
+    int64_t memory_allocations;
+    int64_t memory_frees;
+    int32_t memory_free_counts[MEMORY_SIZE_CLASSES + 1];    // Entries of each free list, the large one last
+    uint64_t variables;             // Section offsets
+    uint64_t float_variables;
+    uint64_t string_variables;
+    uint64_t arrays;
+    uint64_t frames;
+    uint64_t memory;
+    uint64_t memory_blocks;         // uint32_t block table of the committed prefix
+    uint64_t memory_free;           // uint32_t offsets of every free list in turn
+    uint64_t text;
+} SnapshotHeader;
+
+typedef struct {
+    int32_t extents[MAX_DIMENSIONS];
+    int32_t dimension_count;
+    int32_t length;
+    uint64_t data;                  // Offset of the elements; 0 for an array that was never DIMed
+} SnapshotArray;
+
+// Write the interpreter's state to path; execution resumes at resume_pc when it is restored
+static ErrorCode snapshot_write(Interpreter* interpreter, const char* path, int resume_pc) {
+    CacheImage image = {0}, text = {0};
+    SnapshotHeader header = {0};
+    cache_append(&image, &header, sizeof(header));
+    int count = interpreter->variable_count;
+
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.key = interpreter->program_key;
+    header.resume_pc = resume_pc;
+    header.variable_count = count;
+    header.return_stack_size = interpreter->return_stack_size;
+    header.data_pointer = interpreter->data_pointer;
+    header.error_handler = interpreter->error_handler;
+    header.error_code = interpreter->error_code;
+    header.error_pc = interpreter->error_pc;
+    header.in_error_handler = interpreter->in_error_handler;
+    LinearMemory* memory = &interpreter->memory;
+    header.memory_reserved = memory->reserved;
+    header.memory_committed = memory->base ? memory->committed : 0;
+    header.memory_top = memory->top;
+    header.memory_in_use = memory->in_use;
+    header.memory_peak_in_use = memory->peak_in_use;
+    header.memory_allocations = memory->allocations;
+    header.memory_frees = memory->frees;
+    for (int i = 0; i <= MEMORY_SIZE_CLASSES; i++) {
+        header.memory_free_counts[i] = i < MEMORY_SIZE_CLASSES ? memory->free_lists[i].count : memory->large_free.count;
+    }
+
+    header.variables = cache_append(&image, interpreter->variables, count * sizeof(int));
+    header.float_variables = cache_append(&image, interpreter->float_variables, count * sizeof(double));
+    CacheText* strings = (CacheText*)malloc((count + 1) * sizeof(CacheText));
+    SnapshotArray* arrays = (SnapshotArray*)calloc(count + 1, sizeof(SnapshotArray));
+    for (int i = 0; i < count; i++) {
+        String* string = interpreter->string_variables[i];
+        strings[i] = cache_text(&text, string ? string_data(string) : NULL, string_length(string));
+    }
+    header.string_variables = cache_append(&image, strings, count * sizeof(CacheText));
+    header.arrays = cache_append(&image, arrays, count * sizeof(SnapshotArray));
+    header.frames = cache_append(&image, interpreter->return_stack, interpreter->return_stack_size * sizeof(Frame));
+    header.memory_blocks = cache_append(&image, memory->blocks, block_table_bytes(header.memory_committed));
+    header.memory_free = cache_append(&image, NULL, 0);
+    for (int i = 0; i <= MEMORY_SIZE_CLASSES; i++) {
+        const FreeList* list = i < MEMORY_SIZE_CLASSES ? &memory->free_lists[i] : &memory->large_free;
+        cache_append_aligned(&image, list->offsets, list->count * sizeof(uint32_t), 4);
+    }
+    header.text = cache_append(&image, text.bytes, text.size);
+    for (int i = 0; i < count; i++) {
+        Array* array = &interpreter->arrays[i];
+        if (array->dimension_count == 0) continue;
+        size_t bytes = (size_t)array->length * sizeof(int);
+        memcpy(arrays[i].extents, array->extents, sizeof(arrays[i].extents));
+        arrays[i].dimension_count = array->dimension_count;
+        arrays[i].length = array->length;
+        arrays[i].data = cache_append_aligned(&image, array->data, bytes, bytes >= ARRAY_MAP_THRESHOLD ? SNAPSHOT_ALIGN : 8);
+    }
+    memcpy(image.bytes + header.arrays, arrays, count * sizeof(SnapshotArray));
+    header.memory = cache_append_aligned(&image, memory->base, header.memory_committed,
+                                         header.memory_committed > 0 ? SNAPSHOT_ALIGN : 8);
+    header.size = image.size;
+    memcpy(image.bytes, &header, sizeof(header));
+    free(strings);
+    free(arrays);
+    free(text.bytes);
+
+    // Written aside and renamed, so an instance starting meanwhile reads the old snapshot or the new one
+    char temporary[PATH_MAX + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ErrorCode error = fd < 0 ? (errno == ENOENT ? ERR_FILE_NOT_FOUND : ERR_DEVICE_IO) : write_fully(fd, image.bytes, image.size);
+    if (fd >= 0) close(fd);
+    if (error == ERR_NONE && rename(temporary, path) != 0) error = ERR_DEVICE_IO;
+    if (error != ERR_NONE && fd >= 0) unlink(temporary);
+    free(image.bytes);
+    return error;
+}
+
+// Save the interpreter's state; restoring it starts the same program from the top with this state
+bool interpreter_snapshot(Interpreter* interpreter, const char* path) {
+    return snapshot_write(interpreter, path, 0) == ERR_NONE;
+}
+
+// Is the section at offset, count entries of size bytes each, inside the snapshot?
+static bool snapshot_section_fits(const SnapshotHeader* header, uint64_t offset, uint64_t count, size_t size) {
+    return offset % 8 == 0 && offset <= header->size && count * size <= header->size - offset;
+}
+
+// Does the snapshot's ALLOCATE region hold blocks that tile it exactly, with every free list naming free
+// blocks of its own size class once? Sets *in_use to the bytes the blocks in use take.
+static bool snapshot_memory_valid(const SnapshotHeader* header, const unsigned char* bytes, size_t* in_use) {
+    uint64_t committed = header->memory_committed, top = header->memory_top;
+    *in_use = 0;
+    int free_count = 0;
+    for (int i = 0; i <= MEMORY_SIZE_CLASSES; i++) {
+        if (header->memory_free_counts[i] < 0 || header->memory_free_counts[i] > (int64_t)(committed / 16)) return false;
+        free_count += header->memory_free_counts[i];
+    }
+    if (committed == 0) return free_count == 0;
+    if (top % 16 != 0 || top < 16 || top > committed ||
+        !snapshot_section_fits(header, header->memory_blocks, block_table_bytes(committed), 1) ||
+        !snapshot_section_fits(header, header->memory_free, free_count, sizeof(uint32_t))) {
+        return false;
+    }
+    const uint32_t* blocks = (const uint32_t*)(bytes + header->memory_blocks);
+    size_t entries = block_table_bytes(committed) / sizeof(uint32_t);
+    int found[MEMORY_SIZE_CLASSES + 1] = {0};
+    bool valid = blocks[0] == 0;
+    uint64_t offset = 16;
+    while (valid && offset < top) {
+        uint32_t size = blocks[offset / 16] & ~BLOCK_IN_USE;
+        bool pooled = size <= MEMORY_MAX_POOLED && size >= 16 && (size & (size - 1)) == 0;
+        valid = (pooled || (size > MEMORY_MAX_POOLED && size % 4096 == 0)) && offset + size <= top;
+        for (uint64_t i = offset / 16 + 1; valid && i < (offset + size) / 16; i++) valid = blocks[i] == 0;
+        if (!valid) break;
+        if (blocks[offset / 16] & BLOCK_IN_USE) {
+            *in_use += size;
+        } else {
+            found[pooled ? size_class_of(size) : MEMORY_SIZE_CLASSES]++;
+        }
+        offset += size;
+    }
+    for (size_t i = top / 16; valid && i < entries; i++) valid = blocks[i] == 0;
+
+    // Each free block is listed once, in the list of its size
+    const uint32_t* offsets = (const uint32_t*)(bytes + header->memory_free);
+    unsigned char* listed = (unsigned char*)calloc(top / 16, 1);
+    for (int i = 0; valid && i <= MEMORY_SIZE_CLASSES; i++) {
+        valid = header->memory_free_counts[i] == found[i];
+        for (int j = 0; valid && j < header->memory_free_counts[i]; j++) {
+            uint32_t block = *offsets++;
+            valid = block % 16 == 0 && block >= 16 && block < top && !listed[block / 16] &&
+                    blocks[block / 16] != 0 && !(blocks[block / 16] & BLOCK_IN_USE) &&
+                    (i < MEMORY_SIZE_CLASSES ? blocks[block / 16] == (16u << i) : blocks[block / 16] > MEMORY_MAX_POOLED);
+            if (valid) listed[block / 16] = 1;
+        }
+    }
+    free(listed);
+    return valid;
+}
+
+// Do the restored frames and error handler point into program's code? interpreter_restore() checks the
+// file against itself; run_program() checks it against the program it resumes with this.
+static bool snapshot_fits(const Interpreter* interpreter, const Program* program) {
+    for (int i = 0; i < interpreter->return_stack_size; i++) {
+        int address = interpreter->return_stack[i].return_address;
+        if (address <= 0 || address >= program->code_size || program->code[address - 1].op != OP_GOSUB) return false;
+    }
+    return interpreter->error_handler < program->code_size && interpreter->error_pc < program->code_size;
+}
+
+// Load a snapshot written by SNAPSHOT or interpreter_snapshot(); the next run_program() of the same
+// program continues from it. Call after interpreter_init(), which discards a restored state.
+bool interpreter_restore(Interpreter* interpreter, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(SnapshotHeader)) {
+        base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    const unsigned char* bytes = (const unsigned char*)base;
+    const SnapshotHeader* header = (const SnapshotHeader*)base;
+    int count = header->variable_count;
+    bool valid = header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION &&
+                 header->size == (uint64_t)info.st_size && count >= 0 && header->return_stack_size >= 0 &&
+                 header->data_pointer >= 0 && header->error_handler >= -1 && header->error_pc >= -1 &&
+                 header->memory_committed <= header->memory_reserved && header->memory_reserved <= 0x7fffffff &&
+                 snapshot_section_fits(header, header->variables, count, sizeof(int)) &&
+                 snapshot_section_fits(header, header->float_variables, count, sizeof(double)) &&
+                 snapshot_section_fits(header, header->string_variables, count, sizeof(CacheText)) &&
+                 snapshot_section_fits(header, header->arrays, count, sizeof(SnapshotArray)) &&
+                 snapshot_section_fits(header, header->frames, header->return_stack_size, sizeof(Frame)) &&
+                 snapshot_section_fits(header, header->memory, header->memory_committed, 1) &&
+                 snapshot_section_fits(header, header->text, 0, 1);
+    size_t memory_in_use = 0;
+    valid = valid && snapshot_memory_valid(header, bytes, &memory_in_use);
+    const CacheText* strings = (const CacheText*)(bytes + header->string_variables);
+    const SnapshotArray* arrays = (const SnapshotArray*)(bytes + header->arrays);
+    uint64_t text_size = header->size - header->text;
+    for (int i = 0; valid && i < count; i++) {
+        valid = strings[i].offset < 0 || (strings[i].length >= 0 && (uint64_t)strings[i].offset + strings[i].length < text_size);
+        valid = valid && arrays[i].dimension_count >= 0 && arrays[i].dimension_count <= MAX_DIMENSIONS &&
+                (arrays[i].dimension_count == 0 ||
+                 (arrays[i].length > 0 && snapshot_section_fits(header, arrays[i].data, arrays[i].length, sizeof(int))));
+        // Subscripts are bounded by the extents alone, so they must describe exactly length elements
+        long long length = 1;
+        for (int j = 0; valid && j < arrays[i].dimension_count; j++) {
+            valid = arrays[i].extents[j] > 0 && (length *= arrays[i].extents[j]) <= arrays[i].length;
+        }
+        valid = valid && (arrays[i].dimension_count == 0 || length == arrays[i].length);
+    }
+    if (!valid) {
+        munmap(base, (size_t)info.st_size);
+        close(fd);
+        return false;
+    }
+
+    // Drop the current state, then take the snapshot's
+    interpreter_init(interpreter);
+    if (interpreter->variable_count < count) {
+        interpreter->variables = (int*)realloc(interpreter->variables, count * sizeof(int));
+        interpreter->float_variables = (double*)realloc(interpreter->float_variables, count * sizeof(double));
+        interpreter->string_variables = (String**)realloc(interpreter->string_variables, count * sizeof(String*));
+        interpreter->arrays = (Array*)realloc(interpreter->arrays, count * sizeof(Array));
+        memset(interpreter->string_variables + interpreter->variable_count, 0,
+               (count - interpreter->variable_count) * sizeof(String*));
+        memset(interpreter->arrays + interpreter->variable_count, 0, (count - interpreter->variable_count) * sizeof(Array));
+        interpreter->variable_count = count;
+    }
+    if (count > 0) {
+        memcpy(interpreter->variables, bytes + header->variables, count * sizeof(int));
+        memcpy(interpreter->float_variables, bytes + header->float_variables, count * sizeof(double));
+    }
+    // The restored state is charged like the state it replaces, even past the quota: it was held when it was saved
+    MemoryAccount* account = &interpreter->account;
+    MemoryAccount* caller_account = thread_account;
+    thread_account = account;
+    const char* text = (const char*)bytes + header->text;
+    for (int i = 0; i < count; i++) {
+        if (strings[i].offset >= 0) interpreter->string_variables[i] = string_new(text + strings[i].offset, strings[i].length);
+        if (arrays[i].dimension_count == 0) continue;
+        Array* array = &interpreter->arrays[i];
+        size_t size = (size_t)arrays[i].length * sizeof(int);
+        memcpy(array->extents, arrays[i].extents, sizeof(array->extents));
+        array->dimension_count = arrays[i].dimension_count;
+        array->length = arrays[i].length;
+        array->account = account;
+        account_add(account, size);
+        void* data = MAP_FAILED;
+        if (size >= ARRAY_MAP_THRESHOLD && arrays[i].data % SNAPSHOT_ALIGN == 0) {
+            data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)arrays[i].data);
+        }
+        if (data != MAP_FAILED) {
+            array->data = (int*)data;
+            array->mapped_bytes = size;
+        } else {
+            array->data = (int*)malloc(size);
+            memcpy(array->data, bytes + arrays[i].data, size);
+        }
+    }
+
+    interpreter->return_stack_capacity = header->return_stack_size > 64 ? header->return_stack_size : 64;
+    interpreter->return_stack = (Frame*)malloc(interpreter->return_stack_capacity * sizeof(Frame));
+    account_add(account, interpreter->return_stack_capacity * sizeof(Frame));
+    thread_account = caller_account;
+    memcpy(interpreter->return_stack, bytes + header->frames, header->return_stack_size * sizeof(Frame));
+    interpreter->return_stack_size = header->return_stack_size;
+    interpreter->data_pointer = header->data_pointer;
+    interpreter->error_handler = header->error_handler;
+    interpreter->error_code = header->error_code;
+    interpreter->error_pc = header->error_pc;
+    interpreter->in_error_handler = header->in_error_handler != 0;
+
+    // The ALLOCATE region: reserve it as memory_carve() does, with the committed prefix mapped from the file
+    LinearMemory* memory = &interpreter->memory;
+    memory_release(memory);
+    memset(memory, 0, sizeof(LinearMemory));
+    memory->account = account;
+    memory->reserved = header->memory_reserved;
+    bool mapped = true;
+    if (header->memory_committed > 0) {
+        void* region = mmap(NULL, memory->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        mapped = region != MAP_FAILED &&
+                 mmap(region, header->memory_committed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                      (off_t)header->memory) != MAP_FAILED;
+        if (region != MAP_FAILED && !mapped) munmap(region, memory->reserved);
+        if (mapped) {
+            memory->base = (unsigned char*)region;
+            memory->committed = header->memory_committed;
+            size_t table = block_table_bytes(memory->committed);
+            account_add(account, memory->committed + table);
+            memory->blocks = (uint32_t*)malloc(table);
+            memcpy(memory->blocks, bytes + header->memory_blocks, table);
+            const uint32_t* offsets = (const uint32_t*)(bytes + header->memory_free);
+            for (int i = 0; i <= MEMORY_SIZE_CLASSES; i++) {
+                FreeList* list = i < MEMORY_SIZE_CLASSES ? &memory->free_lists[i] : &memory->large_free;
+                for (int j = 0; j < header->memory_free_counts[i]; j++) free_list_push(list, *offsets++);
+            }
+            memory->top = header->memory_top;
+            memory->in_use = memory_in_use;
+            memory->peak_in_use = header->memory_peak_in_use > memory_in_use ? header->memory_peak_in_use : memory_in_use;
+            memory->allocations = header->memory_allocations;
+            memory->frees = header->memory_frees;
+        }
+    }
+    interpreter->resume_pc = header->resume_pc;
+    interpreter->restored_key = header->key;
+    munmap(base, (size_t)info.st_size);
+    close(fd);
+    if (!mapped) {
+        interpreter_init(interpreter);
+        return false;
+    }
+    printf("[DEBUG] Snapshot restored: %d variables, %d frames, %zu bytes of ALLOCATE memory.\n", count,
+           interpreter->return_stack_size, memory->committed);
+    return true;
+}
+
+/* ---------------------------------------------------------------------------
+   Profiler
+
+   The AST carries no source positions, so the profiler lists the program
+   itself, one statement per line in source order and indented by nesting,
+   and reports against that listing. A profiled program is compiled with an
+   OP_COUNT_LINE at the start of every statement, which gives exact
+   execution counts. Time is sampled: an ITIMER_PROF timer raises SIGPROF
+   hz times per CPU second and the handler only sets a flag. The next
+   counted statement sees it and charges the sample to the statement that
+   was running, under the GOSUB frames it was running in; GOSUB is neither
+   inlined nor turned into a jump in tail position while profiling, so every
+   call has its frame. Samples are kept as distinct stacks with a count
+   each, which is what the collapsed-stack ("folded") format of flame graph
+   tools wants.
+
+   Time spent between two statements, such as in a loop condition, is
+   charged to the statement before it. The counters cost an instruction per
+   statement and keep the JIT away from the loops they are in, so a
+   profiled run is slower than a plain one. The timer is per process: only
+   one interpreter at a time can be profiled.
+   --------------------------------------------------------------------------- */
+
+#define PROFILE_MAX_DEPTH 128     // Innermost frames kept per sample; deeper recursion is cut off at the root
+
+// The statements of a program in listing order, each with its nesting depth. A FOR is listed with its
+// initial assignment, so that assignment has no line of its own.
+static ASTNode** source_lines(ASTNode* ast, int** depths, int* count) {
+    int capacity = 64, size = 0, pending_size = 0, pending_capacity = 64;
+    ASTNode** nodes = (ASTNode**)malloc(capacity * sizeof(ASTNode*));
+    *depths = (int*)malloc(capacity * sizeof(int));
+    ASTNode** pending = (ASTNode**)malloc(pending_capacity * sizeof(ASTNode*));
+    int* pending_depths = (int*)malloc(pending_capacity * sizeof(int));
+    pending[pending_size] = ast;
+    pending_depths[pending_size++] = -1;
+    while (pending_size > 0) {
+        ASTNode* node = pending[--pending_size];
+        int depth = pending_depths[pending_size];
+        bool statement = is_statement(node->node_type);
+        if (statement) {
+            if (size >= capacity) {
+                capacity *= 2;
+                nodes = (ASTNode**)realloc(nodes, capacity * sizeof(ASTNode*));
+                *depths = (int*)realloc(*depths, capacity * sizeof(int));
+            }
+            nodes[size] = node;
+            (*depths)[size++] = depth;
+        } else if (strcmp(node->node_type, "block") != 0 && strcmp(node->node_type, "program") != 0) {
+            continue;   // Expressions hold no statements
+        }
+        int first = strcmp(node->node_type, "for_loop") == 0 ? 1 : 0;
+        for (int i = node->children_count - 1; i >= first; i--) {
+            if (pending_size >= pending_capacity) {
+                pending_capacity *= 2;
+                pending = (ASTNode**)realloc(pending, pending_capacity * sizeof(ASTNode*));
+                pending_depths = (int*)realloc(pending_depths, pending_capacity * sizeof(int));
+            }
+            pending[pending_size] = node->children[i];
+            pending_depths[pending_size++] = statement || node == ast ? depth + 1 : depth;
+        }
+    }
+    free(pending);
+    free(pending_depths);
+    *count = size;
+    return nodes;
+}
+
+// Append to a fixed-size line, truncating
+static void format_append(char* out, size_t size, const char* format, ...) {
+    size_t used = strlen(out);
+    if (used + 1 >= size) return;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(out + used, size - used, format, args);
+    va_end(args);
+}
+
+// Keyword of a node type: "line_input_statement" is LINE INPUT, "while_loop" is WHILE
+static void format_keyword(char* out, size_t size, const char* type) {
+    size_t length = strlen(type);
+    if (length > 10 && strcmp(type + length - 10, "_statement") == 0) {
+        length -= 10;
+    } else if (length > 5 && strcmp(type + length - 5, "_loop") == 0) {
+        length -= 5;
+    }
+    size_t used = strlen(out);
+    for (size_t i = 0; i < length && used + 1 < size; i++) {
+        out[used++] = type[i] == '_' ? ' ' : (type[i] >= 'a' && type[i] <= 'z') ? type[i] - 'a' + 'A' : type[i];
+    }
+    out[used] = '\0';
+}
+
+// BASIC text of an expression; nesting past a few levels is elided
+static void format_expression(char* out, size_t size, ASTNode* node, int depth) {
+    const char* type = node->node_type;
+    if (depth > 8) {
+        format_append(out, size, "...");
+    } else if (strcmp(type, "string_literal") == 0) {
+        format_append(out, size, "\"%s\"", node->value);
+    } else if (strcmp(type, "operator") == 0) {
+        for (int i = 0; i < node->children_count; i++) {
+            if (i > 0 || node->children_count == 1) format_append(out, size, i > 0 ? " %s " : "%s ", node->value);
+            bool nested = strcmp(node->children[i]->node_type, "operator") == 0;
+            if (nested) format_append(out, size, "(");
+            format_expression(out, size, node->children[i], depth + 1);
+            if (nested) format_append(out, size, ")");
+        }
+    } else if (node->value && node->children_count == 0 && strcmp(type, "array_ref") != 0) {
+        format_append(out, size, "%s", node->value);    // Variables and numbers
+    } else {
+        if (node->value) format_append(out, size, "%s", node->value); else format_keyword(out, size, type);
+        if (node->children_count > 0 || strcmp(type, "array_ref") == 0) format_append(out, size, "(");
+        for (int i = 0; i < node->children_count; i++) {
+            if (i > 0) format_append(out, size, ", ");
+            format_expression(out, size, node->children[i], depth + 1);
+        }
+        if (node->children_count > 0 || strcmp(type, "array_ref") == 0) format_append(out, size, ")");
+    }
+}
+
+// Listing text of a statement: its header only, since the statements it holds have lines of their own
+static void format_statement(char* out, size_t size, ASTNode* node) {
+    const char* type = node->node_type;
+    if (strcmp(type, "assignment") == 0 && node->children_count == 2) {
+        format_expression(out, size, node->children[0], 0);
+        format_append(out, size, " = ");
+        format_expression(out, size, node->children[1], 0);
+    } else if (strcmp(type, "for_loop") == 0 && node->children[0]->children_count == 2) {
+        format_append(out, size, "FOR ");
+        format_expression(out, size, node->children[0]->children[0], 0);
+        format_append(out, size, " = ");
+        format_expression(out, size, node->children[0]->children[1], 0);
+        format_append(out, size, " TO ");
+        format_expression(out, size, node->children[1], 0);
+        if (node->children_count > 3) {
+            format_append(out, size, " STEP ");
+            format_expression(out, size, node->children[2], 0);
+        }
+    } else if (strcmp(type, "label") == 0) {
+        format_append(out, size, "%s:", node->value);
+    } else {
+        format_keyword(out, size, type);
+        if (node->value) format_append(out, size, " %s", node->value);
+        const char* separator = " ";
+        for (int i = 0; i < node->children_count; i++) {
+            ASTNode* child = node->children[i];
+            if (is_statement(child->node_type) || strcmp(child->node_type, "block") == 0) continue;
+            format_append(out, size, "%s", separator);
+            format_expression(out, size, child, 0);
+            separator = ", ";
+        }
+    }
+}
+
+// List the program and set up empty counters for it
+static Profile* profile_new(ASTNode* ast, int hz) {
+    Profile* profile = (Profile*)calloc(1, sizeof(Profile));
+    profile->hz = hz;
+    int* depths;
+    ASTNode** nodes = source_lines(ast, &depths, &profile->line_count);
+    profile->lines = (char**)calloc(profile->line_count + 1, sizeof(char*));
+    profile->counted = (bool*)calloc(profile->line_count + 1, sizeof(bool));
+    profile->counts = (long*)calloc(profile->line_count + 1, sizeof(long));
+    profile->samples = (long*)calloc(profile->line_count + 1, sizeof(long));
+    for (int i = 0; i < profile->line_count; i++) {
+        char text[256];
+        int indent = depths[i] < 20 ? 2 * depths[i] : 40;
+        memset(text, ' ', indent);
+        text[indent] = '\0';
+        format_statement(text, sizeof(text), nodes[i]);
+        profile->lines[i + 1] = strdup(text);
+        profile->counted[i + 1] = counts_executions(nodes[i]->node_type);
+    }
+    free(nodes);
+    free(depths);
+    profile->stack_capacity = 64;
+    profile->stacks = (ProfileStack*)calloc(profile->stack_capacity, sizeof(ProfileStack));
+    return profile;
+}
+
+static void profile_free(Profile* profile) {
+    if (!profile) return;
+    for (int i = 1; i <= profile->line_count; i++) free(profile->lines[i]);
+    free(profile->lines);
+    free(profile->counted);
+    free(profile->counts);
+    free(profile->samples);
+    free(profile->stacks);
+    free(profile->frames);
+    free(profile);
+}
+
+static struct sigaction profile_previous_action;
+
+static void profile_signal(int signal) {
+    (void)signal;
+    profile_sample_due = 1;
+}
+
+// Start the sampling timer; it measures CPU time, so a program waiting for INPUT is not sampled
+static void profile_start(Profile* profile) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    profile_sample_due = 0;
+    sigaction(SIGPROF, &action, &profile_previous_action);
+    long interval = 1000000L / profile->hz;
+    if (interval < 1) interval = 1;
+    struct itimerval timer;
+    timer.it_interval.tv_sec = timer.it_value.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = timer.it_value.tv_usec = interval % 1000000;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+static void profile_stop(void) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    // A SIGPROF already on its way must not meet the default action, which ends the process
+    if (profile_previous_action.sa_handler == SIG_DFL) profile_previous_action.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &profile_previous_action, NULL);
+    profile_sample_due = 0;
+}
+
+// Entry of the PROCEDURE that frame was pushed for: the operand of the GOSUB before its return address
+static int profile_call_target(const Interpreter* interpreter, const Program* program, int frame) {
+    const Instruction* call = &program->code[interpreter->return_stack[frame].return_address - 1];
+    return call->op == OP_GOSUB ? call->operand : -1;
+}
+
+// Add a distinct stack to the table, which is kept at most half full
+static ProfileStack* profile_insert(Profile* profile, uint64_t hash) {
+    if (2 * (profile->stack_count + 1) > profile->stack_capacity) {
+        int capacity = profile->stack_capacity * 2;
+        ProfileStack* stacks = (ProfileStack*)calloc(capacity, sizeof(ProfileStack));
+        for (int i = 0; i < profile->stack_capacity; i++) {
+            if (profile->stacks[i].samples == 0) continue;
+            int index = (int)(profile->stacks[i].hash & (uint64_t)(capacity - 1));
+            while (stacks[index].samples > 0) index = (index + 1) & (capacity - 1);
+            stacks[index] = profile->stacks[i];
+        }
+        free(profile->stacks);
+        profile->stacks = stacks;
+        profile->stack_capacity = capacity;
+    }
+    int index = (int)(hash & (uint64_t)(profile->stack_capacity - 1));
+    while (profile->stacks[index].samples > 0) index = (index + 1) & (profile->stack_capacity - 1);
+    profile->stack_count++;
+    return &profile->stacks[index];
+}
+
+// Charge a sample to the statement that was running, under the frames it was running in
+static void profile_sample(Interpreter* interpreter, const Program* program) {
+    Profile* profile = interpreter->profile;
+    profile_sample_due = 0;
+    if (profile->line == 0) return;
+    // The frames as they were when the statement started. Those it has popped since, by returning from its
+    // PROCEDURE, are still in the array: only a GOSUB statement pushes, and none has started in between.
+    int depth = profile->depth < interpreter->return_stack_capacity ? profile->depth : interpreter->return_stack_capacity;
+    int outermost = depth > PROFILE_MAX_DEPTH ? depth - PROFILE_MAX_DEPTH : 0;
+    uint64_t hash = (14695981039346656037ull ^ (uint64_t)profile->line) * 1099511628211ull;
+    hash = (hash ^ (uint64_t)outermost) * 1099511628211ull;
+    for (int i = outermost; i < depth; i++) {
+        hash = (hash ^ (uint32_t)profile_call_target(interpreter, program, i)) * 1099511628211ull;
+    }
+    profile->samples[profile->line]++;
+    profile->sample_count++;
+
+    int mask = profile->stack_capacity - 1;
+    for (int index = (int)(hash & (uint64_t)mask); profile->stacks[index].samples > 0; index = (index + 1) & mask) {
+        ProfileStack* stack = &profile->stacks[index];
+        if (stack->hash != hash || stack->line != profile->line || stack->depth != depth - outermost ||
+            stack->truncated != (outermost > 0)) {
+            continue;
+        }
+        int i = 0;
+        while (i < stack->depth && profile->frames[stack->frames + i] ==
+                                       profile_call_target(interpreter, program, outermost + i)) {
+            i++;
+        }
+        if (i == stack->depth) {
+            stack->samples++;
+            return;
+        }
+    }
+
+    if (profile->frame_count + (depth - outermost) > profile->frame_capacity) {
+        profile->frame_capacity = 2 * (profile->frame_count + (depth - outermost)) + 64;
+        profile->frames = (int*)realloc(profile->frames, profile->frame_capacity * sizeof(int));
+    }
+    ProfileStack* stack = profile_insert(profile, hash);
+    stack->hash = hash;
+    stack->frames = profile->frame_count;
+    stack->depth = depth - outermost;
+    stack->truncated = outermost > 0;
+    stack->line = profile->line;
+    stack->samples = 1;
+    for (int i = outermost; i < depth; i++) {
+        profile->frames[profile->frame_count++] = profile_call_target(interpreter, program, i);
+    }
+}
+
+// Name of the PROCEDURE whose entry a call target is
+static const char* profile_frame_name(const Program* program, int target) {
+    for (int i = 0; i < program->label_count; i++) {
+        int address = program->labels[i].address;
+        if (address >= 0 && address < program->code_size && jump_destination(program, address) == target) {
+            return program->labels[i].name;
+        }
+    }
+    return "?";
+}
+
+// Write the profile of the last run_program(). folded_path gets one "main;PROC;...;line: statement samples"
+// line per distinct stack, for flame graph tools; listing_path gets the program listing with the executions
+// and the share of samples of every line. Either may be NULL. Returns false when there is no profile or a
+// file could not be written.
+bool interpreter_write_profile(Interpreter* interpreter, const char* folded_path, const char* listing_path) {
+    Profile* profile = interpreter->profile;
+    if (!profile || !interpreter->program) {
+        fprintf(stderr, "No profile to write; see interpreter_set_profile()\n");
+        return false;
+    }
+    bool written = true;
+    FILE* out;
+    if (folded_path && !(out = fopen(folded_path, "w"))) {
+        fprintf(stderr, "Cannot write profile: %s\n", folded_path);
+        written = false;
+    } else if (folded_path) {
+        for (int i = 0; i < profile->stack_capacity; i++) {
+            const ProfileStack* stack = &profile->stacks[i];
+            if (stack->samples == 0) continue;
+            fputs(stack->truncated ? "..." : "main", out);
+            for (int j = 0; j < stack->depth; j++) {
+                fprintf(out, ";%s", profile_frame_name(interpreter->program, profile->frames[stack->frames + j]));
+            }
+            // The statement without its indentation, and with no ';' for the tools to split it at
+            const char* text = profile->lines[stack->line];
+            while (*text == ' ') text++;
+            fprintf(out, ";%d: ", stack->line);
+            for (; *text; text++) fputc(*text == ';' ? ',' : *text, out);
+            fprintf(out, " %ld\n", stack->samples);
+        }
+        if (fclose(out) != 0) written = false;
+    }
+    if (listing_path && !(out = fopen(listing_path, "w"))) {
+        fprintf(stderr, "Cannot write profile: %s\n", listing_path);
+        written = false;
+    } else if (listing_path) {
+        fprintf(out, "Profile: %ld samples at %d Hz\n\n", profile->sample_count, profile->hz);
+        fprintf(out, "   line       count    time  statement\n");
+        for (int line = 1; line <= profile->line_count; line++) {
+            if (!profile->counted[line]) {
+                fprintf(out, "%7d %11s %7s  %s\n", line, "", "", profile->lines[line]);
+                continue;
+            }
+            double share = profile->sample_count ? 100.0 * profile->samples[line] / profile->sample_count : 0.0;
+            fprintf(out, "%7d %11ld %6.1f%%  %s\n", line, profile->counts[line], share, profile->lines[line]);
+        }
+        if (fclose(out) != 0) written = false;
+    }
+    return written;
+}
+
+/* ---------------------------------------------------------------------------
+   Hot reload
+
+   interpreter_reload() takes a new version of the running program in which
+   only PROCEDURE bodies changed. It may be called from another thread while
+   run_program() executes: it compiles the whole new program on the calling
+   thread and leaves it for the running program, which takes it at its next
+   GOSUB or memo lookup, a point where no call is half made. There the new
+   code is appended after the old, sharing variables by name, and every
+   GOSUB in the old code is rebound to the new version of its PROCEDURE.
+   Old code is never removed: a frame still inside an old body returns into
+   it and finishes there, while any call it makes reaches the new body. The
+   main program carries on where it was.
+
+   Since the main program cannot be swapped while it runs, a reload that
+   changes anything outside the top-level PROCEDUREs is refused, as is one
+   that does not compile; the running program is then left alone. An
+   inlined copy of a PROCEDURE could not be rebound, so reloading needs the
+   program to be compiled with interpreter_set_hot_reload(), which turns
+   inlining off. For the same reason the compiler then assumes a GOSUB may
+   write any variable and memoizes no procedure that calls another: what
+   it knew about the callee holds only until the next reload. Memo tables
+   of the new code start empty, and a variable keeps its slot and value,
+   so a reload that changes the type inferred for a variable the running
+   program already has is refused as well.
+   --------------------------------------------------------------------------- */
+
+// Hash the program outside its top-level PROCEDUREs, and each of those on its own
+static uint64_t source_keys(ASTNode* ast, uint64_t** procedure_keys, int* procedure_count) {
+    uint64_t hash = 14695981039346656037ull;
+    *procedure_keys = (uint64_t*)malloc((ast->children_count + 1) * sizeof(uint64_t));
+    *procedure_count = 0;
+    for (int i = 0; i < ast->children_count; i++) {
+        ASTNode* child = ast->children[i];
+        if (strcmp(child->node_type, "procedure") == 0) {
+            (*procedure_keys)[(*procedure_count)++] = hash_tree(14695981039346656037ull, child);
+        } else {
+            hash = hash_tree(hash, child);
+        }
+    }
+    return hash;
+}
+
+// The variables a reload may add to but not retype, since the running program's code and values stay
+static void record_variable_types(Interpreter* interpreter, const Program* program) {
+    int count = interpreter->variable_name_count;
+    interpreter->variable_names = (char**)realloc(interpreter->variable_names, (count + program->symbol_count + 1) * sizeof(char*));
+    interpreter->variable_types = (ValueType*)realloc(interpreter->variable_types,
+                                                      (count + program->symbol_count + 1) * sizeof(ValueType));
+    for (int i = 0; i < program->symbol_count; i++) {
+        if (!program->symbols[i]) continue;
+        int j = 0;
+        while (j < count && strcmp(interpreter->variable_names[j], program->symbols[i]) != 0) j++;
+        if (j < count) continue;
+        interpreter->variable_names[count] = strdup(program->symbols[i]);
+        interpreter->variable_types[count++] = program->symbol_types[i];
+    }
+    interpreter->variable_name_count = count;
+}
+
+static void forget_variable_types(Interpreter* interpreter) {
+    for (int i = 0; i < interpreter->variable_name_count; i++) free(interpreter->variable_names[i]);
+    free(interpreter->variable_names);
+    free(interpreter->variable_types);
+    interpreter->variable_names = NULL;
+    interpreter->variable_types = NULL;
+    interpreter->variable_name_count = 0;
+}
+
+static void reload_free(Reload* reload) {
+    if (!reload) return;
+    free_program(reload->program);
+    for (int i = 0; i < reload->procedure_count; i++) free(reload->procedures[i]);
+    free(reload->procedures);
+    free(reload);
+}
+
+// interpreter_reload() with reload_lock held
+static bool reload_locked(Interpreter* interpreter, ASTNode* ast) {
+    if (strcmp(ast->node_type, "program") != 0 || !__atomic_load_n(&interpreter->program, __ATOMIC_ACQUIRE)) {
+        fprintf(stderr, "Hot reload: no program is running\n");
+        return false;
+    }
+    if (!interpreter->hot_reload) {
+        fprintf(stderr, "Hot reload: the program was not compiled for it; see interpreter_set_hot_reload()\n");
+        return false;
+    }
+    if (interpreter->profile) {
+        fprintf(stderr, "Hot reload: not while profiling; the listing would no longer match the code\n");
+        return false;
+    }
+    uint64_t* keys;
+    int key_count;
+    if (source_keys(ast, &keys, &key_count) != interpreter->source_key) {
+        fprintf(stderr, "Hot reload: only PROCEDURE bodies may change; restart to pick up other edits\n");
+        free(keys);
+        return false;
+    }
+    int changed = 0;
+    for (int i = 0; i < key_count; i++) {
+        bool known = false;
+        for (int j = 0; j < interpreter->procedure_key_count && !known; j++) known = keys[i] == interpreter->procedure_keys[j];
+        if (!known) changed++;
+    }
+    if (changed == 0 && key_count == interpreter->procedure_key_count) {
+        printf("[DEBUG] Hot reload: no PROCEDURE changed.\n");
+        free(keys);
+        return true;
+    }
+
+    char error[256];
+    Program* program = try_compile_program(ast, 0, interpreter->compile_threads, false, true, error);
+    if (!program) {
+        fprintf(stderr, "Hot reload: %s\n", error);
+        free(keys);
+        return false;
+    }
+    // Array or scalar, the name already tells apart: "a()" and "a" are different slots
+    for (int i = 0; i < program->symbol_count; i++) {
+        if (!program->symbols[i]) continue;
+        for (int j = 0; j < interpreter->variable_name_count; j++) {
+            if (strcmp(interpreter->variable_names[j], program->symbols[i]) != 0) continue;
+            if (interpreter->variable_types[j] == program->symbol_types[i]) break;
+            fprintf(stderr, "Hot reload: the edit changes the type of %s; restart to pick it up\n", program->symbols[i]);
+            free_program(program);
+            free(keys);
+            return false;
+        }
+    }
+    record_variable_types(interpreter, program);
+    Reload* reload = (Reload*)calloc(1, sizeof(Reload));
+    reload->program = program;
+    int node_count;
+    ASTNode** nodes = collect_nodes(ast, &node_count);
+    reload->procedures = (char**)malloc((node_count + 1) * sizeof(char*));
+    for (int i = 0; i < node_count; i++) {
+        if (strcmp(nodes[i]->node_type, "procedure") == 0) reload->procedures[reload->procedure_count++] = strdup(nodes[i]->value);
+    }
+    free(nodes);
+    free(interpreter->procedure_keys);
+    interpreter->procedure_keys = keys;
+    interpreter->procedure_key_count = key_count;
+    // Once published the running program owns it, so it is reported first
+    printf("[DEBUG] Hot reload: %d PROCEDUREs changed, %d instructions ready for the next call.\n", changed,
+           program->code_size);
+    // A reload the running program has not taken yet is superseded: this one was compiled from newer source
+    reload_free(__atomic_exchange_n(&interpreter->reload, reload, __ATOMIC_ACQ_REL));
+    return true;
+}
+
+// Replace the running program's PROCEDUREs with those of ast, the same program with only PROCEDURE bodies
+// edited. The running program switches over at its next call. Returns false, changing nothing, when ast
+// edits anything else, changes the type of a variable the running code shares, or does not compile.
+bool interpreter_reload(Interpreter* interpreter, ASTNode* ast) {
+    pthread_mutex_lock(&interpreter->reload_lock);
+    bool reloaded = reload_locked(interpreter, ast);
+    pthread_mutex_unlock(&interpreter->reload_lock);
+    return reloaded;
+}
+
+// Give a program mapped from the bytecode cache its own copy of everything in the image, so it can be changed
+static void program_unshare(Program* program) {
+    Instruction* code = (Instruction*)malloc((program->code_size + 1) * sizeof(Instruction));
+    memcpy(code, program->code, program->code_size * sizeof(Instruction));
+    program->code = code;
+    int* data = (int*)malloc((program->data_count + 1) * sizeof(int));
+    memcpy(data, program->data, program->data_count * sizeof(int));
+    program->data = data;
+    double* floats = (double*)malloc((program->float_count + 1) * sizeof(double));
+    memcpy(floats, program->floats, program->float_count * sizeof(double));
+    program->floats = floats;
+    StatementRange* statements = (StatementRange*)malloc((program->statement_count + 1) * sizeof(StatementRange));
+    memcpy(statements, program->statements, program->statement_count * sizeof(StatementRange));
+    program->statements = statements;
+    for (int i = 0; i < program->symbol_count; i++) {
+        if (program->symbols[i]) program->symbols[i] = strdup(program->symbols[i]);
+    }
+    for (int i = 0; i < program->label_count; i++) program->labels[i].name = strdup(program->labels[i].name);
+    for (int i = 0; i < program->memo_count; i++) {
+        size_t bytes = (program->memos[i].key_count + program->memos[i].result_count) * sizeof(MemoSlot);
+        MemoSlot* slots = (MemoSlot*)malloc(bytes + sizeof(MemoSlot));
+        memcpy(slots, program->memos[i].slots, bytes);
+        program->memos[i].slots = slots;
+    }
+    // String literals stay slices of the image, and keep it mapped while they live
+    mapping_release(program->image);
+    program->image = NULL;
+}
+
+// Address of a label, -1 if the program has none by that name
+static int label_address(const Program* program, const char* name) {
+    for (int i = 0; i < program->label_count; i++) {
+        if (strcmp(program->labels[i].name, name) == 0) return program->labels[i].address;
+    }
+    return -1;
+}
+
+// Take a pending reload: append its code and tables to the running program and rebind the old code's calls
+static void reload_link(Interpreter* interpreter, Program* program) {
+    Reload* reload = __atomic_exchange_n(&interpreter->reload, NULL, __ATOMIC_ACQ_REL);
+    if (!reload) return;
+    Program* update = reload->program;
+    int max_stack = update->max_stack > program->max_stack ? update->max_stack : program->max_stack;
+    if (reserve_stacks(interpreter, max_stack, update->max_string_stack, update->max_float_stack) != ERR_NONE) {
+        fprintf(stderr, "Hot reload: the new code needs more stack than the limits allow; keeping the old code\n");
+        reload_free(reload);
+        return;
+    }
+    if (program->image) program_unshare(program);
+    int code_base = program->code_size;
+    int string_base = program->string_count;
+    int float_base = program->float_count;
+    int memo_base = program->memo_count;
+
+    // Variables are shared by name; the new code's temporaries get slots of their own
+    int* slots = (int*)malloc((update->symbol_count + 1) * sizeof(int));
+    for (int i = 0; i < update->symbol_count; i++) {
+        slots[i] = update->symbols[i] ? resolve_slot(program, update->symbols[i]) : add_slot(program, NULL);
+        free(update->symbols[i]);
+    }
+    program->symbol_types = (ValueType*)realloc(program->symbol_types, (program->symbol_count + 1) * sizeof(ValueType));
+    for (int i = 0; i < update->symbol_count; i++) program->symbol_types[slots[i]] = update->symbol_types[i];
+    program->code_capacity = program->code_size + update->code_size;
+    program->code = (Instruction*)realloc(program->code, program->code_capacity * sizeof(Instruction));
+    for (int i = 0; i < update->code_size; i++) {
+        Instruction instruction = update->code[i];
+        OpCode op = generic_opcode(instruction.op);
+        if (op == OP_GOSUB || op == OP_ON_ERROR || op == OP_RESUME_LABEL || operand_kind(op) == OPERAND_ADDRESS) {
+            if (instruction.operand >= 0) instruction.operand += code_base;
+        } else if (op == OP_MEMO_LOOKUP) {
+            instruction.operand += memo_base;
+        } else if (operand_kind(op) == OPERAND_SLOT) {
+            instruction.operand = slots[instruction.operand];
+        } else if (operand_kind(op) == OPERAND_ELEMENT) {
+            instruction.operand = slots[instruction.operand >> 3] << 3 | (instruction.operand & 7);
+        } else if (operand_kind(op) == OPERAND_STRING) {
+            instruction.operand += string_base;
+        } else if (operand_kind(op) == OPERAND_FLOAT) {
+            instruction.operand += float_base;
+        }
+        program->code[program->code_size++] = instruction;
+    }
+
+    program->strings = (String**)realloc(program->strings, (program->string_count + update->string_count + 1) * sizeof(String*));
+    for (int i = 0; i < update->string_count; i++) program->strings[program->string_count++] = update->strings[i];
+    program->string_capacity = program->string_count;
+    program->floats = (double*)realloc(program->floats, (program->float_count + update->float_count + 1) * sizeof(double));
+    for (int i = 0; i < update->float_count; i++) program->floats[program->float_count++] = update->floats[i];
+    program->float_capacity = program->float_count;
+    program->statements = (StatementRange*)realloc(program->statements,
+                                                   (program->statement_count + update->statement_count + 1) * sizeof(StatementRange));
+    for (int i = 0; i < update->statement_count; i++) {
+        program->statements[program->statement_count].start = update->statements[i].start + code_base;
+        program->statements[program->statement_count++].end = update->statements[i].end + code_base;
+    }
+    program->statement_capacity = program->statement_count;
+    program->memos = (Memo*)realloc(program->memos, (program->memo_count + update->memo_count + 1) * sizeof(Memo));
+    for (int i = 0; i < update->memo_count; i++) {
+        Memo* memo = &program->memos[program->memo_count++];
+        *memo = update->memos[i];
+        for (int j = 0; j < memo->key_count + memo->result_count; j++) memo->slots[j].slot = slots[memo->slots[j].slot];
+    }
+    free(slots);
+    // DATA belongs to the whole program, so READ goes on in the new version of it
+    free(program->data);
+    program->data = update->data;
+    program->data_count = update->data_count;
+    program->data_capacity = update->data_capacity;
+    update->data = NULL;
+    if (update->max_string_stack > program->max_string_stack) program->max_string_stack = update->max_string_stack;
+    if (update->max_float_stack > program->max_float_stack) program->max_float_stack = update->max_float_stack;
+    program->max_stack = max_stack;
+
+    // Rebind every call in the old code, along with the memo lookup in front of it
+    int rebound = 0;
+    for (int p = 0; p < reload->procedure_count; p++) {
+        int from = label_address(program, reload->procedures[p]);
+        int to = label_address(update, reload->procedures[p]);
+        if (from < 0 || to < 0) continue;
+        from = jump_destination(program, from);
+        to = jump_destination(program, to + code_base);
+        int memo = -1;
+        for (int pc = code_base + 1; pc < program->code_size && memo < 0; pc++) {
+            if (program->code[pc].op == OP_GOSUB && program->code[pc].operand == to && program->code[pc - 1].op == OP_MEMO_LOOKUP) {
+                memo = program->code[pc - 1].operand;
+            }
+        }
+        for (int pc = 0; pc < code_base; pc++) {
+            if (program->code[pc].op != OP_GOSUB || program->code[pc].operand != from) continue;
+            program->code[pc].operand = to;
+            if (pc > 0 && program->code[pc - 1].op == OP_MEMO_LOOKUP) {
+                program->code[pc - 1].op = memo >= 0 ? OP_MEMO_LOOKUP : OP_NOP;
+                program->code[pc - 1].operand = memo >= 0 ? memo : 0;
+            }
+            rebound++;
+        }
+    }
+    // Labels now name the newest code, which the next reload rebinds from
+    for (int i = 0; i < update->label_count; i++) {
+        int j = 0;
+        while (j < program->label_count && strcmp(program->labels[j].name, update->labels[i].name) != 0) j++;
+        if (j == program->label_count) {
+            if (program->label_count >= program->label_capacity) {
+                program->label_capacity = program->label_count + update->label_count;
+                program->labels = (Label*)realloc(program->labels, program->label_capacity * sizeof(Label));
+            }
+            program->labels[program->label_count++].name = update->labels[i].name;
+        } else {
+            free(update->labels[i].name);
+        }
+        program->labels[j].address = update->labels[i].address + code_base;
+    }
+    if (program->jit) {
+        JitCache* jit = program->jit;
+        jit->counts = (int*)realloc(jit->counts, program->code_size * sizeof(int));
+        jit->loops = (JitLoop*)realloc(jit->loops, program->code_size * sizeof(JitLoop));
+        memset(jit->counts + code_base, 0, (program->code_size - code_base) * sizeof(int));
+        memset(jit->loops + code_base, 0, (program->code_size - code_base) * sizeof(JitLoop));
+    }
+    program->reloads++;
+
+    free(update->code);
+    free(update->symbols);
+    free(update->symbol_types);
+    free(update->labels);
+    free(update->strings);
+    free(update->floats);
+    free(update->statements);
+    free(update->memos);
+    free(update);
+    reload->program = NULL;
+    reload_free(reload);
+    prepare_execution(interpreter, program);    // Cannot fail: the stacks were reserved above
+    printf("[DEBUG] Hot reload: linked %d instructions, %d calls rebound.\n", program->code_size - code_base, rebound);
+}
+
+/* ---------------------------------------------------------------------------
+   Native backend: AST -> C
+
+   transpile_program() writes a self-contained C translation unit. Every
+   BASIC variable becomes a local of main() so the C compiler can keep it in
+   a register, structured statements map onto their C counterparts, and
+   GOSUB pushes the address of a return label (computed goto, supported by
+   GCC and Clang) so RETURN is one indirect jump. A small runtime for
+   strings, arrays, DATA and runtime errors is emitted ahead of main().
+   compile_native() hands the result to the system C compiler.
+
+   Variables get the C type inferred for the bytecode (int, double or
+   String *). Integer to float conversions are left to C; float to integer
+   goes through rt_ftoi() so overflow raises the same error as FLT_TO_INT.
+
+   Files, linear memory and error trapping have no native runtime yet;
+   programs using them are rejected and keep running in the interpreter.
+   --------------------------------------------------------------------------- */
+
+// One node being translated; like CompileTask, a small state machine resumed after its children
+typedef struct {
+    ASTNode *node;
+    int state;
+    int index;      // Next child to translate
+    int temp;       // First C temporary (FOR limit/step, SELECT value)
+    int skip;       // PROCEDURE: label that straight-line code jumps to
+    bool truncate;  // Float value wrapped in rt_ftoi(), closed when the task finishes
+} TranspileTask;
+
+typedef struct {
+    FILE *out;              // Body of main(); declarations are written once every name is known
+    Program *symbols;       // Variable slots, labels (address 1 once defined) and DATA
+    TypeTable *types;
+    TranspileTask *tasks;
+    int task_count;
+    int task_capacity;
+    char **literals;
+    int literal_count;
+    int literal_capacity;
+    int temp_count;
+    int float_temp_count;   // FOR limit/step of float loops: f0, f1, ...
+    int return_sites;
+    int skip_count;
+    int indent;
+} Transpiler;
+
+// Runtime shared by every generated program; mirrors the interpreter's semantics and error numbers
+static const char* native_runtime =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <limits.h>\n"
+    "\n"
+    "typedef struct String { int refcount; int length; char data[]; } String;\n"
+    "typedef struct { int *data; int length; int extents[7]; int dimension_count; } Array;\n"
+    "\n"
+    "#define RT_MAX_GOSUB (1 << 20)\n"
+    "static void *rt_returns[RT_MAX_GOSUB];\n"
+    "static int rt_return_count;\n"
+    "static int rt_data_pointer;\n"
+    "\n"
+    "static void rt_error(int code) {\n"
+    "    const char *message = \"Unknown error\";\n"
+    "    switch (code) {\n"
+    "        case 3: message = \"RETURN without GOSUB\"; break;\n"
+    "        case 4: message = \"Out of DATA\"; break;\n"
+    "        case 5: message = \"Illegal function call\"; break;\n"
+    "        case 6: message = \"Overflow\"; break;\n"
+    "        case 7: message = \"Out of memory\"; break;\n"
+    "        case 9: message = \"Subscript out of range\"; break;\n"
+    "        case 11: message = \"Division by zero\"; break;\n"
+    "        case 28: message = \"Out of stack space\"; break;\n"
+    "    }\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"Runtime error %d: %s\\n\", code, message);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "#define RT_GOSUB(target, site) do { if (rt_return_count == RT_MAX_GOSUB) rt_error(28); \\\n"
+    "    rt_returns[rt_return_count++] = &&site; goto target; } while (0); site:\n"
+    "#define RT_RETURN() do { if (rt_return_count == 0) rt_error(3); goto *rt_returns[--rt_return_count]; } while (0)\n"
+    "#define RT_READ(variable) do { if (rt_data_pointer >= RT_DATA_COUNT) rt_error(4); \\\n"
+    "    variable = rt_data[rt_data_pointer++]; } while (0)\n"
+    "\n"
+    "static inline int rt_div(int left, int right) {\n"
+    "    if (right == 0) rt_error(11);\n"
+    "    if (left == -2147483647 - 1 && right == -1) rt_error(6);\n"
+    "    return left / right;\n"
+    "}\n"
+    "\n"
+    "static inline double rt_fdiv(double left, double right) {\n"
+    "    if (right == 0.0) rt_error(11);\n"
+    "    return left / right;\n"
+    "}\n"
+    "\n"
+    "static inline int rt_ftoi(double value) {\n"
+    "    if (!(value > -2147483649.0 && value < 2147483648.0)) rt_error(6);\n"
+    "    return (int)value;\n"
+    "}\n"
+    "\n"
+    "/* Strings: NULL is the empty string; every String* expression is an owned reference */\n"
+    "static String *rt_new(const char *data, int length) {\n"
+    "    if (length == 0) return NULL;\n"
+    "    String *string = malloc(sizeof(String) + length);\n"
+    "    if (!string) rt_error(7);\n"
+    "    string->refcount = 1;\n"
+    "    string->length = length;\n"
+    "    memcpy(string->data, data, length);\n"
+    "    return string;\n"
+    "}\n"
+    "\n"
+    "static inline String *rt_retain(String *string) {\n"
+    "    if (string) string->refcount++;\n"
+    "    return string;\n"
+    "}\n"
+    "\n"
+    "static inline void rt_release(String *string) {\n"
+    "    if (string && --string->refcount == 0) free(string);\n"
+    "}\n"
+    "\n"
+    "static inline void rt_assign(String **variable, String *value) {\n"
+    "    rt_release(*variable);\n"
+    "    *variable = value;\n"
+    "}\n"
+    "\n"
+    "static String *rt_concat(String *left, String *right) {\n"
+    "    if (!left) return right;\n"
+    "    if (!right) return left;\n"
+    "    if (left->length > INT_MAX - right->length) rt_error(7);\n"
+    "    String *result = malloc(sizeof(String) + (size_t)left->length + right->length);\n"
+    "    if (!result) rt_error(7);\n"
+    "    result->refcount = 1;\n"
+    "    result->length = left->length + right->length;\n"
+    "    memcpy(result->data, left->data, left->length);\n"
+    "    memcpy(result->data + left->length, right->data, right->length);\n"
+    "    rt_release(left);\n"
+    "    rt_release(right);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "static int rt_compare(String *left, String *right) {\n"
+    "    int left_length = left ? left->length : 0, right_length = right ? right->length : 0;\n"
+    "    int common = left_length < right_length ? left_length : right_length;\n"
+    "    int result = common ? memcmp(left->data, right->data, common) : 0;\n"
+    "    if (result == 0) result = (left_length > right_length) - (left_length < right_length);\n"
+    "    rt_release(left);\n"
+    "    rt_release(right);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "static void rt_print_int(int value) {\n"
+    "    printf(\"%d\\n\", value);\n"
+    "}\n"
+    "\n"
+    "static void rt_print_float(double value) {\n"
+    "    printf(\"%.15g\\n\", value);\n"
+    "}\n"
+    "\n"
+    "static void rt_print(String *string) {\n"
+    "    if (string) fwrite(string->data, 1, string->length, stdout);\n"
+    "    putchar('\\n');\n"
+    "    rt_release(string);\n"
+    "}\n"
+    "\n"
+    "/* Arrays: row-major ints, DIM bounds are inclusive */\n"
+    "static void rt_dim(Array *array, int count, const int *bounds) {\n"
+    "    long long length = 1;\n"
+    "    for (int i = 0; i < count; i++) {\n"
+    "        if (bounds[i] < 0) rt_error(5);\n"
+    "        length *= (long long)bounds[i] + 1;\n"
+    "        if (length > 0x7fffffff / (long long)sizeof(int)) rt_error(7);\n"
+    "    }\n"
+    "    int *data = calloc((size_t)length, sizeof(int));\n"
+    "    if (!data) rt_error(7);\n"
+    "    free(array->data);\n"
+    "    array->data = data;\n"
+    "    array->length = (int)length;\n"
+    "    array->dimension_count = count;\n"
+    "    for (int i = 0; i < count; i++) array->extents[i] = bounds[i] + 1;\n"
+    "}\n"
+    "\n"
+    "static inline long rt_offset(const Array *array, int count, const int *subscripts) {\n"
+    "    if (count != array->dimension_count) rt_error(9);\n"
+    "    long offset = 0;\n"
+    "    for (int i = 0; i < count; i++) {\n"
+    "        if ((unsigned)subscripts[i] >= (unsigned)array->extents[i]) rt_error(9);\n"
+    "        offset = offset * array->extents[i] + subscripts[i];\n"
+    "    }\n"
+    "    return offset;\n"
+    "}\n"
+    "\n";
+
+// Schedule a node for translation
+static void transpile_push(Transpiler* transpiler, ASTNode* node) {
+    if (transpiler->task_count >= transpiler->task_capacity) {
+        transpiler->task_capacity = (transpiler->task_capacity == 0) ? 32 : transpiler->task_capacity * 2;
+        transpiler->tasks = (TranspileTask*)realloc(transpiler->tasks, transpiler->task_capacity * sizeof(TranspileTask));
+    }
+    TranspileTask* task = &transpiler->tasks[transpiler->task_count++];
+    task->node = node;
+    task->state = 0;
+    task->index = 0;
+    task->temp = -1;
+    task->skip = -1;
+    task->truncate = false;
+}
+
+// Schedule an expression whose value is needed as the given type; floats needed as integers are truncated
+static void transpile_coerced(Transpiler* transpiler, ASTNode* node, ValueType type) {
+    require_type(transpiler->types, node, type);
+    transpile_push(transpiler, node);
+    if (type == TYPE_INT && expression_type(transpiler->types, node) == TYPE_FLOAT) {
+        fputs("rt_ftoi(", transpiler->out);
+        transpiler->tasks[transpiler->task_count - 1].truncate = true;
+    }
+}
+
+// Start a statement line at the current nesting depth
+static void transpile_line(Transpiler* transpiler, const char* format, ...) {
+    fprintf(transpiler->out, "%*s", 4 * (transpiler->indent + 1), "");
+    va_list args;
+    va_start(args, format);
+    vfprintf(transpiler->out, format, args);
+    va_end(args);
+}
+
+// Index of a label, marking it defined when define is set
+static int transpile_label(Transpiler* transpiler, const char* name, bool define) {
+    Program* symbols = transpiler->symbols;
+    int index = 0;
+    while (index < symbols->label_count && strcmp(symbols->labels[index].name, name) != 0) index++;
+    if (index == symbols->label_count) {
+        if (symbols->label_count >= symbols->label_capacity) {
+            symbols->label_capacity = (symbols->label_capacity == 0) ? 8 : symbols->label_capacity * 2;
+            symbols->labels = (Label*)realloc(symbols->labels, symbols->label_capacity * sizeof(Label));
+        }
+        symbols->labels[index].name = strdup(name);
+        symbols->labels[index].address = 0;
+        symbols->label_count++;
+    }
+    if (define) {
+        if (symbols->labels[index].address) {
+            fprintf(stderr, "Duplicate label: %s\n", name);
+            exit(1);
+        }
+        symbols->labels[index].address = 1;
+    }
+    return index;
+}
+
+// Write text as a C string literal; octal escapes keep it independent of the source character set
+static void write_c_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 32 || *p >= 127 || *p == '?') fprintf(out, "\\%03o", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// C spelling of a BASIC operator
+static const char* c_operator(const char* op) {
+    if (strcmp(op, "=") == 0) return "==";
+    if (strcmp(op, "<>") == 0) return "!=";
+    return op;
+}
+
+// Advance the task on top of the stack by one step; false when the node has no native translation
+static bool transpile_step(Transpiler* transpiler) {
+    TranspileTask* task = &transpiler->tasks[transpiler->task_count - 1];
+    ASTNode* node = task->node;
+    const char* type = node->node_type;
+    Program* symbols = transpiler->symbols;
+    TypeTable* types = transpiler->types;
+    FILE* out = transpiler->out;
+
+    if (strcmp(type, "program") == 0 || strcmp(type, "block") == 0) {
+        if (task->index < node->children_count) {
+            transpile_push(transpiler, node->children[task->index++]);
+        } else {
+            transpiler->task_count--;
+        }
+    } else if (strcmp(type, "int_literal") == 0) {
+        fprintf(out, "%d", atoi(node->value));
+        transpiler->task_count--;
+    } else if (strcmp(type, "float_literal") == 0) {
+        fputs(node->value, out);
+        transpiler->task_count--;
+    } else if (strcmp(type, "string_literal") == 0) {
+        if (transpiler->literal_count >= transpiler->literal_capacity) {
+            transpiler->literal_capacity = (transpiler->literal_capacity == 0) ? 16 : transpiler->literal_capacity * 2;
+            transpiler->literals = (char**)realloc(transpiler->literals, transpiler->literal_capacity * sizeof(char*));
+        }
+        transpiler->literals[transpiler->literal_count] = node->value;
+        fprintf(out, "rt_retain(rt_literals[%d])", transpiler->literal_count++);
+        transpiler->task_count--;
+    } else if (strcmp(type, "identifier") == 0) {
+        int slot = resolve_slot(symbols, node->value);
+        fprintf(out, variable_type(types, node->value) == TYPE_STRING ? "rt_retain(v%d)" : "v%d", slot);
+        transpiler->task_count--;
+    } else if (strcmp(type, "operator") == 0) {
+        // Strings: rt_concat(l, r) or (rt_compare(l, r) op 0); numbers: (l op r), rt_div(l, r), rt_fdiv(l, r)
+        bool string = expression_type(types, node->children[0]) == TYPE_STRING;
+        bool divide = !string && strcmp(node->value, "/") == 0;
+        bool floating = expression_type(types, node->children[0]) == TYPE_FLOAT ||
+                        expression_type(types, node->children[1]) == TYPE_FLOAT;
+        OpCode op = operator_opcode(node->value);
+        switch (task->state++) {
+            case 0:
+                require_type(types, node->children[1], string ? TYPE_STRING : TYPE_INT);
+                if (string && op != OP_ADD_INT && !(op >= OP_EQ && op <= OP_GE)) {
+                    fprintf(stderr, "Type mismatch: operator %s on strings\n", node->value);
+                    exit(1);
+                }
+                fputs(string ? (op == OP_ADD_INT ? "rt_concat(" : "(rt_compare(") :
+                      divide ? (floating ? "rt_fdiv(" : "rt_div(") : "(", out);
+                transpile_push(transpiler, node->children[0]);
+                break;
+            case 1:
+                if (string || divide) fputs(", ", out); else fprintf(out, " %s ", c_operator(node->value));
+                transpile_push(transpiler, node->children[1]);
+                break;
+            default:
+                if (string && op != OP_ADD_INT) fprintf(out, ") %s 0)", c_operator(node->value)); else fputc(')', out);
+                transpiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "array_element") == 0) {
+        int slot = resolve_array_slot(symbols, node->value);
+        if (task->state == 0) fprintf(out, "v%d.data[rt_offset(&v%d, %d, (const int[]){", slot, slot, node->children_count);
+        if (task->state < node->children_count) {
+            if (task->state > 0) fputs(", ", out);
+            transpile_coerced(transpiler, node->children[task->state++], TYPE_INT);
+        } else {
+            fputs("})]", out);
+            transpiler->task_count--;
+        }
+    } else if (strcmp(type, "print_statement") == 0) {
+        if (node->children_count > 1) return false;     // PRINT #channel
+        if (task->state++ == 0) {
+            ValueType value_type = expression_type(types, node->children[0]);
+            transpile_line(transpiler, value_type == TYPE_STRING ? "rt_print(" : value_type == TYPE_FLOAT ? "rt_print_float("
+                                                                                                           : "rt_print_int(");
+            transpile_push(transpiler, node->children[0]);
+        } else {
+            fputs(");\n", out);
+            transpiler->task_count--;
+        }
+    } else if (strcmp(type, "assignment") == 0) {
+        // v = expr; rt_assign(&v, expr); or v.data[rt_offset(...)] = expr;
+        ASTNode* target = node->children[0];
+        bool element = strcmp(target->node_type, "array_element") == 0;
+        ValueType target_type = element ? TYPE_INT : variable_type(types, target->value);
+        bool string = target_type == TYPE_STRING;
+        if (task->state == 0) {
+            if (element) {
+                transpile_line(transpiler, "");
+                task->state = 1;
+                transpile_push(transpiler, target);
+            } else {
+                transpile_line(transpiler, string ? "rt_assign(&v%d, " : "v%d = ", resolve_slot(symbols, target->value));
+                task->state = 2;
+                transpile_coerced(transpiler, node->children[1], target_type);
+            }
+        } else if (task->state == 1) {
+            fputs(" = ", out);
+            task->state = 2;
+            transpile_coerced(transpiler, node->children[1], target_type);
+        } else {
+            fputs(string ? ");\n" : ";\n", out);
+            transpiler->task_count--;
+        }
+    } else if (strcmp(type, "dim_statement") == 0) {
+        int dimensions = node->children_count - 1;
+        if (dimensions < 1 || dimensions > MAX_DIMENSIONS) {
+            fprintf(stderr, "DIM %s: between 1 and %d dimensions are supported\n", node->children[0]->value, MAX_DIMENSIONS);
+            exit(1);
+        }
+        if (task->state == 0) {
+            transpile_line(transpiler, "rt_dim(&v%d, %d, (const int[]){", resolve_array_slot(symbols, node->children[0]->value), dimensions);
+        }
+        if (task->state < dimensions) {
+            if (task->state > 0) fputs(", ", out);
+            transpile_coerced(transpiler, node->children[1 + task->state++], TYPE_INT);
+        } else {
+            fputs("});\n", out);
+            transpiler->task_count--;
+        }
+    } else if (strcmp(type, "if_statement") == 0) {
+        switch (task->state++) {
+            case 0:
+                transpile_line(transpiler, "if (");
+                transpile_coerced(transpiler, node->children[0], TYPE_INT);
+                break;
+            case 1:
+                fputs(") {\n", out);
+                transpiler->indent++;
+                transpile_push(transpiler, node->children[1]);
+                break;
+            case 2:
+                transpiler->indent--;
+                if (node->children_count > 2) {
+                    transpile_line(transpiler, "} else {\n");
+                    transpiler->indent++;
+                    transpile_push(transpiler, node->children[2]);
+                    break;
+                }
+                transpile_line(transpiler, "}\n");
+                transpiler->task_count--;
+                break;
+            default:
+                transpiler->indent--;
+                transpile_line(transpiler, "}\n");
+                transpiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "while_loop") == 0) {
+        switch (task->state++) {
+            case 0:
+                transpile_line(transpiler, "while (");
+                transpile_coerced(transpiler, node->children[0], TYPE_INT);
+                break;
+            case 1:
+                fputs(") {\n", out);
+                transpiler->indent++;
+                transpile_push(transpiler, node->children[1]);
+                break;
+            default:
+                transpiler->indent--;
+                transpile_line(transpiler, "}\n");
+                transpiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "repeat_until") == 0) {
+        switch (task->state++) {
+            case 0:
+                transpile_line(transpiler, "do {\n");
+                transpiler->indent++;
+                transpile_push(transpiler, node->children[0]);
+                break;
+            case 1:
+                transpiler->indent--;
+                transpile_line(transpiler, "} while (!(");
+                transpile_coerced(transpiler, node->children[1], TYPE_INT);
+                break;
+            default:
+                fputs("));\n", out);
+                transpiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "for_loop") == 0) {
+        // Same semantics as the bytecode: limit and step are evaluated once, the test is var <= limit
+        int var_slot = resolve_slot(symbols, node->children[0]->children[0]->value);
+        ValueType var_type = variable_type(types, node->children[0]->children[0]->value);
+        char temp = var_type == TYPE_FLOAT ? 'f' : 't';
+        bool has_step = node->children_count > 3;
+        switch (task->state++) {
+            case 0:
+                if (var_type == TYPE_STRING) {
+                    fprintf(stderr, "Type mismatch: FOR needs a numeric variable (%s)\n", node->children[0]->children[0]->value);
+                    exit(1);
+                }
+                if (var_type == TYPE_FLOAT) {
+                    task->temp = transpiler->float_temp_count;
+                    transpiler->float_temp_count += 2;
+                } else {
+                    task->temp = transpiler->temp_count;
+                    transpiler->temp_count += 2;
+                }
+                transpile_push(transpiler, node->children[0]);
+                break;
+            case 1:
+                transpile_line(transpiler, "%c%d = ", temp, task->temp);
+                transpile_coerced(transpiler, node->children[1], var_type);
+                break;
+            case 2:
+                fputs(";\n", out);
+                transpile_line(transpiler, "%c%d = ", temp, task->temp + 1);
+                if (has_step) {
+                    transpile_coerced(transpiler, node->children[2], var_type);
+                } else {
+                    fputs("1", out);
+                }
+                break;
+            case 3:
+                fputs(";\n", out);
+                transpile_line(transpiler, "for (; v%d <= %c%d; v%d += %c%d) {\n", var_slot, temp, task->temp, var_slot, temp,
+                               task->temp + 1);
+                transpiler->indent++;
+                transpile_push(transpiler, node->children[node->children_count - 1]);
+                break;
+            default:
+                transpiler->indent--;
+                transpile_line(transpiler, "}\n");
+                transpiler->task_count--;
+                break;
+        }
+    } else if (strcmp(type, "select_case") == 0) {
+        // t = value; if (t == case1) {...} else if (t == case2) {...}
+        switch (task->state) {
+            case 0:
+                task->temp = transpiler->temp_count++;
+                task->index = 1;
+                task->state = 1;
+                transpile_line(transpiler, "t%d = ", task->temp);
+                transpile_coerced(transpiler, node->children[0], TYPE_INT);
+                break;
+            case 1:
+                fputs(";\n", out);
+                task->state = 2;
+                break;
+            case 2:
+                if (task->index < node->children_count) {
+                    transpile_line(transpiler, task->index == 1 ? "if (t%d == " : "} else if (t%d == ", task->temp);
+                    task->state = 3;
+                    transpile_coerced(transpiler, node->children[task->index]->children[0], TYPE_INT);
+                } else {
+                    if (node->children_count > 1) transpile_line(transpiler, "}\n");
+                    transpiler->task_count--;
+                }
+                break;
+            case 3:
+                fputs(") {\n", out);
+                transpiler->indent++;
+                task->state = 4;
+                transpile_push(transpiler, node->children[task->index]->children[1]);
+                break;
+            default:
+                transpiler->indent--;
+                task->index++;
+                task->state = 2;
+                break;
+        }
+    } else if (strcmp(type, "label") == 0) {
+        transpile_line(transpiler, "L%d:;\n", transpile_label(transpiler, node->value, true));
+        transpiler->task_count--;
+    } else if (strcmp(type, "goto_statement") == 0) {
+        transpile_line(transpiler, "goto L%d;\n", transpile_label(transpiler, node->value, false));
+        transpiler->task_count--;
+    } else if (strcmp(type, "gosub_statement") == 0) {
+        transpile_line(transpiler, "RT_GOSUB(L%d, R%d);\n", transpile_label(transpiler, node->value, false), transpiler->return_sites++);
+        transpiler->task_count--;
+    } else if (strcmp(type, "return_statement") == 0) {
+        transpile_line(transpiler, "RT_RETURN();\n");
+        transpiler->task_count--;
+    } else if (strcmp(type, "procedure") == 0) {
+        // Body is placed inline but skipped by straight-line execution
+        if (task->state++ == 0) {
+            task->skip = transpiler->skip_count++;
+            transpile_line(transpiler, "goto S%d;\n", task->skip);
+            transpile_line(transpiler, "L%d:;\n", transpile_label(transpiler, node->value, true));
+            transpile_push(transpiler, node->children[0]);
+        } else {
+            transpile_line(transpiler, "RT_RETURN();\n");
+            transpile_line(transpiler, "S%d:;\n", task->skip);
+            transpiler->task_count--;
+        }
+    } else if (strcmp(type, "data_statement") == 0) {
+        for (int i = 0; i < node->children_count; i++) {
+            add_data(symbols, atoi(node->children[i]->value));
+        }
+        transpiler->task_count--;
+    } else if (strcmp(type, "read_statement") == 0) {
+        require_type(types, node->children[0], TYPE_INT);
+        transpile_line(transpiler, "RT_READ(v%d);\n", resolve_slot(symbols, node->children[0]->value));
+        transpiler->task_count--;
+    } else if (strcmp(type, "restore_statement") == 0) {
+        transpile_line(transpiler, "rt_data_pointer = 0;\n");
+        transpiler->task_count--;
+    } else if (strcmp(type, "end_statement") == 0 || strcmp(type, "stop_statement") == 0) {
+        transpile_line(transpiler, "exit(0);\n");
+        transpiler->task_count--;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Translate a program to C and write it to out. Returns false, with a message, if it uses
+// statements the native runtime does not support.
+bool transpile_program(ASTNode* ast, FILE* out) {
+    Transpiler transpiler = {0};
+    char* body = NULL;
+    size_t body_size = 0;
+    transpiler.out = open_memstream(&body, &body_size);
+    transpiler.symbols = (Program*)calloc(1, sizeof(Program));
+    int node_count;
+    ASTNode** nodes = collect_nodes(ast, &node_count);
+    transpiler.types = infer_types(nodes, node_count);
+
+    bool ok = true;
+    transpile_push(&transpiler, ast);
+    while (ok && transpiler.task_count > 0) {
+        int before = transpiler.task_count;
+        if (!transpile_step(&transpiler)) {
+            fprintf(stderr, "Native backend: %s is not supported; run the program in the interpreter\n",
+                    transpiler.tasks[transpiler.task_count - 1].node->node_type);
+            ok = false;
+        } else if (transpiler.task_count < before && transpiler.tasks[transpiler.task_count].truncate) {
+            fputc(')', transpiler.out);
+        }
+    }
+    fclose(transpiler.out);
+
+    Program* symbols = transpiler.symbols;
+    for (int i = 0; ok && i < symbols->label_count; i++) {
+        if (!symbols->labels[i].address) {
+            fprintf(stderr, "Undefined label: %s\n", symbols->labels[i].name);
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        fputs("/* Generated by GFALBLC from a BASIC program */\n", out);
+        fputs(native_runtime, out);
+        fprintf(out, "#define RT_DATA_COUNT %d\n", symbols->data_count);
+        fprintf(out, "static const int rt_data[%d] = {", symbols->data_count > 0 ? symbols->data_count : 1);
+        for (int i = 0; i < symbols->data_count; i++) fprintf(out, "%s%d", i ? ", " : "", symbols->data[i]);
+        fprintf(out, "};\nstatic String *rt_literals[%d];\n\n", transpiler.literal_count > 0 ? transpiler.literal_count : 1);
+
+        fputs("int main(void) {\n", out);
+        for (int i = 0; i < symbols->symbol_count; i++) {
+            const char* name = symbols->symbols[i];
+            size_t length = strlen(name);
+            if (length > 2 && strcmp(name + length - 2, "()") == 0) {
+                fprintf(out, "    Array v%d = {0};    /* %s */\n", i, name);
+            } else if (variable_type(transpiler.types, name) == TYPE_STRING) {
+                fprintf(out, "    String *v%d = NULL;    /* %s */\n", i, name);
+            } else if (variable_type(transpiler.types, name) == TYPE_FLOAT) {
+                fprintf(out, "    double v%d = 0;    /* %s */\n", i, name);
+            } else {
+                fprintf(out, "    int v%d = 0;    /* %s */\n", i, name);
+            }
+        }
+        for (int i = 0; i < transpiler.temp_count; i++) fprintf(out, "    int t%d = 0;\n", i);
+        for (int i = 0; i < transpiler.float_temp_count; i++) fprintf(out, "    double f%d = 0;\n", i);
+        for (int i = 0; i < transpiler.literal_count; i++) {
+            fprintf(out, "    rt_literals[%d] = rt_new(", i);
+            write_c_string(out, transpiler.literals[i]);
+            fprintf(out, ", %d);\n", (int)strlen(transpiler.literals[i]));
+        }
+        fputs("\n", out);
+        fwrite(body, 1, body_size, out);
+        fputs("    return 0;\n}\n", out);
+    }
+
+    free(body);
+    free(transpiler.tasks);
+    free(transpiler.literals);
+    free_types(transpiler.types);
+    free_program(symbols);
+    return ok;
+}
+
+// Translate a program to C and build a native executable with the system compiler ($CC, default cc)
+bool compile_native(ASTNode* ast, const char* output_path) {
+    char source_path[] = "/tmp/gfalblc-XXXXXX.c";
+    int fd = mkstemps(source_path, 2);
+    if (fd < 0) {
+        perror("mkstemps");
+        return false;
+    }
+    FILE* source = fdopen(fd, "w");
+    bool ok = transpile_program(ast, source);
+    fclose(source);
+
+    if (ok) {
+        const char* cc = getenv("CC") ? getenv("CC") : "cc";
+        pid_t pid = fork();
+        if (pid == 0) {
+            execlp(cc, cc, "-O2", "-fwrapv", "-w", "-o", output_path, source_path, (char*)NULL);
+            perror(cc);
+            _exit(127);
+        }
+        int status = 0;
+        ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!ok) fprintf(stderr, "Native backend: %s failed to build %s\n", cc, output_path);
+    }
+    unlink(source_path);
+    printf("[DEBUG] Native build of %s %s.\n", output_path, ok ? "succeeded" : "failed");
+    return ok;
+}
+
+// Build an AST node for the demo and benchmark programs
+static ASTNode* make_node(const char* type, const char* value, int children_count, ...) {
+    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
+    node->node_type = (char*)type;
+    node->value = (char*)value;
+    node->children_count = children_count;
+    node->children = children_count > 0 ? (ASTNode**)malloc(children_count * sizeof(ASTNode*)) : NULL;
+    va_list args;
+    va_start(args, children_count);
+    for (int i = 0; i < children_count; i++) {
+        node->children[i] = va_arg(args, ASTNode*);
+    }
+    va_end(args);
+    return node;
+}
+
+// Free a demo AST
+static void free_tree(ASTNode* node) {
+    for (int i = 0; i < node->children_count; i++) free_tree(node->children[i]);
+    free(node->children);
+    free(node);
+}
+
+/* ---------------------------------------------------------------------------
+   Benchmarks
+
+   `bench [runs [results.json [workload]]]` runs a fixed set of workloads
+   that stand for the kinds of program GFA BASIC is used for, on every
+   engine: the bytecode interpreter, the interpreter with the JIT, and the
+   native backend. Each run is a fresh process, so runs do not share heaps,
+   JIT caches or channel state, and the kernel reports each run's peak
+   resident set. A run is timed from fork to exit, compilation included;
+   the native binary is built once per workload, before its runs. Warmup
+   runs go first and are not timed.
+
+   For each workload and engine the harness reports the median and 95th
+   percentile time and the peak RSS. Throughput is the number of bytecode
+   instructions the workload executes, as counted by the interpreter
+   without the JIT, over the engine's median time; the same count is used
+   for every engine, so the figures compare directly. Every run hashes the
+   program's output, and an engine whose hash differs from the bytecode
+   interpreter's fails the workload: a fast wrong answer is a regression
+   too. Results go to stdout and, if a path is given, to a JSON file.
+   --------------------------------------------------------------------------- */
+
+#define BENCH_DEFAULT_RUNS 10
+#define BENCH_WARMUP_RUNS 2
+#define BENCH_SCAN_LINES 100000
+
+typedef enum {
+    ENGINE_BYTECODE,
+    ENGINE_JIT,
+    ENGINE_NATIVE,
+    ENGINE_COUNT
+} BenchEngine;
+
+static const char* const engine_names[ENGINE_COUNT] = {"bytecode", "jit", "native"};
+
+typedef struct {
+    const char* name;
+    ASTNode* (*build)(void);
+    bool (*setup)(void);        // Creates the workload's input files, or NULL
+} BenchWorkload;
+
+// What a child running the interpreter reports back
+typedef struct {
+    uint64_t checksum;
+    long instructions;
+    int error_code;
+} BenchReport;
+
+typedef struct {
+    const char* status;         // "ok", "failed", "mismatch" or "unsupported"
+    double median;
+    double p95;
+    long peak_rss_kb;
+    uint64_t checksum;
+} BenchResult;
+
+static char bench_scan_path[64];
+static uint64_t bench_checksum = 14695981039346656037ull;
+
+// Fold output bytes into an FNV-1a hash
+static uint64_t bench_hash(uint64_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Output callback of a benchmark run: hash each line as the native backend would print it
+static void bench_output(const char* text) {
+    bench_checksum = bench_hash(bench_checksum, text, strlen(text));
+    bench_checksum = bench_hash(bench_checksum, "\n", 1);
+}
+
+/* --- Workload builders --- */
+
+static ASTNode* bench_var(const char* name) {
+    return make_node("identifier", name, 0);
+}
+
+static ASTNode* bench_int(const char* value) {
+    return make_node("int_literal", value, 0);
+}
+
+static ASTNode* bench_float(const char* value) {
+    return make_node("float_literal", value, 0);
+}
+
+static ASTNode* bench_op(const char* op, ASTNode* left, ASTNode* right) {
+    return make_node("operator", op, 2, left, right);
+}
+
+static ASTNode* bench_let(const char* name, ASTNode* value) {
+    return make_node("assignment", NULL, 2, bench_var(name), value);
+}
+
+// name = name <op> value
+static ASTNode* bench_update(const char* name, const char* op, ASTNode* value) {
+    return bench_let(name, bench_op(op, bench_var(name), value));
+}
+
+static ASTNode* bench_for(const char* name, const char* from, const char* to, ASTNode* block) {
+    return make_node("for_loop", NULL, 3, bench_let(name, bench_int(from)), bench_int(to), block);
+}
+
+// DIM flags(300000): count primes five times with the sieve of Eratosthenes
+static ASTNode* bench_sieve(void) {
+    return make_node("program", NULL, 3,
+        make_node("dim_statement", NULL, 2, bench_var("flags"), bench_int("300000")),
+        bench_for("r", "1", "5", make_node("block", NULL, 3,
+            bench_for("i", "2", "300000", make_node("block", NULL, 1,
+                make_node("assignment", NULL, 2, make_node("array_element", "flags", 1, bench_var("i")), bench_int("1")))),
+            bench_let("count", bench_int("0")),
+            bench_for("i", "2", "300000", make_node("block", NULL, 1,
+                make_node("if_statement", NULL, 2,
+                    bench_op("=", make_node("array_element", "flags", 1, bench_var("i")), bench_int("1")),
+                    make_node("block", NULL, 3,
+                        bench_update("count", "+", bench_int("1")),
+                        bench_let("j", bench_op("+", bench_var("i"), bench_var("i"))),
+                        make_node("while_loop", NULL, 2,
+                            bench_op("<=", bench_var("j"), bench_int("300000")),
+                            make_node("block", NULL, 2,
+                                make_node("assignment", NULL, 2, make_node("array_element", "flags", 1, bench_var("j")),
+                                          bench_int("0")),
+                                bench_update("j", "+", bench_var("i")))))))))),
+        make_node("print_statement", NULL, 1, bench_var("count")));
+}
+
+// Escape times of a 150x100 grid over the Mandelbrot set, at most 100 iterations a point
+static ASTNode* bench_mandelbrot(void) {
+    return make_node("program", NULL, 3,
+        bench_let("escaped", bench_int("0")),
+        bench_for("py", "0", "99", make_node("block", NULL, 1,
+            bench_for("px", "0", "149", make_node("block", NULL, 6,
+                bench_let("cr#", bench_op("-", bench_op("*", bench_var("px"), bench_float("0.02")), bench_float("2.0"))),
+                bench_let("ci#", bench_op("-", bench_op("*", bench_var("py"), bench_float("0.02")), bench_float("1.0"))),
+                bench_let("zr#", bench_float("0.0")),
+                bench_let("zi#", bench_float("0.0")),
+                bench_let("it", bench_int("0")),
+                make_node("while_loop", NULL, 2,
+                    bench_op("<", bench_var("it"), bench_int("100")),
+                    make_node("block", NULL, 5,
+                        bench_let("t#", bench_op("+", bench_op("-", bench_op("*", bench_var("zr#"), bench_var("zr#")),
+                                                                bench_op("*", bench_var("zi#"), bench_var("zi#"))),
+                                                 bench_var("cr#"))),
+                        bench_let("zi#", bench_op("+", bench_op("*", bench_op("*", bench_float("2.0"), bench_var("zr#")),
+                                                                 bench_var("zi#")),
+                                                  bench_var("ci#"))),
+                        bench_let("zr#", bench_var("t#")),
+                        bench_update("it", "+", bench_int("1")),
+                        make_node("if_statement", NULL, 2,
+                            bench_op(">", bench_op("+", bench_op("*", bench_var("zr#"), bench_var("zr#")),
+                                                   bench_op("*", bench_var("zi#"), bench_var("zi#"))),
+                                     bench_float("4.0")),
+                            make_node("block", NULL, 2,
+                                bench_update("escaped", "+", bench_var("it")),
+                                bench_let("it", bench_int("100")))))))))),
+        make_node("print_statement", NULL, 1, bench_var("escaped")));
+}
+
+static const char* const body_x[] = {"x1#", "x2#", "x3#"};
+static const char* const body_y[] = {"y1#", "y2#", "y3#"};
+static const char* const body_vx[] = {"vx1#", "vx2#", "vx3#"};
+static const char* const body_vy[] = {"vy1#", "vy2#", "vy3#"};
+
+// Pull bodies a and b together: arrays hold integers only, so the bodies live in scalar variables
+static ASTNode* bench_attract(int a, int b) {
+    return make_node("block", NULL, 7,
+        bench_let("dx#", bench_op("-", bench_var(body_x[b]), bench_var(body_x[a]))),
+        bench_let("dy#", bench_op("-", bench_var(body_y[b]), bench_var(body_y[a]))),
+        bench_let("f#", bench_op("/", bench_float("0.001"),
+                                 bench_op("+", bench_op("+", bench_op("*", bench_var("dx#"), bench_var("dx#")),
+                                                        bench_op("*", bench_var("dy#"), bench_var("dy#"))),
+                                          bench_float("0.01")))),
+        bench_update(body_vx[a], "+", bench_op("*", bench_var("dx#"), bench_var("f#"))),
+        bench_update(body_vy[a], "+", bench_op("*", bench_var("dy#"), bench_var("f#"))),
+        bench_update(body_vx[b], "-", bench_op("*", bench_var("dx#"), bench_var("f#"))),
+        bench_update(body_vy[b], "-", bench_op("*", bench_var("dy#"), bench_var("f#"))));
+}
+
+// name = name + velocity * dt
+static ASTNode* bench_move(const char* name, const char* velocity) {
+    return bench_update(name, "+", bench_op("*", bench_var(velocity), bench_float("0.01")));
+}
+
+// Three bodies under a softened pairwise attraction, 100000 Euler steps
+static ASTNode* bench_nbody(void) {
+    return make_node("program", NULL, 11,
+        bench_let("x1#", bench_float("0.0")), bench_let("y1#", bench_float("0.0")),
+        bench_let("x2#", bench_float("1.0")), bench_let("y2#", bench_float("0.0")),
+        bench_let("x3#", bench_float("0.0")), bench_let("y3#", bench_float("1.5")),
+        bench_let("vy2#", bench_float("0.02")), bench_let("vx3#", bench_float("-0.02")),
+        bench_for("s", "1", "100000", make_node("block", NULL, 9,
+            bench_attract(0, 1), bench_attract(0, 2), bench_attract(1, 2),
+            bench_move("x1#", "vx1#"), bench_move("y1#", "vy1#"),
+            bench_move("x2#", "vx2#"), bench_move("y2#", "vy2#"),
+            bench_move("x3#", "vx3#"), bench_move("y3#", "vy3#"))),
+        bench_let("e%", bench_op("*", bench_op("+", bench_op("+", bench_var("x1#"), bench_var("x2#")), bench_var("x3#")),
+                                 bench_float("1000000.0"))),
+        make_node("print_statement", NULL, 1, bench_var("e%")));
+}
+
+// Build 2000-character strings two characters at a time
+static ASTNode* bench_strings(void) {
+    return make_node("program", NULL, 2,
+        bench_for("r", "1", "300", make_node("block", NULL, 2,
+            bench_let("s$", make_node("string_literal", "", 0)),
+            bench_for("i", "1", "1000", make_node("block", NULL, 1,
+                bench_let("s$", bench_op("+", bench_var("s$"), make_node("string_literal", "ab", 0))))))),
+        make_node("print_statement", NULL, 1, bench_var("s$")));
+}
+
+// READ the same 16 DATA values 100000 times
+static ASTNode* bench_data(void) {
+    return make_node("program", NULL, 4,
+        make_node("data_statement", NULL, 16, bench_int("3"), bench_int("1"), bench_int("4"), bench_int("1"), bench_int("5"),
+                  bench_int("9"), bench_int("2"), bench_int("6"), bench_int("5"), bench_int("3"), bench_int("5"),
+                  bench_int("8"), bench_int("9"), bench_int("7"), bench_int("9"), bench_int("3")),
+        bench_let("total", bench_int("0")),
+        bench_for("r", "1", "100000", make_node("block", NULL, 2,
+            make_node("restore_statement", NULL, 0),
+            bench_for("k", "1", "16", make_node("block", NULL, 2,
+                make_node("read_statement", NULL, 1, bench_var("v")),
+                bench_update("total", "+", bench_var("v")))))),
+        make_node("print_statement", NULL, 1, bench_var("total")));
+}
+
+// A million GOSUBs through a recursive procedure that does work after the call, so it is neither inlined nor a tail call
+static ASTNode* bench_gosub(void) {
+    return make_node("program", NULL, 5,
+        bench_let("n", bench_int("0")),
+        bench_for("i", "1", "20000", make_node("block", NULL, 2,
+            bench_let("d", bench_int("50")),
+            make_node("gosub_statement", "descend", 0))),
+        make_node("print_statement", NULL, 1, bench_var("n")),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "descend", 1, make_node("block", NULL, 1,
+            make_node("if_statement", NULL, 2,
+                bench_op(">", bench_var("d"), bench_int("0")),
+                make_node("block", NULL, 3,
+                    bench_update("d", "-", bench_int("1")),
+                    make_node("gosub_statement", "descend", 0),
+                    bench_update("n", "+", bench_int("1")))))));
+}
+
+// CASE value: t = t + weight
+static ASTNode* bench_case(const char* value, const char* weight) {
+    return make_node("case", NULL, 2, bench_int(value), make_node("block", NULL, 1, bench_update("t", "+", bench_int(weight))));
+}
+
+// Dispatch two million values over an eight-way SELECT CASE
+static ASTNode* bench_select(void) {
+    return make_node("program", NULL, 3,
+        bench_let("t", bench_int("0")),
+        bench_for("i", "1", "2000000", make_node("block", NULL, 2,
+            bench_let("k", bench_op("-", bench_var("i"), bench_op("*", bench_op("/", bench_var("i"), bench_int("8")), bench_int("8")))),
+            make_node("select_case", NULL, 9, bench_var("k"),
+                bench_case("0", "1"), bench_case("1", "3"), bench_case("2", "5"), bench_case("3", "7"),
+                bench_case("4", "11"), bench_case("5", "13"), bench_case("6", "17"), bench_case("7", "19")))),
+        make_node("print_statement", NULL, 1, bench_var("t")));
+}
+
+// Multiply two 60x60 integer matrices five times
+static ASTNode* bench_matrix(void) {
+    return make_node("program", NULL, 8,
+        make_node("dim_statement", NULL, 3, bench_var("a"), bench_int("60"), bench_int("60")),
+        make_node("dim_statement", NULL, 3, bench_var("b"), bench_int("60"), bench_int("60")),
+        make_node("dim_statement", NULL, 3, bench_var("c"), bench_int("60"), bench_int("60")),
+        bench_for("i", "0", "59", make_node("block", NULL, 1,
+            bench_for("j", "0", "59", make_node("block", NULL, 2,
+                make_node("assignment", NULL, 2, make_node("array_element", "a", 2, bench_var("i"), bench_var("j")),
+                          bench_op("+", bench_var("i"), bench_var("j"))),
+                make_node("assignment", NULL, 2, make_node("array_element", "b", 2, bench_var("i"), bench_var("j")),
+                          bench_op("-", bench_op("*", bench_var("i"), bench_var("j")), bench_int("1"))))))),
+        bench_for("r", "1", "5", make_node("block", NULL, 1,
+            bench_for("i", "0", "59", make_node("block", NULL, 1,
+                bench_for("j", "0", "59", make_node("block", NULL, 3,
+                    bench_let("s", bench_int("0")),
+                    bench_for("k", "0", "59", make_node("block", NULL, 1,
+                        bench_update("s", "+", bench_op("*", make_node("array_element", "a", 2, bench_var("i"), bench_var("k")),
+                                                         make_node("array_element", "b", 2, bench_var("k"), bench_var("j")))))),
+                    make_node("assignment", NULL, 2, make_node("array_element", "c", 2, bench_var("i"), bench_var("j")),
+                              bench_var("s")))))))),
+        bench_let("trace", bench_int("0")),
+        bench_for("i", "0", "59", make_node("block", NULL, 1,
+            bench_update("trace", "+", make_node("array_element", "c", 2, bench_var("i"), bench_var("i"))))),
+        make_node("print_statement", NULL, 1, bench_var("trace")));
+}
+
+// Write the line-scan input once, before any run
+static bool bench_scan_setup(void) {
+    snprintf(bench_scan_path, sizeof(bench_scan_path), "/tmp/gfalblc-bench-%d.txt", (int)getpid());
+    FILE* file = fopen(bench_scan_path, "w");
+    if (!file) {
+        perror(bench_scan_path);
+        return false;
+    }
+    for (int i = 1; i <= BENCH_SCAN_LINES; i++) fprintf(file, "%d,record %d,%d\n", i, i * 7919 % 10007, i % 97);
+    return fclose(file) == 0;
+}
+
+// LINE INPUT every line of a 100000-line file, ten times
+static ASTNode* bench_scan(void) {
+    return make_node("program", NULL, 3,
+        bench_let("n", bench_int("0")),
+        bench_for("r", "1", "10", make_node("block", NULL, 3,
+            make_node("open_statement", NULL, 3, make_node("string_literal", "I", 0), bench_int("1"),
+                      make_node("string_literal", bench_scan_path, 0)),
+            make_node("while_loop", NULL, 2,
+                bench_op("=", make_node("eof", NULL, 1, bench_int("1")), bench_int("0")),
+                make_node("block", NULL, 2,
+                    make_node("line_input_statement", NULL, 2, bench_int("1"), bench_var("l$")),
+                    bench_update("n", "+", bench_int("1")))),
+            make_node("close_statement", NULL, 1, bench_int("1")))),
+        make_node("print_statement", NULL, 1, bench_var("n")));
+}
+
+static const BenchWorkload bench_workloads[] = {
+    {"sieve", bench_sieve, NULL},
+    {"mandelbrot", bench_mandelbrot, NULL},
+    {"nbody", bench_nbody, NULL},
+    {"strings", bench_strings, NULL},
+    {"data_read", bench_data, NULL},
+    {"gosub", bench_gosub, NULL},
+    {"select", bench_select, NULL},
+    {"matrix", bench_matrix, NULL},
+    {"line_scan", bench_scan, bench_scan_setup},
+};
+
+/* --- Harness --- */
+
+// Run a workload once in a fresh process. Returns false if the run did not finish cleanly.
+static bool bench_run(ASTNode* ast, BenchEngine engine, const char* native_path, double* seconds, long* peak_rss_kb,
+                      BenchReport* report) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+    uint64_t start = monotonic_ns();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (engine == ENGINE_NATIVE) {
+            // The native program prints to stdout, which the parent hashes
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[1]);
+            execl(native_path, native_path, (char*)NULL);
+            _exit(127);
+        }
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        Interpreter* interpreter = interpreter_new(bench_output);
+        interpreter_init(interpreter);
+        interpreter_set_jit(interpreter, engine == ENGINE_JIT);
+        run_program(interpreter, ast);
+        BenchReport result = {bench_checksum, interpreter_get_stats(interpreter).instructions, interpreter->error_code};
+        _exit(write(fds[1], &result, sizeof(result)) == (ssize_t)sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        return false;
+    }
+
+    bool complete;
+    if (engine == ENGINE_NATIVE) {
+        char buffer[4096];
+        ssize_t length;
+        report->checksum = 14695981039346656037ull;
+        report->instructions = 0;
+        report->error_code = ERR_NONE;
+        while ((length = read(fds[0], buffer, sizeof(buffer))) > 0) {
+            report->checksum = bench_hash(report->checksum, buffer, (size_t)length);
+        }
+        complete = length == 0;
+    } else {
+        size_t done = 0;
+        ssize_t length = 1;
+        while (done < sizeof(*report) && (length = read(fds[0], (char*)report + done, sizeof(*report) - done)) > 0) {
+            done += (size_t)length;
+        }
+        complete = done == sizeof(*report);
+    }
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        perror("wait4");
+        return false;
+    }
+    *seconds = (double)(monotonic_ns() - start) / 1e9;
+    *peak_rss_kb = usage.ru_maxrss;
+    return complete && WIFEXITED(status) && WEXITSTATUS(status) == 0 && report->error_code == ERR_NONE;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Warm up, then time runs of a workload on one engine
+static void bench_engine(ASTNode* ast, BenchEngine engine, const char* native_path, int runs, BenchResult* result,
+                         long* instructions) {
+    double* times = (double*)malloc(runs * sizeof(double));
+    result->status = "ok";
+    result->peak_rss_kb = 0;
+    for (int i = -BENCH_WARMUP_RUNS; i < runs; i++) {
+        double seconds;
+        long rss;
+        BenchReport report;
+        if (!bench_run(ast, engine, native_path, &seconds, &rss, &report)) {
+            result->status = "failed";
+            break;
+        }
+        result->checksum = report.checksum;
+        if (engine == ENGINE_BYTECODE) *instructions = report.instructions;
+        if (i < 0) continue;
+        times[i] = seconds;
+        if (rss > result->peak_rss_kb) result->peak_rss_kb = rss;
+    }
+    if (strcmp(result->status, "ok") == 0) {
+        // Nearest-rank percentiles
+        qsort(times, runs, sizeof(double), compare_doubles);
+        result->median = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+        result->p95 = times[(runs * 95 + 99) / 100 - 1];
+    }
+    free(times);
+}
+
+static void write_bench_json(FILE* out, int runs, const BenchResult results[][ENGINE_COUNT], const long* instructions,
+                             const bool* selected) {
+    fprintf(out, "{\n  \"runs\": %d,\n  \"warmup\": %d,\n  \"results\": [", runs, BENCH_WARMUP_RUNS);
+    bool first = true;
+    for (size_t w = 0; w < sizeof(bench_workloads) / sizeof(bench_workloads[0]); w++) {
+        if (!selected[w]) continue;
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            const BenchResult* result = &results[w][e];
+            fprintf(out, "%s\n    {\"workload\": \"%s\", \"engine\": \"%s\", \"status\": \"%s\"", first ? "" : ",",
+                    bench_workloads[w].name, engine_names[e], result->status);
+            first = false;
+            if (strcmp(result->status, "ok") == 0) {
+                fprintf(out,
+                        ", \"median_seconds\": %.6f, \"p95_seconds\": %.6f, \"instructions\": %ld, "
+                        "\"instructions_per_second\": %.0f, \"peak_rss_kb\": %ld, \"checksum\": \"%016llx\"",
+                        result->median, result->p95, instructions[w], instructions[w] / result->median,
+                        result->peak_rss_kb, (unsigned long long)result->checksum);
+            }
+            fputc('}', out);
+        }
+    }
+    fputs("\n  ]\n}\n", out);
+}
+
+// Run the suite; workloads whose name does not contain filter are skipped. Returns nonzero if any run failed or
+// an engine's output differed from the bytecode interpreter's.
+int run_benchmarks(int runs, const char* results_path, const char* filter) {
+    enum { WORKLOAD_COUNT = sizeof(bench_workloads) / sizeof(bench_workloads[0]) };
+    BenchResult results[WORKLOAD_COUNT][ENGINE_COUNT];
+    long instructions[WORKLOAD_COUNT] = {0};
+    bool selected[WORKLOAD_COUNT];
+    bool regressed = false;
+    if (runs < 1) runs = BENCH_DEFAULT_RUNS;
+    fflush(stdout);
+
+    for (int w = 0; w < WORKLOAD_COUNT; w++) {
+        const BenchWorkload* workload = &bench_workloads[w];
+        selected[w] = !filter || strstr(workload->name, filter);
+        if (!selected[w]) continue;
+        if (workload->setup && !workload->setup()) {
+            fprintf(stderr, "Benchmark %s: setup failed\n", workload->name);
+            for (int e = 0; e < ENGINE_COUNT; e++) results[w][e].status = "failed";
+            regressed = true;
+            continue;
+        }
+        ASTNode* ast = workload->build();
+        // A workload using statements the native backend lacks is unsupported there; only a build of one it
+        // can translate counts as a failure
+        FILE* probe = fopen("/dev/null", "w");
+        bool supported = probe && transpile_program(ast, probe);
+        if (probe) fclose(probe);
+        char native_path[] = "/tmp/gfalblc-bench-XXXXXX";
+        int fd = supported ? mkstemp(native_path) : -1;
+        if (fd >= 0) close(fd);
+        bool native = fd >= 0 && compile_native(ast, native_path);
+
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            BenchResult* result = &results[w][e];
+            if (e == ENGINE_NATIVE && !native) {
+                result->status = supported ? "failed" : "unsupported";
+                if (supported) regressed = true;
+                continue;
+            }
+            bench_engine(ast, (BenchEngine)e, native_path, runs, result, &instructions[w]);
+            if (strcmp(result->status, "ok") == 0 && e != ENGINE_BYTECODE &&
+                strcmp(results[w][ENGINE_BYTECODE].status, "ok") == 0 && result->checksum != results[w][ENGINE_BYTECODE].checksum) {
+                fprintf(stderr, "Benchmark %s: %s output differs from the bytecode interpreter's\n", workload->name,
+                        engine_names[e]);
+                result->status = "mismatch";
+            }
+            if (strcmp(result->status, "failed") == 0 || strcmp(result->status, "mismatch") == 0) regressed = true;
+        }
+        if (fd >= 0) unlink(native_path);
+        if (workload->setup) unlink(bench_scan_path);
+        free_tree(ast);
+    }
+
+    printf("%-12s %-9s %-11s %10s %10s %14s %12s\n", "workload", "engine", "status", "median ms", "p95 ms", "instr/s",
+           "peak RSS KB");
+    for (int w = 0; w < WORKLOAD_COUNT; w++) {
+        if (!selected[w]) continue;
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            const BenchResult* result = &results[w][e];
+            if (strcmp(result->status, "ok") == 0) {
+                printf("%-12s %-9s %-11s %10.2f %10.2f %14.0f %12ld\n", bench_workloads[w].name, engine_names[e],
+                       result->status, result->median * 1e3, result->p95 * 1e3, instructions[w] / result->median,
+                       result->peak_rss_kb);
+            } else {
+                printf("%-12s %-9s %-11s\n", bench_workloads[w].name, engine_names[e], result->status);
+            }
+        }
+    }
+
+    if (results_path) {
+        FILE* out = fopen(results_path, "w");
+        if (!out) {
+            perror(results_path);
+            return 1;
+        }
+        write_bench_json(out, runs, (const BenchResult(*)[ENGINE_COUNT])results, instructions, selected);
+        fclose(out);
+        printf("[DEBUG] Benchmark results written to %s.\n", results_path);
+    }
+    return regressed ? 1 : 0;
+}
+
+/* ---------------------------------------------------------------------------
+   Regression checks
+
+   `check` runs small programs whose output is known and reports each one
+   that prints something else. They cover what the demo and the benchmarks
+   never do, such as a hot reload in the middle of a run: the program is
+   edited and reloaded from the output callback when it prints a given
+   line, which is how an editor on another thread would time it too.
+   --------------------------------------------------------------------------- */
+
+#define CHECK_SCRATCH_PATH "/tmp/gfalblc-check.bin"   // For checks that write a file; removed after each
+#define CHECK_LOG_PATH "/tmp/gfalblc-check.log"       // Run log of CHECK_REPLAY
+#define CHECK_CACHE_DIR "/tmp/gfalblc-check-cache"    // Bytecode cache of CHECK_CACHE
+
+typedef struct {
+    const char* name;
+    ASTNode* (*build)(int version);     // Version 1 is run; version 2, if any, is reloaded
+    const char* reload_after;           // Output line that triggers the reload, NULL for none
+    bool reload_accepted;               // What interpreter_reload() must return
+    const char* expected;               // Output, one line each followed by '\n'
+    unsigned options;                   // CHECK_ flags
+} Check;
+
+#define CHECK_JIT 1u            // Run with the JIT on
+#define CHECK_RESTORE 2u        // Run again from the snapshot the first run wrote to CHECK_SCRATCH_PATH
+#define CHECK_MEMO 4u           // Follow the output of each run with its memo hits, misses and evictions
+#define CHECK_CACHE 8u          // Run again from the bytecode the first run cached in CHECK_CACHE_DIR
+#define CHECK_REPLAY 16u        // Record the first run to CHECK_LOG_PATH and replay it in a second
+#define CHECK_TWICE (CHECK_RESTORE | CHECK_CACHE | CHECK_REPLAY)
+
+static Interpreter* check_interpreter;
+static const Check* check_running;
+static ASTNode* check_edited;
+static int check_reload_result;         // -1 until the reload was attempted
+static char check_output_text[256];
+static size_t check_output_length;
+
+static void check_output(const char* text) {
+    size_t length = strlen(text);
+    if (check_output_length + length + 1 < sizeof(check_output_text)) {
+        memcpy(check_output_text + check_output_length, text, length);
+        check_output_text[check_output_length + length] = '\n';
+        check_output_length += length + 1;
+        check_output_text[check_output_length] = '\0';
+    }
+    if (check_running->reload_after && check_reload_result < 0 && strcmp(text, check_running->reload_after) == 0) {
+        check_reload_result = interpreter_reload(check_interpreter, check_edited);
+    }
+}
+
+// a = 1 : PRINT "start" : FOR i = 1 TO 4 : GOSUB p : PRINT a * i : NEXT i
+// PROCEDURE p: b = 0 in version 1, a = 2 in version 2 and a = 0.5, which makes a a float, in version 3.
+// a * i must not be strength-reduced on the grounds that p leaves a alone.
+static ASTNode* check_hoisting(int version) {
+    ASTNode* body = version == 1 ? bench_let("b", bench_int("0"))
+                  : version == 2 ? bench_let("a", bench_int("2"))
+                  : bench_let("a", bench_float("0.5"));
+    return make_node("program", NULL, 5,
+        bench_let("a", bench_int("1")),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "start", 0)),
+        bench_for("i", "1", "4", make_node("block", NULL, 2,
+            make_node("gosub_statement", "p", 0),
+            make_node("print_statement", NULL, 1, bench_op("*", bench_var("a"), bench_var("i"))))),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "p", 1, make_node("block", NULL, 1, body)));
+}
+
+static ASTNode* check_type_change(int version) {
+    return check_hoisting(version == 1 ? 1 : 3);
+}
+
+// PRINT "start" : GOSUB q : GOSUB q
+// PROCEDURE q: PRINT "q" : GOSUB p, a call in tail position
+// PROCEDURE p: PRINT "old" in version 1, "new" in version 2
+// Reloaded while the first q runs, so the call it is about to make must already reach the new p.
+static ASTNode* check_tail_call(int version) {
+    return make_node("program", NULL, 6,
+        make_node("print_statement", NULL, 1, make_node("string_literal", "start", 0)),
+        make_node("gosub_statement", "q", 0),
+        make_node("gosub_statement", "q", 0),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "q", 1, make_node("block", NULL, 2,
+            make_node("print_statement", NULL, 1, make_node("string_literal", "q", 0)),
+            make_node("gosub_statement", "p", 0))),
+        make_node("procedure", "p", 1, make_node("block", NULL, 1,
+            make_node("print_statement", NULL, 1, make_node("string_literal", version == 1 ? "old" : "new", 0)))));
+}
+
+// a% = -2147483647 - 1 : PRINT "start" : b% = a% / -1 : PRINT "after"
+// The quotient does not fit in an int, so the division must stop the program with an overflow error.
+static ASTNode* check_division_overflow(int version) {
+    (void)version;
+    return make_node("program", NULL, 4,
+        bench_let("a%", bench_op("-", bench_int("-2147483647"), bench_int("1"))),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "start", 0)),
+        bench_let("b%", bench_op("/", bench_var("a%"), bench_int("-1"))),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "after", 0)));
+}
+
+// a% = -2147483647 - 1 : PRINT "start"
+// FOR i = 1 TO 100000 : d% = 1 - 2 * (i / 100000) : b% = a% / d% : NEXT i : PRINT "after"
+// The same division, reached only once the loop runs as native code.
+static ASTNode* check_jit_division_overflow(int version) {
+    (void)version;
+    return make_node("program", NULL, 4,
+        bench_let("a%", bench_op("-", bench_int("-2147483647"), bench_int("1"))),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "start", 0)),
+        bench_for("i", "1", "100000", make_node("block", NULL, 2,
+            bench_let("d%", bench_op("-", bench_int("1"),
+                                     bench_op("*", bench_int("2"), bench_op("/", bench_var("i"), bench_int("100000"))))),
+            bench_let("b%", bench_op("/", bench_var("a%"), bench_var("d%"))))),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "after", 0)));
+}
+
+// a% = 2147483647 : b% = a% * 2 : a% = a% + 1 : PRINT a% : PRINT b%
+// Integer arithmetic wraps around, as it does in the JIT and the native build.
+static ASTNode* check_wraparound(int version) {
+    (void)version;
+    return make_node("program", NULL, 5,
+        bench_let("a%", bench_int("2147483647")),
+        bench_let("b%", bench_op("*", bench_var("a%"), bench_int("2"))),
+        bench_let("a%", bench_op("+", bench_var("a%"), bench_int("1"))),
+        make_node("print_statement", NULL, 1, bench_var("a%")),
+        make_node("print_statement", NULL, 1, bench_var("b%")));
+}
+
+// POKE address + offset, value
+static ASTNode* check_poke(const char* address, const char* offset, const char* value) {
+    return make_node("poke_statement", NULL, 2, bench_op("+", bench_var(address), bench_int(offset)), bench_int(value));
+}
+
+// ALLOCATE a%, 16 : FREE a% : POKE a% .. a% + 3 with F0 FF FF FF : ALLOCATE b%, 16 : ALLOCATE c%, 16
+// PRINT b% - a% : PRINT c% - a% : PRINT PEEK(a%)
+// Freed memory is the program's to scribble on; the allocator must not take its next block from there.
+static ASTNode* check_allocator_metadata(int version) {
+    (void)version;
+    return make_node("program", NULL, 11,
+        make_node("allocate_statement", NULL, 2, bench_var("a%"), bench_int("16")),
+        make_node("free_statement", NULL, 1, bench_var("a%")),
+        check_poke("a%", "0", "240"), check_poke("a%", "1", "255"), check_poke("a%", "2", "255"), check_poke("a%", "3", "255"),
+        make_node("allocate_statement", NULL, 2, bench_var("b%"), bench_int("16")),
+        make_node("allocate_statement", NULL, 2, bench_var("c%"), bench_int("16")),
+        make_node("print_statement", NULL, 1, bench_op("-", bench_var("b%"), bench_var("a%"))),
+        make_node("print_statement", NULL, 1, bench_op("-", bench_var("c%"), bench_var("a%"))),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_var("a%"))));
+}
+
+// ALLOCATE a%, 16 : POKE a% .. a% + 3 with F0 FF FF FF : BSAVE file$, a%, 4
+// ALLOCATE b%, 16 : FREE b% : BLOAD file$, b% : ALLOCATE c%, 16 : ALLOCATE d%, 16
+// PRINT c% - b% : PRINT d% - b% : PRINT PEEK(b%)
+// The same forged link as in allocator_metadata, written by BLOAD this time.
+static ASTNode* check_bload_metadata(int version) {
+    (void)version;
+    return make_node("program", NULL, 14,
+        make_node("allocate_statement", NULL, 2, bench_var("a%"), bench_int("16")),
+        check_poke("a%", "0", "240"), check_poke("a%", "1", "255"), check_poke("a%", "2", "255"), check_poke("a%", "3", "255"),
+        make_node("bsave_statement", NULL, 3, make_node("string_literal", CHECK_SCRATCH_PATH, 0), bench_var("a%"), bench_int("4")),
+        make_node("allocate_statement", NULL, 2, bench_var("b%"), bench_int("16")),
+        make_node("free_statement", NULL, 1, bench_var("b%")),
+        make_node("bload_statement", NULL, 2, make_node("string_literal", CHECK_SCRATCH_PATH, 0), bench_var("b%")),
+        make_node("allocate_statement", NULL, 2, bench_var("c%"), bench_int("16")),
+        make_node("allocate_statement", NULL, 2, bench_var("d%"), bench_int("16")),
+        make_node("print_statement", NULL, 1, bench_op("-", bench_var("c%"), bench_var("b%"))),
+        make_node("print_statement", NULL, 1, bench_op("-", bench_var("d%"), bench_var("b%"))),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_var("b%"))));
+}
+
+// DIM a(2, 3) : a(1, 2) = 6 : s$ = "x" : ALLOCATE p%, 32 : POKE p%, 7 : ALLOCATE q%, 16 : FREE q%
+// GOSUB save : PRINT a(1, 2) : PRINT s$ : PRINT PEEK(p%) : ALLOCATE r%, 16 : PRINT r% - q% : END
+// PROCEDURE save: SNAPSHOT file$ : PRINT "saved"
+// Restored, the program goes on inside save with its variables, array, frame, memory and free list.
+static ASTNode* check_snapshot(int version) {
+    (void)version;
+    return make_node("program", NULL, 15,
+        make_node("dim_statement", NULL, 3, bench_var("a"), bench_int("2"), bench_int("3")),
+        make_node("assignment", NULL, 2, make_node("array_element", "a", 2, bench_int("1"), bench_int("2")), bench_int("6")),
+        bench_let("s$", make_node("string_literal", "x", 0)),
+        make_node("allocate_statement", NULL, 2, bench_var("p%"), bench_int("32")),
+        make_node("poke_statement", NULL, 2, bench_var("p%"), bench_int("7")),
+        make_node("allocate_statement", NULL, 2, bench_var("q%"), bench_int("16")),
+        make_node("free_statement", NULL, 1, bench_var("q%")),
+        make_node("gosub_statement", "keep", 0),
+        make_node("print_statement", NULL, 1, make_node("array_element", "a", 2, bench_int("1"), bench_int("2"))),
+        make_node("print_statement", NULL, 1, bench_var("s$")),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_var("p%"))),
+        make_node("allocate_statement", NULL, 2, bench_var("r%"), bench_int("16")),
+        make_node("print_statement", NULL, 1, bench_op("-", bench_var("r%"), bench_var("q%"))),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "keep", 1, make_node("block", NULL, 2,
+            make_node("snapshot_statement", NULL, 1, make_node("string_literal", CHECK_SCRATCH_PATH, 0)),
+            make_node("print_statement", NULL, 1, make_node("string_literal", "saved", 0)))));
+}
+
+// FOR r = 1 TO 2 : FOR i = 1 TO 3 : x = i : GOSUB sq : PRINT y : NEXT i : NEXT r : END
+// PROCEDURE sq: y = x * x
+// The second round is answered from the memo.
+static ASTNode* check_memo_hits(int version) {
+    (void)version;
+    return make_node("program", NULL, 3,
+        bench_for("r", "1", "2", make_node("block", NULL, 1,
+            bench_for("i", "1", "3", make_node("block", NULL, 3,
+                bench_let("x", bench_var("i")),
+                make_node("gosub_statement", "sq", 0),
+                make_node("print_statement", NULL, 1, bench_var("y")))))),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "sq", 1, make_node("block", NULL, 1,
+            bench_let("y", bench_op("*", bench_var("x"), bench_var("x"))))));
+}
+
+// t = 5 : x = -1 : GOSUB f : PRINT y : t = 7 : GOSUB f : PRINT y : x = 1 : GOSUB f : PRINT y
+// t = 7 : x = -1 : GOSUB f : PRINT y : u = 9 : GOSUB g : PRINT v : u = 4 : GOSUB g : PRINT v : END
+// PROCEDURE f: IF x > 0 THEN t = 1 ENDIF : y = t + x
+// PROCEDURE g: u = x * 2 : v = u + 1
+// f sets t only on some paths, so t is part of its key; g sets u before reading it, so u is not.
+static ASTNode* check_memo_keys(int version) {
+    (void)version;
+    return make_node("program", NULL, 23,
+        bench_let("t", bench_int("5")),
+        bench_let("x", bench_int("-1")),
+        make_node("gosub_statement", "f", 0),
+        make_node("print_statement", NULL, 1, bench_var("y")),
+        bench_let("t", bench_int("7")),
+        make_node("gosub_statement", "f", 0),
+        make_node("print_statement", NULL, 1, bench_var("y")),
+        bench_let("x", bench_int("1")),
+        make_node("gosub_statement", "f", 0),
+        make_node("print_statement", NULL, 1, bench_var("y")),
+        bench_let("t", bench_int("7")),
+        bench_let("x", bench_int("-1")),
+        make_node("gosub_statement", "f", 0),
+        make_node("print_statement", NULL, 1, bench_var("y")),
+        bench_let("u", bench_int("9")),
+        make_node("gosub_statement", "g", 0),
+        make_node("print_statement", NULL, 1, bench_var("v")),
+        bench_let("u", bench_int("4")),
+        make_node("gosub_statement", "g", 0),
+        make_node("print_statement", NULL, 1, bench_var("v")),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "f", 1, make_node("block", NULL, 2,
+            make_node("if_statement", NULL, 2, bench_op(">", bench_var("x"), bench_int("0")),
+                make_node("block", NULL, 1, bench_let("t", bench_int("1")))),
+            bench_let("y", bench_op("+", bench_var("t"), bench_var("x"))))),
+        make_node("procedure", "g", 1, make_node("block", NULL, 2,
+            bench_let("u", bench_op("*", bench_var("x"), bench_int("2"))),
+            bench_let("v", bench_op("+", bench_var("u"), bench_int("1"))))));
+}
+
+// s = 0 : FOR r = 1 TO 2 : FOR i = 1 TO 5000 : x = i : GOSUB twice : s = s + y : NEXT i : NEXT r : PRINT s : END
+// PROCEDURE twice: y = x + x
+// More keys than the memo has entries, so calls evict each other; every result must still be right.
+static ASTNode* check_memo_eviction(int version) {
+    (void)version;
+    return make_node("program", NULL, 5,
+        bench_let("s", bench_int("0")),
+        bench_for("r", "1", "2", make_node("block", NULL, 1,
+            bench_for("i", "1", "5000", make_node("block", NULL, 3,
+                bench_let("x", bench_var("i")),
+                make_node("gosub_statement", "twice", 0),
+                bench_update("s", "+", bench_var("y")))))),
+        make_node("print_statement", NULL, 1, bench_var("s")),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "twice", 1, make_node("block", NULL, 1,
+            bench_let("y", bench_op("+", bench_var("x"), bench_var("x"))))));
+}
+
+// ON ERROR GOTO h : z% = 0 : b% = 10 / z% : PRINT b% : z% = 0 : c% = 10 / z% : PRINT "next"
+// d% = 10 / z% : PRINT "skipped" : done: PRINT "done" : END
+// h: n% = n% + 1 : PRINT ERR : IF n% = 1 THEN z% = 2 : RESUME ENDIF : IF n% = 2 THEN RESUME NEXT ENDIF : RESUME done
+// The handler retries the first division, skips the second and leaves the third for a label.
+static ASTNode* check_on_error(int version) {
+    (void)version;
+    return make_node("program", NULL, 18,
+        make_node("on_error_goto", "h", 0),
+        bench_let("z%", bench_int("0")),
+        bench_let("b%", bench_op("/", bench_int("10"), bench_var("z%"))),
+        make_node("print_statement", NULL, 1, bench_var("b%")),
+        bench_let("z%", bench_int("0")),
+        bench_let("c%", bench_op("/", bench_int("10"), bench_var("z%"))),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "next", 0)),
+        bench_let("d%", bench_op("/", bench_int("10"), bench_var("z%"))),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "skipped", 0)),
+        make_node("label", "done", 0),
+        make_node("print_statement", NULL, 1, make_node("string_literal", "done", 0)),
+        make_node("end_statement", NULL, 0),
+        make_node("label", "h", 0),
+        bench_update("n%", "+", bench_int("1")),
+        make_node("print_statement", NULL, 1, make_node("err", NULL, 0)),
+        make_node("if_statement", NULL, 2, bench_op("=", bench_var("n%"), bench_int("1")),
+            make_node("block", NULL, 2, bench_let("z%", bench_int("2")), make_node("resume_statement", NULL, 0))),
+        make_node("if_statement", NULL, 2, bench_op("=", bench_var("n%"), bench_int("2")),
+            make_node("block", NULL, 1, make_node("resume_statement", "NEXT", 0))),
+        make_node("resume_statement", "done", 0));
+}
+
+// ALLOCATE a%, 16 : POKE a% .. a% + 3 with 1 2 3 4 : BSAVE file$, a%, 4
+// ALLOCATE b%, 16 : BLOAD file$, b% : BLOAD file$, b% + 8, 2
+// PRINT PEEK(b%) : PRINT PEEK(b% + 3) : PRINT PEEK(b% + 8) : PRINT PEEK(b% + 9) : PRINT PEEK(b% + 10)
+// BLOAD without a length takes the whole file; with one, only that many bytes.
+static ASTNode* check_bload_bsave(int version) {
+    (void)version;
+    return make_node("program", NULL, 14,
+        make_node("allocate_statement", NULL, 2, bench_var("a%"), bench_int("16")),
+        check_poke("a%", "0", "1"), check_poke("a%", "1", "2"), check_poke("a%", "2", "3"), check_poke("a%", "3", "4"),
+        make_node("bsave_statement", NULL, 3, make_node("string_literal", CHECK_SCRATCH_PATH, 0), bench_var("a%"), bench_int("4")),
+        make_node("allocate_statement", NULL, 2, bench_var("b%"), bench_int("16")),
+        make_node("bload_statement", NULL, 2, make_node("string_literal", CHECK_SCRATCH_PATH, 0), bench_var("b%")),
+        make_node("bload_statement", NULL, 3, make_node("string_literal", CHECK_SCRATCH_PATH, 0),
+                  bench_op("+", bench_var("b%"), bench_int("8")), bench_int("2")),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_var("b%"))),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_op("+", bench_var("b%"), bench_int("3")))),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_op("+", bench_var("b%"), bench_int("8")))),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_op("+", bench_var("b%"), bench_int("9")))),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_op("+", bench_var("b%"), bench_int("10")))));
+}
+
+// DATA 3, 4 : READ a : READ b : s$ = "hyp" : GOSUB f : GOSUB f : PRINT s$ : PRINT h : PRINT h * 0.5 : END
+// PROCEDURE f: h = a * a + b * b
+// Run from the bytecode cache, the program keeps its DATA, literals and memo.
+static ASTNode* check_cache(int version) {
+    (void)version;
+    return make_node("program", NULL, 11,
+        make_node("data_statement", NULL, 2, bench_int("3"), bench_int("4")),
+        make_node("read_statement", NULL, 1, bench_var("a")),
+        make_node("read_statement", NULL, 1, bench_var("b")),
+        bench_let("s$", make_node("string_literal", "hyp", 0)),
+        make_node("gosub_statement", "f", 0),
+        make_node("gosub_statement", "f", 0),
+        make_node("print_statement", NULL, 1, bench_var("s$")),
+        make_node("print_statement", NULL, 1, bench_var("h")),
+        make_node("print_statement", NULL, 1, bench_op("*", bench_var("h"), bench_float("0.5"))),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "f", 1, make_node("block", NULL, 1,
+            bench_let("h", bench_op("+", bench_op("*", bench_var("a"), bench_var("a")),
+                                    bench_op("*", bench_var("b"), bench_var("b")))))));
+}
+
+// ON ERROR GOTO missing : ALLOCATE a%, 16 : BLOAD file$, a%
+// back: PRINT PEEK(a%) : POKE a%, PEEK(a%) + 1 : BSAVE file$, a%, 1 : END
+// missing: PRINT ERR : RESUME back
+// The recorded run finds no file and writes one; the replay must not see it.
+static ASTNode* check_replay(int version) {
+    (void)version;
+    return make_node("program", NULL, 11,
+        make_node("on_error_goto", "missing", 0),
+        make_node("allocate_statement", NULL, 2, bench_var("a%"), bench_int("16")),
+        make_node("bload_statement", NULL, 2, make_node("string_literal", CHECK_SCRATCH_PATH, 0), bench_var("a%")),
+        make_node("label", "back", 0),
+        make_node("print_statement", NULL, 1, make_node("peek", NULL, 1, bench_var("a%"))),
+        make_node("poke_statement", NULL, 2, bench_var("a%"),
+                  bench_op("+", make_node("peek", NULL, 1, bench_var("a%")), bench_int("1"))),
+        make_node("bsave_statement", NULL, 3, make_node("string_literal", CHECK_SCRATCH_PATH, 0), bench_var("a%"), bench_int("1")),
+        make_node("end_statement", NULL, 0),
+        make_node("label", "missing", 0),
+        make_node("print_statement", NULL, 1, make_node("err", NULL, 0)),
+        make_node("resume_statement", "back", 0));
+}
+
+static const Check checks[] = {
+    {"reload_hoisting", check_hoisting, "start", true, "start\n2\n4\n6\n8\n", 0},
+    {"reload_tail_call", check_tail_call, "q", true, "start\nq\nnew\nq\nnew\n", 0},
+    {"reload_type_change", check_type_change, "start", false, "start\n1\n2\n3\n4\n", 0},
+    {"division_overflow", check_division_overflow, NULL, false, "start\n", 0},
+    {"jit_division_overflow", check_jit_division_overflow, NULL, false, "start\n", CHECK_JIT},
+    {"wraparound", check_wraparound, NULL, false, "-2147483648\n-2\n", 0},
+    {"allocator_metadata", check_allocator_metadata, NULL, false, "0\n16\n240\n", 0},
+    {"bload_metadata", check_bload_metadata, NULL, false, "0\n16\n240\n", 0},
+    {"snapshot_round_trip", check_snapshot, NULL, false, "saved\n6\nx\n7\n0\nsaved\n6\nx\n7\n0\n", CHECK_RESTORE},
+    {"memo_hits", check_memo_hits, NULL, false, "1\n4\n9\n1\n4\n9\nmemo: 3 hits, 3 misses, 0 evictions\n", CHECK_MEMO},
+    {"memo_keys", check_memo_keys, NULL, false, "4\n6\n2\n6\n-1\n-1\nmemo: 2 hits, 4 misses, 0 evictions\n", CHECK_MEMO},
+    {"memo_eviction", check_memo_eviction, NULL, false, "50010000\nmemo: 3293 hits, 6707 misses, 2669 evictions\n", CHECK_MEMO},
+    {"on_error_resume", check_on_error, NULL, false, "11\n5\n11\nnext\n11\ndone\n", 0},
+    {"bload_bsave", check_bload_bsave, NULL, false, "1\n4\n1\n2\n0\n", 0},
+    {"cache_round_trip", check_cache, NULL, false,
+     "hyp\n25\n12.5\nmemo: 1 hits, 1 misses, 0 evictions\nhyp\n25\n12.5\nmemo: 1 hits, 1 misses, 0 evictions\n",
+     CHECK_CACHE | CHECK_MEMO},
+    {"record_replay", check_replay, NULL, false, "53\n0\n53\n0\n", CHECK_REPLAY},
+};
+
+// Run every check; returns 1 if any failed
+int run_checks(void) {
+    int failed = 0;
+    int check_count = (int)(sizeof(checks) / sizeof(checks[0]));
+    for (int i = 0; i < check_count; i++) {
+        const Check* check = &checks[i];
+        check_running = check;
+        check_output_length = 0;
+        check_output_text[0] = '\0';
+        check_reload_result = -1;
+        ASTNode* ast = check->build(1);
+        check_edited = check->reload_after ? check->build(2) : NULL;
+        // Checks run with hot reload on, so nothing is inlined and the program has this cache key
+        char cache_file[512];
+        cache_path(cache_file, sizeof(cache_file), CHECK_CACHE_DIR, cache_key(ast, 0, false, true));
+        if (check->options & CHECK_CACHE) mkdir(CHECK_CACHE_DIR, 0700);
+        unlink(cache_file);
+        unlink(CHECK_SCRATCH_PATH);
+        for (int run = 0; run < (check->options & CHECK_TWICE ? 2 : 1); run++) {
+            check_interpreter = interpreter_new(check_output);
+            interpreter_set_hot_reload(check_interpreter, true);
+            interpreter_set_jit(check_interpreter, (check->options & CHECK_JIT) != 0);
+            if (check->options & CHECK_CACHE) interpreter_set_cache_dir(check_interpreter, CHECK_CACHE_DIR);
+            if (check->options & CHECK_REPLAY) {
+                if (run == 0) {
+                    interpreter_set_record(check_interpreter, CHECK_LOG_PATH);
+                } else {
+                    interpreter_set_replay(check_interpreter, CHECK_LOG_PATH);
+                }
+            }
+            interpreter_init(check_interpreter);
+            if (run == 1 && (check->options & CHECK_RESTORE) && !interpreter_restore(check_interpreter, CHECK_SCRATCH_PATH)) {
+                check_output("(not restored)");
+            }
+            run_program(check_interpreter, ast);
+            if (run == 1 && (check->options & CHECK_CACHE) && !check_interpreter->program->image) check_output("(not cached)");
+            if (check->options & CHECK_MEMO) {
+                InterpreterStats stats = interpreter_get_stats(check_interpreter);
+                char line[96];
+                snprintf(line, sizeof(line), "memo: %ld hits, %ld misses, %ld evictions", stats.memo_hits,
+                         stats.memo_misses, stats.memo_evictions);
+                check_output(line);
+            }
+            interpreter_free(check_interpreter);
+        }
+        unlink(CHECK_SCRATCH_PATH);
+        unlink(CHECK_LOG_PATH);
+        unlink(cache_file);
+        rmdir(CHECK_CACHE_DIR);
+        free_tree(ast);
+        if (check_edited) free_tree(check_edited);
+
+        bool passed = strcmp(check_output_text, check->expected) == 0 &&
+                      (!check->reload_after || check_reload_result == (int)check->reload_accepted);
+        if (!passed) {
+            failed++;
+            fprintf(stderr, "Check %s failed: printed\n%s", check->name, check_output_text);
+            if (check->reload_after && check_reload_result != (int)check->reload_accepted) {
+                fprintf(stderr, "and the reload was %s\n", check_reload_result > 0 ? "accepted" : "refused");
+            }
+        }
+        printf("[DEBUG] Check %s: %s.\n", check->name, passed ? "passed" : "FAILED");
+    }
+    printf("[DEBUG] Checks: %d of %d passed.\n", check_count - failed, check_count);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    // bench [runs [results.json [workload]]] runs the benchmark suite instead of the demo
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return run_benchmarks(argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_RUNS, argc > 3 ? argv[3] : NULL,
+                              argc > 4 ? argv[4] : NULL);
+    }
+    // check runs the regression checks
+    if (argc > 1 && strcmp(argv[1], "check") == 0) return run_checks();
+
+    // Example usage
+    Interpreter* interpreter = interpreter_new(NULL);
+    interpreter_init(interpreter);
+
+    // total = 0 : FOR i = 1 TO 10 : total = total + i : NEXT i : PRINT total
+    // n = 5 : GOSUB countdown : END
+    // PROCEDURE countdown : IF n > 0 THEN PRINT n : n = n - 1 : GOSUB countdown : ENDIF : RETURN
+    ASTNode* program_node = make_node("program", NULL, 7,
+        make_node("assignment", NULL, 2, make_node("identifier", "total", 0), make_node("int_literal", "0", 0)),
+        make_node("for_loop", NULL, 3,
+            make_node("assignment", NULL, 2, make_node("identifier", "i", 0), make_node("int_literal", "1", 0)),
+            make_node("int_literal", "10", 0),
+            make_node("block", NULL, 1,
+                make_node("assignment", NULL, 2, make_node("identifier", "total", 0),
+                    make_node("operator", "+", 2, make_node("identifier", "total", 0), make_node("identifier", "i", 0))))),
+        make_node("print_statement", NULL, 1, make_node("identifier", "total", 0)),
+        make_node("assignment", NULL, 2, make_node("identifier", "n", 0), make_node("int_literal", "5", 0)),
+        make_node("gosub_statement", "countdown", 0),
+        make_node("end_statement", NULL, 0),
+        make_node("procedure", "countdown", 1,
+            make_node("block", NULL, 1,
+                make_node("if_statement", NULL, 2,
+                    make_node("operator", ">", 2, make_node("identifier", "n", 0), make_node("int_literal", "0", 0)),
+                    make_node("block", NULL, 3,
+                        make_node("print_statement", NULL, 1, make_node("identifier", "n", 0)),
+                        make_node("assignment", NULL, 2, make_node("identifier", "n", 0),
+                            make_node("operator", "-", 2, make_node("identifier", "n", 0), make_node("int_literal", "1", 0))),
+                        make_node("gosub_statement", "countdown", 0))))));
+
+    run_program(interpreter, program_node);
+
+    interpreter_free(interpreter);
+    free_tree(program_node);
+    return 0;
+}
